@@ -3,6 +3,7 @@
 ## a directory.                                           ##
 ############################################################
 
+import json
 from os import popen, makedirs, path
 from pprint import pprint
 from subprocess import call
@@ -11,6 +12,7 @@ import multiprocessing
 from glob import glob
 from collections import defaultdict
 from raw_condor_submit import submit_command
+from cost_model import CostModel, count_entries, plan_jobs
 
 
 def getNames(sample):
@@ -66,16 +68,17 @@ def valid_sample(ifile):
     return True
 
 
-def getSyst(name, signal_type, exe, doSyst):
+def getSyst(name, signal_type, exe, doSyst, theory_reruns=False):
     """Return the list of systematics to be processed for this sample.
 
     The list of systematics is built based on the process, signal type, and channel.
     All applicable systematics will be added to the list for processing.
     Arguments:
-    name        -- name of the process
-    signal_type -- signal type or None
-    exe         -- name of the executable to determine the channel
-    doSyst      -- if False, returns a list with just the nominal case
+    name          -- name of the process
+    signal_type   -- signal type or None
+    exe           -- name of the executable to determine the channel
+    doSyst        -- if False, returns a list with just the nominal case
+    theory_reruns -- also run the ggH and VBF theory variations the nominal job stores as weight branches
     Returns:
     systs       -- list of systematics to processes
     """
@@ -187,14 +190,14 @@ def getSyst(name, signal_type, exe, doSyst):
             'RecoilReso_2jet_Up', 'RecoilReso_2jet_Down', 'RecoilResp_2jet_Up', 'RecoilResp_2jet_Down',
             ]
 
-    if name == 'ggH125' and signal_type == 'powheg':
+    if theory_reruns and name == 'ggH125' and signal_type == 'powheg':
         systs += [
             'ggH_Rivet0_Up', 'ggH_Rivet0_Down', 'ggH_Rivet1_Up', 'ggH_Rivet1_Down', 'ggH_Rivet2_Up', 'ggH_Rivet2_Down',
             'ggH_Rivet3_Up', 'ggH_Rivet3_Down', 'ggH_Rivet4_Up', 'ggH_Rivet4_Down', 'ggH_Rivet5_Up', 'ggH_Rivet5_Down',
             'ggH_Rivet6_Up', 'ggH_Rivet6_Down', 'ggH_Rivet7_Up', 'ggH_Rivet7_Down', 'ggH_Rivet8_Up', 'ggH_Rivet8_Down',
         ]
 
-    if name == 'VBF125' and signal_type == 'powheg':
+    if theory_reruns and name == 'VBF125' and signal_type == 'powheg':
         systs += [
             'VBF_Rivet0_Up', 'VBF_Rivet0_Down', 'VBF_Rivet1_Up', 'VBF_Rivet1_Down', 'VBF_Rivet2_Up', 'VBF_Rivet2_Down',
             'VBF_Rivet3_Up', 'VBF_Rivet3_Down', 'VBF_Rivet4_Up', 'VBF_Rivet4_Down', 'VBF_Rivet5_Up', 'VBF_Rivet5_Down',
@@ -240,10 +243,17 @@ def listener(q, fname):
             f.flush()
 
 
-def build_processes(processes, callstring, names, signal_type, exe, output_dir, doSyst):
+def getShards(sample, nshards, patterns):
+    """Return the --shard option of each job the sample is split into."""
+    if nshards < 2 or not any(pattern in sample for pattern in patterns):
+        return ['']
+    return [' --shard {}/{}'.format(i, nshards) for i in range(nshards)]
+
+
+def build_processes(processes, callstring, names, signal_type, exe, output_dir, doSyst, theory_reruns=False):
     """Create output directories and callstrings then add them to the list of processes."""
     for name in names:
-        for isyst in getSyst(name, signal_type, exe, doSyst):
+        for isyst in getSyst(name, signal_type, exe, doSyst, theory_reruns):
             if isyst == "" and not path.exists('Output/trees/{}/NOMINAL'.format(output_dir)):
                 makedirs('Output/trees/{}/NOMINAL'.format(output_dir))
             if isyst != "" and not path.exists('Output/trees/{}/SYST_{}'.format(output_dir, isyst)):
@@ -282,12 +292,56 @@ def run_parallel(output_dir, processes):
     pool.join()
 
 
+def supports_manifest(exe):
+    """The et/mt AC analyzers (analyze<year>_et/mt) can run many jobs with --manifest."""
+    exe = exe.split('/')[-1]
+    return exe.startswith('analyze') and ('_et' in exe or '_mt' in exe)
+
+
+def run_native(output_dir, processes, tasks):
+    """
+    Run analyzer with plugins/Tools/run_tasks.cc (largest inputs first, tasks sharing an input together).
+    Analyzers supporting --manifest run all their tasks from one process with forked workers.
+    """
+    n_processes = min(10, multiprocessing.cpu_count() / 2)
+    print 'Process with {} cores'.format(n_processes)
+    task_file = 'Output/trees/{}/logs/tasks.json'.format(output_dir)
+    with open(task_file, 'w') as ofile:
+        json.dump([dict(task, command=command, manifest=supports_manifest(command.split()[0]))
+                   for command, task in zip(processes, tasks)], ofile, indent=2)
+    call('run_tasks -t {} -j {} -l Output/trees/{}/logs/runninglog.txt'.format(task_file, n_processes, output_dir), shell=True)
+
+
+def run_manifest(output_dir, processes, parallel):
+    """Run all processes from one analyzer with --manifest, sharing the scale factors between jobs."""
+    manifest = 'Output/trees/{}/logs/manifest.txt'.format(output_dir)
+    with open(manifest, 'w') as ofile:
+        for command in processes:
+            ofile.write(command.split(None, 1)[1] + '\n')
+    n_processes = min(10, multiprocessing.cpu_count() / 2) if parallel else 1
+    print 'Process with {} workers'.format(n_processes)
+    exe = processes[0].split()[0]
+    run_series(output_dir, ['{} --manifest {} --workers {}'.format(exe, manifest, n_processes)])
+
+
 def run_series(output_dir, processes):
     """Run analyzer on processes in series."""
     with open('Output/trees/{}/logs/runninglog.txt'.format(output_dir), 'w') as ifile:
         [run_command(command, ifile, False) for command in processes]
 
 
+def dispatch(args, processes, tasks):
+    """Run the processes the way the command line asked for."""
+    if args.manifest:
+        run_manifest(args.output_dir, processes, args.parallel)
+    elif args.native:
+        run_native(args.output_dir, processes, tasks)
+    elif args.parallel:
+        run_parallel(args.output_dir, processes)
+    else:
+        run_series(args.output_dir, processes)
+
+
 def main(args):
     """Build all processes and run them."""
     start = time.time()
@@ -295,14 +349,14 @@ def main(args):
     fileList = [ifile for ifile in glob(args.path+'/*') if '.root' in ifile and valid_sample(ifile)]
 
     if args.condor:
-        job_map = {}
+        job_map, entries = {}, {}
         for ifile in fileList:
             sample = ifile.split('/')[-1].split(suffix)[0]
             tosample = ifile.replace(sample+suffix, '')
             names, signal_type = getNames(sample)
             file_map = defaultdict(list)
             for name in names:
-                systs = getSyst(name, signal_type, args.exe, args.syst)
+                systs = getSyst(name, signal_type, args.exe, args.syst, args.theory_reruns)
                 for syst in systs:
                     if syst == '':
                       syst = 'NOMINAL'
@@ -312,23 +366,40 @@ def main(args):
                     command = '{} -p {} -s {} -d ./ --stype {} -n {} -u {} --condor'.format(
                             args.exe, tosample, sample, signal_type,
                             name, syst.replace('SYST_', ''))
-
-                    file_map[syst].append({
-                        'path': tosample,
-                        'sample': sample,
-                        'name': name,
-                        'command': command,
-                        'signal_type': signal_type,
-                        'syst': syst,
-                    })
+                    if args.schema:
+                        command += ' --schema {}'.format(args.schema)
+                    if args.stage:
+                        command += ' --stage {}'.format(args.stage)
+                    if args.checkpoint:
+                        command += ' --checkpoint {} --resume'.format(args.checkpoint)
+                    if args.ff:
+                        command += ' --ff {}'.format(args.ff) + (' --ff-syst' if args.ff_syst else '')
+
+                    # with --target-time the cost model decides the shards
+                    shards = [''] if args.target_time else getShards(sample, args.shards, args.shard_samples)
+                    for shard in shards:
+                        file_map[syst].append({
+                            'path': tosample,
+                            'sample': sample,
+                            'name': name + shard.replace(' --shard ', '_shard').replace('/', 'of'),
+                            'command': command + shard,
+                            'signal_type': signal_type,
+                            'syst': syst,
+                        })
 
             job_map[sample] = file_map
+            if args.target_time:
+                entries[sample] = count_entries(ifile, args.exe)
 
         to_submit = []
         for sample, systs in job_map.iteritems():
             for syst, configs in systs.iteritems():
                 for config in configs:
                     to_submit.append(config)
+        if args.target_time:
+            model = CostModel.load(args.cost_model) if path.exists(args.cost_model) else CostModel()
+            to_submit = plan_jobs(to_submit, model, entries, args.target_time, manifest=args.manifest)
+            print 'Packed into {} jobs, longest expected to take {:.0f} s'.format(len(to_submit), max(job['cost'] for job in to_submit))
         submit_command(args.output_dir, to_submit, False)
     else:
         try:
@@ -336,7 +407,7 @@ def main(args):
         except:
             pass
 
-        processes = []
+        processes, tasks = [], []
         for ifile in fileList:
             sample = ifile.split('/')[-1].split(suffix)[0]
             tosample = ifile.replace(sample+suffix, '')
@@ -345,15 +416,46 @@ def main(args):
             # if signal_type != "None": continue
             callstring = './{} -p {} -s {} -d {} --stype {} '.format(args.exe,
                                                                      tosample, sample, args.output_dir, signal_type)
+            if args.schema:
+                callstring += '--schema {} '.format(args.schema)
+            if args.stage:
+                callstring += '--stage {} '.format(args.stage)
+            if args.checkpoint:
+                callstring += '--checkpoint {} --resume '.format(args.checkpoint)
+            if args.ff:
+                callstring += '--ff {} '.format(args.ff) + ('--ff-syst ' if args.ff_syst else '')
+            if args.sf_cache:
+                callstring += '--sf-cache Output/trees/{}/sf_cache '.format(args.output_dir)
+            if args.sel_cache:
+                callstring += '--sel-cache Output/trees/{}/sel_cache '.format(args.output_dir)
+            if args.friend:
+                callstring += '--friend '
 
             doSyst = True if args.syst and not 'data' in sample.lower() else False
-            processes = build_processes(processes, callstring, names, signal_type, args.exe, args.output_dir, doSyst)
+            shards = getShards(sample, args.shards, args.shard_samples)
+            for shard in shards:
+                processes = build_processes(processes, callstring + shard, names, signal_type, args.exe, args.output_dir, doSyst,
+                                            args.theory_reruns)
+                # the input size stands in for the run time, a shard reads its share of the file
+                tasks += [{
+                    'name': '{}_{}'.format(sample, len(tasks) + i),
+                    'input': ifile + shard,
+                    'cost': path.getsize(ifile) / float(len(shards)),
+                } for i in range(len(processes) - len(tasks))]
         pprint(processes, width=150)
 
-        if args.parallel:
-            run_parallel(args.output_dir, processes)
+        if args.sf_cache or args.sel_cache or args.friend:
+            # the nominal jobs write the scale factors, selection decisions and row keys the systematic jobs use, so they go first
+            for cache, enabled in [('sf_cache', args.sf_cache), ('sel_cache', args.sel_cache)]:
+                if enabled and not path.exists('Output/trees/{}/{}'.format(args.output_dir, cache)):
+                    makedirs('Output/trees/{}/{}'.format(args.output_dir, cache))
+            nominal = [i for i, command in enumerate(processes) if ' -u ' not in command]
+            shifted = [i for i, command in enumerate(processes) if ' -u ' in command]
+            for indices in [nominal, shifted]:
+                if indices:
+                    dispatch(args, [processes[i] for i in indices], [tasks[i] for i in indices])
         else:
-            run_series(args.output_dir, processes)
+            dispatch(args, processes, tasks)
 
         end = time.time()
         print 'Processing completed in', end-start, 'seconds.'
@@ -364,9 +466,35 @@ if __name__ == "__main__":
     parser = ArgumentParser()
     parser.add_argument('--exe', '-e', required=True, help='name of executable')
     parser.add_argument('--syst', action='store_true', help='run systematics as well')
+    parser.add_argument('--theory-reruns', action='store_true', dest='theory_reruns',
+                        help='with --syst, also rerun the powheg theory variations stored as weight branches by the nominal job')
     parser.add_argument('--path', '-p', required=True, help='path to input file directory')
     parser.add_argument('--parallel', action='store_true', help='run in parallel')
     parser.add_argument('--output-dir', required=True, dest='output_dir',
                         help='name of output directory after Output/trees')
+    parser.add_argument('--native', action='store_true',
+                        help='run in parallel with run_tasks (make tools), scheduling the largest inputs first')
+    parser.add_argument('--manifest', action='store_true',
+                        help='run all jobs from one analyzer process (et/mt only), with --parallel it forks workers')
     parser.add_argument('--condor', action='store_true', help='submit jobs to condor')
+    parser.add_argument('--target-time', type=float, dest='target_time',
+                        help='with --condor, shard and pack the jobs to take about this many seconds each')
+    parser.add_argument('--cost-model', dest='cost_model', default='configs/cost_model.json',
+                        help='model from cost_model.py used by --target-time')
+    parser.add_argument('--schema', help='output schema from configs/output_schema.json (default: all standard branches)')
+    parser.add_argument('--stage', help='node-local directory used to cache input files (i.e. /tmp/htt_stage)')
+    parser.add_argument('--checkpoint', type=int,
+                        help='save progress every this many seconds and resume from it when rerun')
+    parser.add_argument('--ff', help='fake fractions file, computes fake_weight for anti-isolated et/mt events in the analyzer')
+    parser.add_argument('--sf-cache', action='store_true', dest='sf_cache',
+                        help='run the nominal jobs first and let the systematic jobs reuse their scale factors')
+    parser.add_argument('--sel-cache', action='store_true', dest='sel_cache',
+                        help='run the nominal jobs first and let the systematic jobs skip the entries their shift can\'t select')
+    parser.add_argument('--friend', action='store_true',
+                        help='systematic outputs only store the columns they change next to the nominal rows (not with --checkpoint)')
+    parser.add_argument('--ff-syst', action='store_true', dest='ff_syst', help='store the fake factor variations as well')
+    parser.add_argument('--shards', type=int, default=1,
+                        help='split large samples into this many entry-range jobs (merge with reassemble_shards)')
+    parser.add_argument('--shard-samples', nargs='+', dest='shard_samples', default=['data', 'DYJets', 'embed'],
+                        help='samples containing any of these strings are split with --shards')
     main(parser.parse_args())
@@ -0,0 +1,245 @@
+############################################################
+## Runtime model of the analyzer jobs, used to pack small ##
+## jobs together and shard large ones for condor.        ##
+############################################################
+
+import json
+import math
+from glob import glob
+from os import path
+from collections import defaultdict
+
+# shifted objects change the selection, the other systematics only change weights
+shape_systs = ['DM0', 'DM1', 'DM10', 'DM11', 'efaket_es', 'mfaket_es', 'UncMet', 'Jet', 'EEScale', 'MES', 'Recoil']
+
+# used until there are logs to learn from
+default_overhead = 60.
+default_rate = 2000.
+
+
+def syst_type(syst):
+    """Group the systematics by how much work they add."""
+    syst = syst.replace('SYST_', '')
+    if syst in ['', 'NOMINAL']:
+        return 'nominal'
+    elif any(syst.startswith(shape) for shape in shape_systs):
+        return 'shape'
+    return 'weight'
+
+
+def tree_name(exe):
+    """Name of the input tree read by the analyzer."""
+    if '_et' in exe:
+        return 'etau_tree'
+    elif '_mt' in exe:
+        return 'mutau_tree'
+    return 'tt_tree'
+
+
+def parse_logs(patterns):
+    """Read the jobs from analyzer logs (Output/trees/*/logs/*.txt) or condor output.
+
+    Every job starts with "Opening file..." and ends with the "Processed N entries
+    in T s" line of entry_range::report. A condor output can hold several of them.
+    Jobs resumed from a checkpoint are skipped, their time only covers part of the range.
+    The analyzers log "Resumed from checkpoint" just before "Processed"; logs written
+    before that have it right after, it then applies to the job that just ended.
+    """
+    jobs = []
+    for pattern in patterns:
+        for log_name in glob(pattern):
+            job, finished = None, None
+            with open(log_name) as log:
+                for line in log:
+                    if line.startswith('Opening file...'):
+                        job = {'sample': line.split()[-1], 'name': '', 'syst': 'NOMINAL', 'resumed': False}
+                        finished = None
+                    elif line.startswith('Resumed from checkpoint'):
+                        if job is not None:
+                            job['resumed'] = True
+                        elif finished is not None:
+                            finished['resumed'] = True
+                            if finished in jobs:
+                                jobs.remove(finished)
+                    elif job is None:
+                        continue
+                    elif line.startswith('With name......'):
+                        job['name'] = line.split()[-1]
+                    elif line.startswith('And running systematic'):
+                        job['syst'] = line.split()[-1]
+                    elif line.startswith('Processed ') and ' entries in ' in line:
+                        words = line.split()
+                        job['entries'] = int(words[1])
+                        job['seconds'] = float(words[4])
+                        if not job['resumed'] and job['entries'] > 0:
+                            jobs.append(job)
+                        job, finished = None, job
+    return jobs
+
+
+class CostModel:
+    """
+    Wall time of a job as overhead + entries / rate.
+
+    The overhead (opening the scale factors, NNLOPS graphs and AC weights) and the rate are
+    fitted by least squares for each systematic type. A sample with past jobs of the same
+    type uses its own measured rate instead, since the rate depends a lot on how many events
+    pass the preselection.
+    """
+
+    def __init__(self, fits=None, sample_rates=None):
+        self.fits = fits or {}
+        self.sample_rates = sample_rates or {}
+
+    @classmethod
+    def train(cls, jobs):
+        """Fit the model to jobs from parse_logs."""
+        by_type = defaultdict(list)
+        for job in jobs:
+            by_type[syst_type(job['syst'])].append(job)
+
+        fits = {}
+        for stype, typed in by_type.iteritems():
+            n = float(len(typed))
+            mean_x = sum(job['entries'] for job in typed) / n
+            mean_y = sum(job['seconds'] for job in typed) / n
+            var_x = sum((job['entries'] - mean_x) ** 2 for job in typed)
+            cov_xy = sum((job['entries'] - mean_x) * (job['seconds'] - mean_y) for job in typed)
+            slope = cov_xy / var_x if var_x > 0 else 0.
+            if slope <= 0:
+                # all jobs the same size (or noise), charge everything to the entries
+                slope = mean_y / mean_x
+            overhead = max(mean_y - slope * mean_x, 0.)
+            fits[stype] = {'overhead': overhead, 'rate': 1. / slope, 'jobs': len(typed)}
+
+        sample_entries, sample_seconds = defaultdict(float), defaultdict(float)
+        for job in jobs:
+            key = '{}:{}'.format(job['sample'], syst_type(job['syst']))
+            sample_entries[key] += job['entries']
+            sample_seconds[key] += max(job['seconds'] - fits[syst_type(job['syst'])]['overhead'], 1.)
+        sample_rates = {key: sample_entries[key] / sample_seconds[key] for key in sample_entries}
+        return cls(fits, sample_rates)
+
+    @classmethod
+    def load(cls, name):
+        with open(name) as ifile:
+            stored = json.load(ifile)
+        return cls(stored['fits'], stored['sample_rates'])
+
+    def save(self, name):
+        with open(name, 'w') as ofile:
+            json.dump({'fits': self.fits, 'sample_rates': self.sample_rates}, ofile, indent=2, sort_keys=True)
+
+    def overhead(self, syst):
+        fit = self.fits.get(syst_type(syst), self.fits.get('nominal'))
+        return fit['overhead'] if fit else default_overhead
+
+    def rate(self, sample, syst):
+        key = '{}:{}'.format(sample, syst_type(syst))
+        if key in self.sample_rates:
+            return self.sample_rates[key]
+        fit = self.fits.get(syst_type(syst), self.fits.get('nominal'))
+        return fit['rate'] if fit else default_rate
+
+    def predict(self, sample, syst, entries):
+        """Expected wall time in seconds."""
+        return self.overhead(syst) + entries / self.rate(sample, syst)
+
+
+def count_entries(ifile, exe):
+    """Entries of the analyzer input tree (0 if the file can't be read)."""
+    import ROOT
+    open_file = ROOT.TFile.Open(ifile)
+    if not open_file or open_file.IsZombie():
+        return 0
+    tree = open_file.Get(tree_name(exe))
+    entries = tree.GetEntries() if tree else 0
+    open_file.Close()
+    return entries
+
+
+def plan_jobs(configs, model, entries, target, max_shards=50, manifest=False):
+    """Shard and pack the condor job configs so each job takes about target seconds.
+
+    Arguments:
+    configs    -- job configs for raw_condor_submit (path, sample, name, command, signal_type, syst)
+    model      -- CostModel
+    entries    -- {sample: input entries}
+    target     -- wanted wall time of a job in seconds
+    max_shards -- never split a sample in more pieces than this
+    manifest   -- run a packed job as one analyzer process with --manifest (et/mt analyzers)
+    Returns:
+    jobs       -- configs where 'command' may hold several analyzer commands and 'cost' is the prediction
+    """
+    tasks = []
+    for config in configs:
+        nentries = entries.get(config['sample'], 0)
+        cost = model.predict(config['sample'], config['syst'], nentries)
+        overhead = model.overhead(config['syst'])
+        nshards = 1
+        if cost > target and target > 2 * overhead:
+            nshards = min(int(math.ceil((cost - overhead) / (target - overhead))), max_shards)
+        if nshards < 2:
+            tasks.append(dict(config, cost=cost))
+            continue
+        shard_cost = model.predict(config['sample'], config['syst'], nentries / float(nshards))
+        for i in range(nshards):
+            tasks.append(dict(config, name='{}_shard{}of{}'.format(config['name'], i, nshards),
+                              command='{} --shard {}/{}'.format(config['command'], i, nshards), cost=shard_cost))
+
+    # first-fit decreasing, only jobs of the same systematic share a job (their outputs go to one directory)
+    by_syst = defaultdict(list)
+    for task in tasks:
+        by_syst[task['syst']].append(task)
+
+    jobs = []
+    for syst in sorted(by_syst):
+        bins = []
+        for task in sorted(by_syst[syst], key=lambda task: -task['cost']):
+            for ibin in bins:
+                if ibin['cost'] + task['cost'] <= target:
+                    ibin['tasks'].append(task)
+                    ibin['cost'] += task['cost']
+                    break
+            else:
+                bins.append({'tasks': [task], 'cost': task['cost']})
+
+        for ibin in bins:
+            if len(ibin['tasks']) == 1:
+                jobs.append(ibin['tasks'][0])
+                continue
+            first = ibin['tasks'][0]
+            command = '\n'.join(task['command'] for task in ibin['tasks'])
+            if manifest:
+                # the options of each job go to the manifest, the scale factors are read once
+                command = "cat > manifest.txt << 'EOF'\n{}\nEOF\n{} --manifest manifest.txt".format(
+                    '\n'.join(task['command'].split(None, 1)[1] for task in ibin['tasks']), first['command'].split()[0])
+            jobs.append(dict(first, sample='packed{}'.format(len(jobs)), name='{}jobs'.format(len(ibin['tasks'])),
+                             command=command, cost=ibin['cost']))
+    return jobs
+
+
+def main(args):
+    jobs = parse_logs(args.logs)
+    if not jobs:
+        print 'No finished jobs found in', ' '.join(args.logs)
+        return
+
+    model = CostModel.train(jobs)
+    model.save(args.output)
+    print 'Trained on {} jobs, saved to {}'.format(len(jobs), args.output)
+    for stype, fit in sorted(model.fits.iteritems()):
+        print '\t {:8} {:5} jobs: overhead {:7.1f} s, {:9.1f} entries/s'.format(stype, fit['jobs'], fit['overhead'], fit['rate'])
+
+    # how well it does on the jobs it was trained on
+    errors = sorted(abs(model.predict(job['sample'], job['syst'], job['entries']) - job['seconds']) / job['seconds'] for job in jobs)
+    print 'Relative error: median {:.2f}, 90% {:.2f}'.format(errors[len(errors) / 2], errors[int(0.9 * (len(errors) - 1))])
+
+
+if __name__ == "__main__":
+    from argparse import ArgumentParser
+    parser = ArgumentParser(description='learn the analyzer run time from finished jobs')
+    parser.add_argument('--logs', '-l', nargs='+', default=['Output/trees/*/logs/*.txt'],
+                        help='analyzer logs or condor outputs to learn from')
+    parser.add_argument('--output', '-o', default='configs/cost_model.json', help='where to save the model')
+    main(parser.parse_args())
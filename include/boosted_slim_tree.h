@@ -6,9 +6,11 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include "TMath.h"
 #include "TTree.h"
+#include "./output_schema.h"
 #include "ggntuple/jet_factory.h"
 #include "ggntuple/event_factory.h"
 #include "ggntuple/met_factory.h"
@@ -18,7 +20,7 @@
 
 class slim_tree {
  public:
-    slim_tree(std::string, bool);
+    slim_tree(std::string, bool, std::string);
     ~slim_tree() {}  // default destructor
 
     // member functions
@@ -29,11 +31,16 @@ class slim_tree {
                      std::shared_ptr<std::vector<double>>);
     void initial_values();
     void add_ac_branches();
+    void fill();
+    Float_t *add_weight_branch(std::string);
+    void keep_event_keys();
 
     // member data
     TTree *otree;
+    output_schema schema;
+    static constexpr const char *schema_config = "configs/output_schema.json";
     Int_t cat_0jet, cat_boosted, cat_vbf, cat_VH, is_signal, is_antiLepIso, is_antiTauIso, is_antiBothIso, is_qcd, is_looseIso, OS, SS, contamination;
-    ULong64_t evtno;
+    ULong64_t evtno, trigger_mask;
     UInt_t run, lumi;
     Float_t evtwt, el_pt, el_eta, el_phi, el_mass, el_charge, el_iso, el_genMatch, mu_pt, mu_eta, mu_phi, mu_mass, mu_charge, mu_iso, mu_genMatch,
         t1_pt, t1_eta, t1_phi, t1_mass, t1_charge, t1_iso, t1_iso_VL, t1_iso_L, t1_iso_M, t1_iso_T, t1_iso_VT, t1_iso_VVT, t1_decayMode,
@@ -51,85 +58,106 @@ class slim_tree {
         wt_wh_a3, wt_wh_L1, wt_wh_L1Zg, wt_wh_a2int, wt_wh_a3int, wt_wh_L1int, wt_wh_L1Zgint, wt_zh_a1, wt_zh_a2, wt_zh_a3, wt_zh_L1, wt_zh_L1Zg,
         wt_zh_a2int, wt_zh_a3int, wt_zh_L1int, wt_zh_L1Zgint;
     Float_t sm_weight_nlo, mm_weight_nlo, ps_weight_nlo;
+
+    // extra per-event weights booked by the analyzer (systematic variations, ...)
+    std::unordered_map<std::string, Float_t> extra_weights;
 };
 
-slim_tree::slim_tree(std::string tree_name, bool isAC = false) : otree(new TTree(tree_name.c_str(), tree_name.c_str())) {
-    otree->Branch("evtwt", &evtwt, "evtwt/F");
-    // otree->Branch("evt", &evtno);
-    // otree->Branch("run", &run);
-    // otree->Branch("lumi", &lumi);
-
-    otree->Branch("el_pt", &el_pt, "el_pt/F");
-    otree->Branch("el_eta", &el_eta, "el_eta/F");
-    otree->Branch("el_phi", &el_phi, "el_phi/F");
-    otree->Branch("el_mass", &el_mass, "el_mass/F");
-    // otree->Branch("el_charge", &el_charge, "el_charge/F");
-    // otree->Branch("el_iso", &el_iso, "el_iso/F");
-    // otree->Branch("el_genMatch", &el_genMatch, "el_genMatch/F");
-    otree->Branch("mu_pt", &mu_pt, "mu_pt/F");
-    otree->Branch("mu_eta", &mu_eta, "mu_eta/F");
-    otree->Branch("mu_phi", &mu_phi, "mu_phi/F");
-    otree->Branch("mu_mass", &mu_mass, "mu_mass/F");
-    // otree->Branch("mu_charge", &mu_charge, "mu_charge/F");
-    // otree->Branch("mu_iso", &mu_iso, "mu_iso/F");
-    // otree->Branch("mu_genMatch", &mu_genMatch, "mu_genMatch/F");
-    otree->Branch("t1_pt", &t1_pt, "t1_pt/F");
-    otree->Branch("t1_eta", &t1_eta, "t1_eta/F");
-    otree->Branch("t1_phi", &t1_phi, "t1_phi/F");
-    otree->Branch("t1_mass", &t1_mass, "t1_mass/F");
-    // otree->Branch("t1_charge", &t1_charge, "t1_charge/F");
-    otree->Branch("t1_iso", &t1_iso, "t1_iso/F");
-    otree->Branch("t1_decayMode", &t1_decayMode, "t1_decayMode/F");
-    otree->Branch("t1_dmf", &dmf, "t1_dmf/F");
-    otree->Branch("t1_dmf_new", &dmf_new, "t1_dmf_new/F");
-    otree->Branch("t1_genMatch", &t1_genMatch, "t1_genMatch/F");
-    otree->Branch("lep_dr", &lep_dr, "lep_dr/F");
-
-    otree->Branch("numGenJets", &numGenJets, "numGenJets/F");
-    otree->Branch("njets", &njets, "njets");
-    otree->Branch("nbjets", &nbjets, "nbjets");
-    otree->Branch("j1_pt", &j1_pt, "j1_pt/F");
-    otree->Branch("j1_eta", &j1_eta, "j1_eta/F");
-    otree->Branch("j1_phi", &j1_phi, "j1_phi/F");
-    otree->Branch("j2_pt", &j2_pt, "j2_pt/F");
-    otree->Branch("j2_eta", &j2_eta, "j2_eta/F");
-    otree->Branch("j2_phi", &j2_phi, "j2_phi/F");
-
-    otree->Branch("met", &met, "met/F");
-    otree->Branch("metphi", &metphi, "metphi/F");
-    otree->Branch("mt", &mt, "mt/F");
-
-    otree->Branch("mjj", &mjj, "mjj/F");
-    otree->Branch("higgs_pT", &higgs_pT, "higgs_pT/F");
-    otree->Branch("vis_mass", &vis_mass, "vis_mass/F");
-    otree->Branch("dPhijj", &dPhijj, "dPhijj/F");
-    otree->Branch("pt_sv", &pt_sv, "pt_sv/F");
-    otree->Branch("m_sv", &m_sv, "m_sv/F");
-
-    otree->Branch("D0_ggH", &D0_ggH, "D0_ggH/F");
-    otree->Branch("DCP_ggH", &DCP_ggH, "DCP_ggH/F");
-    otree->Branch("D0_VBF", &D0_VBF, "D0_VBF/F");
-    otree->Branch("D_a2_VBF", &D_a2_VBF, "D_a2_VBF/F");
-    otree->Branch("D_l1_VBF", &D_l1_VBF, "D_l1_VBF/F");
-    otree->Branch("D_l1zg_VBF", &D_l1zg_VBF, "D_l1zg_VBF/F");
-    otree->Branch("DCP_VBF", &DCP_VBF, "DCP_VBF/F");
-    otree->Branch("MELA_D2j", &MELA_D2j, "MELA_D2j/F");
-
-    otree->Branch("Phi", &Phi, "Phi/F");
-    otree->Branch("Phi1", &Phi1, "Phi1/F");
-    otree->Branch("costheta1", &costheta1, "costheta1/F");
-    otree->Branch("costheta2", &costheta2, "costheta2/F");
-    otree->Branch("costhetastar", &costhetastar, "costhetastar/F");
-    otree->Branch("Q2V1", &Q2V1, "Q2V1/F");
-    otree->Branch("Q2V2", &Q2V2, "Q2V2/F");
-
-    otree->Branch("OS", &OS, "OS/I");
-    otree->Branch("is_signal", &is_signal, "is_signal/I");
-    otree->Branch("is_antiLepIso", &is_antiLepIso, "is_antiLepIso/I");
-    otree->Branch("is_antiTauIso", &is_antiTauIso, "is_antiTauIso/I");
-    otree->Branch("is_antiBothIso", &is_antiBothIso, "is_antiBothIso/I");
-    otree->Branch("contamination", &contamination, "contamination/I");
-    otree->Branch("cross_trigger", &cross_trigger, "cross_trigger/F");
+slim_tree::slim_tree(std::string tree_name, bool isAC = false, std::string schema_name = "")
+    : otree(new TTree(tree_name.c_str(), tree_name.c_str())) {
+    // register every variable with the schema. Without a schema only the
+    // legacy branches (those not marked false) are written.
+    if (!schema_name.empty() && !schema.load(schema_config, schema_name)) {
+        std::cerr << "Unable to load output schema " << schema_name << std::endl;
+    }
+
+    schema.add_float("evtwt", &evtwt);
+    schema.add_ulong("evt", &evtno, false);
+    schema.add_uint("run", &run, false);
+    schema.add_uint("lumi", &lumi, false);
+    schema.add_ulong("trigger_mask", &trigger_mask, false);
+
+    schema.add_float("el_pt", &el_pt);
+    schema.add_float("el_eta", &el_eta);
+    schema.add_float("el_phi", &el_phi);
+    schema.add_float("el_mass", &el_mass);
+    schema.add_float("el_charge", &el_charge, false);
+    schema.add_float("el_iso", &el_iso, false);
+    schema.add_float("el_genMatch", &el_genMatch, false);
+    schema.add_float("mu_pt", &mu_pt);
+    schema.add_float("mu_eta", &mu_eta);
+    schema.add_float("mu_phi", &mu_phi);
+    schema.add_float("mu_mass", &mu_mass);
+    schema.add_float("mu_charge", &mu_charge, false);
+    schema.add_float("mu_iso", &mu_iso, false);
+    schema.add_float("mu_genMatch", &mu_genMatch, false);
+    schema.add_float("t1_pt", &t1_pt);
+    schema.add_float("t1_eta", &t1_eta);
+    schema.add_float("t1_phi", &t1_phi);
+    schema.add_float("t1_mass", &t1_mass);
+    schema.add_float("t1_charge", &t1_charge, false);
+    schema.add_float("t1_iso", &t1_iso);
+    schema.add_float("t1_decayMode", &t1_decayMode);
+    schema.add_float("t1_dmf", &dmf);
+    schema.add_float("t1_dmf_new", &dmf_new);
+    schema.add_float("t1_genMatch", &t1_genMatch);
+    schema.add_float("lep_dr", &lep_dr);
+
+    schema.add_float("numGenJets", &numGenJets);
+    schema.add_float("njets", &njets);
+    schema.add_float("nbjets", &nbjets);
+    schema.add_float("j1_pt", &j1_pt);
+    schema.add_float("j1_eta", &j1_eta);
+    schema.add_float("j1_phi", &j1_phi);
+    schema.add_float("j2_pt", &j2_pt);
+    schema.add_float("j2_eta", &j2_eta);
+    schema.add_float("j2_phi", &j2_phi);
+
+    schema.add_float("met", &met);
+    schema.add_float("metphi", &metphi);
+    schema.add_float("mt", &mt);
+
+    schema.add_float("mjj", &mjj);
+    schema.add_float("higgs_pT", &higgs_pT);
+    schema.add_float("vis_mass", &vis_mass);
+    schema.add_float("dPhijj", &dPhijj);
+    schema.add_float("pt_sv", &pt_sv);
+    schema.add_float("m_sv", &m_sv);
+
+    schema.add_float("D0_ggH", &D0_ggH);
+    schema.add_float("DCP_ggH", &DCP_ggH);
+    schema.add_float("D0_VBF", &D0_VBF);
+    schema.add_float("D_a2_VBF", &D_a2_VBF);
+    schema.add_float("D_l1_VBF", &D_l1_VBF);
+    schema.add_float("D_l1zg_VBF", &D_l1zg_VBF);
+    schema.add_float("DCP_VBF", &DCP_VBF);
+    schema.add_float("MELA_D2j", &MELA_D2j);
+
+    schema.add_float("Phi", &Phi);
+    schema.add_float("Phi1", &Phi1);
+    schema.add_float("costheta1", &costheta1);
+    schema.add_float("costheta2", &costheta2);
+    schema.add_float("costhetastar", &costhetastar);
+    schema.add_float("Q2V1", &Q2V1);
+    schema.add_float("Q2V2", &Q2V2);
+
+    schema.add_int("OS", &OS);
+    schema.add_int("is_signal", &is_signal);
+    schema.add_int("is_antiLepIso", &is_antiLepIso);
+    schema.add_int("is_antiTauIso", &is_antiTauIso);
+    schema.add_int("is_antiBothIso", &is_antiBothIso);
+    schema.add_int("contamination", &contamination);
+    schema.add_float("cross_trigger", &cross_trigger);
+
+    // only written when a schema asks for them
+    schema.add_float("higgs_m", &higgs_m, false);
+    schema.add_float("hjj_pT", &hjj_pT, false);
+    schema.add_float("hjj_m", &hjj_m, false);
+    schema.add_float("dEtajj", &dEtajj, false);
+    schema.add_float("b1_pt", &b1_pt, false);
+    schema.add_float("b1_eta", &b1_eta, false);
+    schema.add_float("b1_phi", &b1_phi, false);
+    schema.add_float("MT_HiggsMET", &MT_HiggsMET, false);
 
     // Set any initial values for variables. For instance, ac weights are
     // initialized to = 1 so that any non-AC sample has the weight saved as
@@ -140,6 +168,8 @@ slim_tree::slim_tree(std::string tree_name, bool isAC = false) : otree(new TTree
     if (isAC) {
         add_ac_branches();
     }
+
+    schema.book(otree);
 }
 
 void slim_tree::generalFill(std::vector<std::string> cats, jet_factory *fjets, met_factory *fmet, event_factory *evt, Float_t weight,
@@ -153,6 +183,7 @@ void slim_tree::generalFill(std::vector<std::string> cats, jet_factory *fjets, m
     evtno = evt->getEvt();
     run = evt->getRun();
     lumi = evt->getLumi();
+    trigger_mask = evt->getTriggerMask();
     higgs_pT = higgs.Pt();
     higgs_m = higgs.M();
 
@@ -294,7 +325,7 @@ void slim_tree::fillTree(electron *el, tau *t, event_factory *evt, std::string n
     }
     lep_dr = el->getP4().DeltaR(t->getP4());
 
-    otree->Fill();
+    fill();
 }
 
 void slim_tree::fillTree(muon *mu, tau *t, event_factory *evt, std::string name) {
@@ -322,7 +353,7 @@ void slim_tree::fillTree(muon *mu, tau *t, event_factory *evt, std::string name)
     }
     lep_dr = mu->getP4().DeltaR(t->getP4());
 
-    otree->Fill();
+    fill();
 }
 
 void slim_tree::fillTree(electron *el, muon *mu, event_factory *evt, std::string name) {
@@ -346,7 +377,33 @@ void slim_tree::fillTree(electron *el, muon *mu, event_factory *evt, std::string
   }
   lep_dr = el->getP4().DeltaR(mu->getP4());
 
-  otree->Fill();
+  fill();
+}
+
+// narrow anything stored at reduced precision, then fill
+void slim_tree::fill() {
+    schema.narrow();
+    otree->Fill();
+}
+
+// Book a float branch for a weight computed in the analyzer and return the
+// address to fill each event. Weights start at 1 so events that never set
+// them (i.e. data) store 1. The schema decides whether it is written, the
+// address is valid either way.
+Float_t *slim_tree::add_weight_branch(std::string name) {
+    if (extra_weights.find(name) == extra_weights.end()) {
+        extra_weights[name] = 1.;
+        schema.book_float(otree, name, &extra_weights.at(name));
+    }
+    return &extra_weights.at(name);
+}
+
+// Data keeps run, lumi and evt whatever the schema so fast_merge --dedup can
+// remove the events repeated across jobs. Call before the first fill.
+void slim_tree::keep_event_keys() {
+    for (auto name : {"run", "lumi", "evt"}) {
+        schema.require(otree, name);
+    }
 }
 
 void slim_tree::initial_values() {
@@ -383,43 +440,43 @@ void slim_tree::initial_values() {
 }
 
 void slim_tree::add_ac_branches() {
-    otree->Branch("wt_vbf_a1", &wt_a1);
-    otree->Branch("wt_vbf_a2", &wt_a2);
-    otree->Branch("wt_vbf_a3", &wt_a3);
-    otree->Branch("wt_vbf_L1", &wt_L1);
-    otree->Branch("wt_vbf_L1Zg", &wt_L1Zg);
-    otree->Branch("wt_vbf_a2int", &wt_a2int);
-    otree->Branch("wt_vbf_a3int", &wt_a3int);
-    otree->Branch("wt_vbf_L1int", &wt_L1int);
-    otree->Branch("wt_vbf_L1Zgint", &wt_L1Zgint);
-
-    otree->Branch("wt_ggh_a1", &wt_ggH_a1);
-    otree->Branch("wt_ggh_a3", &wt_ggH_a3);
-    otree->Branch("wt_ggh_a3int", &wt_ggH_a3int);
-
-    otree->Branch("wt_wh_a1", &wt_wh_a1);
-    otree->Branch("wt_wh_a2", &wt_wh_a2);
-    otree->Branch("wt_wh_a3", &wt_wh_a3);
-    otree->Branch("wt_wh_L1", &wt_wh_L1);
-    otree->Branch("wt_wh_L1Zg", &wt_wh_L1Zg);
-    otree->Branch("wt_wh_a2int", &wt_wh_a2int);
-    otree->Branch("wt_wh_a3int", &wt_wh_a3int);
-    otree->Branch("wt_wh_L1int", &wt_wh_L1int);
-    otree->Branch("wt_wh_L1Zgint", &wt_wh_L1Zgint);
-
-    otree->Branch("wt_zh_a1", &wt_zh_a1);
-    otree->Branch("wt_zh_a2", &wt_zh_a2);
-    otree->Branch("wt_zh_a3", &wt_zh_a3);
-    otree->Branch("wt_zh_L1", &wt_zh_L1);
-    otree->Branch("wt_zh_L1Zg", &wt_zh_L1Zg);
-    otree->Branch("wt_zh_a2int", &wt_zh_a2int);
-    otree->Branch("wt_zh_a3int", &wt_zh_a3int);
-    otree->Branch("wt_zh_L1int", &wt_zh_L1int);
-    otree->Branch("wt_zh_L1Zgint", &wt_zh_L1Zgint);
-
-    otree->Branch("sm_weight_nlo", &sm_weight_nlo);
-    otree->Branch("mm_weight_nlo", &mm_weight_nlo);
-    otree->Branch("ps_weight_nlo", &ps_weight_nlo);
+    schema.add_float("wt_vbf_a1", &wt_a1, true, true);
+    schema.add_float("wt_vbf_a2", &wt_a2, true, true);
+    schema.add_float("wt_vbf_a3", &wt_a3, true, true);
+    schema.add_float("wt_vbf_L1", &wt_L1, true, true);
+    schema.add_float("wt_vbf_L1Zg", &wt_L1Zg, true, true);
+    schema.add_float("wt_vbf_a2int", &wt_a2int, true, true);
+    schema.add_float("wt_vbf_a3int", &wt_a3int, true, true);
+    schema.add_float("wt_vbf_L1int", &wt_L1int, true, true);
+    schema.add_float("wt_vbf_L1Zgint", &wt_L1Zgint, true, true);
+
+    schema.add_float("wt_ggh_a1", &wt_ggH_a1, true, true);
+    schema.add_float("wt_ggh_a3", &wt_ggH_a3, true, true);
+    schema.add_float("wt_ggh_a3int", &wt_ggH_a3int, true, true);
+
+    schema.add_float("wt_wh_a1", &wt_wh_a1, true, true);
+    schema.add_float("wt_wh_a2", &wt_wh_a2, true, true);
+    schema.add_float("wt_wh_a3", &wt_wh_a3, true, true);
+    schema.add_float("wt_wh_L1", &wt_wh_L1, true, true);
+    schema.add_float("wt_wh_L1Zg", &wt_wh_L1Zg, true, true);
+    schema.add_float("wt_wh_a2int", &wt_wh_a2int, true, true);
+    schema.add_float("wt_wh_a3int", &wt_wh_a3int, true, true);
+    schema.add_float("wt_wh_L1int", &wt_wh_L1int, true, true);
+    schema.add_float("wt_wh_L1Zgint", &wt_wh_L1Zgint, true, true);
+
+    schema.add_float("wt_zh_a1", &wt_zh_a1, true, true);
+    schema.add_float("wt_zh_a2", &wt_zh_a2, true, true);
+    schema.add_float("wt_zh_a3", &wt_zh_a3, true, true);
+    schema.add_float("wt_zh_L1", &wt_zh_L1, true, true);
+    schema.add_float("wt_zh_L1Zg", &wt_zh_L1Zg, true, true);
+    schema.add_float("wt_zh_a2int", &wt_zh_a2int, true, true);
+    schema.add_float("wt_zh_a3int", &wt_zh_a3int, true, true);
+    schema.add_float("wt_zh_L1int", &wt_zh_L1int, true, true);
+    schema.add_float("wt_zh_L1Zgint", &wt_zh_L1Zgint, true, true);
+
+    schema.add_float("sm_weight_nlo", &sm_weight_nlo, true, true);
+    schema.add_float("mm_weight_nlo", &mm_weight_nlo, true, true);
+    schema.add_float("ps_weight_nlo", &ps_weight_nlo, true, true);
 }
 
 #endif  // INCLUDE_BOOSTED_SLIM_TREE_H_
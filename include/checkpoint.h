@@ -0,0 +1,227 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_CHECKPOINT_H_
+#define INCLUDE_CHECKPOINT_H_
+
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "TBranch.h"
+#include "TFile.h"
+#include "TH1F.h"
+#include "TH2F.h"
+#include "TKey.h"
+#include "TList.h"
+#include "TNamed.h"
+#include "TTree.h"
+#include "./swiss_army_class.h"
+
+// Periodic checkpoints so an evicted job continues where it stopped instead
+// of starting over.
+//
+// With "--checkpoint S" the output tree is auto-saved every S seconds. The
+// UserInfo of the tree holds the next entry to process and copies of the
+// Helper (grabbag) histograms, so the single AutoSave write commits all of
+// the state at once: the entries on disk, the histograms and the entry
+// number always belong to the same checkpoint. The UserInfo is emptied
+// again before the final write.
+//
+// With "--resume" an existing output is opened in UPDATE mode (ROOT recovers
+// the keys of a file that wasn't closed), the saved tree takes the place of
+// the one just booked, the histograms are restored and the loop continues
+// from the saved entry. The duplicate-event filter is rebuilt by replaying
+// the run, lumi and evt branches of the entries already processed, so it
+// rejects the same events as an uninterrupted run. Without a usable
+// checkpoint the output is recreated and the job starts from the beginning.
+//
+// Nothing else is restored: the counters of the scale factor and selection
+// caches, the fake factors and the read-ahead only cover the entries
+// processed after the resume. Outputs that describe every entry of the job
+// are not written by a resumed job (the caller passes isResumed() to
+// sf_cache and selection_cache; friend_output is off with checkpoints).
+class checkpoint {
+ public:
+    checkpoint(std::string, std::string, bool);
+
+    TFile *getFile() { return file; }
+    bool isResumed() { return saved_tree != nullptr; }
+
+    template <class Tree, class Event, class Filter>
+    Long64_t resume(Tree *, Helper *, TTree *, Event *, Filter *, Long64_t);
+    template <class Tree>
+    void update(Long64_t, Tree *, Helper *);
+    template <class Tree>
+    void finish(Tree *);
+    void report(std::ostream &);
+
+ private:
+    TFile *file;
+    TTree *saved_tree;
+    double interval;
+    int nsaved;
+    Long64_t resume_entry;
+    std::chrono::steady_clock::time_point last_save;
+};
+
+checkpoint::checkpoint(std::string filename, std::string interval_str, bool resume)
+    : file(nullptr),
+      saved_tree(nullptr),
+      interval(interval_str.empty() ? 0. : std::stod(interval_str)),
+      nsaved(0),
+      resume_entry(-1),
+      last_save(std::chrono::steady_clock::now()) {
+    if (resume && access(filename.c_str(), F_OK) == 0) {
+        file = new TFile(filename.c_str(), "UPDATE");
+        if (file->IsZombie()) {
+            delete file;
+            file = nullptr;
+        } else {
+            // the output tree is the one carrying a checkpoint
+            TIter next(file->GetListOfKeys());
+            while (auto key = reinterpret_cast<TKey *>(next())) {
+                if (std::string(key->GetClassName()) != "TTree") {
+                    continue;
+                }
+                auto tree = reinterpret_cast<TTree *>(key->ReadObj());
+                auto info = tree->GetUserInfo()->FindObject("checkpoint");
+                if (info != nullptr) {
+                    saved_tree = tree;
+                    resume_entry = std::stoll(reinterpret_cast<TNamed *>(info)->GetTitle());
+                    break;
+                }
+                delete tree;
+            }
+        }
+        if (file != nullptr && saved_tree == nullptr) {
+            std::cerr << "checkpoint: no checkpoint in " << filename << ", starting from the beginning" << std::endl;
+            file->Close();
+            delete file;
+            file = nullptr;
+        }
+    }
+    if (file == nullptr) {
+        file = new TFile(filename.c_str(), "RECREATE");
+    }
+}
+
+// Swap in the saved tree and histograms and return the first entry left to
+// process ("first" if there is nothing to resume).
+template <class Tree, class Event, class Filter>
+Long64_t checkpoint::resume(Tree *st, Helper *helper, TTree *input, Event *event, Filter *filter, Long64_t first) {
+    if (saved_tree == nullptr) {
+        return first;
+    }
+    if (std::string(saved_tree->GetName()) != st->otree->GetName() ||
+        saved_tree->GetListOfBranches()->GetEntriesFast() != st->otree->GetListOfBranches()->GetEntriesFast()) {
+        std::cerr << "checkpoint: saved " << saved_tree->GetName() << " doesn't match the branches booked by this job, starting over" << std::endl;
+        file->Delete((std::string(saved_tree->GetName()) + ";*").c_str());
+        delete saved_tree;
+        saved_tree = nullptr;
+        resume_entry = -1;
+        return first;
+    }
+
+    st->otree->CopyAddresses(saved_tree);
+    delete st->otree;
+    st->otree = saved_tree;
+
+    // histograms already booked by the job take the saved contents, so
+    // grabbag holds one copy of each
+    auto grabbag = file->GetDirectory("grabbag");
+    TIter next(saved_tree->GetUserInfo());
+    while (auto obj = next()) {
+        if (obj->InheritsFrom("TH2F")) {
+            auto &hist = (*helper->getHistos2D())[obj->GetName()];
+            if (hist == nullptr) {
+                hist = reinterpret_cast<TH2F *>(obj->Clone());
+                hist->SetDirectory(grabbag);
+            } else {
+                hist->Reset();
+                hist->Add(reinterpret_cast<TH2F *>(obj));
+            }
+        } else if (obj->InheritsFrom("TH1F")) {
+            auto &hist = (*helper->getHistos1D())[obj->GetName()];
+            if (hist == nullptr) {
+                hist = reinterpret_cast<TH1F *>(obj->Clone());
+                hist->SetDirectory(grabbag);
+            } else {
+                hist->Reset();
+                hist->Add(reinterpret_cast<TH1F *>(obj));
+            }
+        }
+    }
+    saved_tree->GetUserInfo()->Delete();
+
+    // the duplicate keys of the processed entries, read through the event
+    // so the branch names of the backend are used
+    if (filter->isActive()) {
+        std::vector<TBranch *> ids;
+        for (auto &name : event->getIdBranches()) {
+            auto branch = input->GetBranch(name.c_str());
+            if (branch == nullptr) {
+                std::cerr << "checkpoint: no " << name << " branch in the input, duplicates of resumed entries aren't removed"
+                          << std::endl;
+                ids.clear();
+                break;
+            }
+            ids.push_back(branch);
+        }
+        for (Long64_t i = first; !ids.empty() && i < resume_entry; i++) {
+            for (auto branch : ids) {
+                branch->GetEntry(i);
+            }
+            filter->pass(event);
+        }
+    }
+    return resume_entry;
+}
+
+// Called at the top of the event loop with the entry about to be processed;
+// everything before it is complete.
+template <class Tree>
+void checkpoint::update(Long64_t entry, Tree *st, Helper *helper) {
+    if (interval <= 0. || entry % 1000 != 0) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - last_save).count() < interval) {
+        return;
+    }
+
+    auto info = st->otree->GetUserInfo();
+    info->Delete();
+    info->Add(new TNamed("checkpoint", std::to_string(entry).c_str()));
+    for (auto &hist : *helper->getHistos1D()) {
+        auto copy = reinterpret_cast<TH1F *>(hist.second->Clone());
+        copy->SetDirectory(nullptr);
+        info->Add(copy);
+    }
+    for (auto &hist : *helper->getHistos2D()) {
+        auto copy = reinterpret_cast<TH2F *>(hist.second->Clone());
+        copy->SetDirectory(nullptr);
+        info->Add(copy);
+    }
+    st->otree->AutoSave("SaveSelf");
+    nsaved++;
+    last_save = now;
+}
+
+// the finished output carries no checkpoint
+template <class Tree>
+void checkpoint::finish(Tree *st) {
+    st->otree->GetUserInfo()->Delete();
+}
+
+void checkpoint::report(std::ostream &out) {
+    if (resume_entry >= 0) {
+        out << "Resumed from checkpoint at entry " << resume_entry << std::endl;
+        out << "\t the cache, fake factor and read-ahead counters only cover the entries from there on" << std::endl;
+    }
+    if (interval > 0.) {
+        out << "Checkpoints: " << nsaved << " saved (every " << interval << " s)" << std::endl;
+    }
+}
+
+#endif  // INCLUDE_CHECKPOINT_H_
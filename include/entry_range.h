@@ -0,0 +1,155 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_ENTRY_RANGE_H_
+#define INCLUDE_ENTRY_RANGE_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include "TDirectory.h"
+#include "TNamed.h"
+#include "TTree.h"
+
+// Range of input entries processed by one job.
+//
+// "--first A --last B" asks for entries [A, B) and "--shard k/N" for the k-th
+// of N pieces of roughly equal size (k = 0 ... N-1). Both ends of the range
+// are moved forward to the start of the next cluster, so a job never shares
+// a basket with its neighbour and the shards of one file tile it exactly: the
+// end of shard k is the start of shard k + 1.
+//
+// The output name gets a "_shardkofN" (or "_entriesAtoB") suffix and a
+// "shard_info" object with the range is written next to the trees, which is
+// what reassemble_shards checks before merging the pieces back together.
+// Quantities copied from the input once per file (the nevents histogram) are
+// only written by the job that starts at entry 0.
+//
+// report() also gives the wall time of the job (counted from the
+// construction of the range) and the number of entries, which is what
+// cost_model.py learns the run time of the jobs from.
+class entry_range {
+ public:
+    entry_range(std::string, std::string, std::string);
+
+    bool isGood() { return good; }
+    bool isSharded() { return sharded; }
+    bool isFirst() { return nshards > 0 ? shard == 0 : requested_first == 0; }
+    Long64_t getFirst() { return first; }
+    Long64_t getLast() { return last; }
+    Long64_t getEntries() { return last - first; }
+    std::string getSuffix();
+
+    void setTree(TTree *);
+    void write(TDirectory *);
+    void report(std::ostream &);
+
+    // parse a "shard_info" title, returns false if it isn't one
+    static bool parse(std::string, Long64_t *, Long64_t *, Long64_t *, int *, int *);
+
+ private:
+    Long64_t align(TTree *, Long64_t);
+
+    bool good, sharded;
+    int shard, nshards;
+    Long64_t requested_first, requested_last;
+    Long64_t first, last, total;
+    std::chrono::steady_clock::time_point start;
+};
+
+entry_range::entry_range(std::string first_str, std::string last_str, std::string shard_str)
+    : good(true),
+      sharded(false),
+      shard(-1),
+      nshards(0),
+      requested_first(0),
+      requested_last(-1),
+      first(0),
+      last(0),
+      total(0),
+      start(std::chrono::steady_clock::now()) {
+    if (!shard_str.empty()) {
+        if (!first_str.empty() || !last_str.empty()) {
+            std::cerr << "entry_range: --shard can't be combined with --first/--last" << std::endl;
+            good = false;
+        } else if (std::sscanf(shard_str.c_str(), "%d/%d", &shard, &nshards) != 2 || nshards < 1 || shard < 0 || shard >= nshards) {
+            std::cerr << "entry_range: --shard must be k/N with 0 <= k < N, got " << shard_str << std::endl;
+            good = false;
+        }
+        sharded = good && nshards > 1;
+    } else if (!first_str.empty() || !last_str.empty()) {
+        requested_first = first_str.empty() ? 0 : std::stoll(first_str);
+        requested_last = last_str.empty() ? -1 : std::stoll(last_str);
+        if (requested_first < 0 || (requested_last >= 0 && requested_last < requested_first)) {
+            std::cerr << "entry_range: invalid range [" << first_str << ", " << last_str << ")" << std::endl;
+            good = false;
+        }
+        sharded = good;
+    }
+}
+
+std::string entry_range::getSuffix() {
+    if (!sharded) {
+        return "";
+    } else if (nshards > 0) {
+        return "_shard" + std::to_string(shard) + "of" + std::to_string(nshards);
+    }
+    return "_entries" + std::to_string(requested_first) + "to" + (requested_last < 0 ? std::string("end") : std::to_string(requested_last));
+}
+
+// first cluster start at or after entry (the number of entries past the end)
+Long64_t entry_range::align(TTree *tree, Long64_t entry) {
+    if (entry <= 0) {
+        return 0;
+    } else if (entry >= total) {
+        return total;
+    }
+    auto clusters = tree->GetClusterIterator(entry);
+    Long64_t start = clusters.Next();
+    if (start < entry) {
+        start = clusters.Next();
+    }
+    return std::min(start, total);
+}
+
+// Resolve the range against the input tree.
+void entry_range::setTree(TTree *tree) {
+    total = tree->GetEntries();
+    if (nshards > 0) {
+        first = align(tree, total * shard / nshards);
+        last = align(tree, total * (shard + 1) / nshards);
+    } else {
+        first = align(tree, requested_first);
+        last = align(tree, requested_last < 0 ? total : requested_last);
+    }
+    last = std::max(first, last);
+}
+
+void entry_range::write(TDirectory *dir) {
+    if (!sharded) {
+        return;
+    }
+    std::string info = std::to_string(first) + " " + std::to_string(last) + " " + std::to_string(total) + " " + std::to_string(shard) + " " +
+                       std::to_string(nshards);
+    TNamed shard_info("shard_info", info.c_str());
+    dir->WriteTObject(&shard_info, "shard_info");
+}
+
+bool entry_range::parse(std::string info, Long64_t *first, Long64_t *last, Long64_t *total, int *shard, int *nshards) {
+    return std::sscanf(info.c_str(), "%lld %lld %lld %d %d", first, last, total, shard, nshards) == 5;
+}
+
+void entry_range::report(std::ostream &out) {
+    if (sharded) {
+        out << "Entry range: [" << first << ", " << last << ") of " << total;
+        if (nshards > 0) {
+            out << " (shard " << shard << " of " << nshards << ")";
+        }
+        out << std::endl;
+    }
+    out << "Processed " << getEntries() << " entries in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+        << " s" << std::endl;
+}
+
+#endif  // INCLUDE_ENTRY_RANGE_H_
@@ -0,0 +1,325 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_EVENT_FILTER_H_
+#define INCLUDE_EVENT_FILTER_H_
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "TROOT.h"
+#include "./json_reader.h"
+
+// Certified luminosity mask. The golden JSON ({"run": [[first, last], ...]})
+// is flattened into a sorted list of intervals keyed by (run << 32 | first)
+// so a lookup is a single binary search. Data files are ordered by run and
+// lumi, so the interval from the previous lookup is checked first.
+class lumi_mask {
+ public:
+    lumi_mask() : last(0) {}
+    bool load(std::string);
+    bool pass(UInt_t, UInt_t);
+    size_t size() { return starts.size(); }
+
+ private:
+    static ULong64_t key(UInt_t run, UInt_t lumi) { return (static_cast<ULong64_t>(run) << 32) | lumi; }
+
+    std::vector<ULong64_t> starts, ends;
+    size_t last;
+};
+
+bool lumi_mask::load(std::string filename) {
+    json_reader reader;
+    auto golden = reader.parseFile(filename);
+    if (!reader.ok() || !golden.isObject()) {
+        std::cerr << "Unable to read lumi mask " << filename << std::endl;
+        return false;
+    }
+
+    std::vector<std::pair<ULong64_t, ULong64_t>> intervals;
+    for (auto &run : golden.getMembers()) {
+        auto run_number = static_cast<UInt_t>(std::stoul(run.first));
+        for (auto &range : run.second.getElements()) {
+            if (range.size() != 2 || range.at(0).asDouble() > range.at(1).asDouble()) {
+                std::cerr << "Bad lumi range for run " << run.first << " in " << filename << std::endl;
+                return false;
+            }
+            intervals.push_back(std::make_pair(key(run_number, range.at(0).asInt()), key(run_number, range.at(1).asInt())));
+        }
+    }
+
+    // sort and merge overlapping ranges so the binary search only needs to
+    // look at one interval
+    std::sort(intervals.begin(), intervals.end());
+    starts.clear();
+    ends.clear();
+    for (auto &interval : intervals) {
+        if (!ends.empty() && interval.first <= ends.back() + 1 && (interval.first >> 32) == (ends.back() >> 32)) {
+            ends.back() = std::max(ends.back(), interval.second);
+        } else {
+            starts.push_back(interval.first);
+            ends.push_back(interval.second);
+        }
+    }
+    last = 0;
+    return true;
+}
+
+bool lumi_mask::pass(UInt_t run, UInt_t lumi) {
+    auto k = key(run, lumi);
+    if (last < starts.size() && starts[last] <= k && k <= ends[last]) {
+        return true;
+    }
+    auto it = std::upper_bound(starts.begin(), starts.end(), k);
+    if (it == starts.begin()) {
+        return false;
+    }
+    auto index = std::distance(starts.begin(), it) - 1;
+    if (k <= ends[index]) {
+        last = index;
+        return true;
+    }
+    return false;
+}
+
+// Set of (run, lumi, evt) keys used to reject repeated events when merging
+// primary datasets or reprocessings. The full keys are stored in an
+// open-addressing table with linear probing, so an event is only rejected if
+// exactly the same key was seen. The table is sized from the entries of the
+// job: it starts small and doubles up to room for every entry at 70% load, so
+// it never fills up and never lets a key through unchecked. A job whose
+// entries need more memory than the limit (--dedup-mb) is refused before it
+// starts; shard it (--shard) to bring it under the limit. At 16 bytes per
+// slot, a 2^26 entry job needs 1.5 GB.
+//
+// The optional Bloom prefilter (three bits in one 64-bit word per key, one
+// word for eight entries) answers "definitely new" for most keys with a
+// single memory access. Keys it may have seen are looked up in the table.
+//
+// The table only covers one job. Duplicates across jobs (other datasets,
+// shards or eras) are removed when the outputs are merged with
+// fast_merge --dedup.
+class duplicate_filter {
+ public:
+    explicit duplicate_filter(Long64_t entries, bool bloom = false);
+    static size_t needed_mb(Long64_t, bool);
+    bool isDuplicate(UInt_t, UInt_t, ULong64_t);
+    void report(std::ostream &);
+    ULong64_t getDuplicates() { return duplicates; }
+
+ private:
+    struct key {
+        ULong64_t run_lumi, evt;
+        bool operator==(const key &other) const { return run_lumi == other.run_lumi && evt == other.evt; }
+    };
+
+    static size_t table_slots(Long64_t);
+    static size_t bloom_words(Long64_t);
+    static ULong64_t hash(const key &);
+    static ULong64_t mix(ULong64_t);
+    void insert(const key &, ULong64_t);
+    void grow();
+
+    std::vector<key> table;
+    std::vector<bool> used;
+    std::vector<ULong64_t> bloom_bits;
+    size_t max_slots, filled;
+    ULong64_t checked, duplicates, bloom_skips;
+    bool use_bloom;
+};
+
+duplicate_filter::duplicate_filter(Long64_t entries, bool bloom)
+    : table(1 << 16), used(1 << 16, false), max_slots(table_slots(entries)), filled(0), checked(0), duplicates(0), bloom_skips(0),
+      use_bloom(bloom) {
+    if (use_bloom) {
+        bloom_bits.assign(bloom_words(entries), 0);
+    }
+}
+
+// smallest power of two holding the entries at 70% load
+size_t duplicate_filter::table_slots(Long64_t entries) {
+    size_t slots(1 << 16);
+    while (7 * slots < 10 * static_cast<size_t>(std::max<Long64_t>(entries, 0))) {
+        slots *= 2;
+    }
+    return slots;
+}
+
+size_t duplicate_filter::bloom_words(Long64_t entries) {
+    size_t words(1 << 10);
+    while (8 * words < static_cast<size_t>(std::max<Long64_t>(entries, 0))) {
+        words *= 2;
+    }
+    return words;
+}
+
+// memory the filter of a job with this many entries can grow to
+size_t duplicate_filter::needed_mb(Long64_t entries, bool bloom) {
+    size_t bytes = table_slots(entries) * (sizeof(key) + 1) + (bloom ? bloom_words(entries) * sizeof(ULong64_t) : 0);
+    return (bytes + 1024 * 1024 - 1) / (1024 * 1024);
+}
+
+// splitmix64 finalizer
+ULong64_t duplicate_filter::mix(ULong64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+ULong64_t duplicate_filter::hash(const key &k) { return mix(mix(k.run_lumi) ^ k.evt); }
+
+// Returns true if this (run, lumi, evt) has been seen before. The key is
+// remembered otherwise.
+bool duplicate_filter::isDuplicate(UInt_t run, UInt_t lumi, ULong64_t evt) {
+    checked++;
+    key k = {(static_cast<ULong64_t>(run) << 32) | lumi, evt};
+    auto h = hash(k);
+
+    if (use_bloom) {
+        // blocked Bloom filter: three bits inside a single word
+        auto &word = bloom_bits[(h >> 18) & (bloom_bits.size() - 1)];
+        ULong64_t bits = (1ULL << (h & 63)) | (1ULL << ((h >> 6) & 63)) | (1ULL << ((h >> 12) & 63));
+        if ((word & bits) != bits) {
+            word |= bits;
+            bloom_skips++;
+            insert(k, h);
+            return false;
+        }
+    }
+
+    auto mask = table.size() - 1;
+    for (auto slot = h & mask; used[slot]; slot = (slot + 1) & mask) {
+        if (table[slot] == k) {
+            duplicates++;
+            return true;
+        }
+    }
+    insert(k, h);
+    return false;
+}
+
+// The table holds at most one key per entry of the job, so it stays below
+// 70% load at max_slots. It keeps doubling past that rather than dropping
+// keys if more arrive than expected.
+void duplicate_filter::insert(const key &k, ULong64_t h) {
+    if (10 * (filled + 1) > 7 * table.size()) {
+        if (table.size() >= max_slots) {
+            std::cerr << "duplicate_filter: more keys than the " << 7 * max_slots / 10 << " expected, growing past the memory estimate"
+                      << std::endl;
+            max_slots *= 2;
+        }
+        grow();
+    }
+
+    auto mask = table.size() - 1;
+    auto slot = h & mask;
+    while (used[slot] && !(table[slot] == k)) {
+        slot = (slot + 1) & mask;
+    }
+    if (!used[slot]) {
+        table[slot] = k;
+        used[slot] = true;
+        filled++;
+    }
+}
+
+void duplicate_filter::grow() {
+    std::vector<key> old_table(table.size() * 2);
+    std::vector<bool> old_used(used.size() * 2, false);
+    old_table.swap(table);
+    old_used.swap(used);
+    auto mask = table.size() - 1;
+    for (size_t i = 0; i < old_table.size(); i++) {
+        if (!old_used[i]) {
+            continue;
+        }
+        auto slot = hash(old_table[i]) & mask;
+        while (used[slot]) {
+            slot = (slot + 1) & mask;
+        }
+        table[slot] = old_table[i];
+        used[slot] = true;
+    }
+}
+
+void duplicate_filter::report(std::ostream &out) {
+    out << "Duplicate filter: checked " << checked << " events, rejected " << duplicates << " duplicates" << std::endl;
+    out << "\t table: " << filled << " / " << table.size() << " keys (" << table.size() * sizeof(key) / (1024 * 1024) << " MB, up to "
+        << max_slots * sizeof(key) / (1024 * 1024) << " MB for this job)" << std::endl;
+    if (use_bloom) {
+        out << "\t Bloom prefilter: " << bloom_bits.size() * sizeof(ULong64_t) / (1024 * 1024) << " MB, "
+            << bloom_skips << " events accepted without a table lookup" << std::endl;
+    }
+}
+
+// Filter stage for the data path of the analyzers. Works with the
+// event_factory from either backend since it only needs getRun, getLumi
+// and getEvt.
+class event_filter {
+ public:
+    event_filter() : mask(nullptr), dedup(nullptr), failed_mask(0), failed_dedup(0) {}
+    ~event_filter() {
+        delete mask;
+        delete dedup;
+    }
+
+    bool setLumiMask(std::string);
+    bool setDuplicateFilter(Long64_t, size_t, bool);
+    bool isActive() { return mask != nullptr || dedup != nullptr; }
+    template <class Event>
+    bool pass(Event *);
+    void report(std::ostream &);
+
+ private:
+    lumi_mask *mask;
+    duplicate_filter *dedup;
+    ULong64_t failed_mask, failed_dedup;
+};
+
+bool event_filter::setLumiMask(std::string filename) {
+    mask = new lumi_mask();
+    return mask->load(filename);
+}
+
+// Size the duplicate table for the entries of the job. Returns false if it
+// could need more than max_mb (0 for no limit).
+bool event_filter::setDuplicateFilter(Long64_t entries, size_t max_mb, bool bloom) {
+    auto needed = duplicate_filter::needed_mb(entries, bloom);
+    if (max_mb > 0 && needed > max_mb) {
+        std::cerr << "Checking " << entries << " entries for duplicates needs up to " << needed << " MB, more than the " << max_mb
+                  << " MB allowed. Split the job with --shard or raise --dedup-mb." << std::endl;
+        return false;
+    }
+    dedup = new duplicate_filter(entries, bloom);
+    return true;
+}
+
+// The lumi mask is applied first so uncertified events never take up room in
+// the duplicate table.
+template <class Event>
+bool event_filter::pass(Event *evt) {
+    if (mask != nullptr && !mask->pass(evt->getRun(), evt->getLumi())) {
+        failed_mask++;
+        return false;
+    }
+    if (dedup != nullptr && dedup->isDuplicate(evt->getRun(), evt->getLumi(), evt->getEvt())) {
+        failed_dedup++;
+        return false;
+    }
+    return true;
+}
+
+void event_filter::report(std::ostream &out) {
+    if (mask != nullptr) {
+        out << "Lumi mask: " << mask->size() << " certified ranges, rejected " << failed_mask << " events" << std::endl;
+    }
+    if (dedup != nullptr) {
+        dedup->report(out);
+    }
+}
+
+#endif  // INCLUDE_EVENT_FILTER_H_
@@ -0,0 +1,287 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_FAKE_FACTOR_H_
+#define INCLUDE_FAKE_FACTOR_H_
+
+#include <array>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "TF1.h"
+#include "TFile.h"
+#include "TH2F.h"
+
+// Jet -> tau fake factors for the et and mt channels, computed the same way
+// as FFApplicationTool in scripts/utils/ApplyFF.py.
+//
+// The raw fake factor fits, the closure corrections and the QCD/W/tt
+// fractions (from scripts/fill_fake_fractions.py --fractions-only) are read
+// once when the object is built. For an anti-isolated event each fit that
+// enters any variation is evaluated once and fake_weight plus the 46
+// ff_*, mtclosure_*, lptclosure_* and osssclosure_* variations are put
+// together from those values. Other events get 0. Anything but data enters
+// the jetFakes estimate with a negative weight, as in the python script.
+class fake_factor {
+ public:
+    fake_factor(std::string, std::string, std::string, std::string, std::string, bool);
+    ~fake_factor();
+    bool isGood() { return good; }
+
+    static const std::vector<std::string> &sources();
+
+    template <class Tree>
+    void book(Tree *, bool);
+    void fill(bool, double, double, double, double, double, double, bool);
+    void report(std::ostream &);
+
+ private:
+    // nominal, unc1 up, unc1 down, unc2 up, unc2 down
+    typedef std::array<TF1 *, 5> fit_set;
+
+    TF1 *get_fit(TFile *, std::string);
+    TH2F *get_fraction(TFile *, std::string);
+    bool get_fits(TFile *, std::string, fit_set *);
+
+    // the fits are only trusted up to these values
+    static double raw(TF1 *fit, double pt) { return fit->Eval(pt > 100 ? 100 : pt); }
+    static double mvis_closure(TF1 *fit, double mvis) { return fit->Eval(mvis > 250 ? 250 : mvis); }
+    static double lpt_closure(TF1 *fit, double lpt) { return fit->Eval(lpt > 150 ? 150 : lpt); }
+
+    bool good;
+    double sign;
+    std::array<fit_set, 3> raw_qcd, raw_w;  // 0, 1 and >= 2 jets
+    fit_set raw_tt, mt_closure_w;
+    TF1 *lpt_qcd, *lpt_w, *lpt_tt, *lpt_xtrg_qcd, *lpt_xtrg_w, *lpt_xtrg_tt, *osss_qcd;
+    std::array<TH2F *, 3> frac_data, frac_qcd, frac_w, frac_tt;  // 0jet, boosted, vbf
+    Float_t *nominal;
+    std::vector<Float_t *> branches;  // up and down for each source
+    Long64_t nweighted;
+};
+
+fake_factor::fake_factor(std::string raw_file, std::string corrections_file, std::string osss_file, std::string fractions_file,
+                         std::string channel, bool isData)
+    : good(true),
+      sign(isData ? 1. : -1.),
+      raw_qcd(),
+      raw_w(),
+      raw_tt(),
+      mt_closure_w(),
+      lpt_qcd(nullptr),
+      lpt_w(nullptr),
+      lpt_tt(nullptr),
+      lpt_xtrg_qcd(nullptr),
+      lpt_xtrg_w(nullptr),
+      lpt_xtrg_tt(nullptr),
+      osss_qcd(nullptr),
+      frac_data(),
+      frac_qcd(),
+      frac_w(),
+      frac_tt(),
+      nominal(nullptr),
+      nweighted(0) {
+    auto fin = TFile::Open(raw_file.c_str());
+    if (fin == nullptr || fin->IsZombie()) {
+        std::cerr << "fake_factor: unable to open " << raw_file << std::endl;
+        good = false;
+    } else {
+        std::vector<std::string> njets = {"0jet", "1jet", "2jet"};
+        for (int i = 0; i < 3; i++) {
+            good = get_fits(fin, "rawFF_" + channel + "_qcd_" + njets.at(i), &raw_qcd[i]) && good;
+            good = get_fits(fin, "rawFF_" + channel + "_w_" + njets.at(i), &raw_w[i]) && good;
+        }
+        good = get_fits(fin, "mc_rawFF_" + channel + "_tt", &raw_tt) && good;
+        fin->Close();
+    }
+
+    fin = TFile::Open(corrections_file.c_str());
+    if (fin == nullptr || fin->IsZombie()) {
+        std::cerr << "fake_factor: unable to open " << corrections_file << std::endl;
+        good = false;
+    } else {
+        lpt_w = get_fit(fin, "closure_lpt_" + channel + "_0jet_w");
+        lpt_qcd = get_fit(fin, "closure_lpt_" + channel + "_0jet_qcd");
+        lpt_tt = get_fit(fin, "closure_lpt_" + channel + "_ttmc");
+        lpt_xtrg_w = get_fit(fin, "closure_lpt_xtrg_" + channel + "_0jet_w");
+        lpt_xtrg_qcd = get_fit(fin, "closure_lpt_xtrg_" + channel + "_0jet_qcd");
+        lpt_xtrg_tt = get_fit(fin, "closure_lpt_xtrg_" + channel + "_ttmc");
+        good = lpt_w != nullptr && lpt_qcd != nullptr && lpt_tt != nullptr && lpt_xtrg_w != nullptr && lpt_xtrg_qcd != nullptr &&
+               lpt_xtrg_tt != nullptr && good;
+        fin->Close();
+    }
+
+    fin = TFile::Open(osss_file.c_str());
+    if (fin == nullptr || fin->IsZombie()) {
+        std::cerr << "fake_factor: unable to open " << osss_file << std::endl;
+        good = false;
+    } else {
+        osss_qcd = get_fit(fin, "closure_OSSS_mvis_" + channel + "_qcd");
+        good = osss_qcd != nullptr && get_fits(fin, "closure_mt_" + channel + "_w", &mt_closure_w) && good;
+        fin->Close();
+    }
+
+    fin = TFile::Open(fractions_file.c_str());
+    if (fin == nullptr || fin->IsZombie()) {
+        std::cerr << "fake_factor: unable to open " << fractions_file << std::endl;
+        good = false;
+    } else {
+        std::vector<std::string> categories = {"0jet", "boosted", "vbf"};
+        for (int i = 0; i < 3; i++) {
+            std::string dir = channel + "_" + categories.at(i) + "/";
+            frac_data[i] = get_fraction(fin, dir + "frac_data");
+            frac_qcd[i] = get_fraction(fin, dir + "frac_qcd");
+            frac_w[i] = get_fraction(fin, dir + "frac_w");
+            frac_tt[i] = get_fraction(fin, dir + "frac_tt");
+            good = frac_data[i] != nullptr && frac_qcd[i] != nullptr && frac_w[i] != nullptr && frac_tt[i] != nullptr && good;
+        }
+        fin->Close();
+    }
+}
+
+// the fits and fractions outlive the files they were read from, they belong to this object
+fake_factor::~fake_factor() {
+    for (auto fits : {&raw_qcd[0], &raw_qcd[1], &raw_qcd[2], &raw_w[0], &raw_w[1], &raw_w[2], &raw_tt, &mt_closure_w}) {
+        for (auto fit : *fits) {
+            delete fit;
+        }
+    }
+    for (auto fit : {lpt_qcd, lpt_w, lpt_tt, lpt_xtrg_qcd, lpt_xtrg_w, lpt_xtrg_tt, osss_qcd}) {
+        delete fit;
+    }
+    for (auto fractions : {&frac_data, &frac_qcd, &frac_w, &frac_tt}) {
+        for (auto hist : *fractions) {
+            delete hist;
+        }
+    }
+}
+
+TF1 *fake_factor::get_fit(TFile *fin, std::string name) {
+    auto fit = reinterpret_cast<TF1 *>(fin->Get(name.c_str()));
+    if (fit == nullptr) {
+        std::cerr << "fake_factor: unable to read " << name << " from " << fin->GetName() << std::endl;
+    }
+    return fit;
+}
+
+TH2F *fake_factor::get_fraction(TFile *fin, std::string name) {
+    auto hist = reinterpret_cast<TH2F *>(fin->Get(name.c_str()));
+    if (hist == nullptr) {
+        std::cerr << "fake_factor: unable to read " << name << " from " << fin->GetName() << std::endl;
+        return nullptr;
+    }
+    hist->SetDirectory(nullptr);
+    return hist;
+}
+
+bool fake_factor::get_fits(TFile *fin, std::string name, fit_set *fits) {
+    std::vector<std::string> suffixes = {"", "_unc1_up", "_unc1_down", "_unc2_up", "_unc2_down"};
+    bool ok(true);
+    for (int i = 0; i < 5; i++) {
+        fits->at(i) = get_fit(fin, name + suffixes.at(i));
+        ok = fits->at(i) != nullptr && ok;
+    }
+    return ok;
+}
+
+// variations are stored as <source>_up and <source>_down
+const std::vector<std::string> &fake_factor::sources() {
+    static const std::vector<std::string> names = {
+        "ff_qcd_0jet_unc1", "ff_qcd_0jet_unc2", "ff_qcd_1jet_unc1", "ff_qcd_1jet_unc2", "ff_qcd_2jet_unc1", "ff_qcd_2jet_unc2",
+        "ff_w_0jet_unc1",   "ff_w_0jet_unc2",   "ff_w_1jet_unc1",   "ff_w_1jet_unc2",   "ff_w_2jet_unc1",   "ff_w_2jet_unc2",
+        "ff_tt_0jet_unc1",  "ff_tt_0jet_unc2",  "mtclosure_w_unc1", "mtclosure_w_unc2", "lptclosure_xtrg_qcd", "lptclosure_xtrg_w",
+        "lptclosure_xtrg_tt", "lptclosure_qcd", "lptclosure_w",     "lptclosure_tt",    "osssclosure_qcd"};
+    return names;
+}
+
+template <class Tree>
+void fake_factor::book(Tree *st, bool systematics) {
+    nominal = st->add_weight_branch("fake_weight");
+    if (systematics) {
+        for (auto &source : sources()) {
+            branches.push_back(st->add_weight_branch(source + "_up"));
+            branches.push_back(st->add_weight_branch(source + "_down"));
+        }
+    }
+}
+
+// tau pT, mT, visible mass, lepton pT, njets, mjj and the cross trigger
+// decision of one event
+void fake_factor::fill(bool anti_iso, double pt, double mt, double mvis, double lpt, double njets, double mjj, bool xtrg) {
+    if (nominal == nullptr) {
+        return;
+    }
+    if (!anti_iso) {
+        *nominal = 0.;
+        for (auto branch : branches) {
+            *branch = 0.;
+        }
+        return;
+    }
+    nweighted++;
+
+    // fractions of the category
+    int cat = njets == 0 ? 0 : (njets == 1 || mjj < 300 ? 1 : 2);
+    int xbin = frac_data[cat]->GetXaxis()->FindBin(mvis);
+    int ybin = frac_data[cat]->GetYaxis()->FindBin(njets);
+    double f_qcd(frac_qcd[cat]->GetBinContent(xbin, ybin)), f_w(frac_w[cat]->GetBinContent(xbin, ybin)),
+        f_tt(frac_tt[cat]->GetBinContent(xbin, ybin));
+    auto combine = [&](double ff_qcd, double ff_w, double ff_tt) { return sign * (f_tt * ff_tt + f_qcd * ff_qcd + f_w * ff_w); };
+
+    // every fit needed by the nominal weight and the variations
+    int jet = njets == 0 ? 0 : (njets == 1 ? 1 : 2);
+    int nfits = branches.empty() ? 1 : 5;
+    std::array<double, 5> rq, rw, rt, mw;
+    for (int i = 0; i < nfits; i++) {
+        rq[i] = raw(raw_qcd[jet][i], pt);
+        rw[i] = raw(raw_w[jet][i], pt);
+        rt[i] = raw(raw_tt[i], pt);
+        mw[i] = mt_closure_w[i]->Eval(mt);
+    }
+    double cq(lpt_closure(xtrg ? lpt_xtrg_qcd : lpt_qcd, lpt)), cw(lpt_closure(xtrg ? lpt_xtrg_w : lpt_w, lpt)),
+        ct(lpt_closure(xtrg ? lpt_xtrg_tt : lpt_tt, lpt)), osss(mvis_closure(osss_qcd, mvis));
+
+    double qcd(rq[0] * cq * osss), w(rw[0] * cw * mw[0]), tt(rt[0] * ct);
+    *nominal = combine(qcd, w, tt);
+    if (branches.empty()) {
+        return;
+    }
+
+    // same order as sources(), up then down (index 2k - 1 and 2k of the fits)
+    size_t b(0);
+    for (int n = 0; n < 3; n++) {
+        for (int i = 1; i < 5; i++) {
+            *branches[b++] = combine(jet == n ? rq[i] * cq * osss : qcd, w, tt);
+        }
+    }
+    for (int n = 0; n < 3; n++) {
+        for (int i = 1; i < 5; i++) {
+            *branches[b++] = combine(qcd, jet == n ? rw[i] * cw * mw[0] : w, tt);
+        }
+    }
+    for (int i = 1; i < 5; i++) {
+        *branches[b++] = combine(qcd, w, rt[i] * ct);
+    }
+    for (int i = 1; i < 5; i++) {
+        *branches[b++] = combine(qcd, rw[0] * cw * mw[i], tt);
+    }
+
+    // closure variations: up doubles the correction, down removes it
+    for (bool xtrg_source : {true, false}) {
+        bool shift = xtrg == xtrg_source;
+        *branches[b++] = combine(shift ? rq[0] * (2 * cq - 1) * osss : qcd, w, tt);
+        *branches[b++] = combine(shift ? rq[0] * osss : qcd, w, tt);
+        *branches[b++] = combine(qcd, shift ? rw[0] * (2 * cw - 1) * mw[0] : w, tt);
+        *branches[b++] = combine(qcd, shift ? rw[0] * mw[0] : w, tt);
+        *branches[b++] = combine(qcd, w, shift ? rt[0] * (2 * ct - 1) : tt);
+        *branches[b++] = combine(qcd, w, shift ? rt[0] : tt);
+    }
+    *branches[b++] = combine(rq[0] * cq * (2 * osss - 1), w, tt);
+    *branches[b++] = combine(rq[0] * cq, w, tt);
+}
+
+void fake_factor::report(std::ostream &out) {
+    if (nominal != nullptr) {
+        out << "Fake factors: " << nweighted << " anti-isolated events weighted, " << branches.size() << " variations" << std::endl;
+    }
+}
+
+#endif  // INCLUDE_FAKE_FACTOR_H_
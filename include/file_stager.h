@@ -0,0 +1,473 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_FILE_STAGER_H_
+#define INCLUDE_FILE_STAGER_H_
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#include <utime.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "TBranch.h"
+#include "TFile.h"
+#include "TObjArray.h"
+#include "TTree.h"
+#include "TTreeCache.h"
+
+// Node-local staging cache for input files.
+//
+// Each file is stored in the cache directory under a name derived from its
+// source path, size and modification time, so a file that is replaced on
+// /hdfs gets a new entry instead of a stale copy. Jobs on the same node
+// coordinate without locks: the first job to create "<entry>.claim" with
+// O_EXCL copies the file to a temporary name and renames it into place; the
+// others wait for the rename. A copier that dies leaves a claim that stops
+// being touched, and waiters then read the source directly. If anything
+// goes wrong the original path is returned, so staging never stops a job.
+class file_stager {
+ public:
+    explicit file_stager(std::string dir, int _wait_seconds = 900)
+        : cache_dir(dir), wait_seconds(_wait_seconds), hits(0), copied(0), waited(0), direct(0), bytes_copied(0) {
+        if (!cache_dir.empty()) {
+            mkdir(cache_dir.c_str(), 0755);
+        }
+    }
+
+    std::string stage(std::string);
+    bool isActive() { return !cache_dir.empty(); }
+    void report(std::ostream &);
+
+ private:
+    static bool isRemote(const std::string &path) { return path.find("://") != std::string::npos; }
+    std::string entry_name(const std::string &, const struct stat *);
+    bool copy(const std::string &, const std::string &, const std::string &);
+    std::string wait_for(const std::string &, const std::string &, const std::string &);
+
+    std::string cache_dir;
+    int wait_seconds;
+    int hits, copied, waited, direct;
+    Long64_t bytes_copied;
+};
+
+std::string file_stager::entry_name(const std::string &source, const struct stat *info) {
+    std::stringstream identity;
+    identity << source;
+    if (info != nullptr) {
+        identity << "|" << info->st_size << "|" << info->st_mtime;
+    }
+
+    // 64-bit FNV-1a
+    ULong64_t hash = 0xcbf29ce484222325ULL;
+    for (auto c : identity.str()) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+    return cache_dir + "/" + key + "_" + source.substr(source.find_last_of('/') + 1);
+}
+
+// Returns the path to open: the staged copy when possible, otherwise the
+// source itself.
+std::string file_stager::stage(std::string source) {
+    if (cache_dir.empty()) {
+        return source;
+    }
+
+    struct stat info;
+    bool remote = isRemote(source);
+    if (!remote && stat(source.c_str(), &info) != 0) {
+        return source;  // let TFile report the missing file
+    }
+    auto target = entry_name(source, remote ? nullptr : &info);
+    if (access(target.c_str(), R_OK) == 0) {
+        hits++;
+        return target;
+    }
+
+    // leave room for other jobs: only stage when the file fits twice
+    struct statvfs space;
+    if (!remote && statvfs(cache_dir.c_str(), &space) == 0 &&
+        static_cast<double>(space.f_bavail) * space.f_frsize < 2. * info.st_size) {
+        direct++;
+        return source;
+    }
+
+    auto claim = target + ".claim";
+    int fd = open(claim.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+    if (fd < 0) {
+        return errno == EEXIST ? wait_for(source, target, claim) : (direct++, source);
+    }
+    close(fd);
+
+    bool ok = copy(source, target, claim);
+    unlink(claim.c_str());
+    if (!ok) {
+        std::cerr << "file_stager: unable to stage " << source << ", reading it directly" << std::endl;
+        direct++;
+        return source;
+    }
+    copied++;
+    return target;
+}
+
+// Copy to a temporary name and rename so readers never see a partial file.
+// The claim is touched while copying to show the copy is still alive.
+bool file_stager::copy(const std::string &source, const std::string &target, const std::string &claim) {
+    auto tmp_name = target + ".tmp" + std::to_string(getpid());
+    bool ok(false);
+    if (isRemote(source)) {
+        ok = TFile::Cp(source.c_str(), tmp_name.c_str(), false);
+    } else {
+        int in = open(source.c_str(), O_RDONLY);
+        int out = open(tmp_name.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (in >= 0 && out >= 0) {
+            std::vector<char> buffer(4 << 20);
+            ssize_t n;
+            int chunks(0);
+            ok = true;
+            while (ok && (n = read(in, buffer.data(), buffer.size())) > 0) {
+                ok = write(out, buffer.data(), n) == n;
+                bytes_copied += n;
+                if (++chunks % 16 == 0) {
+                    utime(claim.c_str(), nullptr);
+                }
+            }
+            ok = ok && n == 0;
+        }
+        if (in >= 0) {
+            close(in);
+        }
+        if (out >= 0) {
+            ok = close(out) == 0 && ok;
+        }
+    }
+    if (ok && rename(tmp_name.c_str(), target.c_str()) == 0) {
+        return true;
+    }
+    unlink(tmp_name.c_str());
+    return false;
+}
+
+// Another job is copying the file. Wait for it unless its claim goes stale,
+// the copy fails (claim removed without a result) or the wait times out.
+std::string file_stager::wait_for(const std::string &source, const std::string &target, const std::string &claim) {
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < std::chrono::seconds(wait_seconds)) {
+        if (access(target.c_str(), R_OK) == 0) {
+            waited++;
+            return target;
+        }
+        struct stat info;
+        if (stat(claim.c_str(), &info) != 0) {
+            if (access(target.c_str(), R_OK) == 0) {
+                continue;
+            }
+            break;  // copier gave up
+        } else if (time(nullptr) - info.st_mtime > 120) {
+            break;  // copier is gone
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+    direct++;
+    return source;
+}
+
+void file_stager::report(std::ostream &out) {
+    if (cache_dir.empty()) {
+        return;
+    }
+    int total = hits + copied + waited + direct;
+    out << "Staging cache " << cache_dir << ": " << total << " files, " << hits << " hits, " << waited
+        << " staged by another job, " << copied << " copied (" << bytes_copied / (1024 * 1024) << " MB), " << direct
+        << " read directly" << std::endl;
+    if (total > 0) {
+        out << "\t hit rate: " << 100. * (hits + waited) / total << "%" << std::endl;
+    }
+}
+
+// Read-ahead for the input tree.
+//
+// The tree gets a TTreeCache that learns the branches used in the first
+// entries. In addition, the byte ranges of the baskets belonging to each
+// cluster are computed up front (for branches that have an address set),
+// and a background thread reads the next clusters with pread while the
+// current one is being processed. The thread never touches ROOT objects,
+// it only warms the page cache (or the /hdfs FUSE cache) so the reads done
+// by the TTreeCache are served locally. Remote (root://) inputs only get the
+// TTreeCache.
+class cluster_prefetcher {
+ public:
+    cluster_prefetcher(TTree *, std::string, int cache_mb = 64, int _depth = 2);
+    ~cluster_prefetcher() { join(); }
+
+    void set_range(Long64_t, Long64_t);
+    void next(Long64_t);
+    // must be called before the input file is closed, it takes the read statistics
+    void stop();
+    void report(std::ostream &);
+
+ private:
+    typedef std::vector<std::pair<Long64_t, Long64_t>> ranges;  // offset, length
+
+    void add_branch(TBranch *, bool, std::vector<ranges> *);
+    void run();
+    void join();
+
+    TTree *tree;
+    int depth, fd;
+    std::vector<Long64_t> cluster_starts;
+    std::vector<ranges> cluster_ranges;
+    size_t current;
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::atomic<long> requested, fetched, end_cluster;
+    std::atomic<bool> done;
+    std::atomic<Long64_t> bytes_prefetched;
+    std::atomic<double> busy_seconds;
+    int clusters_seen, clusters_ready;
+    std::chrono::steady_clock::time_point start, end;
+    // statistics of the input file, taken by stop()
+    bool stopped, have_file, have_cache;
+    Long64_t file_bytes;
+    Int_t file_reads;
+    double cache_efficiency;
+};
+
+cluster_prefetcher::cluster_prefetcher(TTree *_tree, std::string filename, int cache_mb, int _depth)
+    : tree(_tree),
+      depth(_depth),
+      fd(-1),
+      current(0),
+      requested(0),
+      fetched(0),
+      end_cluster(0),
+      done(false),
+      bytes_prefetched(0),
+      busy_seconds(0.),
+      clusters_seen(0),
+      clusters_ready(0),
+      start(std::chrono::steady_clock::now()),
+      stopped(false),
+      have_file(false),
+      have_cache(false),
+      file_bytes(0),
+      file_reads(0),
+      cache_efficiency(0.) {
+    tree->SetCacheSize(static_cast<Long64_t>(cache_mb) * 1024 * 1024);
+    tree->SetCacheLearnEntries(100);
+
+    auto entries = tree->GetEntries();
+    auto clusters = tree->GetClusterIterator(0);
+    for (Long64_t first = clusters.Next(); first < entries; first = clusters.Next()) {
+        cluster_starts.push_back(first);
+    }
+    end_cluster = cluster_starts.size();
+    if (filename.find("://") != std::string::npos || cluster_starts.size() < 2) {
+        return;
+    }
+
+    // baskets of the branches the factories read, grouped by the cluster
+    // their first entry belongs to
+    cluster_ranges.resize(cluster_starts.size());
+    for (int i = 0; i < tree->GetListOfBranches()->GetEntriesFast(); i++) {
+        add_branch(reinterpret_cast<TBranch *>(tree->GetListOfBranches()->UncheckedAt(i)), true, &cluster_ranges);
+    }
+    if (std::all_of(cluster_ranges.begin(), cluster_ranges.end(), [](const ranges &r) { return r.empty(); })) {
+        // no addresses set (i.e. a TTreeReader is used), read everything
+        for (int i = 0; i < tree->GetListOfBranches()->GetEntriesFast(); i++) {
+            add_branch(reinterpret_cast<TBranch *>(tree->GetListOfBranches()->UncheckedAt(i)), false, &cluster_ranges);
+        }
+    }
+    for (auto &cluster : cluster_ranges) {
+        std::sort(cluster.begin(), cluster.end());
+        ranges merged;
+        for (auto &range : cluster) {
+            // neighbouring baskets are read in one go
+            if (!merged.empty() && range.first <= merged.back().first + merged.back().second + 65536) {
+                merged.back().second = std::max(merged.back().second, range.first + range.second - merged.back().first);
+            } else {
+                merged.push_back(range);
+            }
+        }
+        cluster.swap(merged);
+    }
+
+    fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        worker = std::thread(&cluster_prefetcher::run, this);
+    }
+}
+
+void cluster_prefetcher::add_branch(TBranch *branch, bool only_active, std::vector<ranges> *output) {
+    if (branch == nullptr) {
+        return;
+    }
+    auto children = branch->GetListOfBranches();
+    if (children != nullptr && children->GetEntriesFast() > 0) {
+        for (int i = 0; i < children->GetEntriesFast(); i++) {
+            add_branch(reinterpret_cast<TBranch *>(children->UncheckedAt(i)), only_active, output);
+        }
+        return;
+    }
+    if (only_active && branch->GetAddress() == nullptr) {
+        return;
+    }
+
+    auto first_entries = branch->GetBasketEntry();
+    auto bytes = branch->GetBasketBytes();
+    for (int i = 0; i < branch->GetWriteBasket(); i++) {
+        auto seek = branch->GetBasketSeek(i);
+        if (seek <= 0 || bytes[i] <= 0) {
+            continue;
+        }
+        auto cluster = std::upper_bound(cluster_starts.begin(), cluster_starts.end(), first_entries[i]) - cluster_starts.begin() - 1;
+        output->at(std::max(0L, static_cast<long>(cluster))).push_back(std::make_pair(seek, static_cast<Long64_t>(bytes[i])));
+    }
+}
+
+// Only entries [first, last) will be read (see entry_range.h): the cache and
+// the read-ahead start at the cluster holding "first" and stop at "last".
+void cluster_prefetcher::set_range(Long64_t first, Long64_t last) {
+    tree->SetCacheEntryRange(first, last);
+    auto begin = std::upper_bound(cluster_starts.begin(), cluster_starts.end(), first) - cluster_starts.begin() - 1;
+    current = std::max(0L, static_cast<long>(begin));
+    end_cluster = std::lower_bound(cluster_starts.begin(), cluster_starts.end(), last) - cluster_starts.begin();
+    if (worker.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            requested = current + depth;
+        }
+        wake.notify_one();
+    }
+}
+
+// Called with every entry number; wakes the thread at cluster boundaries.
+void cluster_prefetcher::next(Long64_t entry) {
+    if (current + 1 >= cluster_starts.size() || entry < cluster_starts[current + 1]) {
+        return;
+    }
+    while (current + 1 < cluster_starts.size() && entry >= cluster_starts[current + 1]) {
+        current++;
+    }
+    if (!worker.joinable()) {
+        return;
+    }
+    clusters_seen++;
+    if (fetched.load() > static_cast<long>(current)) {
+        clusters_ready++;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        requested = current + depth;
+    }
+    wake.notify_one();
+}
+
+void cluster_prefetcher::run() {
+    std::vector<char> buffer(1 << 20);
+    long next_cluster(1);
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this, next_cluster] { return done.load() || requested.load() >= next_cluster; });
+        }
+        if (done) {
+            return;
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        // skip whatever lies before the current cluster
+        next_cluster = std::max(next_cluster, requested.load() - depth + 1);
+        while (!done && next_cluster <= requested && next_cluster < end_cluster) {
+            for (auto &range : cluster_ranges[next_cluster]) {
+                for (Long64_t offset = 0; offset < range.second && !done; offset += buffer.size()) {
+                    auto n = pread(fd, buffer.data(), std::min(static_cast<Long64_t>(buffer.size()), range.second - offset), range.first + offset);
+                    if (n <= 0) {
+                        break;
+                    }
+                    bytes_prefetched += n;
+                }
+            }
+            fetched = ++next_cluster;
+        }
+        busy_seconds = busy_seconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        if (next_cluster >= end_cluster) {
+            return;
+        }
+    }
+}
+
+void cluster_prefetcher::join() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        done = true;
+    }
+    wake.notify_one();
+    if (worker.joinable()) {
+        worker.join();
+    }
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+void cluster_prefetcher::stop() {
+    join();
+    if (stopped) {
+        return;
+    }
+    stopped = true;
+    end = std::chrono::steady_clock::now();
+    auto file = tree->GetCurrentFile();
+    if (file != nullptr) {
+        have_file = true;
+        file_bytes = file->GetBytesRead();
+        file_reads = file->GetReadCalls();
+        auto cache = dynamic_cast<TTreeCache *>(file->GetCacheRead(tree));
+        if (cache != nullptr) {
+            have_cache = true;
+            cache_efficiency = cache->GetEfficiency();
+        }
+    }
+}
+
+void cluster_prefetcher::report(std::ostream &out) {
+    if (!stopped) {
+        std::cerr << "cluster_prefetcher: report() called before stop(), no input statistics" << std::endl;
+        join();
+        end = std::chrono::steady_clock::now();
+    }
+    out << "Input: " << cluster_starts.size() << " clusters";
+    if (have_file) {
+        out << ", " << file_bytes / (1024 * 1024) << " MB in " << file_reads << " reads";
+        if (have_cache) {
+            out << ", TTreeCache efficiency " << cache_efficiency;
+        }
+    }
+    out << std::endl;
+    if (clusters_seen > 0) {
+        auto wall = std::chrono::duration<double>(end - start).count();
+        out << "\t prefetch: " << clusters_ready << " / " << clusters_seen << " clusters ready before use ("
+            << 100. * clusters_ready / clusters_seen << "%), " << bytes_prefetched / (1024 * 1024) << " MB read ahead, thread busy "
+            << busy_seconds.load() << " s of " << wall << " s" << std::endl;
+    }
+}
+
+#endif  // INCLUDE_FILE_STAGER_H_
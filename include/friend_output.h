@@ -0,0 +1,195 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_FRIEND_OUTPUT_H_
+#define INCLUDE_FRIEND_OUTPUT_H_
+
+#include <fnmatch.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "TBranch.h"
+#include "TDirectory.h"
+#include "TFile.h"
+#include "TList.h"
+#include "TTree.h"
+#include "./json_reader.h"
+
+// Systematic outputs holding only the columns a systematic changes ("--friend").
+//
+// Every job of a friend production writes row_key: the input entry in the
+// lower 32 bits and a hash of the sample in the upper ones, so rows still
+// match after the outputs are sharded or hadded. A systematic job reads the
+// keys of its nominal output and splits the events it selects in two:
+//   - events the nominal job selected as well go to the tree of the usual
+//     name, with only row_key and the columns listed for the systematic in
+//     configs/friend_columns.json (the rest equals the nominal row)
+//   - events selected only with the shift go to "<tree>_extra" with all
+//     the columns
+// scripts/utils/friend_output.py joins both with the nominal tree again.
+//
+// Systematics missing from the config, jobs without a finished nominal
+// output (or one written without --friend) and checkpointed jobs write the
+// full tree as before.
+class friend_output {
+ public:
+    static constexpr const char *config = "configs/friend_columns.json";
+
+    friend_output() : active(false), friend_tree(nullptr), extra_tree(nullptr), nshifted(0), nextra(0) {}
+    friend_output(std::string, std::string, std::string, std::string);
+
+    bool isActive() { return active; }
+    const std::vector<std::string> &getColumns() { return columns; }
+
+    // upper 32 bits of the row keys of a sample
+    static ULong64_t key_base(const std::string &);
+    // true if the tree in this file was split by a friend job
+    static bool is_friend(TDirectory *, const std::string &);
+
+    // split the booked output tree, it becomes the extra tree
+    bool book(TTree *);
+    void fill(ULong64_t);
+    void report(std::ostream &);
+
+ private:
+    bool read_columns(std::string, std::string);
+    bool read_keys(std::string, std::string);
+    bool selected(const std::string &);
+
+    bool active;
+    std::string group;
+    std::vector<std::string> columns;
+    std::unordered_set<ULong64_t> nominal_keys;
+    TTree *friend_tree, *extra_tree;
+    Long64_t nshifted, nextra;
+};
+
+friend_output::friend_output(std::string config_name, std::string syst, std::string nominal_name, std::string tree_name)
+    : active(false), friend_tree(nullptr), extra_tree(nullptr), nshifted(0), nextra(0) {
+    if (config_name.empty() || syst.empty() || syst == "NOMINAL") {
+        return;
+    }
+    active = read_columns(config_name, syst) && read_keys(nominal_name, tree_name);
+}
+
+ULong64_t friend_output::key_base(const std::string &sample) {
+    // FNV-1a, 32 bits
+    UInt_t hash(2166136261U);
+    for (auto c : sample) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619U;
+    }
+    return static_cast<ULong64_t>(hash) << 32;
+}
+
+// The tree of a split output only holds row_key and the shifted columns.
+// Tools reading the trees directly refuse it, friend_output.py joins it
+// with the nominal rows.
+bool friend_output::is_friend(TDirectory *dir, const std::string &tree_name) {
+    return dir != nullptr && dir->GetKey((tree_name + "_extra").c_str()) != nullptr;
+}
+
+// the columns of the first group with a prefix matching the systematic
+bool friend_output::read_columns(std::string config_name, std::string syst) {
+    json_reader reader;
+    auto cfg = reader.parseFile(config_name);
+    if (!reader.ok()) {
+        std::cerr << "friend_output: unable to read " << config_name << ", writing the full tree" << std::endl;
+        return false;
+    }
+    for (auto &entry : cfg.get("systematics").getMembers()) {
+        for (auto &prefix : entry.second.get("prefixes").asStringVector()) {
+            if (syst.compare(0, prefix.size(), prefix) != 0) {
+                continue;
+            }
+            group = entry.first;
+            columns = cfg.get("common").asStringVector();
+            for (auto &column : entry.second.get("columns").asStringVector()) {
+                columns.push_back(column);
+            }
+            return true;
+        }
+    }
+    std::cerr << "friend_output: no columns listed for " << syst << " in " << config_name << ", writing the full tree" << std::endl;
+    return false;
+}
+
+bool friend_output::read_keys(std::string nominal_name, std::string tree_name) {
+    if (nominal_name.empty() || access(nominal_name.c_str(), R_OK) != 0) {
+        std::cerr << "friend_output: no nominal output " << nominal_name << ", writing the full tree" << std::endl;
+        return false;
+    }
+    // the current directory is back to the output file afterwards
+    TDirectory::TContext restore;
+    auto nominal = TFile::Open(nominal_name.c_str());
+    auto tree = nominal == nullptr ? nullptr : reinterpret_cast<TTree *>(nominal->Get(tree_name.c_str()));
+    bool good = tree != nullptr && tree->GetBranch("row_key") != nullptr && tree->GetUserInfo()->FindObject("checkpoint") == nullptr;
+    if (good) {
+        ULong64_t key;
+        tree->SetBranchStatus("*", false);
+        tree->SetBranchStatus("row_key", true);
+        tree->SetBranchAddress("row_key", &key);
+        nominal_keys.reserve(tree->GetEntries());
+        for (Long64_t i = 0; i < tree->GetEntries(); i++) {
+            tree->GetEntry(i);
+            nominal_keys.insert(key);
+        }
+    } else {
+        std::cerr << "friend_output: " << nominal_name << " is unfinished or has no row_key, writing the full tree" << std::endl;
+    }
+    if (nominal != nullptr) {
+        nominal->Close();
+    }
+    return good;
+}
+
+bool friend_output::selected(const std::string &name) {
+    for (auto &pattern : columns) {
+        if (fnmatch(pattern.c_str(), name.c_str(), 0) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Must come after every branch is booked. The friend tree shares the
+// addresses of the output tree, so narrowed columns are filled once.
+bool friend_output::book(TTree *tree) {
+    if (!active) {
+        return false;
+    }
+    std::string name(tree->GetName());
+    friend_tree = new TTree(name.c_str(), name.c_str());
+    friend_tree->SetDirectory(tree->GetDirectory());
+    auto branches = tree->GetListOfBranches();
+    for (int i = 0; i < branches->GetEntriesFast(); i++) {
+        auto branch = reinterpret_cast<TBranch *>(branches->At(i));
+        if (selected(branch->GetName())) {
+            friend_tree->Branch(branch->GetName(), branch->GetAddress(), branch->GetTitle());
+        }
+    }
+    extra_tree = tree;
+    extra_tree->SetName((name + "_extra").c_str());
+    extra_tree->SetTitle((name + "_extra").c_str());
+    return true;
+}
+
+void friend_output::fill(ULong64_t key) {
+    if (nominal_keys.count(key) > 0) {
+        friend_tree->Fill();
+        nshifted++;
+    } else {
+        extra_tree->Fill();
+        nextra++;
+    }
+}
+
+void friend_output::report(std::ostream &out) {
+    if (!active) {
+        return;
+    }
+    out << "Friend output (" << group << "): " << friend_tree->GetListOfBranches()->GetEntriesFast() << " columns for " << nshifted
+        << " nominal events, " << nextra << " events only selected with the shift" << std::endl;
+}
+
+#endif  // INCLUDE_FRIEND_OUTPUT_H_
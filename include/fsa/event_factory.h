@@ -5,13 +5,67 @@
 
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "../models/defaults.h"
-#include "../qq2Hqq_uncert_scheme.h"
+#include "../vbf_theory_weights.h"
 #include "../swiss_army_class.h"
 #include "TTree.h"
 
+// Bits in the packed flag/trigger mask built by event_factory::run_factory.
+// A bit is set when the corresponding Float_t branch is non-zero.
+namespace event_mask {
+enum bits {
+    // MET filters
+    goodVertices = 0,
+    globalSuperTightHalo2016Filter = 1,
+    HBHENoiseFilter = 2,
+    HBHENoiseIsoFilter = 3,
+    eeBadScFilter = 4,
+    EcalDeadCellTriggerPrimitiveFilter = 5,
+    BadPFMuonFilter = 6,
+    ecalBadCalibFilter = 7,
+    BadChargedCandidateFilter = 8,
+    badMuons = 9,
+    duplicateMuons = 10,
+    globalTightHalo2016Filter = 11,
+    // e+tau cross trigger
+    Ele24LooseTau30Pass = 16,
+    eMatchesEle24Tau30Filter = 17,
+    eMatchesEle24Tau30Path = 18,
+    tMatchesEle24Tau30Filter = 19,
+    tMatchesEle24Tau30Path = 20,
+    Ele24LooseHPSTau30Pass = 21,
+    eMatchesEle24HPSTau30Filter = 22,
+    eMatchesEle24HPSTau30Path = 23,
+    tMatchesEle24HPSTau30Filter = 24,
+    tMatchesEle24HPSTau30Path = 25
+};
+
+constexpr ULong64_t bit(bits b) { return 1ULL << b; }
+constexpr ULong64_t pack(Float_t value, bits b) { return value != 0 ? bit(b) : 0; }
+
+// filters vetoing the event in each era (eeBadScFilter is added for data)
+constexpr ULong64_t flags_2016 = bit(goodVertices) | bit(globalSuperTightHalo2016Filter) | bit(HBHENoiseFilter) | bit(HBHENoiseIsoFilter) |
+                                 bit(EcalDeadCellTriggerPrimitiveFilter) | bit(BadPFMuonFilter);
+constexpr ULong64_t flags_2017 = flags_2016 | bit(ecalBadCalibFilter);
+constexpr ULong64_t flags_2018 = flags_2017;
+
+constexpr ULong64_t flags(int era, bool isData) {
+    return (era == 2016 ? flags_2016 : era == 2017 ? flags_2017 : flags_2018) | (isData ? bit(eeBadScFilter) : 0);
+}
+
+// trigger fired and both legs matched
+constexpr ULong64_t Ele24Tau30 = bit(Ele24LooseTau30Pass) | bit(eMatchesEle24Tau30Filter) | bit(eMatchesEle24Tau30Path) |
+                                 bit(tMatchesEle24Tau30Filter) | bit(tMatchesEle24Tau30Path);
+constexpr ULong64_t Ele24HPSTau30 = bit(Ele24LooseHPSTau30Pass) | bit(eMatchesEle24HPSTau30Filter) | bit(eMatchesEle24HPSTau30Path) |
+                                    bit(tMatchesEle24HPSTau30Filter) | bit(tMatchesEle24HPSTau30Path);
+
+constexpr bool all_set(ULong64_t word, ULong64_t mask) { return (word & mask) == mask; }
+constexpr bool none_set(ULong64_t word, ULong64_t mask) { return (word & mask) == 0; }
+}  // namespace event_mask
+
 /////////////////////////////////////////
 // Purpose: To hold general event data //
 /////////////////////////////////////////
@@ -29,8 +83,9 @@ class event_factory {
         Flag_HBHENoiseIsoFilter, Flag_badMuons, Flag_duplicateMuons, Flag_ecalBadCalibFilter, Flag_eeBadScFilter, Flag_globalSuperTightHalo2016Filter,
         Flag_globalTightHalo2016Filter, Flag_goodVertices;
     Float_t Ele24LooseTau30Pass, eMatchesEle24Tau30Filter, eMatchesEle24Tau30Path, tMatchesEle24Tau30Filter, tMatchesEle24Tau30Path,
-        Ele24LooseHPSTau30Pass, PassEle24Tau30_2018, eMatchesEle24HPSTau30Filter, eMatchesEle24HPSTau30Path, tMatchesEle24HPSTau30Filter,
+        Ele24LooseHPSTau30Pass, eMatchesEle24HPSTau30Filter, eMatchesEle24HPSTau30Path, tMatchesEle24HPSTau30Filter,
         tMatchesEle24HPSTau30Path;
+    ULong64_t trigger_mask;  // packed flags and triggers
     Float_t m_sv, pt_sv, m_sv_shift, m_sv_noshift;                      // SVFit
     Float_t Phi, Phi1, costheta1, costheta2, costhetastar, Q2V1, Q2V2;  // MELA
     Float_t DCP_VBF, DCP_ggH;
@@ -55,6 +110,7 @@ class event_factory {
     void setEmbed() { isEmbed = true; }
     void setNjets(Float_t _njets) { njets = _njets; }  // must be set in event loop
     void setRivets(TTree*);
+    void run_factory();  // must be called once per event
     std::string fix_syst_string(std::string);
     void do_shift(bool _shift) { valid_shift = (_shift || always_shift); }
 
@@ -63,9 +119,12 @@ class event_factory {
     UInt_t getConvEvt() { return convert_evt; }
     UInt_t getRun() { return run; }
     UInt_t getLumi() { return lumi; }
+    // branches filling getRun, getLumi and getEvt
+    std::vector<std::string> getIdBranches() { return {"run", "lumi", "evt"}; }
     Float_t getGenWeight() { return genweight; }
     Float_t getMSV() { return shifting && valid_shift ? m_sv_shift : m_sv_noshift; }
     Float_t getPtSV() { return pt_sv; }
+    ULong64_t getTriggerMask() { return trigger_mask; }
     Bool_t fire_trigger(trigger t);
     Bool_t getPassFlags(Bool_t);
     Float_t getPrefiringWeight();
@@ -114,7 +173,18 @@ class event_factory {
 
 // read data from trees into member variables
 event_factory::event_factory(TTree* input, Bool_t _is_data, lepton _lep, int _era, bool isMadgraph, std::string _syst)
-    : sm_weight_nlo(1.),
+    : Ele24LooseTau30Pass(0.),
+      eMatchesEle24Tau30Filter(0.),
+      eMatchesEle24Tau30Path(0.),
+      tMatchesEle24Tau30Filter(0.),
+      tMatchesEle24Tau30Path(0.),
+      Ele24LooseHPSTau30Pass(0.),
+      eMatchesEle24HPSTau30Filter(0.),
+      eMatchesEle24HPSTau30Path(0.),
+      tMatchesEle24HPSTau30Filter(0.),
+      tMatchesEle24HPSTau30Path(0.),
+      trigger_mask(0),
+      sm_weight_nlo(1.),
       mm_weight_nlo(1.),
       ps_weight_nlo(1.),
       isEmbed(false),
@@ -219,6 +289,26 @@ event_factory::event_factory(TTree* input, Bool_t _is_data, lepton _lep, int _er
     input->SetBranchAddress("Flag_globalTightHalo2016Filter", &Flag_globalTightHalo2016Filter);
     input->SetBranchAddress("Flag_goodVertices", &Flag_goodVertices);
 
+    // e+tau cross trigger branches only exist in the etau ntuples
+    if (lep == lepton::ELECTRON) {
+        std::vector<std::pair<std::string, Float_t*>> cross_trigger_branches{
+            {"Ele24LooseTau30Pass", &Ele24LooseTau30Pass},
+            {"eMatchesEle24Tau30Filter", &eMatchesEle24Tau30Filter},
+            {"eMatchesEle24Tau30Path", &eMatchesEle24Tau30Path},
+            {"tMatchesEle24Tau30Filter", &tMatchesEle24Tau30Filter},
+            {"tMatchesEle24Tau30Path", &tMatchesEle24Tau30Path},
+            {"Ele24LooseHPSTau30Pass", &Ele24LooseHPSTau30Pass},
+            {"eMatchesEle24HPSTau30Filter", &eMatchesEle24HPSTau30Filter},
+            {"eMatchesEle24HPSTau30Path", &eMatchesEle24HPSTau30Path},
+            {"tMatchesEle24HPSTau30Filter", &tMatchesEle24HPSTau30Filter},
+            {"tMatchesEle24HPSTau30Path", &tMatchesEle24HPSTau30Path}};
+        for (auto& branch : cross_trigger_branches) {
+            if (input->GetBranch(branch.first.c_str()) != nullptr) {
+                input->SetBranchAddress(branch.first.c_str(), branch.second);
+            }
+        }
+    }
+
     if (isMadgraph) {
         input->SetBranchAddress("sm_weight_nlo", &sm_weight_nlo);
         input->SetBranchAddress("mm_weight_nlo", &mm_weight_nlo);
@@ -242,6 +332,33 @@ std::string event_factory::fix_syst_string(std::string syst) {
     return syst;
 }
 
+// pack flags and triggers into trigger_mask so the per-event decisions
+// are single mask comparisons
+void event_factory::run_factory() {
+    trigger_mask = event_mask::pack(Flag_goodVertices, event_mask::goodVertices) |
+                   event_mask::pack(Flag_globalSuperTightHalo2016Filter, event_mask::globalSuperTightHalo2016Filter) |
+                   event_mask::pack(Flag_HBHENoiseFilter, event_mask::HBHENoiseFilter) |
+                   event_mask::pack(Flag_HBHENoiseIsoFilter, event_mask::HBHENoiseIsoFilter) |
+                   event_mask::pack(Flag_eeBadScFilter, event_mask::eeBadScFilter) |
+                   event_mask::pack(Flag_EcalDeadCellTriggerPrimitiveFilter, event_mask::EcalDeadCellTriggerPrimitiveFilter) |
+                   event_mask::pack(Flag_BadPFMuonFilter, event_mask::BadPFMuonFilter) |
+                   event_mask::pack(Flag_ecalBadCalibFilter, event_mask::ecalBadCalibFilter) |
+                   event_mask::pack(Flag_BadChargedCandidateFilter, event_mask::BadChargedCandidateFilter) |
+                   event_mask::pack(Flag_badMuons, event_mask::badMuons) |
+                   event_mask::pack(Flag_duplicateMuons, event_mask::duplicateMuons) |
+                   event_mask::pack(Flag_globalTightHalo2016Filter, event_mask::globalTightHalo2016Filter) |
+                   event_mask::pack(Ele24LooseTau30Pass, event_mask::Ele24LooseTau30Pass) |
+                   event_mask::pack(eMatchesEle24Tau30Filter, event_mask::eMatchesEle24Tau30Filter) |
+                   event_mask::pack(eMatchesEle24Tau30Path, event_mask::eMatchesEle24Tau30Path) |
+                   event_mask::pack(tMatchesEle24Tau30Filter, event_mask::tMatchesEle24Tau30Filter) |
+                   event_mask::pack(tMatchesEle24Tau30Path, event_mask::tMatchesEle24Tau30Path) |
+                   event_mask::pack(Ele24LooseHPSTau30Pass, event_mask::Ele24LooseHPSTau30Pass) |
+                   event_mask::pack(eMatchesEle24HPSTau30Filter, event_mask::eMatchesEle24HPSTau30Filter) |
+                   event_mask::pack(eMatchesEle24HPSTau30Path, event_mask::eMatchesEle24HPSTau30Path) |
+                   event_mask::pack(tMatchesEle24HPSTau30Filter, event_mask::tMatchesEle24HPSTau30Filter) |
+                   event_mask::pack(tMatchesEle24HPSTau30Path, event_mask::tMatchesEle24HPSTau30Path);
+}
+
 Float_t event_factory::getPrefiringWeight() {
     if (syst == "prefiring_up") {
         return prefiring_weight_up;
@@ -270,71 +387,24 @@ Float_t event_factory::getRivetUnc(std::vector<double> uncs, std::string syst) {
 }
 
 Float_t event_factory::getVBFTheoryUnc(std::string syst) {
-    if (syst.find("VBF_Rivet") == std::string::npos) {
-        return 1.;
-    }
-
-    double shift(1.0);
-    if (syst.find("_Down") != std::string::npos) {
-        shift *= -1.;
-    }
-
-    int source;
-    if (syst.find("VBF_Rivet0") != std::string::npos) {
-        source = 0;
-    } else if (syst.find("VBF_Rivet1") != std::string::npos) {
-        source = 1;
-    } else if (syst.find("VBF_Rivet2") != std::string::npos) {
-        source = 2;
-    } else if (syst.find("VBF_Rivet3") != std::string::npos) {
-        source = 3;
-    } else if (syst.find("VBF_Rivet4") != std::string::npos) {
-        source = 4;
-    } else if (syst.find("VBF_Rivet5") != std::string::npos) {
-        source = 5;
-    } else if (syst.find("VBF_Rivet6") != std::string::npos) {
-        source = 6;
-    } else if (syst.find("VBF_Rivet7") != std::string::npos) {
-        source = 7;
-    } else if (syst.find("VBF_Rivet8") != std::string::npos) {
-        source = 8;
-    } else if (syst.find("VBF_Rivet9") != std::string::npos) {
-        source = 9;
-    } else {
-        return 1.;
-    }
-
-    return vbf_uncert_stage_1_1(source, static_cast<int>(Rivet_stage1_cat_pTjet30GeV), shift);
+    return vbf_theory_weights::weight(vbf_theory_weights::get(static_cast<int>(Rivet_stage1_cat_pTjet30GeV)), syst);
 }
 
 Bool_t event_factory::getPassFlags(Bool_t isData) {
-    if (era == 2016) {
-        return !(Flag_goodVertices || Flag_globalSuperTightHalo2016Filter || Flag_HBHENoiseFilter || Flag_HBHENoiseIsoFilter ||
-                 (Flag_eeBadScFilter && isData) || Flag_EcalDeadCellTriggerPrimitiveFilter || Flag_BadPFMuonFilter);
-    } else if (era == 2017) {
-        return !(Flag_goodVertices || Flag_globalSuperTightHalo2016Filter || Flag_HBHENoiseFilter || Flag_HBHENoiseIsoFilter ||
-                 (Flag_eeBadScFilter && isData) || Flag_EcalDeadCellTriggerPrimitiveFilter || Flag_BadPFMuonFilter || Flag_ecalBadCalibFilter);
-    } else {
-        return !(Flag_goodVertices || Flag_globalSuperTightHalo2016Filter || Flag_HBHENoiseFilter || Flag_HBHENoiseIsoFilter ||
-                 (Flag_eeBadScFilter && isData) || Flag_EcalDeadCellTriggerPrimitiveFilter || Flag_BadPFMuonFilter || Flag_ecalBadCalibFilter);
-    }
+    return event_mask::none_set(trigger_mask, event_mask::flags(era, isData));
 }
 
 // PRIVATE - fire_trigger(trigger::Ele24Tau30_2017)
 Bool_t event_factory::getPassEle24Tau30() {
-    return Ele24LooseTau30Pass && eMatchesEle24Tau30Filter && eMatchesEle24Tau30Path && tMatchesEle24Tau30Filter && tMatchesEle24Tau30Path;
+    return event_mask::all_set(trigger_mask, event_mask::Ele24Tau30);
 }
 
 // PRIVATE - fire_trigger(trigger::Ele24Tau30_2018)
 Bool_t event_factory::getPassEle24Tau30_2018() {
-    PassEle24Tau30_2018 = eMatchesEle24HPSTau30Filter && eMatchesEle24HPSTau30Path && tMatchesEle24HPSTau30Filter && tMatchesEle24HPSTau30Path;
     if (isData && run < 317509) {
-        return eMatchesEle24Tau30Filter && eMatchesEle24Tau30Path && tMatchesEle24Tau30Filter && tMatchesEle24Tau30Path && Ele24LooseTau30Pass;
-    } else if ((isData && run >= 317509) || !isData) {
-        return eMatchesEle24HPSTau30Filter && eMatchesEle24HPSTau30Path && tMatchesEle24HPSTau30Filter && tMatchesEle24HPSTau30Path &&
-               Ele24LooseHPSTau30Pass;
+        return event_mask::all_set(trigger_mask, event_mask::Ele24Tau30);
     }
-    return false;
+    return event_mask::all_set(trigger_mask, event_mask::Ele24HPSTau30);
 }
 
 Bool_t event_factory::getPassCrossTrigger(Float_t pt) {
@@ -0,0 +1,251 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_GGH_THEORY_WEIGHTS_H_
+#define INCLUDE_GGH_THEORY_WEIGHTS_H_
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "TFile.h"
+#include "TGraph.h"
+#include "./sf_snapshot.h"
+
+// Theory weights for the powheg ggH sample.
+//
+// The NNLOPS reweighting graphs are copied into flat tables when the file is
+// opened. Each table keeps the graph points and a uniform grid over x that
+// points at the segment containing every grid cell, so evaluating it costs a
+// cell lookup, a short forward step and the same linear interpolation (and
+// extrapolation past the ends) as TGraph::Eval.
+//
+// The WG1 "2017 scheme" uncertainties are the nine amplitudes returned by
+// qcd_ggF_uncert_2017 in ComputeWG1Unc.h (mu, res, mig01, mig12, vbf2j,
+// vbf3j, pT60, pT120, qm_t), computed into a fixed-size array instead of a
+// freshly allocated vector. Source N is varied by ggH_RivetN_Up/_Down with
+// weight 1 + u[N] or 1 - u[N].
+class ggh_theory_weights {
+ public:
+    static const int n_sources = 9;
+    typedef std::array<double, n_sources> uncertainties;
+
+    explicit ggh_theory_weights(std::string);
+    // graphs stored as prefix/gr_NNLOPSratio_pt_powheg_Njet by make_sf_snapshot
+    ggh_theory_weights(const sf_snapshot *, std::string);
+    bool isGood() { return good; }
+
+    double nnlops(int, double);
+    static uncertainties wg1_2017(int, double, int);
+    static int source(std::string);
+    static std::string variation(int, bool);
+    static double weight(const uncertainties &, std::string);
+
+    template <class Tree>
+    void book(Tree *);
+    void fill(const uncertainties &);
+
+ private:
+    // linear interpolation table built from one TGraph
+    struct table {
+        std::vector<double> x, y;
+        std::vector<int> cell_start;
+        double xmin, inv_width;
+        bool build(TGraph *);
+        bool build(const double *, const double *, int);
+        double eval(double) const;
+    };
+
+    static double interpol(double x, double x1, double y1, double x2, double y2) {
+        if (x < x1) return y1;
+        if (x > x2) return y2;
+        return y1 + (y2 - y1) * (x - x1) / (x2 - x1);
+    }
+
+    bool good;
+    std::array<table, 4> graphs;                  // 0, 1, 2, >= 3 jets
+    std::array<double, 4> max_pt;                 // the graphs are only trusted up to these values
+    std::array<Float_t *, 2 * n_sources> branches;  // Up, Down for each source
+};
+
+ggh_theory_weights::ggh_theory_weights(std::string filename) : good(false), max_pt{125., 625., 800., 925.} {
+    branches.fill(nullptr);
+    auto fin = TFile::Open(filename.c_str());
+    if (fin == nullptr) {
+        std::cerr << "ggh_theory_weights: unable to open " << filename << std::endl;
+        return;
+    }
+    good = true;
+    for (unsigned i = 0; i < graphs.size(); i++) {
+        std::string name = "gr_NNLOPSratio_pt_powheg_" + std::to_string(i) + "jet";
+        if (!graphs.at(i).build(reinterpret_cast<TGraph *>(fin->Get(name.c_str())))) {
+            std::cerr << "ggh_theory_weights: unable to read " << name << " from " << filename << std::endl;
+            good = false;
+        }
+    }
+    fin->Close();
+}
+
+ggh_theory_weights::ggh_theory_weights(const sf_snapshot *snapshot, std::string prefix) : good(true), max_pt{125., 625., 800., 925.} {
+    branches.fill(nullptr);
+    for (unsigned i = 0; i < graphs.size(); i++) {
+        std::string name = prefix + "/gr_NNLOPSratio_pt_powheg_" + std::to_string(i) + "jet";
+        auto graph = snapshot->table(name);
+        if (graph == nullptr || graph->axes.size() != 1 ||
+            !graphs.at(i).build(graph->axes[0].edges, graph->values, static_cast<int>(graph->nvalues))) {
+            std::cerr << "ggh_theory_weights: unable to read " << name << " from " << snapshot->getName() << std::endl;
+            good = false;
+        }
+    }
+}
+
+bool ggh_theory_weights::table::build(TGraph *graph) {
+    return graph != nullptr && build(graph->GetX(), graph->GetY(), graph->GetN());
+}
+
+bool ggh_theory_weights::table::build(const double *graph_x, const double *graph_y, int npoints) {
+    if (npoints < 2) {
+        return false;
+    }
+
+    std::vector<std::pair<double, double>> points;
+    for (int i = 0; i < npoints; i++) {
+        points.push_back(std::make_pair(graph_x[i], graph_y[i]));
+    }
+    std::stable_sort(points.begin(), points.end(),
+                     [](const std::pair<double, double> &a, const std::pair<double, double> &b) { return a.first < b.first; });
+    for (auto &point : points) {
+        x.push_back(point.first);
+        y.push_back(point.second);
+    }
+
+    // four cells per point keeps the forward step at zero or one for the
+    // roughly evenly spaced NNLOPS graphs
+    int ncells = 4 * x.size();
+    xmin = x.front();
+    inv_width = x.back() > xmin ? ncells / (x.back() - xmin) : 0.;
+    int low(0);
+    for (int cell = 0; cell < ncells; cell++) {
+        double start = xmin + cell / inv_width;
+        while (low + 1 < static_cast<int>(x.size()) && x.at(low + 1) <= start) {
+            low++;
+        }
+        cell_start.push_back(low);
+    }
+    return true;
+}
+
+// Same result as TGraph::Eval without a spline: linear interpolation between
+// the surrounding points, linear extrapolation from the first or last two.
+double ggh_theory_weights::table::eval(double value) const {
+    int n = x.size();
+    int low;
+    if (value < xmin) {
+        low = 0;
+    } else {
+        int cell = static_cast<int>((value - xmin) * inv_width);
+        if (cell >= static_cast<int>(cell_start.size())) {
+            low = n - 2;
+        } else {
+            low = cell_start[cell];
+            while (low + 1 < n && x[low + 1] <= value) {
+                low++;
+            }
+            low = std::min(low, n - 2);
+        }
+    }
+    int up = low + 1;
+    if (x[low] == x[up]) {
+        return y[low];
+    }
+    return y[up] + (value - x[up]) * (y[low] - y[up]) / (x[low] - x[up]);
+}
+
+double ggh_theory_weights::nnlops(int njets, double pt) {
+    int index = std::max(0, std::min(njets, 3));
+    return graphs[index].eval(std::min(pt, max_pt[index]));
+}
+
+// Identical to qcd_ggF_uncert_2017(njets, pt, stxs).
+ggh_theory_weights::uncertainties ggh_theory_weights::wg1_2017(int njets, double pt, int stxs) {
+    // BLPTW jet bin uncertainties, normalized to the NNLOPS cross section per
+    // jet bin and scaled to sigma(N3LO)
+    static const double sig[3] = {30.117, 12.928, 5.475 - 0.630};
+    static const double yield_unc[3] = {1.12, 0.66, 0.42};
+    static const double res_unc[3] = {0.03, 0.57, 0.42};
+    static const double cut01_unc[3] = {-1.22, 1.00, 0.21};
+    static const double cut12_unc[3] = {0, -0.86, 0.86};
+
+    uncertainties result;
+    int jet_bin = njets > 1 ? 2 : njets;
+    double norm = 48.52 / 47.4 / sig[jet_bin];
+    result[0] = yield_unc[jet_bin] * norm;
+    result[1] = res_unc[jet_bin] * norm;
+    result[2] = cut01_unc[jet_bin] * norm;
+    result[3] = cut12_unc[jet_bin] * norm;
+
+    // VBF topology
+    result[4] = (stxs == 101 || stxs == 102) ? 0.200 : 0.;
+    result[5] = stxs == 101 ? -0.320 : (stxs == 102 ? 0.235 : 0.);
+    if (result[5] != 0.) {
+        result[0] = result[1] = result[2] = result[3] = 0.;
+    }
+
+    // pT migrations and top mass
+    if (njets == 0) {
+        result[6] = 0.;
+    } else if (njets == 1) {
+        result[6] = interpol(pt, 20, -0.1, 100, 0.1);
+    } else {
+        result[6] = interpol(pt, 0, -0.1, 180, 0.10);
+    }
+    result[7] = njets == 0 ? 0. : interpol(pt, 90, -0.016, 160, 0.14);
+    result[8] = interpol(pt, 160, 0.0, 500, 0.37);
+    return result;
+}
+
+// index of the source in "ggH_RivetN_Up/Down", -1 if syst isn't one
+int ggh_theory_weights::source(std::string syst) {
+    auto pos = syst.find("ggH_Rivet");
+    if (pos == std::string::npos || pos + 9 >= syst.size()) {
+        return -1;
+    }
+    int index = syst.at(pos + 9) - '0';
+    return (index >= 0 && index < n_sources) ? index : -1;
+}
+
+std::string ggh_theory_weights::variation(int source, bool up) {
+    return "ggH_Rivet" + std::to_string(source) + (up ? "_Up" : "_Down");
+}
+
+// weight for the systematic being run, 1 for anything but ggH_Rivet
+double ggh_theory_weights::weight(const uncertainties &uncs, std::string syst) {
+    int index = source(syst);
+    if (index < 0) {
+        return 1.;
+    }
+    return syst.find("Down") != std::string::npos ? 1. - uncs[index] : 1. + uncs[index];
+}
+
+// Book one weight branch per variation so all of them are available from the
+// nominal pass.
+template <class Tree>
+void ggh_theory_weights::book(Tree *st) {
+    for (int i = 0; i < n_sources; i++) {
+        branches[2 * i] = st->add_weight_branch(variation(i, true));
+        branches[2 * i + 1] = st->add_weight_branch(variation(i, false));
+    }
+}
+
+void ggh_theory_weights::fill(const uncertainties &uncs) {
+    if (branches[0] == nullptr) {
+        return;
+    }
+    for (int i = 0; i < n_sources; i++) {
+        *branches[2 * i] = 1. + uncs[i];
+        *branches[2 * i + 1] = 1. - uncs[i];
+    }
+}
+
+#endif  // INCLUDE_GGH_THEORY_WEIGHTS_H_
@@ -35,9 +35,12 @@ class event_factory {
     ULong64_t getEvt() { return evt; }
     UInt_t getRun() { return run; }
     UInt_t getLumi() { return lumi; }
+    // branches filling getRun, getLumi and getEvt
+    std::vector<std::string> getIdBranches() { return {"run", "lumis", "event"}; }
     Float_t getGenWeight() { return genWeight; }
     Float_t getMSV() { return m_sv; }
     Float_t getPtSV() { return pt_sv; }
+    ULong64_t getTriggerMask() { return HLTEleMuX; }
     Bool_t fire_trigger(trigger t) { return (HLTEleMuX >> t & 1); }
     Bool_t getPassFlags(Bool_t) { return true; }  // TODO(tyler): implement
     Float_t getPrefiringWeight() { return 1.; }  // TODO(tyler): implement
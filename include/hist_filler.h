@@ -0,0 +1,267 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_HIST_FILLER_H_
+#define INCLUDE_HIST_FILLER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "TBranch.h"
+#include "TH1F.h"
+#include "TH2F.h"
+#include "TLeaf.h"
+#include "TTree.h"
+
+// Building blocks for filling many histograms from the slim trees outside
+// of python: an axis that finds bins the way TAxis does, bin sums (1D and 2D)
+// that can be filled from one thread each and added together afterwards, and
+// a reader that loads a block of entries of the needed branches into columns.
+
+// Fixed-width (TH1F(name, title, n, low, high)) or variable-width binning.
+class hist_axis {
+ public:
+    hist_axis(int n, double low, double high) : nbins(n), xmin(low), xmax(high), uniform(true) {}
+    explicit hist_axis(std::vector<double> bin_edges)
+        : nbins(bin_edges.size() - 1), xmin(bin_edges.front()), xmax(bin_edges.back()), uniform(false), edges(bin_edges) {}
+
+    int getNbins() const { return nbins; }
+    double getMin() const { return xmin; }
+    double getMax() const { return xmax; }
+    bool isUniform() const { return uniform; }
+    const std::vector<double> &getEdges() const { return edges; }
+
+    // bin edges, also for fixed-width binning
+    std::vector<double> binEdges() const {
+        if (!uniform) {
+            return edges;
+        }
+        std::vector<double> computed;
+        for (int i = 0; i <= nbins; i++) {
+            computed.push_back(xmin + i * (xmax - xmin) / nbins);
+        }
+        return computed;
+    }
+
+    // same bin as TAxis::FindFixBin: 0 is underflow, nbins + 1 overflow (NaN too)
+    int find(double x) const {
+        if (x < xmin) {
+            return 0;
+        } else if (!(x < xmax)) {
+            return nbins + 1;
+        } else if (uniform) {
+            return 1 + static_cast<int>(nbins * (x - xmin) / (xmax - xmin));
+        }
+        return std::upper_bound(edges.begin(), edges.end(), x) - edges.begin();
+    }
+
+    TH1F *book(std::string name) const {
+        if (uniform) {
+            return new TH1F(name.c_str(), name.c_str(), nbins, xmin, xmax);
+        }
+        return new TH1F(name.c_str(), name.c_str(), nbins, edges.data());
+    }
+
+ private:
+    int nbins;
+    double xmin, xmax;
+    bool uniform;
+    std::vector<double> edges;
+};
+
+// Contents, squared weights and the statistics TH1::Fill keeps (sum of w,
+// w^2, w*x, w*x^2 over the in-range bins and the number of fills).
+class bin_sums {
+ public:
+    explicit bin_sums(int nbins) : sumw(nbins + 2, 0.), sumw2(nbins + 2, 0.), stats{0., 0., 0., 0.}, entries(0), weighted(false) {}
+
+    void fill(int bin, double x, double w) {
+        entries++;
+        sumw[bin] += w;
+        sumw2[bin] += w * w;
+        weighted |= w != 1.;
+        if (bin > 0 && bin < static_cast<int>(sumw.size()) - 1) {
+            stats[0] += w;
+            stats[1] += w * w;
+            stats[2] += w * x;
+            stats[3] += w * x * x;
+        }
+    }
+
+    void add(const bin_sums &other) {
+        for (size_t i = 0; i < sumw.size(); i++) {
+            sumw[i] += other.sumw[i];
+            sumw2[i] += other.sumw2[i];
+        }
+        for (int i = 0; i < 4; i++) {
+            stats[i] += other.stats[i];
+        }
+        entries += other.entries;
+        weighted |= other.weighted;
+    }
+
+    // The histogram TH1F::Fill would have produced. A weight other than one
+    // turns on Sumw2, as it does in TH1::Fill.
+    TH1F *make(std::string name, const hist_axis &axis) const {
+        auto hist = axis.book(name);
+        if (weighted) {
+            hist->Sumw2();
+        }
+        for (size_t i = 0; i < sumw.size(); i++) {
+            hist->SetBinContent(i, sumw[i]);
+            if (weighted) {
+                hist->SetBinError(i, std::sqrt(sumw2[i]));
+            }
+        }
+        double put[4] = {stats[0], stats[1], stats[2], stats[3]};
+        hist->PutStats(put);
+        hist->SetEntries(entries);
+        return hist;
+    }
+
+ private:
+    std::vector<double> sumw, sumw2;
+    double stats[4];
+    Long64_t entries;
+    bool weighted;
+};
+
+// The same for TH2F::Fill. Bins are numbered like TH2 global bins and the
+// statistics are the seven of TH2 (w, w^2, w*x, w*x^2, w*y, w*y^2, w*x*y).
+class bin_sums_2d {
+ public:
+    bin_sums_2d(int _nx, int _ny)
+        : nx(_nx), ny(_ny), sumw((nx + 2) * (ny + 2), 0.), sumw2((nx + 2) * (ny + 2), 0.), stats{0., 0., 0., 0., 0., 0., 0.}, entries(0),
+          weighted(false) {}
+
+    void fill(int xbin, int ybin, double x, double y, double w) {
+        entries++;
+        int bin = xbin + (nx + 2) * ybin;
+        sumw[bin] += w;
+        sumw2[bin] += w * w;
+        weighted |= w != 1.;
+        if (xbin > 0 && xbin <= nx && ybin > 0 && ybin <= ny) {
+            stats[0] += w;
+            stats[1] += w * w;
+            stats[2] += w * x;
+            stats[3] += w * x * x;
+            stats[4] += w * y;
+            stats[5] += w * y * y;
+            stats[6] += w * x * y;
+        }
+    }
+
+    void add(const bin_sums_2d &other) {
+        for (size_t i = 0; i < sumw.size(); i++) {
+            sumw[i] += other.sumw[i];
+            sumw2[i] += other.sumw2[i];
+        }
+        for (int i = 0; i < 7; i++) {
+            stats[i] += other.stats[i];
+        }
+        entries += other.entries;
+        weighted |= other.weighted;
+    }
+
+    TH2F *make(std::string name, const hist_axis &xaxis, const hist_axis &yaxis) const {
+        TH2F *hist;
+        if (xaxis.isUniform() && yaxis.isUniform()) {
+            hist = new TH2F(name.c_str(), name.c_str(), nx, xaxis.getMin(), xaxis.getMax(), ny, yaxis.getMin(), yaxis.getMax());
+        } else {
+            auto xedges = xaxis.binEdges();
+            auto yedges = yaxis.binEdges();
+            hist = new TH2F(name.c_str(), name.c_str(), nx, xedges.data(), ny, yedges.data());
+        }
+        if (weighted) {
+            hist->Sumw2();
+        }
+        for (size_t i = 0; i < sumw.size(); i++) {
+            hist->SetBinContent(i, sumw[i]);
+            if (weighted) {
+                hist->SetBinError(i, std::sqrt(sumw2[i]));
+            }
+        }
+        double put[7] = {stats[0], stats[1], stats[2], stats[3], stats[4], stats[5], stats[6]};
+        hist->PutStats(put);
+        hist->SetEntries(entries);
+        return hist;
+    }
+
+ private:
+    int nx, ny;
+    std::vector<double> sumw, sumw2;
+    double stats[7];
+    Long64_t entries;
+    bool weighted;
+};
+
+// Split a tree into [first, last) entry ranges on cluster boundaries, with
+// small clusters grouped so each range is worth a column read.
+std::vector<std::pair<Long64_t, Long64_t>> cluster_chunks(TTree *tree, Long64_t min_entries = 10000) {
+    std::vector<std::pair<Long64_t, Long64_t>> chunks;
+    auto entries = tree->GetEntries();
+    auto clusters = tree->GetClusterIterator(0);
+    for (Long64_t first = clusters.Next(); first < entries; first = clusters.Next()) {
+        if (!chunks.empty() && chunks.back().second - chunks.back().first < min_entries) {
+            chunks.back().second = std::min(clusters.GetNextEntry(), entries);
+        } else {
+            chunks.push_back(std::make_pair(first, std::min(clusters.GetNextEntry(), entries)));
+        }
+    }
+    return chunks;
+}
+
+// Columns of doubles for a block of entries. Each branch is read on its own
+// over the whole block, whatever its type (TLeaf::GetValue converts).
+// Branches missing from the tree are reported and have index -1.
+class column_block {
+ public:
+    column_block(TTree *, const std::vector<std::string> &);
+
+    int index(std::string) const;
+    Long64_t read(Long64_t, Long64_t);
+    const std::vector<double> &operator[](int i) const { return columns.at(i); }
+
+ private:
+    std::vector<std::string> names;
+    std::vector<TLeaf *> leaves;
+    std::vector<std::vector<double>> columns;
+};
+
+column_block::column_block(TTree *tree, const std::vector<std::string> &branch_names) {
+    for (auto &name : branch_names) {
+        auto leaf = tree->GetLeaf(name.c_str());
+        if (leaf == nullptr) {
+            std::cerr << "column_block: no branch " << name << " in " << tree->GetName() << std::endl;
+            continue;
+        }
+        names.push_back(name);
+        leaves.push_back(leaf);
+        tree->AddBranchToCache(leaf->GetBranch());
+    }
+    tree->StopCacheLearningPhase();
+    columns.resize(leaves.size());
+}
+
+int column_block::index(std::string name) const {
+    auto found = std::find(names.begin(), names.end(), name);
+    return found == names.end() ? -1 : found - names.begin();
+}
+
+// read entries [first, last), returns the number read
+Long64_t column_block::read(Long64_t first, Long64_t last) {
+    for (size_t i = 0; i < leaves.size(); i++) {
+        auto branch = leaves.at(i)->GetBranch();
+        auto &column = columns.at(i);
+        column.resize(last - first);
+        for (Long64_t entry = first; entry < last; entry++) {
+            branch->GetEntry(entry);
+            column[entry - first] = leaves.at(i)->GetValue();
+        }
+    }
+    return last - first;
+}
+
+#endif  // INCLUDE_HIST_FILLER_H_
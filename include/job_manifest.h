@@ -0,0 +1,207 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_JOB_MANIFEST_H_
+#define INCLUDE_JOB_MANIFEST_H_
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "./json_reader.h"
+
+// Run many analyzer jobs from one process.
+//
+// "--manifest jobs.txt" lists one job per line with the options that differ
+// between jobs (i.e. "-s DYJets1 -n ZTT -u JetJER_Up"). The other options of
+// the command line are used by every job. A json manifest is a list of
+// objects with "sample", "name", "syst", "output", and optionally "path",
+// "stype", "shard" and "args" (any other options).
+//
+// Inputs used by many jobs are kept by shared_resources.h. "--workers N"
+// forks N processes that take jobs from a pipe until it is empty. Processes
+// are used instead of threads because the workspaces are not safe to
+// evaluate from several threads and the analyzers rely on the current ROOT
+// directory. Each worker still reads the shared inputs only once.
+class job_manifest {
+ public:
+    job_manifest(int, char **);
+
+    bool isActive() { return !manifest_name.empty(); }
+    bool isGood() { return good; }
+    size_t size() { return jobs.size(); }
+
+    // run every job with the analyzer, returns the number of failed jobs
+    int run(std::function<int(int, char **)>);
+
+ private:
+    bool read_text();
+    bool read_json();
+    int run_job(size_t, std::function<int(int, char **)>);
+    int run_workers(std::function<int(int, char **)>);
+
+    bool good;
+    int nworkers;
+    std::string manifest_name;
+    std::vector<std::string> common;             // options shared by all jobs
+    std::vector<std::vector<std::string>> jobs;  // options of each job
+};
+
+job_manifest::job_manifest(int argc, char **argv) : good(true), nworkers(1) {
+    for (int i = 0; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "--manifest" || arg == "--workers") && i + 1 < argc) {
+            if (arg == "--manifest") {
+                manifest_name = argv[i + 1];
+            } else {
+                nworkers = std::max(std::stoi(argv[i + 1]), 1);
+            }
+            i++;
+        } else {
+            common.push_back(arg);
+        }
+    }
+    if (isActive()) {
+        auto json = manifest_name.size() > 5 && manifest_name.substr(manifest_name.size() - 5) == ".json";
+        good = json ? read_json() : read_text();
+    }
+}
+
+bool job_manifest::read_text() {
+    std::ifstream input(manifest_name);
+    if (!input.good()) {
+        std::cerr << "Unable to open manifest " << manifest_name << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(input, line)) {
+        line = line.substr(0, line.find('#'));
+        std::stringstream words(line);
+        std::vector<std::string> job;
+        std::string word;
+        while (words >> word) {
+            job.push_back(word);
+        }
+        if (!job.empty()) {
+            jobs.push_back(job);
+        }
+    }
+    return true;
+}
+
+bool job_manifest::read_json() {
+    json_reader reader;
+    auto entries = reader.parseFile(manifest_name);
+    if (!reader.ok() || !entries.isArray()) {
+        std::cerr << "Manifest " << manifest_name << " must be a list of jobs" << std::endl;
+        return false;
+    }
+    static const std::vector<std::pair<std::string, std::string>> keys = {
+        {"sample", "-s"}, {"name", "-n"}, {"syst", "-u"}, {"output", "-d"}, {"path", "-p"}, {"stype", "--stype"}, {"shard", "--shard"}};
+    for (auto &entry : entries.getElements()) {
+        std::vector<std::string> job;
+        for (auto &key : keys) {
+            if (!entry.get(key.first).asString().empty()) {
+                job.push_back(key.second);
+                job.push_back(entry.get(key.first).asString());
+            }
+        }
+        std::stringstream words(entry.get("args").asString());
+        std::string word;
+        while (words >> word) {
+            job.push_back(word);
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// CLParser takes the first occurrence of an option, so the job's own options go first
+int job_manifest::run_job(size_t index, std::function<int(int, char **)> analyze) {
+    std::vector<std::string> args = {common.front()};
+    args.insert(args.end(), jobs.at(index).begin(), jobs.at(index).end());
+    args.insert(args.end(), common.begin() + 1, common.end());
+
+    std::vector<char *> argv;
+    std::string command;
+    for (auto &arg : args) {
+        argv.push_back(&arg[0]);
+        command += (command.empty() ? "" : " ") + arg;
+    }
+    argv.push_back(nullptr);
+    int argc = args.size();
+
+    auto code = analyze(argc, argv.data());
+    if (code == 0) {
+        std::cout << "[SUCCESS] " << command << " completed successfully" << std::endl;
+    } else {
+        std::cout << "[ERROR] returned non-zero exit code while running " << command << std::endl;
+    }
+    return code;
+}
+
+int job_manifest::run_workers(std::function<int(int, char **)> analyze) {
+    int jobs_pipe[2];
+    if (pipe(jobs_pipe) != 0) {
+        std::cerr << "Unable to create the job pipe, running the manifest in one process" << std::endl;
+        nworkers = 1;
+        return run(analyze);
+    }
+
+    std::cout.flush();
+    std::vector<pid_t> workers;
+    for (int i = 0; i < std::min(nworkers, static_cast<int>(jobs.size())); i++) {
+        auto pid = fork();
+        if (pid == 0) {
+            // jobs are read one index at a time, writes this small are atomic
+            close(jobs_pipe[1]);
+            int failed(0);
+            int index;
+            while (read(jobs_pipe[0], &index, sizeof(index)) == sizeof(index)) {
+                failed += run_job(index, analyze) != 0;
+            }
+            std::cout.flush();
+            _exit(std::min(failed, 255));
+        } else if (pid > 0) {
+            workers.push_back(pid);
+        }
+    }
+    close(jobs_pipe[0]);
+    if (workers.empty()) {
+        std::cerr << "Unable to start the workers, running the manifest in one process" << std::endl;
+        close(jobs_pipe[1]);
+        nworkers = 1;
+        return run(analyze);
+    }
+    for (int index = 0; index < static_cast<int>(jobs.size()); index++) {
+        if (write(jobs_pipe[1], &index, sizeof(index)) != sizeof(index)) {
+            std::cerr << "Unable to hand out job " << index << std::endl;
+        }
+    }
+    close(jobs_pipe[1]);
+
+    int failed(0);
+    for (auto pid : workers) {
+        int status;
+        waitpid(pid, &status, 0);
+        failed += WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+    }
+    return failed;
+}
+
+int job_manifest::run(std::function<int(int, char **)> analyze) {
+    if (nworkers > 1 && jobs.size() > 1) {
+        return run_workers(analyze);
+    }
+    int failed(0);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        failed += run_job(i, analyze) != 0;
+    }
+    return failed;
+}
+
+#endif  // INCLUDE_JOB_MANIFEST_H_
@@ -0,0 +1,291 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_JSON_READER_H_
+#define INCLUDE_JSON_READER_H_
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Minimal JSON value used to read the files in configs/. Objects keep the
+// order their keys appear in the file so that anything built from them
+// (branch lists, category lists, ...) matches what the python scripts see.
+class json_value {
+ public:
+    enum json_type { null_type, bool_type, number_type, string_type, array_type, object_type };
+
+    json_value() : type(null_type), boolean(false), number(0.) {}
+
+    bool isNull() const { return type == null_type; }
+    bool isBool() const { return type == bool_type; }
+    bool isNumber() const { return type == number_type; }
+    bool isString() const { return type == string_type; }
+    bool isArray() const { return type == array_type; }
+    bool isObject() const { return type == object_type; }
+
+    bool asBool() const { return boolean; }
+    double asDouble() const { return number; }
+    int asInt() const { return static_cast<int>(number); }
+    std::string asString() const { return str; }
+
+    // array and object access
+    size_t size() const { return type == object_type ? members.size() : elements.size(); }
+    const json_value &at(size_t i) const { return elements.at(i); }
+    const std::vector<json_value> &getElements() const { return elements; }
+    const std::vector<std::pair<std::string, json_value>> &getMembers() const { return members; }
+    bool has(const std::string &) const;
+    const json_value &get(const std::string &) const;
+
+    std::vector<std::string> asStringVector() const;
+    std::vector<double> asDoubleVector() const;
+
+    json_type type;
+    bool boolean;
+    double number;
+    std::string str;
+    std::vector<json_value> elements;
+    std::vector<std::pair<std::string, json_value>> members;
+};
+
+bool json_value::has(const std::string &key) const {
+    for (auto &member : members) {
+        if (member.first == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const json_value &json_value::get(const std::string &key) const {
+    static const json_value null_value;
+    for (auto &member : members) {
+        if (member.first == key) {
+            return member.second;
+        }
+    }
+    return null_value;
+}
+
+std::vector<std::string> json_value::asStringVector() const {
+    std::vector<std::string> values;
+    for (auto &element : elements) {
+        values.push_back(element.asString());
+    }
+    return values;
+}
+
+std::vector<double> json_value::asDoubleVector() const {
+    std::vector<double> values;
+    for (auto &element : elements) {
+        values.push_back(element.asDouble());
+    }
+    return values;
+}
+
+// Recursive-descent parser. Errors are reported to std::cerr and leave
+// ok() false so callers can decide whether to bail.
+class json_reader {
+ public:
+    json_reader() : pos(0), good(true) {}
+    json_value parse(const std::string &);
+    json_value parseFile(const std::string &);
+    bool ok() const { return good; }
+
+ private:
+    void skip();
+    bool expect(char);
+    void fail(const std::string &);
+    json_value parseValue();
+    json_value parseObject();
+    json_value parseArray();
+    json_value parseNumber();
+    std::string parseString();
+
+    std::string text;
+    size_t pos;
+    bool good;
+};
+
+json_value json_reader::parseFile(const std::string &filename) {
+    std::ifstream infile(filename);
+    if (!infile.good()) {
+        std::cerr << "Unable to open JSON file " << filename << std::endl;
+        good = false;
+        return json_value();
+    }
+    std::stringstream buffer;
+    buffer << infile.rdbuf();
+    auto value = parse(buffer.str());
+    if (!good) {
+        std::cerr << "\twhile reading " << filename << std::endl;
+    }
+    return value;
+}
+
+json_value json_reader::parse(const std::string &input) {
+    text = input;
+    pos = 0;
+    good = true;
+    auto value = parseValue();
+    skip();
+    if (good && pos != text.size()) {
+        fail("trailing characters");
+    }
+    return value;
+}
+
+void json_reader::skip() {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\n' || text[pos] == '\t' || text[pos] == '\r')) {
+        pos++;
+    }
+}
+
+bool json_reader::expect(char c) {
+    skip();
+    if (pos < text.size() && text[pos] == c) {
+        pos++;
+        return true;
+    }
+    fail(std::string("expected '") + c + "'");
+    return false;
+}
+
+void json_reader::fail(const std::string &msg) {
+    if (good) {
+        std::cerr << "JSON parse error at character " << pos << ": " << msg << std::endl;
+    }
+    good = false;
+    pos = text.size();
+}
+
+json_value json_reader::parseValue() {
+    skip();
+    json_value value;
+    if (pos >= text.size()) {
+        fail("unexpected end of input");
+        return value;
+    }
+
+    auto c = text[pos];
+    if (c == '{') {
+        return parseObject();
+    } else if (c == '[') {
+        return parseArray();
+    } else if (c == '"') {
+        value.type = json_value::string_type;
+        value.str = parseString();
+    } else if (text.compare(pos, 4, "true") == 0) {
+        value.type = json_value::bool_type;
+        value.boolean = true;
+        pos += 4;
+    } else if (text.compare(pos, 5, "false") == 0) {
+        value.type = json_value::bool_type;
+        pos += 5;
+    } else if (text.compare(pos, 4, "null") == 0) {
+        pos += 4;
+    } else {
+        return parseNumber();
+    }
+    return value;
+}
+
+json_value json_reader::parseObject() {
+    json_value value;
+    value.type = json_value::object_type;
+    expect('{');
+    skip();
+    if (pos < text.size() && text[pos] == '}') {
+        pos++;
+        return value;
+    }
+    while (good) {
+        skip();
+        auto key = parseString();
+        if (!expect(':')) {
+            break;
+        }
+        value.members.push_back(std::make_pair(key, parseValue()));
+        skip();
+        if (pos < text.size() && text[pos] == ',') {
+            pos++;
+        } else {
+            expect('}');
+            break;
+        }
+    }
+    return value;
+}
+
+json_value json_reader::parseArray() {
+    json_value value;
+    value.type = json_value::array_type;
+    expect('[');
+    skip();
+    if (pos < text.size() && text[pos] == ']') {
+        pos++;
+        return value;
+    }
+    while (good) {
+        value.elements.push_back(parseValue());
+        skip();
+        if (pos < text.size() && text[pos] == ',') {
+            pos++;
+        } else {
+            expect(']');
+            break;
+        }
+    }
+    return value;
+}
+
+json_value json_reader::parseNumber() {
+    json_value value;
+    value.type = json_value::number_type;
+    const char *start = text.c_str() + pos;
+    char *end = nullptr;
+    value.number = std::strtod(start, &end);
+    if (end == start) {
+        fail("invalid value");
+        return json_value();
+    }
+    pos += end - start;
+    return value;
+}
+
+std::string json_reader::parseString() {
+    std::string value;
+    if (pos >= text.size() || text[pos] != '"') {
+        fail("expected string");
+        return value;
+    }
+    pos++;
+    while (pos < text.size() && text[pos] != '"') {
+        if (text[pos] == '\\' && pos + 1 < text.size()) {
+            pos++;
+            switch (text[pos]) {
+                case 'n': value += '\n'; break;
+                case 't': value += '\t'; break;
+                case 'r': value += '\r'; break;
+                case 'b': value += '\b'; break;
+                case 'f': value += '\f'; break;
+                case 'u': value += '?'; pos += 4; break;  // configs are plain ASCII
+                default: value += text[pos];
+            }
+        } else {
+            value += text[pos];
+        }
+        pos++;
+    }
+    if (pos >= text.size()) {
+        fail("unterminated string");
+        return value;
+    }
+    pos++;
+    return value;
+}
+
+#endif  // INCLUDE_JSON_READER_H_
@@ -0,0 +1,186 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_NN_INFERENCE_H_
+#define INCLUDE_NN_INFERENCE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "./json_reader.h"
+
+// Inference for the dense networks trained in neural-network/train.py,
+// without Keras or any other dependency.
+//
+// The model file (Output/models/<model>.json, written by train.py) holds the
+// names of the inputs, the StandardScaler mean and scale used in training and
+// for every layer the kernel (inputs x outputs), the bias and the activation.
+// Inputs are cleaned (NaN and inf become -100) and scaled exactly like
+// classify.py does before the first layer.
+//
+// Each layer is a matrix-vector product done four outputs at a time with the
+// GCC/clang vector extension: the kernel is stored input-major with the
+// outputs padded to a multiple of four, so every input adds one broadcast
+// multiply per block of outputs. The padding has zero weights and is never
+// read by the next layer. Buffers are reused between events, so one network
+// must not be shared between threads.
+class dense_network {
+ public:
+    explicit dense_network(std::string);
+
+    bool isGood() { return good; }
+    const std::vector<std::string> &getInputs() { return inputs; }
+
+    // discriminant (first output) for the raw input values, in the order of getInputs()
+    float evaluate(const double *);
+
+ private:
+    typedef float block __attribute__((vector_size(16)));
+
+    struct layer {
+        int nin, nout, nblocks;
+        std::string activation;
+        std::vector<block> kernel;  // nin x nblocks
+        std::vector<block> bias;
+    };
+
+    bool read_layer(const json_value &, int);
+    static void forward(const layer &, const float *, block *);
+    static void activate(const layer &, float *);
+
+    bool good;
+    std::vector<std::string> inputs;
+    std::vector<double> mean, scale;
+    std::vector<layer> layers;
+    std::vector<block> in_buffer, out_buffer;
+};
+
+dense_network::dense_network(std::string filename) : good(false) {
+    json_reader reader;
+    auto model = reader.parseFile(filename);
+    if (!reader.ok() || !model.has("inputs") || !model.has("layers")) {
+        std::cerr << "dense_network: unable to read model from " << filename << std::endl;
+        return;
+    }
+    inputs = model.get("inputs").asStringVector();
+    mean = model.get("mean").asDoubleVector();
+    scale = model.get("scale").asDoubleVector();
+    if (inputs.empty() || mean.size() != inputs.size() || scale.size() != inputs.size()) {
+        std::cerr << "dense_network: " << filename << " needs a mean and scale for each of its " << inputs.size() << " inputs" << std::endl;
+        return;
+    }
+
+    int nin = inputs.size();
+    size_t max_blocks = (nin + 3) / 4;
+    for (auto &config : model.get("layers").getElements()) {
+        if (!read_layer(config, nin)) {
+            std::cerr << "dense_network: layer " << layers.size() << " of " << filename << " is malformed" << std::endl;
+            return;
+        }
+        nin = layers.back().nout;
+        max_blocks = std::max(max_blocks, static_cast<size_t>(layers.back().nblocks));
+    }
+    if (layers.empty()) {
+        std::cerr << "dense_network: " << filename << " has no layers" << std::endl;
+        return;
+    }
+    in_buffer.resize(max_blocks);
+    out_buffer.resize(max_blocks);
+    good = true;
+}
+
+bool dense_network::read_layer(const json_value &config, int nin) {
+    auto &weights = config.get("weights");
+    auto bias = config.get("bias").asDoubleVector();
+    layer next;
+    next.nin = nin;
+    next.nout = bias.size();
+    next.nblocks = (next.nout + 3) / 4;
+    next.activation = config.get("activation").asString();
+    if (next.nout == 0 || static_cast<int>(weights.size()) != nin) {
+        return false;
+    }
+    if (next.activation != "relu" && next.activation != "sigmoid" && next.activation != "tanh" && next.activation != "linear" &&
+        next.activation != "softmax") {
+        std::cerr << "dense_network: unknown activation " << next.activation << std::endl;
+        return false;
+    }
+
+    next.kernel.assign(nin * next.nblocks, block{0., 0., 0., 0.});
+    next.bias.assign(next.nblocks, block{0., 0., 0., 0.});
+    for (int i = 0; i < nin; i++) {
+        auto row = weights.at(i).asDoubleVector();
+        if (static_cast<int>(row.size()) != next.nout) {
+            return false;
+        }
+        for (int j = 0; j < next.nout; j++) {
+            next.kernel[i * next.nblocks + j / 4][j % 4] = row[j];
+        }
+    }
+    for (int j = 0; j < next.nout; j++) {
+        next.bias[j / 4][j % 4] = bias[j];
+    }
+    layers.push_back(next);
+    return true;
+}
+
+// out = bias + input x kernel, four outputs per block
+void dense_network::forward(const layer &lay, const float *in, block *out) {
+    for (int b = 0; b < lay.nblocks; b++) {
+        out[b] = lay.bias[b];
+    }
+    const block *row = lay.kernel.data();
+    for (int i = 0; i < lay.nin; i++, row += lay.nblocks) {
+        block x = {in[i], in[i], in[i], in[i]};
+        for (int b = 0; b < lay.nblocks; b++) {
+            out[b] += x * row[b];
+        }
+    }
+}
+
+void dense_network::activate(const layer &lay, float *values) {
+    if (lay.activation == "relu") {
+        for (int j = 0; j < lay.nout; j++) {
+            values[j] = values[j] > 0 ? values[j] : 0;
+        }
+    } else if (lay.activation == "sigmoid") {
+        for (int j = 0; j < lay.nout; j++) {
+            values[j] = 1. / (1. + std::exp(-values[j]));
+        }
+    } else if (lay.activation == "tanh") {
+        for (int j = 0; j < lay.nout; j++) {
+            values[j] = std::tanh(values[j]);
+        }
+    } else if (lay.activation == "softmax") {
+        float max = values[0], sum = 0;
+        for (int j = 1; j < lay.nout; j++) {
+            max = std::max(max, values[j]);
+        }
+        for (int j = 0; j < lay.nout; j++) {
+            values[j] = std::exp(values[j] - max);
+            sum += values[j];
+        }
+        for (int j = 0; j < lay.nout; j++) {
+            values[j] /= sum;
+        }
+    }
+}
+
+float dense_network::evaluate(const double *raw) {
+    auto in = reinterpret_cast<float *>(in_buffer.data());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        double value = std::isfinite(raw[i]) ? raw[i] : -100.;
+        in[i] = (value - mean[i]) / scale[i];
+    }
+    for (auto &lay : layers) {
+        forward(lay, in, out_buffer.data());
+        auto out = reinterpret_cast<float *>(out_buffer.data());
+        activate(lay, out);
+        in_buffer.swap(out_buffer);
+        in = reinterpret_cast<float *>(in_buffer.data());
+    }
+    return in[0];
+}
+
+#endif  // INCLUDE_NN_INFERENCE_H_
@@ -0,0 +1,86 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_OUTPUT_MERGER_H_
+#define INCLUDE_OUTPUT_MERGER_H_
+
+#include <memory>
+#include <string>
+#include "RVersion.h"
+#include "ROOT/TBufferMerger.hxx"
+#include "TClass.h"
+#include "TDirectory.h"
+#include "TFile.h"
+#include "TKey.h"
+#include "TList.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 26, 0)
+namespace buffer_merger = ROOT;
+#else
+namespace buffer_merger = ROOT::Experimental;
+#endif
+
+// Merges the output of several producers running in one process straight
+// into the final file.
+//
+// Every producer asks for its own in-memory file with get_file() and fills
+// it like a normal TFile. Calling Write() on that file hands its buffer to
+// the merger, which appends the contents to the output file from a
+// background thread: trees are concatenated and histograms are added, the
+// same as hadd, but without an intermediate file per producer. Call
+// ROOT::EnableThreadSafety() before using it from several threads.
+//
+// Only fast_merge --buffered uses it, with one producer thread per input
+// file. The analyzers still write one file per job: job_manifest.h runs
+// its workers as separate processes, which a TBufferMerger can't collect.
+class output_merger {
+ public:
+    explicit output_merger(std::string filename, int compression = 101)
+        : name(filename), merger(filename.c_str(), "RECREATE", compression) {}
+
+    std::shared_ptr<TFile> get_file() { return merger.GetFile(); }
+    void set_autosave(size_t bytes) { merger.SetAutoSave(bytes); }
+    size_t getQueueSize() { return merger.GetQueueSize(); }
+    std::string getName() { return name; }
+
+    static void copy_directory(TDirectory *, TDirectory *);
+
+ private:
+    std::string name;
+    buffer_merger::TBufferMerger merger;
+};
+
+// Copy every object of "input" into "output", recursing into directories.
+// Trees are cloned with their baskets ("fast"), everything else is read and
+// written as is. Only the highest cycle of each key is copied.
+void output_merger::copy_directory(TDirectory *input, TDirectory *output) {
+    TIter next(input->GetListOfKeys());
+    std::string last_name;
+    while (auto key = reinterpret_cast<TKey *>(next())) {
+        std::string key_name = key->GetName();
+        if (key_name == last_name) {
+            continue;  // keys are sorted by cycle, newest first
+        }
+        last_name = key_name;
+
+        auto cls = TClass::GetClass(key->GetClassName());
+        if (cls == nullptr) {
+            continue;
+        } else if (cls->InheritsFrom("TDirectory")) {
+            auto subdir = output->GetDirectory(key_name.c_str());
+            if (subdir == nullptr) {
+                subdir = output->mkdir(key_name.c_str());
+            }
+            copy_directory(input->GetDirectory(key_name.c_str()), subdir);
+        } else if (cls->InheritsFrom("TTree")) {
+            auto tree = reinterpret_cast<TTree *>(key->ReadObj());
+            output->cd();
+            tree->CloneTree(-1, "fast");
+        } else {
+            output->WriteTObject(key->ReadObj(), key_name.c_str());
+        }
+    }
+}
+
+#endif  // INCLUDE_OUTPUT_MERGER_H_
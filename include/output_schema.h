@@ -0,0 +1,297 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_OUTPUT_SCHEMA_H_
+#define INCLUDE_OUTPUT_SCHEMA_H_
+
+#include <fnmatch.h>
+#include <cmath>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "TTree.h"
+#include "./json_reader.h"
+
+// output_schema decides which of the slim_tree variables become branches
+// and how precisely they are stored. The slim trees register every variable
+// they know how to fill, then book() creates branches for the subset chosen
+// by a schema from configs/output_schema.json. With no schema loaded, only
+// the variables registered as "legacy" are booked at full precision, which
+// reproduces the historical output.
+//
+// Supported precisions:
+//   - native: the type of the member (Float_t -> /F, Int_t -> /I, ...)
+//   - float:  32-bit float
+//   - half:   Float16_t (/f), float with the mantissa truncated to 12 bits
+//   - int:    32-bit integer, floats are rounded
+//   - int8:   Char_t (/B), meant for flags and small counters
+//
+// "ac_layout" decides how the AC weights are written. "columns" (default) is
+// one wt_* branch per hypothesis. "block" writes only the weights of the
+// hypothesis group of the event (VBF, ggH, WH or ZH) as ac_wt[ac_n] with
+// ac_group telling which one, at the "ac_weights" precision. "ratios" is a
+// block of the weights divided by wt_a1 of the group (stored in ac_a1),
+// always as Float16_t. scripts/utils/ac_block.py expands both back into
+// the wt_* columns.
+//
+// Branch names in a schema may be fnmatch patterns ("ff_*"). Variables
+// booked after the tree (the weights of the analyzer and NN_disc) go
+// through book_float() and are chosen the same way.
+class output_schema {
+ public:
+    output_schema() : loaded(false), checked(false), ac_precision("native"), ac_layout("columns"), block{nullptr, nullptr, nullptr, nullptr} {}
+    ~output_schema() {}
+
+    bool load(std::string, std::string);
+    void add_float(std::string, Float_t *, bool legacy = true, bool ac = false);
+    void add_int(std::string, Int_t *, bool legacy = true);
+    void add_uint(std::string, UInt_t *, bool legacy = true);
+    void add_ulong(std::string, ULong64_t *, bool legacy = true);
+    // group, size, wt_a1 and values of the AC weight block
+    void set_ac_block(Int_t *, Int_t *, Float_t *, Float_t *);
+    Float_t *find_float(std::string);
+    void book(TTree *);
+    // register and book a float once the tree is booked, returns false if the schema drops it
+    bool book_float(TTree *, std::string, Float_t *, bool legacy = true);
+    // book a registered column the schema drops at native precision
+    void require(TTree *, std::string);
+    void narrow();
+    bool isLoaded() { return loaded; }
+    std::string getName() { return schema_name; }
+    std::string getACLayout() { return ac_layout; }
+
+ private:
+    struct column {
+        std::string name;
+        char type;  // F, I, i, l
+        void *address;
+        bool legacy, ac, booked;
+    };
+    struct conversion {
+        size_t source;  // index of the column
+        char target;    // B or I
+        size_t index;
+    };
+
+    bool valid_precision(const std::string &);
+    std::string choose_precision(const column &);
+    void add(std::string, char, void *, bool, bool);
+    bool book_column(TTree *, size_t);
+    void check_selection();
+    double read(const column &);
+
+    struct ac_block {
+        Int_t *group, *size;
+        Float_t *first, *values;
+    };
+
+    bool loaded, checked;
+    std::string schema_name, default_precision, ac_precision, ac_layout;
+    ac_block block;
+    std::vector<std::pair<std::string, std::string>> selected;
+    std::vector<column> columns;
+    std::vector<conversion> conversions;
+    // deques so the addresses given to the tree stay valid as columns are added
+    std::deque<Char_t> int8_buffer;
+    std::deque<Int_t> int_buffer;
+};
+
+// Read the schema named "name" from the JSON file "filename". Returns false
+// if the file can't be read, the schema doesn't exist or contains an unknown
+// precision.
+bool output_schema::load(std::string filename, std::string name) {
+    json_reader reader;
+    auto config = reader.parseFile(filename);
+    if (!reader.ok()) {
+        return false;
+    }
+    if (!config.has(name)) {
+        std::cerr << "Schema " << name << " not found in " << filename << std::endl;
+        return false;
+    }
+
+    auto schema = config.get(name);
+    if (schema.get("default").isString()) {
+        default_precision = schema.get("default").asString();
+        if (!valid_precision(default_precision)) {
+            return false;
+        }
+    }
+
+    if (schema.get("ac_weights").isBool()) {
+        ac_precision = schema.get("ac_weights").asBool() ? "native" : "";
+    } else if (schema.get("ac_weights").isString()) {
+        ac_precision = schema.get("ac_weights").asString();
+        if (!valid_precision(ac_precision)) {
+            return false;
+        }
+    }
+
+    if (schema.get("ac_layout").isString()) {
+        ac_layout = schema.get("ac_layout").asString();
+        if (ac_layout != "columns" && ac_layout != "block" && ac_layout != "ratios") {
+            std::cerr << "Unknown AC weight layout: " << ac_layout << std::endl;
+            return false;
+        }
+    }
+    for (auto &branch : schema.get("branches").getMembers()) {
+        if (!valid_precision(branch.second.asString())) {
+            return false;
+        }
+        selected.push_back(std::make_pair(branch.first, branch.second.asString()));
+    }
+
+    schema_name = name;
+    loaded = true;
+    return true;
+}
+
+bool output_schema::valid_precision(const std::string &precision) {
+    if (precision == "native" || precision == "float" || precision == "half" || precision == "int" || precision == "int8") {
+        return true;
+    }
+    std::cerr << "Unknown branch precision: " << precision << std::endl;
+    return false;
+}
+
+void output_schema::add(std::string name, char type, void *address, bool legacy, bool ac) {
+    columns.push_back({name, type, address, legacy, ac, false});
+}
+
+void output_schema::add_float(std::string name, Float_t *address, bool legacy, bool ac) { add(name, 'F', address, legacy, ac); }
+void output_schema::add_int(std::string name, Int_t *address, bool legacy) { add(name, 'I', address, legacy, false); }
+void output_schema::add_uint(std::string name, UInt_t *address, bool legacy) { add(name, 'i', address, legacy, false); }
+void output_schema::add_ulong(std::string name, ULong64_t *address, bool legacy) { add(name, 'l', address, legacy, false); }
+
+void output_schema::set_ac_block(Int_t *group, Int_t *size, Float_t *first, Float_t *values) { block = {group, size, first, values}; }
+
+// address of a registered float variable, nullptr if there is none
+Float_t *output_schema::find_float(std::string name) {
+    for (auto &col : columns) {
+        if (col.name == name && col.type == 'F') {
+            return reinterpret_cast<Float_t *>(col.address);
+        }
+    }
+    return nullptr;
+}
+
+// empty string means the column isn't written
+std::string output_schema::choose_precision(const column &col) {
+    if (!loaded) {
+        return col.legacy ? "native" : "";
+    }
+    for (auto &sel : selected) {
+        if (fnmatch(sel.first.c_str(), col.name.c_str(), 0) == 0) {
+            return sel.second;
+        }
+    }
+    return col.ac ? ac_precision : default_precision;
+}
+
+void output_schema::book(TTree *tree) {
+    for (size_t i = 0; i < columns.size(); i++) {
+        book_column(tree, i);
+    }
+
+    if (block.values != nullptr && !ac_precision.empty()) {
+        tree->Branch("ac_group", block.group, "ac_group/I");
+        tree->Branch("ac_n", block.size, "ac_n/I");
+        if (ac_layout == "ratios") {
+            tree->Branch("ac_a1", block.first, "ac_a1/F");
+            tree->Branch("ac_wt", block.values, "ac_wt[ac_n]/f");
+        } else {
+            tree->Branch("ac_wt", block.values, ac_precision == "half" ? "ac_wt[ac_n]/f" : "ac_wt[ac_n]/F");
+        }
+    }
+}
+
+bool output_schema::book_float(TTree *tree, std::string name, Float_t *address, bool legacy) {
+    add_float(name, address, legacy);
+    return book_column(tree, columns.size() - 1);
+}
+
+// Some branches are needed by later steps whatever the schema (the event keys
+// of data for fast_merge --dedup, row_key for friend outputs). Call after
+// book() and before the first fill.
+void output_schema::require(TTree *tree, std::string name) {
+    for (auto &col : columns) {
+        if (col.name == name && !col.booked) {
+            col.booked = true;
+            tree->Branch(col.name.c_str(), col.address, (col.name + "/" + col.type).c_str());
+        }
+    }
+}
+
+// returns false if the column isn't written
+bool output_schema::book_column(TTree *tree, size_t index) {
+    auto &col = columns.at(index);
+    auto precision = choose_precision(col);
+    if ((precision == "float" || precision == "half") && col.type != 'F') {
+        std::cerr << "Branch " << col.name << " is an integer, storing at native precision" << std::endl;
+        precision = "native";
+    } else if (precision == "int" && col.type != 'F') {
+        precision = "native";
+    }
+
+    if (precision.empty()) {
+        return false;
+    }
+    col.booked = true;
+    if (precision == "int8") {
+        int8_buffer.push_back(0);
+        conversions.push_back({index, 'B', int8_buffer.size() - 1});
+        tree->Branch(col.name.c_str(), &int8_buffer.back(), (col.name + "/B").c_str());
+    } else if (precision == "int") {
+        int_buffer.push_back(0);
+        conversions.push_back({index, 'I', int_buffer.size() - 1});
+        tree->Branch(col.name.c_str(), &int_buffer.back(), (col.name + "/I").c_str());
+    } else if (precision == "half") {
+        tree->Branch(col.name.c_str(), col.address, (col.name + "/f").c_str());
+    } else {
+        tree->Branch(col.name.c_str(), col.address, (col.name + "/" + col.type).c_str());
+    }
+    return true;
+}
+
+// warn about typos in the schema so a branch doesn't silently vanish. Done
+// at the first fill, once the analyzer has booked its weights.
+void output_schema::check_selection() {
+    checked = true;
+    for (auto &sel : selected) {
+        bool found(false);
+        for (auto &col : columns) {
+            found = found || fnmatch(sel.first.c_str(), col.name.c_str(), 0) == 0;
+        }
+        if (!found) {
+            std::cerr << "Schema " << schema_name << " requests unknown branch " << sel.first << std::endl;
+        }
+    }
+}
+
+double output_schema::read(const column &col) {
+    switch (col.type) {
+        case 'F': return *static_cast<Float_t *>(col.address);
+        case 'I': return *static_cast<Int_t *>(col.address);
+        case 'i': return *static_cast<UInt_t *>(col.address);
+        default: return *static_cast<ULong64_t *>(col.address);
+    }
+}
+
+// Copy members stored at reduced integer precision into their buffers. Must
+// be called right before every TTree::Fill.
+void output_schema::narrow() {
+    if (!checked) {
+        check_selection();
+    }
+    for (auto &conv : conversions) {
+        auto value = std::round(read(columns[conv.source]));
+        if (conv.target == 'B') {
+            int8_buffer[conv.index] = static_cast<Char_t>(std::fmax(-128., std::fmin(127., value)));
+        } else {
+            int_buffer[conv.index] = static_cast<Int_t>(value);
+        }
+    }
+}
+
+#endif  // INCLUDE_OUTPUT_SCHEMA_H_
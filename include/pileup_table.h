@@ -0,0 +1,231 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_PILEUP_TABLE_H_
+#define INCLUDE_PILEUP_TABLE_H_
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "TFile.h"
+#include "TH1F.h"
+
+// Dense pileup weight table. The data/MC ratio is built exactly the way
+// reweight::LumiReWeighting builds it, then every bin (including under- and
+// overflow) is copied into a flat array so the per-event lookup is the
+// TAxis::FindBin arithmetic followed by an array read.
+//
+// Three ratios are stored side by side: nominal, up and down. The variations
+// come from the data histograms "<name>_plus" and "<name>_minus" (shifted
+// minimum-bias cross section) in the same file as the nominal one. If they
+// are missing, the nominal weights are used and a warning is printed every
+// time the table is loaded, from the cache as well.
+//
+// Tables are cached on disk, keyed by the input files and histogram names,
+// so the ROOT files only need to be read once per era.
+class pileup_table {
+ public:
+    struct entry {
+        Float_t nominal, up, down;
+    };
+
+    pileup_table(std::string, std::string, std::string, std::string, std::string cache_dir = "Output/pileup_tables");
+    ~pileup_table() {}
+
+    const entry &get(Float_t);
+    double weight(Float_t npu) { return get(npu).nominal; }
+    bool isGood() { return good; }
+    // false if up and down are copies of the nominal weights
+    bool hasVariations() { return variations; }
+
+ private:
+    bool build(std::string, std::string, std::string, std::string);
+    std::unique_ptr<TH1F> ratio(TH1F *, TFile *, std::string);
+    static std::unique_ptr<TH1F> detached_copy(TH1F *);
+    std::string cache_key(std::string, std::string, std::string, std::string);
+    bool read_cache(std::string);
+    void write_cache(std::string);
+
+    bool good, variable_bins, variations;
+    int nbins;
+    double xmin, xmax;
+    std::vector<double> edges;
+    std::vector<entry> table;  // bins 0 to nbins + 1
+};
+
+pileup_table::pileup_table(std::string mc_file, std::string data_file, std::string mc_hist, std::string data_hist, std::string cache_dir)
+    : good(false), variable_bins(false), variations(false), nbins(0), xmin(0), xmax(0) {
+    std::string cache_name = cache_dir.empty() ? "" : cache_dir + "/pu_" + cache_key(mc_file, data_file, mc_hist, data_hist) + ".table";
+    if (!cache_name.empty() && read_cache(cache_name)) {
+        good = true;
+    } else {
+        good = build(mc_file, data_file, mc_hist, data_hist);
+        if (good && !cache_name.empty()) {
+            mkdir(cache_dir.c_str(), 0755);
+            write_cache(cache_name);
+        }
+    }
+    if (good && !variations) {
+        std::cerr << "pileup_table: " << data_hist << "_plus/_minus not found in " << data_file
+                  << ", puweight_up and puweight_down equal the nominal weights" << std::endl;
+    }
+}
+
+// Detached copy of a histogram so it never ends up in the current directory
+// (the output file of the analyzers).
+std::unique_ptr<TH1F> pileup_table::detached_copy(TH1F *hist) {
+    std::unique_ptr<TH1F> copy(static_cast<TH1F *>(hist->Clone()));
+    copy->SetDirectory(nullptr);
+    return copy;
+}
+
+// same normalization as reweight::LumiReWeighting
+std::unique_ptr<TH1F> pileup_table::ratio(TH1F *mc, TFile *data_file, std::string name) {
+    auto data_hist = reinterpret_cast<TH1F *>(data_file->Get(name.c_str()));
+    if (data_hist == nullptr) {
+        return nullptr;
+    }
+    auto data = detached_copy(data_hist);
+    if (data->GetBinWidth(1) == 2 * mc->GetBinWidth(1)) {
+        data->Rebin(2);
+    }
+    data->Scale(1.0 / data->Integral());
+    data->Divide(mc);
+    return data;
+}
+
+bool pileup_table::build(std::string mc_file, std::string data_file, std::string mc_hist, std::string data_hist) {
+    std::unique_ptr<TFile> fmc(TFile::Open(mc_file.c_str()));
+    std::unique_ptr<TFile> fdata(TFile::Open(data_file.c_str()));
+    if (fmc == nullptr || fdata == nullptr) {
+        std::cerr << "pileup_table: unable to open " << mc_file << " or " << data_file << std::endl;
+        return false;
+    }
+
+    auto mc_input = reinterpret_cast<TH1F *>(fmc->Get(mc_hist.c_str()));
+    if (mc_input == nullptr) {
+        std::cerr << "pileup_table: no histogram " << mc_hist << " in " << mc_file << std::endl;
+        return false;
+    }
+    auto mc = detached_copy(mc_input);
+    mc->Scale(1.0 / mc->Integral());
+
+    auto nominal = ratio(mc.get(), fdata.get(), data_hist);
+    if (nominal == nullptr) {
+        std::cerr << "pileup_table: no histogram " << data_hist << " in " << data_file << std::endl;
+        return false;
+    }
+    auto up = ratio(mc.get(), fdata.get(), data_hist + "_plus");
+    auto down = ratio(mc.get(), fdata.get(), data_hist + "_minus");
+    variations = up != nullptr && down != nullptr;
+    if (!variations) {
+        up.reset();
+        down.reset();
+    }
+
+    auto axis = nominal->GetXaxis();
+    nbins = axis->GetNbins();
+    xmin = axis->GetXmin();
+    xmax = axis->GetXmax();
+    variable_bins = axis->IsVariableBinSize();
+    edges.clear();
+    for (int i = 1; i <= nbins + 1; i++) {
+        edges.push_back(axis->GetBinLowEdge(i));
+    }
+
+    table.clear();
+    for (int i = 0; i <= nbins + 1; i++) {
+        Float_t w_nom = nominal->GetBinContent(i);
+        Float_t w_up = up == nullptr ? w_nom : up->GetBinContent(up->GetXaxis()->FindBin(nominal->GetXaxis()->GetBinCenter(i)));
+        Float_t w_down = down == nullptr ? w_nom : down->GetBinContent(down->GetXaxis()->FindBin(nominal->GetXaxis()->GetBinCenter(i)));
+        table.push_back({w_nom, w_up, w_down});
+    }
+
+    return true;
+}
+
+// Reproduces TAxis::FindBin for a fixed axis (no extension).
+const pileup_table::entry &pileup_table::get(Float_t npu) {
+    double x = npu;
+    int bin;
+    if (x < xmin) {
+        bin = 0;
+    } else if (!(x < xmax)) {
+        bin = nbins + 1;
+    } else if (!variable_bins) {
+        bin = 1 + static_cast<int>(nbins * (x - xmin) / (xmax - xmin));
+    } else {
+        bin = std::upper_bound(edges.begin(), edges.end(), x) - edges.begin();
+    }
+    return table[bin];
+}
+
+std::string pileup_table::cache_key(std::string mc_file, std::string data_file, std::string mc_hist, std::string data_hist) {
+    // local inputs also contribute their size and modification time so a
+    // replaced file invalidates the cache
+    std::stringstream input;
+    input << "v2|" << mc_file << "|" << data_file << "|" << mc_hist << "|" << data_hist;
+    for (auto &name : {mc_file, data_file}) {
+        struct stat info;
+        if (stat(name.c_str(), &info) == 0) {
+            input << "|" << info.st_size << "|" << info.st_mtime;
+        }
+    }
+
+    // 64-bit FNV-1a
+    ULong64_t hash = 0xcbf29ce484222325ULL;
+    for (auto c : input.str()) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+    return key;
+}
+
+bool pileup_table::read_cache(std::string name) {
+    std::ifstream cache(name, std::ios::binary);
+    if (!cache.good()) {
+        return false;
+    }
+    cache.read(reinterpret_cast<char *>(&nbins), sizeof(nbins));
+    cache.read(reinterpret_cast<char *>(&xmin), sizeof(xmin));
+    cache.read(reinterpret_cast<char *>(&xmax), sizeof(xmax));
+    cache.read(reinterpret_cast<char *>(&variable_bins), sizeof(variable_bins));
+    cache.read(reinterpret_cast<char *>(&variations), sizeof(variations));
+    if (!cache.good() || nbins <= 0 || nbins > 100000) {
+        return false;
+    }
+    edges.resize(nbins + 1);
+    table.resize(nbins + 2);
+    cache.read(reinterpret_cast<char *>(edges.data()), edges.size() * sizeof(double));
+    cache.read(reinterpret_cast<char *>(table.data()), table.size() * sizeof(entry));
+    return cache.good();
+}
+
+// write to a temporary name first so concurrent jobs never read a partial table
+void pileup_table::write_cache(std::string name) {
+    auto tmp_name = name + ".tmp" + std::to_string(getpid());
+    std::ofstream cache(tmp_name, std::ios::binary);
+    cache.write(reinterpret_cast<const char *>(&nbins), sizeof(nbins));
+    cache.write(reinterpret_cast<const char *>(&xmin), sizeof(xmin));
+    cache.write(reinterpret_cast<const char *>(&xmax), sizeof(xmax));
+    cache.write(reinterpret_cast<const char *>(&variable_bins), sizeof(variable_bins));
+    cache.write(reinterpret_cast<const char *>(&variations), sizeof(variations));
+    cache.write(reinterpret_cast<const char *>(edges.data()), edges.size() * sizeof(double));
+    cache.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(entry));
+    cache.close();
+    if (cache.good()) {
+        std::rename(tmp_name.c_str(), name.c_str());
+    } else {
+        std::remove(tmp_name.c_str());
+    }
+}
+
+#endif  // INCLUDE_PILEUP_TABLE_H_
@@ -0,0 +1,232 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_ROC_SCANNER_H_
+#define INCLUDE_ROC_SCANNER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+#include "TGraph.h"
+#include "TH2F.h"
+#include "./hist_filler.h"
+
+// Weighted ROC curves and cut scans from cumulative sums, replacing the
+// histogram reordering of scripts/eraROCs.py and scripts/plotROCCurves3.C and
+// the threshold loop of scripts/optimize_mela.py.
+
+// Events are sorted once by score (higher is more signal-like) and the
+// weights are summed from the top, so every distinct score is a point of the
+// curve with the signal and background passing "score >= cut". Events with
+// a non-finite score (a ratio with a null denominator) can't be ordered;
+// they are left out of the curve and the totals and only counted.
+class roc_curve {
+ public:
+    struct point {
+        double cut, sig, bkg;  // passing weights
+    };
+
+    roc_curve(const std::vector<double> &, const std::vector<double> &, const std::vector<double> &, const std::vector<double> &);
+
+    double getSigTotal() const { return sig_total; }
+    double getBkgTotal() const { return bkg_total; }
+    size_t getNonFinite() const { return non_finite; }
+    const std::vector<point> &getPoints() const { return points; }
+
+    // area under signal efficiency vs background efficiency (1 is perfect separation, 0.5 none)
+    double auc() const;
+    // point with the largest S / sqrt(B)
+    point best_significance() const;
+    // first point reaching the signal efficiency
+    point working_point(double) const;
+    // point where background efficiency equals signal inefficiency (the alpha of optimize_mela.py)
+    point balance() const;
+    // signal efficiency vs background efficiency, at most n points
+    TGraph *graph(std::string, size_t) const;
+
+ private:
+    double sig_total, bkg_total;
+    size_t non_finite;
+    std::vector<point> points;
+};
+
+roc_curve::roc_curve(const std::vector<double> &sig_score, const std::vector<double> &sig_weight, const std::vector<double> &bkg_score,
+                     const std::vector<double> &bkg_weight)
+    : sig_total(0.), bkg_total(0.), non_finite(0) {
+    std::vector<std::pair<double, std::pair<double, double>>> events;
+    events.reserve(sig_score.size() + bkg_score.size());
+    for (size_t i = 0; i < sig_score.size(); i++) {
+        if (!std::isfinite(sig_score[i])) {
+            non_finite++;
+            continue;
+        }
+        events.push_back(std::make_pair(sig_score[i], std::make_pair(sig_weight[i], 0.)));
+    }
+    for (size_t i = 0; i < bkg_score.size(); i++) {
+        if (!std::isfinite(bkg_score[i])) {
+            non_finite++;
+            continue;
+        }
+        events.push_back(std::make_pair(bkg_score[i], std::make_pair(0., bkg_weight[i])));
+    }
+    std::sort(events.begin(), events.end(),
+              [](const std::pair<double, std::pair<double, double>> &a, const std::pair<double, std::pair<double, double>> &b) {
+                  return a.first > b.first;
+              });
+
+    // equal scores can't be separated by a cut, so they make one point
+    for (auto &event : events) {
+        sig_total += event.second.first;
+        bkg_total += event.second.second;
+        if (!points.empty() && points.back().cut == event.first) {
+            points.back().sig = sig_total;
+            points.back().bkg = bkg_total;
+        } else {
+            points.push_back(point{event.first, sig_total, bkg_total});
+        }
+    }
+}
+
+double roc_curve::auc() const {
+    if (sig_total <= 0 || bkg_total <= 0) {
+        return 0.;
+    }
+    // integral of signal efficiency over background efficiency (trapezoids)
+    double area(0.), last_sig(0.), last_bkg(0.);
+    for (auto &p : points) {
+        area += (p.bkg - last_bkg) * (p.sig + last_sig) / 2.;
+        last_sig = p.sig;
+        last_bkg = p.bkg;
+    }
+    return area / (sig_total * bkg_total);
+}
+
+roc_curve::point roc_curve::best_significance() const {
+    point best{0., 0., 0.};
+    double best_value(-1.);
+    for (auto &p : points) {
+        if (p.bkg > 0 && p.sig / std::sqrt(p.bkg) > best_value) {
+            best_value = p.sig / std::sqrt(p.bkg);
+            best = p;
+        }
+    }
+    return best;
+}
+
+roc_curve::point roc_curve::working_point(double efficiency) const {
+    for (auto &p : points) {
+        if (p.sig >= efficiency * sig_total) {
+            return p;
+        }
+    }
+    return points.empty() ? point{0., 0., 0.} : points.back();
+}
+
+roc_curve::point roc_curve::balance() const {
+    point best{0., 0., 0.};
+    double best_diff(1e10);
+    for (auto &p : points) {
+        auto diff = std::fabs(p.bkg / bkg_total - (1. - p.sig / sig_total));
+        if (diff < best_diff) {
+            best_diff = diff;
+            best = p;
+        }
+    }
+    return best;
+}
+
+TGraph *roc_curve::graph(std::string name, size_t max_points) const {
+    // keep a point whenever either efficiency moved by 1/max_points
+    std::vector<double> sig_eff = {0.}, bkg_eff = {0.};
+    auto step = 1. / std::max(max_points, static_cast<size_t>(1));
+    for (auto &p : points) {
+        double s = p.sig / sig_total, b = p.bkg / bkg_total;
+        if (&p == &points.back() || s - sig_eff.back() >= step || b - bkg_eff.back() >= step) {
+            sig_eff.push_back(s);
+            bkg_eff.push_back(b);
+        }
+    }
+    auto roc = new TGraph(sig_eff.size(), sig_eff.data(), bkg_eff.data());
+    roc->SetName(name.c_str());
+    roc->SetTitle(name.c_str());
+    return roc;
+}
+
+// Two discriminants binned together (for example D0 x DCP). Suffix sums give
+// the signal and background passing "x >= low edge && y >= low edge" for
+// every pair of bins, so the whole grid of rectangular cuts is scanned at once.
+class cut_grid {
+ public:
+    cut_grid(const hist_axis &, const hist_axis &);
+
+    void fill(double x, double y, double w, bool signal) {
+        auto bin = xaxis.find(x) + (xaxis.getNbins() + 2) * yaxis.find(y);
+        (signal ? sig : bkg)[bin] += w;
+    }
+    void add(const cut_grid &);
+
+    // S / sqrt(B) for each pair of cuts and the best of them (x cut, y cut, value)
+    TH2F *significance(std::string, double *) const;
+
+ private:
+    hist_axis xaxis, yaxis;
+    std::vector<double> sig, bkg;
+};
+
+cut_grid::cut_grid(const hist_axis &_xaxis, const hist_axis &_yaxis)
+    : xaxis(_xaxis),
+      yaxis(_yaxis),
+      sig((xaxis.getNbins() + 2) * (yaxis.getNbins() + 2), 0.),
+      bkg((xaxis.getNbins() + 2) * (yaxis.getNbins() + 2), 0.) {}
+
+void cut_grid::add(const cut_grid &other) {
+    for (size_t i = 0; i < sig.size(); i++) {
+        sig[i] += other.sig[i];
+        bkg[i] += other.bkg[i];
+    }
+}
+
+TH2F *cut_grid::significance(std::string name, double *best) const {
+    int nx = xaxis.getNbins() + 2, ny = yaxis.getNbins() + 2;
+    std::vector<double> sig_pass(sig), bkg_pass(bkg);
+    for (int j = ny - 1; j >= 0; j--) {
+        for (int i = nx - 1; i >= 0; i--) {
+            auto bin = i + nx * j;
+            if (i < nx - 1) {
+                sig_pass[bin] += sig_pass[bin + 1];
+                bkg_pass[bin] += bkg_pass[bin + 1];
+            }
+            if (j < ny - 1) {
+                sig_pass[bin] += sig_pass[bin + nx];
+                bkg_pass[bin] += bkg_pass[bin + nx];
+            }
+            if (i < nx - 1 && j < ny - 1) {
+                sig_pass[bin] -= sig_pass[bin + nx + 1];
+                bkg_pass[bin] -= bkg_pass[bin + nx + 1];
+            }
+        }
+    }
+
+    auto xedges = xaxis.binEdges();
+    auto yedges = yaxis.binEdges();
+    auto hist = new TH2F(name.c_str(), name.c_str(), nx - 2, xedges.data(), ny - 2, yedges.data());
+    best[0] = xedges.front();
+    best[1] = yedges.front();
+    best[2] = -1.;
+    for (int j = 1; j < ny - 1; j++) {
+        for (int i = 1; i < nx - 1; i++) {
+            auto bin = i + nx * j;
+            auto value = bkg_pass[bin] > 0 ? sig_pass[bin] / std::sqrt(bkg_pass[bin]) : 0.;
+            hist->SetBinContent(i, j, value);
+            if (value > best[2]) {
+                best[0] = xedges.at(i - 1);
+                best[1] = yedges.at(j - 1);
+                best[2] = value;
+            }
+        }
+    }
+    return hist;
+}
+
+#endif  // INCLUDE_ROC_SCANNER_H_
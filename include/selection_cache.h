@@ -0,0 +1,287 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_SELECTION_CACHE_H_
+#define INCLUDE_SELECTION_CACHE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Decisions of the event selection written by the nominal job and reused by
+// the systematic jobs of the same sample and shard ("--sel-cache dir").
+//
+// The analyzer declares its cuts in order, each with the inputs it reads
+// (cut("mt", 5, lepton | met)), and passes every decision through pass().
+// skip() is called with every entry, before it is read. The nominal job
+// stores the first cut each entry failed. A systematic job knows which
+// inputs its shift changes (shifted_inputs), so an entry that failed a cut,
+// with neither that cut nor the ones before it reading any of them, fails
+// it again: skip() rejects it without reading it and the cutflow bins of
+// the cuts it passed are filled from the cache. Entries that passed, or
+// failed after a cut reading a shifted input, go through the whole
+// selection as before.
+//
+// File layout (native endianness):
+//   "HTTSEL" magic (8 bytes), uint32 version, uint32 number of cuts
+//   each cut: uint64 name length, name, uint32 inputs
+//   int64 first entry, uint64 entries, then one uint8 per entry: 0 if no
+//   cut failed, otherwise the index of the failed cut + 1
+// A cache written for another list of cuts or entry range is ignored. Like
+// sf_cache.h, it is written next to its final name and renamed, and not
+// written by a resumed job.
+class selection_cache {
+ public:
+    static const uint32_t version = 1;
+
+    // inputs read by a cut
+    enum input : unsigned {
+        flags = 1 << 0,      // MET filters and other event flags
+        gen_match = 1 << 1,  // generator matching of the legs
+        charge = 1 << 2,
+        lepton = 1 << 3,     // electron or muon momentum
+        tau = 1 << 4,        // tau momentum
+        met = 1 << 5,
+        jets = 1 << 6,       // jets and b-tagged jets
+        isolation = 1 << 7,  // lepton isolation and tau ID working points
+        all_inputs = (1 << 8) - 1
+    };
+
+    selection_cache() : active(false), writing(false), shifted(all_inputs), first(0), entry(-1), nskipped(0), nevaluated(0) {}
+    selection_cache(std::string, std::string, bool, int64_t, int64_t);
+
+    bool isActive() { return active; }
+
+    // index of a cut, declared in the order the analyzer applies them
+    int cut(std::string, double, unsigned);
+    // inputs changed by a systematic, unknown systematics change everything
+    static unsigned shifted_inputs(const std::string &);
+
+    // true if the nominal job rejected the entry with a cut the shift can't change
+    bool skip(int64_t);
+    // cutflow bins of the cuts passed by the skipped entry
+    const std::vector<double> &passed_bins() { return bins; }
+    bool pass(int, bool);
+
+    bool write();
+    void report(std::ostream &);
+
+ private:
+    struct cut_info {
+        std::string name;
+        double bin;
+        unsigned inputs;
+        int64_t evaluated = 0, failed = 0, skipped = 0;
+    };
+
+    bool read();
+
+    bool active, writing;
+    std::string filename;
+    unsigned shifted;
+    int64_t first, entry, nskipped, nevaluated;
+    std::vector<cut_info> cuts;
+    std::vector<uint8_t> failed;
+    std::vector<double> bins;
+    // the stored decisions, read when the first entry is checked (all cuts are declared by then)
+    bool loaded = false, usable = false;
+};
+
+selection_cache::selection_cache(std::string _filename, std::string syst, bool _writing, int64_t _first, int64_t _last)
+    : active(!_filename.empty()),
+      writing(_writing),
+      filename(_filename),
+      shifted(shifted_inputs(syst)),
+      first(_first),
+      entry(-1),
+      nskipped(0),
+      nevaluated(0) {
+    if (active && writing) {
+        failed.assign(_last > _first ? _last - _first : 0, 0);
+    }
+}
+
+int selection_cache::cut(std::string name, double bin, unsigned inputs) {
+    cut_info info;
+    info.name = name;
+    info.bin = bin;
+    info.inputs = inputs;
+    cuts.push_back(info);
+    return cuts.size() - 1;
+}
+
+// what the factories of this tree shift for each systematic of auto_ac_wisc.py
+unsigned selection_cache::shifted_inputs(const std::string &syst) {
+    auto starts = [&syst](const std::string &prefix) { return syst.compare(0, prefix.size(), prefix) == 0; };
+    if (syst.empty() || syst == "NOMINAL") {
+        return 0;
+    } else if (starts("DM0") || starts("DM1") || starts("efaket_es") || starts("mfaket_es")) {
+        return tau;
+    } else if (starts("EEScale") || starts("EESigma") || starts("MES_")) {
+        return lepton;
+    } else if (starts("Jet")) {
+        return jets | met;
+    } else if (starts("UncMet") || starts("Recoil")) {
+        return met;
+    } else if (starts("tau_id_") || starts("single_trigger") || starts("cross_trigger") || starts("mc_") || starts("embed_") ||
+               starts("prefiring") || starts("tracking") || starts("ttbarShape") || starts("dyShape") || starts("ggH_Rivet") ||
+               starts("VBF_Rivet") || starts("efaket_norm")) {
+        return 0;  // only weights change
+    }
+    return all_inputs;
+}
+
+bool selection_cache::skip(int64_t _entry) {
+    entry = _entry;
+    if (!active || writing) {
+        return false;
+    }
+    if (!loaded) {
+        loaded = true;
+        usable = read();
+        if (!usable) {
+            std::cerr << "selection_cache: no usable cache in " << filename << ", evaluating the full selection" << std::endl;
+        }
+    }
+    if (!usable || entry < first || entry - first >= static_cast<int64_t>(failed.size()) || failed[entry - first] == 0) {
+        return false;
+    }
+    // the cuts before it must be unaffected as well, or the cutflow would change
+    size_t failed_index = failed[entry - first] - 1;
+    for (size_t i = 0; i <= failed_index; i++) {
+        if ((cuts[i].inputs & shifted) != 0) {
+            return false;
+        }
+    }
+    auto &failed_cut = cuts[failed_index];
+    bins.clear();
+    for (size_t i = 0; i < failed_index; i++) {
+        bins.push_back(cuts[i].bin);
+    }
+    failed_cut.skipped++;
+    nskipped++;
+    return true;
+}
+
+bool selection_cache::pass(int index, bool decision) {
+    auto &info = cuts.at(index);
+    info.evaluated++;
+    if (index == 0) {
+        nevaluated++;
+    }
+    if (!decision) {
+        info.failed++;
+        if (active && writing && entry >= first && entry - first < static_cast<int64_t>(failed.size())) {
+            failed[entry - first] = index + 1;
+        }
+    }
+    return decision;
+}
+
+bool selection_cache::read() {
+    std::ifstream input(filename, std::ios::binary);
+    if (!input.good()) {
+        return false;
+    }
+    char magic[8];
+    uint32_t file_version(0), ncuts(0);
+    input.read(magic, sizeof(magic));
+    input.read(reinterpret_cast<char *>(&file_version), sizeof(file_version));
+    input.read(reinterpret_cast<char *>(&ncuts), sizeof(ncuts));
+    if (!input.good() || std::string(magic, 6) != "HTTSEL" || file_version != version) {
+        std::cerr << "selection_cache: " << filename << " is not a selection cache of version " << version << std::endl;
+        return false;
+    }
+    if (ncuts != cuts.size()) {
+        std::cerr << "selection_cache: " << filename << " was written for another selection" << std::endl;
+        return false;
+    }
+    for (auto &info : cuts) {
+        uint64_t length(0);
+        uint32_t inputs(0);
+        input.read(reinterpret_cast<char *>(&length), sizeof(length));
+        std::string name(length < 1024 ? length : 0, '\0');
+        input.read(&name[0], name.size());
+        input.read(reinterpret_cast<char *>(&inputs), sizeof(inputs));
+        if (!input.good() || name != info.name || inputs != info.inputs) {
+            std::cerr << "selection_cache: " << filename << " was written for another selection" << std::endl;
+            return false;
+        }
+    }
+    int64_t file_first(0);
+    uint64_t nentries(0);
+    input.read(reinterpret_cast<char *>(&file_first), sizeof(file_first));
+    input.read(reinterpret_cast<char *>(&nentries), sizeof(nentries));
+    if (!input.good() || file_first != first) {
+        std::cerr << "selection_cache: " << filename << " covers other entries" << std::endl;
+        return false;
+    }
+    failed.resize(nentries);
+    input.read(reinterpret_cast<char *>(failed.data()), nentries);
+    if (!input.good()) {
+        std::cerr << "selection_cache: " << filename << " is truncated" << std::endl;
+        failed.clear();
+        return false;
+    }
+    for (auto value : failed) {
+        if (value > cuts.size()) {
+            std::cerr << "selection_cache: " << filename << " is corrupted" << std::endl;
+            failed.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool selection_cache::write() {
+    if (!active || !writing) {
+        return true;
+    }
+    auto temporary = filename + ".tmp";
+    std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+    if (!output.good()) {
+        std::cerr << "selection_cache: unable to write " << temporary << std::endl;
+        return false;
+    }
+    uint32_t file_version(version), ncuts(cuts.size());
+    output.write("HTTSEL\0\0", 8);
+    output.write(reinterpret_cast<const char *>(&file_version), sizeof(file_version));
+    output.write(reinterpret_cast<const char *>(&ncuts), sizeof(ncuts));
+    for (auto &info : cuts) {
+        uint64_t length(info.name.size());
+        uint32_t inputs(info.inputs);
+        output.write(reinterpret_cast<const char *>(&length), sizeof(length));
+        output.write(info.name.data(), length);
+        output.write(reinterpret_cast<const char *>(&inputs), sizeof(inputs));
+    }
+    uint64_t nentries(failed.size());
+    output.write(reinterpret_cast<const char *>(&first), sizeof(first));
+    output.write(reinterpret_cast<const char *>(&nentries), sizeof(nentries));
+    output.write(reinterpret_cast<const char *>(failed.data()), nentries);
+    output.close();
+    if (!output.good() || std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        std::cerr << "selection_cache: unable to write " << filename << std::endl;
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+void selection_cache::report(std::ostream &out) {
+    if (!active) {
+        return;
+    }
+    if (writing) {
+        out << "Selection cache: wrote the decisions of " << failed.size() << " entries to " << filename << std::endl;
+        return;
+    }
+    out << "Selection cache: " << nskipped << " entries rejected from " << filename << ", " << nevaluated << " evaluated" << std::endl;
+    for (auto &info : cuts) {
+        out << "\t " << info.name << ": " << info.skipped << " rejected from the cache, " << info.failed << " of " << info.evaluated
+            << " evaluated failed" << ((info.inputs & shifted) != 0 ? " (reads shifted inputs)" : "") << std::endl;
+    }
+}
+
+#endif  // INCLUDE_SELECTION_CACHE_H_
@@ -0,0 +1,239 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_SF_CACHE_H_
+#define INCLUDE_SF_CACHE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Scale factors of each input entry, written by the nominal job and reused by
+// the systematic jobs of the same sample ("--sf-cache dir").
+//
+// Every value is stored with a hash of the inputs it was computed from (the
+// workspace variables the function depends on). A systematic job takes the
+// cached value when the hash matches, i.e. the muon and tau kinematics used
+// by m_trk_ratio are untouched by a tau energy shift, and evaluates the
+// function otherwise. Functions used by the systematic job only (the "_up"
+// and "_down" variations) are never cached.
+//
+// File layout (native endianness):
+//   "HTTSFC" magic (8 bytes), uint32 version, uint32 number of functions
+//   each function: uint64 name length, name, uint64 records, then
+//   the records {int64 entry, uint64 hash, double value} sorted by entry.
+// A function can be called more than once in an entry (m_sel_id_ic_ratio for
+// both legs of embedded events), the calls are matched in order.
+//
+// The file is written next to its final name and renamed, so a systematic job
+// starting before the nominal one finished sees no cache instead of half of
+// one. A resumed nominal job doesn't write it.
+class sf_cache {
+ public:
+    static const uint32_t version = 1;
+
+    sf_cache() : active(false), writing(false), entry(-1) {}
+    sf_cache(std::string, bool);
+
+    bool isActive() { return active; }
+    bool isWriting() { return writing; }
+
+    // slot of a function, used for every call
+    int slot(const std::string &);
+    void setEntry(int64_t _entry) { entry = _entry; }
+
+    // cached value for the current entry, if its inputs are the same
+    bool find(int, uint64_t, double *);
+    void store(int, uint64_t, double);
+
+    bool write();
+    void report(std::ostream &);
+
+    static uint64_t hash(const std::vector<const double *> &);
+
+ private:
+    struct record {
+        int64_t entry;
+        uint64_t hash;
+        double value;
+    };
+    struct function {
+        std::string name;
+        std::vector<record> records;
+        size_t cursor = 0;
+        int64_t last_entry = -1;
+        size_t call = 0;
+        int64_t hits = 0, evaluated = 0;
+    };
+
+    bool read();
+    size_t next_call(function *);
+
+    bool active, writing;
+    std::string filename;
+    int64_t entry;
+    std::vector<function> functions;
+    std::unordered_map<std::string, int> slots;
+};
+
+sf_cache::sf_cache(std::string _filename, bool _writing) : active(!_filename.empty()), writing(_writing), filename(_filename), entry(-1) {
+    if (active && !writing && !read()) {
+        // nothing to reuse yet, every value gets evaluated
+        std::cerr << "sf_cache: no usable cache in " << filename << ", evaluating all scale factors" << std::endl;
+    }
+}
+
+int sf_cache::slot(const std::string &name) {
+    auto found = slots.find(name);
+    if (found != slots.end()) {
+        return found->second;
+    }
+    functions.emplace_back();
+    functions.back().name = name;
+    slots[name] = functions.size() - 1;
+    return functions.size() - 1;
+}
+
+// index of this call among the calls of the function in the current entry
+size_t sf_cache::next_call(function *func) {
+    if (func->last_entry != entry) {
+        func->last_entry = entry;
+        func->call = 0;
+    } else {
+        func->call++;
+    }
+    return func->call;
+}
+
+bool sf_cache::find(int index, uint64_t key, double *value) {
+    auto &func = functions.at(index);
+    auto call = next_call(&func);
+    if (writing) {
+        return false;
+    }
+    while (func.cursor < func.records.size() && func.records[func.cursor].entry < entry) {
+        func.cursor++;
+    }
+    auto position = func.cursor + call;
+    if (position < func.records.size() && func.records[position].entry == entry && func.records[position].hash == key) {
+        *value = func.records[position].value;
+        func.hits++;
+        return true;
+    }
+    return false;
+}
+
+void sf_cache::store(int index, uint64_t key, double value) {
+    auto &func = functions.at(index);
+    func.evaluated++;
+    if (writing) {
+        func.records.push_back(record{entry, key, value});
+    }
+}
+
+uint64_t sf_cache::hash(const std::vector<const double *> &inputs) {
+    // FNV-1a over the bits of the input values
+    uint64_t key(14695981039346656037ULL);
+    for (auto input : inputs) {
+        unsigned char bytes[sizeof(double)];
+        std::memcpy(bytes, input, sizeof(double));
+        for (auto byte : bytes) {
+            key = (key ^ byte) * 1099511628211ULL;
+        }
+    }
+    return key;
+}
+
+bool sf_cache::read() {
+    std::ifstream input(filename, std::ios::binary);
+    if (!input.good()) {
+        return false;
+    }
+    char magic[8];
+    uint32_t file_version(0), nfunctions(0);
+    input.read(magic, sizeof(magic));
+    input.read(reinterpret_cast<char *>(&file_version), sizeof(file_version));
+    input.read(reinterpret_cast<char *>(&nfunctions), sizeof(nfunctions));
+    if (!input.good() || std::string(magic, 6) != "HTTSFC" || file_version != version) {
+        std::cerr << "sf_cache: " << filename << " is not a scale factor cache of version " << version << std::endl;
+        return false;
+    }
+    for (uint32_t i = 0; i < nfunctions; i++) {
+        uint64_t length(0), nrecords(0);
+        input.read(reinterpret_cast<char *>(&length), sizeof(length));
+        std::string name(length, '\0');
+        input.read(&name[0], length);
+        input.read(reinterpret_cast<char *>(&nrecords), sizeof(nrecords));
+        auto &func = functions.at(slot(name));
+        func.records.resize(nrecords);
+        input.read(reinterpret_cast<char *>(func.records.data()), nrecords * sizeof(record));
+        if (!input.good()) {
+            std::cerr << "sf_cache: " << filename << " is truncated" << std::endl;
+            functions.clear();
+            slots.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool sf_cache::write() {
+    if (!active || !writing) {
+        return true;
+    }
+    auto temporary = filename + ".tmp";
+    std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+    if (!output.good()) {
+        std::cerr << "sf_cache: unable to write " << temporary << std::endl;
+        return false;
+    }
+    uint32_t file_version(version), nfunctions(functions.size());
+    output.write("HTTSFC\0\0", 8);
+    output.write(reinterpret_cast<const char *>(&file_version), sizeof(file_version));
+    output.write(reinterpret_cast<const char *>(&nfunctions), sizeof(nfunctions));
+    for (auto &func : functions) {
+        uint64_t length(func.name.size()), nrecords(func.records.size());
+        output.write(reinterpret_cast<const char *>(&length), sizeof(length));
+        output.write(func.name.data(), length);
+        output.write(reinterpret_cast<const char *>(&nrecords), sizeof(nrecords));
+        output.write(reinterpret_cast<const char *>(func.records.data()), nrecords * sizeof(record));
+    }
+    output.close();
+    if (!output.good() || std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        std::cerr << "sf_cache: unable to write " << filename << std::endl;
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+void sf_cache::report(std::ostream &out) {
+    if (!active) {
+        return;
+    }
+    if (writing) {
+        int64_t nrecords(0);
+        for (auto &func : functions) {
+            nrecords += func.records.size();
+        }
+        out << "SF cache: wrote " << nrecords << " values of " << functions.size() << " scale factors to " << filename << std::endl;
+        return;
+    }
+    out << "SF cache: reused from " << filename << std::endl;
+    for (auto &func : functions) {
+        auto calls = func.hits + func.evaluated;
+        if (calls == 0) {
+            continue;
+        }
+        out << "\t " << std::setw(45) << std::left << func.name << std::right << std::setw(10) << func.hits << " / " << std::setw(10) << calls
+            << " (" << std::fixed << std::setprecision(1) << 100. * func.hits / calls << "%)" << std::endl;
+    }
+    out.unsetf(std::ios::fixed);
+}
+
+#endif  // INCLUDE_SF_CACHE_H_
@@ -0,0 +1,164 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_SF_PROVIDER_H_
+#define INCLUDE_SF_PROVIDER_H_
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "RooAbsReal.h"
+#include "RooRealVar.h"
+#include "RooWorkspace.h"
+#include "./sf_cache.h"
+#include "./sf_snapshot.h"
+
+// Scale factors used like a RooWorkspace (var("m_pt")->setVal(pt), then
+// function("m_trk_ratio")->getVal()), backed either by the workspace itself
+// or by the tables of a snapshot from make_sf_snapshot. The analyzers don't
+// change between the two, only the way the provider is created does.
+//
+// With an sf_cache (setCache) the values of a function are looked up by the
+// current entry and the values of the variables it depends on before being
+// evaluated.
+class sf_variable {
+ public:
+    sf_variable() : value(0.), real(nullptr) {}
+
+    void setVal(double _value) {
+        value = _value;
+        if (real != nullptr) {
+            real->setVal(_value);
+        }
+    }
+    double getVal() const { return value; }
+
+    double value;
+    RooRealVar *real;
+};
+
+class sf_function {
+ public:
+    sf_function() : table(nullptr), real(nullptr), cache(nullptr), slot(-1) {}
+
+    double evaluate() const { return real != nullptr ? real->getVal() : table->eval(inputs.data()); }
+    double getVal() const;
+
+    const sf_table *table;
+    std::vector<const double *> inputs;   // values of the table axes
+    std::vector<const double *> depends;  // values of the variables it depends on
+    RooAbsReal *real;
+    sf_cache *cache;
+    int slot;
+};
+
+double sf_function::getVal() const {
+    if (cache == nullptr) {
+        return evaluate();
+    }
+    auto key = sf_cache::hash(depends);
+    double value;
+    if (cache->find(slot, key, &value)) {
+        return value;
+    }
+    value = evaluate();
+    cache->store(slot, key, value);
+    return value;
+}
+
+class sf_provider {
+ public:
+    explicit sf_provider(RooWorkspace *_workspace) : workspace(_workspace), snapshot(nullptr), cache(nullptr) {}
+    sf_provider(const sf_snapshot *_snapshot, std::string _prefix)
+        : workspace(nullptr), snapshot(_snapshot), prefix(_prefix + "/"), cache(nullptr) {}
+
+    bool isGood() { return workspace != nullptr || snapshot != nullptr; }
+    bool isSnapshot() { return snapshot != nullptr; }
+
+    sf_variable *var(const std::string &);
+    sf_variable *var(const char *name) { return var(std::string(name)); }
+    // a function missing from the snapshot ends the job, like a missing one in the workspace would
+    sf_function *function(const std::string &);
+    sf_function *function(const char *name) { return function(std::string(name)); }
+
+    // nullptr (or an inactive cache) to evaluate every call, jobs sharing the provider set their own
+    void setCache(sf_cache *);
+
+ private:
+    RooWorkspace *workspace;
+    const sf_snapshot *snapshot;
+    std::string prefix;
+    sf_cache *cache;
+    std::unordered_map<std::string, std::unique_ptr<sf_variable>> variables;
+    std::unordered_map<std::string, std::unique_ptr<sf_function>> functions;
+};
+
+sf_variable *sf_provider::var(const std::string &name) {
+    auto found = variables.find(name);
+    if (found != variables.end()) {
+        return found->second.get();
+    }
+    auto variable = new sf_variable();
+    if (workspace != nullptr) {
+        variable->real = workspace->var(name.c_str());
+        if (variable->real == nullptr) {
+            std::cerr << "sf_provider: no variable " << name << " in the workspace" << std::endl;
+            std::exit(1);
+        }
+        variable->value = variable->real->getVal();
+        for (auto &entry : functions) {
+            if (entry.second->real->dependsOn(*variable->real)) {
+                entry.second->depends.push_back(&variable->value);
+            }
+        }
+    }
+    variables[name].reset(variable);
+    return variable;
+}
+
+sf_function *sf_provider::function(const std::string &name) {
+    auto found = functions.find(name);
+    if (found != functions.end()) {
+        return found->second.get();
+    }
+    auto func = new sf_function();
+    if (workspace != nullptr) {
+        func->real = workspace->function(name.c_str());
+        for (auto &entry : variables) {
+            if (func->real != nullptr && func->real->dependsOn(*entry.second->real)) {
+                func->depends.push_back(&entry.second->value);
+            }
+        }
+    } else {
+        func->table = snapshot->table(prefix + name);
+        if (func->table != nullptr) {
+            for (auto &ax : func->table->axes) {
+                func->inputs.push_back(&var(ax.name)->value);
+            }
+            func->depends = func->inputs;
+        }
+    }
+    if (func->real == nullptr && func->table == nullptr) {
+        std::cerr << "sf_provider: no function " << name << (snapshot != nullptr ? " in snapshot " + snapshot->getName() : " in the workspace")
+                  << std::endl;
+        std::exit(1);
+    }
+    if (cache != nullptr) {
+        func->cache = cache;
+        func->slot = cache->slot(name);
+    }
+    functions[name].reset(func);
+    return func;
+}
+
+void sf_provider::setCache(sf_cache *_cache) {
+    cache = _cache != nullptr && _cache->isActive() ? _cache : nullptr;
+    for (auto &entry : functions) {
+        entry.second->cache = cache;
+        entry.second->slot = cache != nullptr ? cache->slot(entry.first) : -1;
+    }
+}
+
+#endif  // INCLUDE_SF_PROVIDER_H_
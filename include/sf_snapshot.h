@@ -0,0 +1,356 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_SF_SNAPSHOT_H_
+#define INCLUDE_SF_SNAPSHOT_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Scale factors flattened into tables, written once per era and channel by
+// plugins/Tools/make_sf_snapshot.cc and mapped into memory by the analyzers
+// (see sf_provider.h) instead of deserializing the RooWorkspaces.
+//
+// File layout, all little-endian and 8-byte aligned so the numbers can be
+// used straight from the mapping:
+//   "HTTSNAP" magic (8 bytes), uint32 version, uint32 number of records
+//   each record: uint32 kind, uint32 axes, uint64 values, name
+//     each axis: uint32 mode, uint32 edges, name, double edges[]
+//     double values[] (the last axis changes fastest)
+//   names are a uint64 length followed by the characters, padded to 8 bytes
+//
+// A table axis is either "bins" (edges of bins, the value is constant inside
+// a bin) or "points" (the value is interpolated linearly between points).
+// Inputs past the ends use the first or last bin or point. Graphs are one
+// axis of x points with the y values, constants have no axis.
+struct sf_table {
+    enum kind_type { table_kind = 1, graph_kind = 2, constant_kind = 3 };
+    enum axis_mode { bins = 0, points = 1 };
+    static const size_t max_axes = 8;
+
+    struct axis {
+        std::string name;
+        int mode;
+        const double *edges;
+        size_t nedges;
+    };
+
+    std::string name;
+    int kind;
+    std::vector<axis> axes;
+    std::vector<size_t> strides;
+    const double *values;
+    size_t nvalues;
+
+    // one input per axis
+    double eval(const double *const *) const;
+};
+
+double sf_table::eval(const double *const *inputs) const {
+    // each axis contributes one (bins) or two (points) cells with their weights
+    std::array<std::array<std::pair<size_t, double>, 2>, max_axes> cells;
+    std::array<int, max_axes> ncells;
+    for (size_t i = 0; i < axes.size(); i++) {
+        auto &ax = axes[i];
+        double x = *inputs[i];
+        size_t last = ax.mode == bins ? ax.nedges - 2 : ax.nedges - 1;
+        size_t low = std::upper_bound(ax.edges, ax.edges + ax.nedges, x) - ax.edges;
+        low = low == 0 ? 0 : std::min(low - 1, last);
+        if (ax.mode == bins || ax.nedges < 2) {
+            cells[i][0] = std::make_pair(low, 1.);
+            ncells[i] = 1;
+        } else {
+            low = std::min(low, ax.nedges - 2);
+            double t = (x - ax.edges[low]) / (ax.edges[low + 1] - ax.edges[low]);
+            t = std::max(0., std::min(1., t));
+            cells[i][0] = std::make_pair(low, 1. - t);
+            cells[i][1] = std::make_pair(low + 1, t);
+            ncells[i] = 2;
+        }
+    }
+
+    // sum over the corners of the cell
+    std::array<int, max_axes> corner;
+    corner.fill(0);
+    double result(0.);
+    while (true) {
+        size_t index(0);
+        double weight(1.);
+        for (size_t i = 0; i < axes.size(); i++) {
+            index += cells[i][corner[i]].first * strides[i];
+            weight *= cells[i][corner[i]].second;
+        }
+        if (weight != 0.) {
+            result += weight * values[index];
+        }
+        size_t i = 0;
+        while (i < axes.size() && ++corner[i] == ncells[i]) {
+            corner[i++] = 0;
+        }
+        if (i == axes.size()) {
+            break;
+        }
+    }
+    return result;
+}
+
+class sf_snapshot {
+ public:
+    static const uint32_t version = 1;
+
+    explicit sf_snapshot(std::string);
+    ~sf_snapshot();
+
+    bool isGood() { return good; }
+    std::string getName() const { return filename; }
+    size_t size() { return tables.size(); }
+
+    // nullptr if it isn't in the snapshot
+    const sf_table *table(const std::string &) const;
+    double constant(const std::string &, double) const;
+    std::vector<std::string> names() const;
+
+ private:
+    bool parse();
+    bool read_u32(uint32_t *);
+    bool read_u64(uint64_t *);
+    bool read_name(std::string *);
+    const double *read_doubles(size_t);
+
+    bool good;
+    std::string filename;
+    const char *data;
+    size_t length, pos;
+    std::unordered_map<std::string, sf_table> tables;
+};
+
+sf_snapshot::sf_snapshot(std::string _filename) : good(false), filename(_filename), data(nullptr), length(0), pos(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        std::cerr << "sf_snapshot: unable to open " << filename << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    length = info.st_size;
+    auto mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "sf_snapshot: unable to map " << filename << std::endl;
+        length = 0;
+        return;
+    }
+    data = reinterpret_cast<const char *>(mapped);
+    good = parse();
+}
+
+sf_snapshot::~sf_snapshot() {
+    if (data != nullptr) {
+        munmap(const_cast<char *>(data), length);
+    }
+}
+
+bool sf_snapshot::read_u32(uint32_t *value) {
+    if (pos + sizeof(uint32_t) > length) {
+        return false;
+    }
+    std::memcpy(value, data + pos, sizeof(uint32_t));
+    pos += sizeof(uint32_t);
+    return true;
+}
+
+bool sf_snapshot::read_u64(uint64_t *value) {
+    if (pos + sizeof(uint64_t) > length) {
+        return false;
+    }
+    std::memcpy(value, data + pos, sizeof(uint64_t));
+    pos += sizeof(uint64_t);
+    return true;
+}
+
+bool sf_snapshot::read_name(std::string *name) {
+    uint64_t size;
+    if (!read_u64(&size) || pos + size > length) {
+        return false;
+    }
+    name->assign(data + pos, size);
+    pos += (size + 7) / 8 * 8;
+    return pos <= length;
+}
+
+const double *sf_snapshot::read_doubles(size_t n) {
+    if (pos + n * sizeof(double) > length) {
+        return nullptr;
+    }
+    auto values = reinterpret_cast<const double *>(data + pos);
+    pos += n * sizeof(double);
+    return values;
+}
+
+bool sf_snapshot::parse() {
+    if (length < 16 || std::string(data, 7) != "HTTSNAP") {
+        std::cerr << "sf_snapshot: " << filename << " is not a scale factor snapshot" << std::endl;
+        return false;
+    }
+    pos = 8;
+    uint32_t file_version(0), nrecords(0);
+    read_u32(&file_version);
+    read_u32(&nrecords);
+    if (file_version != version) {
+        std::cerr << "sf_snapshot: " << filename << " has version " << file_version << ", expected " << version
+                  << " (remake it with make_sf_snapshot)" << std::endl;
+        return false;
+    }
+
+    for (uint32_t r = 0; r < nrecords; r++) {
+        sf_table table;
+        uint32_t kind, naxes;
+        uint64_t nvalues;
+        if (!read_u32(&kind) || !read_u32(&naxes) || !read_u64(&nvalues) || !read_name(&table.name) || naxes > sf_table::max_axes) {
+            std::cerr << "sf_snapshot: " << filename << " is truncated or corrupted" << std::endl;
+            return false;
+        }
+        table.kind = kind;
+        size_t expected(1);
+        for (uint32_t i = 0; i < naxes; i++) {
+            uint32_t mode, nedges;
+            sf_table::axis ax;
+            if (!read_u32(&mode) || !read_u32(&nedges) || !read_name(&ax.name) || nedges < 1 || (mode == sf_table::bins && nedges < 2)) {
+                std::cerr << "sf_snapshot: bad axis in " << table.name << " of " << filename << std::endl;
+                return false;
+            }
+            ax.mode = mode;
+            ax.nedges = nedges;
+            ax.edges = read_doubles(nedges);
+            if (ax.edges == nullptr) {
+                std::cerr << "sf_snapshot: " << filename << " is truncated" << std::endl;
+                return false;
+            }
+            expected *= mode == sf_table::bins ? nedges - 1 : nedges;
+            table.axes.push_back(ax);
+        }
+        table.values = read_doubles(nvalues);
+        table.nvalues = nvalues;
+        if (table.values == nullptr || (kind != sf_table::graph_kind && nvalues != expected)) {
+            std::cerr << "sf_snapshot: wrong number of values in " << table.name << " of " << filename << std::endl;
+            return false;
+        }
+
+        table.strides.assign(naxes, 1);
+        for (int i = static_cast<int>(naxes) - 2; i >= 0; i--) {
+            auto &next = table.axes[i + 1];
+            table.strides[i] = table.strides[i + 1] * (next.mode == sf_table::bins ? next.nedges - 1 : next.nedges);
+        }
+        tables[table.name] = table;
+    }
+    return true;
+}
+
+const sf_table *sf_snapshot::table(const std::string &name) const {
+    auto found = tables.find(name);
+    return found == tables.end() ? nullptr : &found->second;
+}
+
+double sf_snapshot::constant(const std::string &name, double fallback) const {
+    auto found = table(name);
+    return found == nullptr || found->nvalues < 1 ? fallback : found->values[0];
+}
+
+std::vector<std::string> sf_snapshot::names() const {
+    std::vector<std::string> all;
+    for (auto &entry : tables) {
+        all.push_back(entry.first);
+    }
+    std::sort(all.begin(), all.end());
+    return all;
+}
+
+// Builds a snapshot in memory and writes it in the layout read above.
+class sf_snapshot_writer {
+ public:
+    struct axis {
+        std::string name;
+        int mode;
+        std::vector<double> edges;
+    };
+
+    void add_table(std::string, const std::vector<axis> &, const std::vector<double> &);
+    void add_graph(std::string, const std::vector<double> &, const std::vector<double> &);
+    void add_constant(std::string, double);
+    bool write(std::string);
+    size_t size() { return records; }
+
+ private:
+    void put_u32(uint32_t value) { buffer.append(reinterpret_cast<const char *>(&value), sizeof(value)); }
+    void put_u64(uint64_t value) { buffer.append(reinterpret_cast<const char *>(&value), sizeof(value)); }
+    void put_name(const std::string &);
+    void put_doubles(const std::vector<double> &values) {
+        buffer.append(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(double));
+    }
+    void put_record(int, std::string, const std::vector<axis> &, const std::vector<double> &);
+
+    std::string buffer;
+    uint32_t records = 0;
+};
+
+void sf_snapshot_writer::put_name(const std::string &name) {
+    put_u64(name.size());
+    buffer += name;
+    buffer.append((8 - name.size() % 8) % 8, '\0');
+}
+
+void sf_snapshot_writer::put_record(int kind, std::string name, const std::vector<axis> &axes, const std::vector<double> &values) {
+    put_u32(kind);
+    put_u32(axes.size());
+    put_u64(values.size());
+    put_name(name);
+    for (auto &ax : axes) {
+        put_u32(ax.mode);
+        put_u32(ax.edges.size());
+        put_name(ax.name);
+        put_doubles(ax.edges);
+    }
+    put_doubles(values);
+    records++;
+}
+
+void sf_snapshot_writer::add_table(std::string name, const std::vector<axis> &axes, const std::vector<double> &values) {
+    put_record(sf_table::table_kind, name, axes, values);
+}
+
+void sf_snapshot_writer::add_graph(std::string name, const std::vector<double> &x, const std::vector<double> &y) {
+    put_record(sf_table::graph_kind, name, {axis{"x", sf_table::points, x}}, y);
+}
+
+void sf_snapshot_writer::add_constant(std::string name, double value) {
+    put_record(sf_table::constant_kind, name, {}, {value});
+}
+
+bool sf_snapshot_writer::write(std::string filename) {
+    std::ofstream output(filename, std::ios::binary | std::ios::trunc);
+    if (!output.good()) {
+        std::cerr << "sf_snapshot_writer: unable to write " << filename << std::endl;
+        return false;
+    }
+    uint32_t file_version(sf_snapshot::version);
+    output.write("HTTSNAP", 8);
+    output.write(reinterpret_cast<const char *>(&file_version), sizeof(file_version));
+    output.write(reinterpret_cast<const char *>(&records), sizeof(records));
+    output.write(buffer.data(), buffer.size());
+    return output.good();
+}
+
+#endif  // INCLUDE_SF_SNAPSHOT_H_
@@ -0,0 +1,168 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_SHARED_RESOURCES_H_
+#define INCLUDE_SHARED_RESOURCES_H_
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include "RooWorkspace.h"
+#include "TFile.h"
+#include "./ACWeighter.h"
+#include "./ggh_theory_weights.h"
+#include "./pileup_table.h"
+#include "./sf_provider.h"
+#include "./sf_snapshot.h"
+
+// Inputs that are the same for many jobs, read once per process and kept
+// until it exits. With --manifest (job_manifest.h) one analyzer process runs
+// many jobs, and the scale factor workspaces (or snapshots), pileup tables,
+// NNLOPS graphs and AC weights of a sample are only read by the first job
+// needing them.
+//
+// The jobs of a process run one after the other, so the workspace variables
+// set while computing a weight can't be seen by another job. Objects booking
+// output branches (ggh_theory_weights::book) are booked again by every job.
+class shared_resources {
+ public:
+    // the RooWorkspace "w" of a scale factor file
+    static RooWorkspace *workspace(const std::string &);
+    static sf_snapshot *snapshot(const std::string &);
+    // scale factors from a workspace file, or from the tables of a snapshot with this prefix
+    static sf_provider *scale_factors(const std::string &);
+    static sf_provider *scale_factors(const std::string &, const std::string &);
+    static pileup_table *pileup(const std::string &, const std::string &, const std::string &, const std::string &);
+    static ggh_theory_weights *ggh_theory(const std::string &);
+    static ggh_theory_weights *ggh_theory(const std::string &, const std::string &);
+    // AC weights of a sample, filled on first use
+    static ACWeighter *ac_weights(const std::string &, const std::string &, const std::string &, const std::string &);
+
+    static void report(std::ostream &);
+
+ private:
+    template <class T>
+    static std::map<std::string, T *> &store() {
+        static std::map<std::string, T *> objects;
+        return objects;
+    }
+    static int &hits() {
+        static int count(0);
+        return count;
+    }
+};
+
+RooWorkspace *shared_resources::workspace(const std::string &filename) {
+    auto &workspaces = store<RooWorkspace>();
+    auto found = workspaces.find(filename);
+    if (found != workspaces.end()) {
+        hits()++;
+        return found->second;
+    }
+    TFile sf_file(filename.c_str());
+    auto w = reinterpret_cast<RooWorkspace *>(sf_file.Get("w"));
+    sf_file.Close();
+    workspaces[filename] = w;
+    return w;
+}
+
+sf_snapshot *shared_resources::snapshot(const std::string &filename) {
+    auto &snapshots = store<sf_snapshot>();
+    auto found = snapshots.find(filename);
+    if (found != snapshots.end()) {
+        hits()++;
+        return found->second;
+    }
+    auto snap = new sf_snapshot(filename);
+    if (!snap->isGood()) {
+        std::cerr << "Unable to use the scale factor snapshot " << filename << std::endl;
+        std::exit(1);
+    }
+    snapshots[filename] = snap;
+    return snap;
+}
+
+sf_provider *shared_resources::scale_factors(const std::string &filename) {
+    auto &providers = store<sf_provider>();
+    auto found = providers.find(filename);
+    if (found != providers.end()) {
+        return found->second;
+    }
+    auto provider = new sf_provider(workspace(filename));
+    providers[filename] = provider;
+    return provider;
+}
+
+sf_provider *shared_resources::scale_factors(const std::string &snapshot_name, const std::string &prefix) {
+    auto &providers = store<sf_provider>();
+    auto key = snapshot_name + ":" + prefix;
+    auto found = providers.find(key);
+    if (found != providers.end()) {
+        return found->second;
+    }
+    auto provider = new sf_provider(snapshot(snapshot_name), prefix);
+    providers[key] = provider;
+    return provider;
+}
+
+pileup_table *shared_resources::pileup(const std::string &mc_file, const std::string &data_file, const std::string &mc_hist,
+                                       const std::string &data_hist) {
+    auto &tables = store<pileup_table>();
+    auto key = mc_file + ":" + mc_hist + ":" + data_file + ":" + data_hist;
+    auto found = tables.find(key);
+    if (found != tables.end()) {
+        hits()++;
+        return found->second;
+    }
+    auto table = new pileup_table(mc_file, data_file, mc_hist, data_hist);
+    tables[key] = table;
+    return table;
+}
+
+ggh_theory_weights *shared_resources::ggh_theory(const std::string &filename) {
+    auto &weights = store<ggh_theory_weights>();
+    auto found = weights.find(filename);
+    if (found != weights.end()) {
+        hits()++;
+        return found->second;
+    }
+    auto theory = new ggh_theory_weights(filename);
+    weights[filename] = theory;
+    return theory;
+}
+
+ggh_theory_weights *shared_resources::ggh_theory(const std::string &snapshot_name, const std::string &prefix) {
+    auto &weights = store<ggh_theory_weights>();
+    auto key = snapshot_name + ":" + prefix;
+    auto found = weights.find(key);
+    if (found != weights.end()) {
+        hits()++;
+        return found->second;
+    }
+    auto theory = new ggh_theory_weights(snapshot(snapshot_name), prefix);
+    weights[key] = theory;
+    return theory;
+}
+
+ACWeighter *shared_resources::ac_weights(const std::string &original, const std::string &sample, const std::string &signal_type,
+                                         const std::string &year) {
+    auto &weighters = store<ACWeighter>();
+    auto key = original + ":" + sample + ":" + signal_type + ":" + year;
+    auto found = weighters.find(key);
+    if (found != weighters.end()) {
+        hits()++;
+        return found->second;
+    }
+    auto weighter = new ACWeighter(original, sample, signal_type, year);
+    weighter->fillWeightMap();
+    weighters[key] = weighter;
+    return weighter;
+}
+
+void shared_resources::report(std::ostream &out) {
+    out << "Shared resources: " << store<RooWorkspace>().size() << " workspaces, " << store<sf_snapshot>().size() << " snapshots, "
+        << store<pileup_table>().size() << " pileup tables, " << store<ggh_theory_weights>().size() << " NNLOPS tables, "
+        << store<ACWeighter>().size() << " AC weight maps loaded, " << hits() << " reused" << std::endl;
+}
+
+#endif  // INCLUDE_SHARED_RESOURCES_H_
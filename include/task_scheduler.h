@@ -0,0 +1,188 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_TASK_SCHEDULER_H_
+#define INCLUDE_TASK_SCHEDULER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// One unit of work for the scheduler: the command to run, the input it reads
+// (tasks with the same group share an input file) and its estimated cost.
+struct scheduled_task {
+    std::string name, command, group;
+    double cost;
+};
+
+// Work-stealing scheduler for many tasks of very different cost.
+//
+// Tasks are grouped by input. Groups are ordered by total cost and each one
+// is given, largest first, to the worker with the least work so far (LPT).
+// Each worker then runs its own queue from the front, so the tasks of a
+// group run back to back: the input is staged and in the page cache for all
+// of them. A worker whose queue is empty steals from the back of the busiest
+// queue. It takes tasks of that queue's last group, up to half of what is
+// left, so the big groups are still split when that is needed to finish.
+class task_scheduler {
+ public:
+    explicit task_scheduler(int _nworkers) : nworkers(std::max(_nworkers, 1)), steals(0), stolen(0) {}
+
+    void add(scheduled_task task) { tasks.push_back(task); }
+    size_t size() { return tasks.size(); }
+
+    // run every task with the function (0 means success), returns the number of failures
+    int run(std::function<int(const scheduled_task &)>);
+    void report(std::ostream &);
+
+ private:
+    struct worker_queue {
+        std::mutex lock;
+        std::deque<scheduled_task> tasks;
+        double remaining;
+    };
+
+    void plan();
+    bool next(int, scheduled_task *);
+    bool steal(int, scheduled_task *);
+    void work(int, std::function<int(const scheduled_task &)>, std::atomic<int> *);
+
+    int nworkers;
+    std::vector<scheduled_task> tasks;
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<double> busy_seconds;
+    std::atomic<int> steals, stolen;
+};
+
+void task_scheduler::plan() {
+    std::unordered_map<std::string, size_t> group_index;
+    std::vector<std::pair<double, std::vector<scheduled_task>>> groups;
+    for (auto &task : tasks) {
+        auto found = group_index.find(task.group);
+        if (found == group_index.end()) {
+            found = group_index.insert(std::make_pair(task.group, groups.size())).first;
+            groups.push_back(std::make_pair(0., std::vector<scheduled_task>()));
+        }
+        groups[found->second].first += task.cost;
+        groups[found->second].second.push_back(task);
+    }
+    std::stable_sort(groups.begin(), groups.end(), [](const std::pair<double, std::vector<scheduled_task>> &a,
+                                                      const std::pair<double, std::vector<scheduled_task>> &b) { return a.first > b.first; });
+
+    queues.clear();
+    for (int i = 0; i < nworkers; i++) {
+        queues.emplace_back(new worker_queue());
+        queues.back()->remaining = 0.;
+    }
+    for (auto &group : groups) {
+        auto least = std::min_element(queues.begin(), queues.end(),
+                                      [](const std::unique_ptr<worker_queue> &a, const std::unique_ptr<worker_queue> &b) {
+                                          return a->remaining < b->remaining;
+                                      });
+        std::stable_sort(group.second.begin(), group.second.end(),
+                         [](const scheduled_task &a, const scheduled_task &b) { return a.cost > b.cost; });
+        for (auto &task : group.second) {
+            (*least)->tasks.push_back(task);
+        }
+        (*least)->remaining += group.first;
+    }
+}
+
+bool task_scheduler::next(int worker, scheduled_task *task) {
+    auto &queue = *queues.at(worker);
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    *task = queue.tasks.front();
+    queue.tasks.pop_front();
+    queue.remaining -= task->cost;
+    return true;
+}
+
+// false once every queue is empty
+bool task_scheduler::steal(int thief, scheduled_task *task) {
+    std::vector<scheduled_task> taken;
+    while (taken.empty()) {
+        // the victim is the queue with the most work left
+        int victim(-1);
+        double most(0.);
+        for (int i = 0; i < nworkers; i++) {
+            std::lock_guard<std::mutex> guard(queues.at(i)->lock);
+            if (i != thief && !queues.at(i)->tasks.empty() && (victim < 0 || queues.at(i)->remaining > most)) {
+                victim = i;
+                most = queues.at(i)->remaining;
+            }
+        }
+        if (victim < 0) {
+            return false;
+        }
+
+        // it may have been emptied in the meantime, then look again
+        std::lock_guard<std::mutex> guard(queues.at(victim)->lock);
+        auto &from = *queues.at(victim);
+        size_t limit = std::max(from.tasks.size() / 2, static_cast<size_t>(1));
+        while (!from.tasks.empty() && taken.size() < limit && (taken.empty() || from.tasks.back().group == taken.front().group)) {
+            taken.push_back(from.tasks.back());
+            from.remaining -= from.tasks.back().cost;
+            from.tasks.pop_back();
+        }
+    }
+    steals++;
+    stolen += taken.size();
+
+    // largest first in the thief's queue as well
+    std::lock_guard<std::mutex> guard(queues.at(thief)->lock);
+    auto &to = *queues.at(thief);
+    for (auto &stolen_task : taken) {
+        to.tasks.push_front(stolen_task);
+        to.remaining += stolen_task.cost;
+    }
+    *task = to.tasks.front();
+    to.tasks.pop_front();
+    to.remaining -= task->cost;
+    return true;
+}
+
+void task_scheduler::work(int worker, std::function<int(const scheduled_task &)> execute, std::atomic<int> *failures) {
+    scheduled_task task;
+    while (next(worker, &task) || steal(worker, &task)) {
+        auto start = std::chrono::steady_clock::now();
+        if (execute(task) != 0) {
+            (*failures)++;
+        }
+        busy_seconds.at(worker) += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int task_scheduler::run(std::function<int(const scheduled_task &)> execute) {
+    plan();
+    busy_seconds.assign(nworkers, 0.);
+    std::atomic<int> failures(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < nworkers; i++) {
+        workers.push_back(std::thread(&task_scheduler::work, this, i, execute, &failures));
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    return failures;
+}
+
+void task_scheduler::report(std::ostream &out) {
+    out << "Scheduler: " << tasks.size() << " tasks on " << nworkers << " workers, " << steals << " steals (" << stolen << " tasks)" << std::endl;
+    for (int i = 0; i < nworkers && i < static_cast<int>(busy_seconds.size()); i++) {
+        out << "\t worker " << i << ": busy " << busy_seconds.at(i) << " s" << std::endl;
+    }
+}
+
+#endif  // INCLUDE_TASK_SCHEDULER_H_
@@ -0,0 +1,152 @@
+// Copyright 2020 Tyler Mitchell
+
+#ifndef INCLUDE_VBF_THEORY_WEIGHTS_H_
+#define INCLUDE_VBF_THEORY_WEIGHTS_H_
+
+#include <array>
+#include <string>
+#include "TROOT.h"
+
+// qq2Hqq (VBF) theory uncertainties of the STXS stage 1.1 scheme.
+//
+// The inputs are the ones in qq2Hqq_uncert_scheme.h: bin acceptances from
+// POWHEG VBFH + PYTHIA8, uncertainty amplitudes from proVBF NNLO and the
+// POWHEG cross section of each bin. vbf_uncert_stage_1_1 combines them per
+// event as 1 + Nsigma * acc[bin][source] * delta[source] / xsec[bin]; here
+// the relative shift for every (bin, source) pair is computed at compile time
+// so the per-event cost is one row lookup.
+namespace vbf_theory {
+
+const int n_sources = 10;  // tot, PTH200, Mjj60, Mjj120, Mjj350, Mjj700, Mjj1000, Mjj1500, 25, JET01
+const int first_bin = 200;
+const int n_bins = 25;     // STXS bins 200 - 224
+
+constexpr double acceptance[n_bins][n_sources] = {
+    {0.07, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0.0744, 0, 0, 0, 0, 0, 0, 0, 0, -0.1649},
+    {0.3367, 0, 0, 0, 0, 0, 0, 0, 0, -0.7464},
+    {0.0092, 0, -0.6571, 0, 0, 0, 0, 0, -0.0567, 0.0178},
+    {0.0143, 0, 0.0282, -0.5951, 0, 0, 0, 0, -0.0876, 0.0275},
+    {0.0455, 0, 0.0902, 0.0946, -0.3791, 0, 0, 0, -0.2799, 0.0877},
+    {0.0048, 0, -0.3429, 0, 0, 0, 0, 0, +0.0567, 0.0093},
+    {0.0097, 0, 0.0192, -0.4049, 0, 0, 0, 0, +0.0876, 0.0187},
+    {0.0746, 0, 0.1477, 0.0155, -0.6209, 0, 0, 0, +0.2799, 0.1437},
+    {0.0375, 0.1166, 0.0743, 0.078, 0.1039, -0.2757, 0, 0, -0.2306, 0.0723},
+    {0.0985, 0.3062, 0.1951, 0.2048, 0.273, -0.7243, 0, 0, +0.2306, 0.1898},
+    {0.0166, 0.0515, 0.0328, 0.0345, 0.0459, 0.0773, -0.2473, 0, -0.1019, 0.0319},
+    {0.0504, 0.1568, 0.0999, 0.1049, 0.1398, 0.2353, -0.7527, 0, +0.1019, 0.0972},
+    {0.0137, 0.0426, 0.0271, 0.0285, 0.0379, 0.0639, 0.0982, -0.2274, -0.0842, 0.0264},
+    {0.0465, 0.1446, 0.0922, 0.0967, 0.1289, 0.2171, 0.3335, -0.7726, +0.0842, 0.0897},
+    {0.0105, 0.0327, 0.0208, 0.0219, 0.0291, 0.0491, 0.0754, 0.1498, -0.0647, 0.0203},
+    {0.048, 0.1491, 0.095, 0.0998, 0.133, 0.2239, 0.344, 0.6836, +0.0647, 0.0925},
+    {0.0051, -0.1304, 0.0101, 0.0106, 0.0141, 0.0238, 0.0366, 0.0727, -0.0314, 0.0098},
+    {0.0054, -0.1378, 0.0107, 0.0112, 0.0149, 0.0251, 0.0386, 0.0768, +0.0314, 0.0104},
+    {0.0032, -0.0816, 0.0063, 0.0066, 0.0088, 0.0149, 0.0229, 0.0455, -0.0196, 0.0062},
+    {0.0047, -0.1190, 0.0092, 0.0097, 0.0129, 0.0217, 0.0334, 0.0663, +0.0196, 0.0090},
+    {0.0034, -0.0881, 0.0068, 0.0072, 0.0096, 0.0161, 0.0247, 0.0491, -0.0212, 0.0066},
+    {0.0056, -0.1440, 0.0112, 0.0117, 0.0156, 0.0263, 0.0404, 0.0802, +0.0212, 0.0109},
+    {0.0036, -0.0929, 0.0072, 0.0076, 0.0101, 0.0169, 0.026, 0.0518, -0.0223, 0.0070},
+    {0.0081, -0.2062, 0.016, 0.0168, 0.0223, 0.0376, 0.0578, 0.1149, +0.0223, 0.0155}};
+
+constexpr double deltas[n_sources] = {14.867, 0.394, 9.762, 6.788, 7.276, 3.645, 2.638, 1.005, 20.073, 18.094};
+
+constexpr double powheg_xsec[n_bins] = {273.952, 291.030, 1317.635, 36.095,  55.776,  178.171, 18.839, 37.952, 291.846,
+                                        146.782, 385.566, 64.859,   197.414, 53.598,  182.107, 41.167, 187.823, 19.968,
+                                        21.092,  12.496,  18.215,   13.490,  22.044,  14.220,  31.565};
+
+struct shift_table {
+    double shift[n_bins][n_sources];
+};
+
+constexpr shift_table make_shifts() {
+    shift_table table{};
+    for (int bin = 0; bin < n_bins; bin++) {
+        for (int source = 0; source < n_sources; source++) {
+            table.shift[bin][source] = acceptance[bin][source] * deltas[source] / powheg_xsec[bin];
+        }
+    }
+    return table;
+}
+
+constexpr shift_table shifts = make_shifts();
+
+}  // namespace vbf_theory
+
+// Per-event access to the table. Source N is varied by VBF_RivetN_Up/_Down
+// with weight 1 + u[N] or 1 - u[N]. Events outside bins 200 - 224 get no
+// shift.
+class vbf_theory_weights {
+ public:
+    typedef std::array<double, vbf_theory::n_sources> uncertainties;
+
+    vbf_theory_weights() { branches.fill(nullptr); }
+
+    static uncertainties get(int);
+    static int source(std::string);
+    static std::string variation(int, bool);
+    static double weight(const uncertainties &, std::string);
+
+    template <class Tree>
+    void book(Tree *);
+    void fill(const uncertainties &);
+
+ private:
+    std::array<Float_t *, 2 * vbf_theory::n_sources> branches;  // Up, Down for each source
+};
+
+vbf_theory_weights::uncertainties vbf_theory_weights::get(int stxs) {
+    uncertainties result;
+    result.fill(0.);
+    int bin = stxs - vbf_theory::first_bin;
+    if (bin >= 0 && bin < vbf_theory::n_bins) {
+        for (int i = 0; i < vbf_theory::n_sources; i++) {
+            result[i] = vbf_theory::shifts.shift[bin][i];
+        }
+    }
+    return result;
+}
+
+// index of the source in "VBF_RivetN_Up/Down", -1 if syst isn't one
+int vbf_theory_weights::source(std::string syst) {
+    auto pos = syst.find("VBF_Rivet");
+    if (pos == std::string::npos || pos + 9 >= syst.size()) {
+        return -1;
+    }
+    int index = syst.at(pos + 9) - '0';
+    return (index >= 0 && index < vbf_theory::n_sources) ? index : -1;
+}
+
+std::string vbf_theory_weights::variation(int source, bool up) {
+    return "VBF_Rivet" + std::to_string(source) + (up ? "_Up" : "_Down");
+}
+
+// weight for the systematic being run, 1 for anything but VBF_Rivet
+double vbf_theory_weights::weight(const uncertainties &uncs, std::string syst) {
+    int index = source(syst);
+    if (index < 0) {
+        return 1.;
+    }
+    return syst.find("_Down") != std::string::npos ? 1. - uncs[index] : 1. + uncs[index];
+}
+
+// Book one weight branch per variation so all of them are available from the
+// nominal pass.
+template <class Tree>
+void vbf_theory_weights::book(Tree *st) {
+    for (int i = 0; i < vbf_theory::n_sources; i++) {
+        branches[2 * i] = st->add_weight_branch(variation(i, true));
+        branches[2 * i + 1] = st->add_weight_branch(variation(i, false));
+    }
+}
+
+void vbf_theory_weights::fill(const uncertainties &uncs) {
+    if (branches[0] == nullptr) {
+        return;
+    }
+    for (int i = 0; i < vbf_theory::n_sources; i++) {
+        *branches[2 * i] = 1. + uncs[i];
+        *branches[2 * i + 1] = 1. - uncs[i];
+    }
+}
+
+#endif  // INCLUDE_VBF_THEORY_WEIGHTS_H_
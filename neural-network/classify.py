@@ -13,6 +13,7 @@ from array import array
 from pprint import pprint
 import multiprocessing
 import subprocess
+from dataset import load_scaler
 
 
 def build_filelist(input_dir):
@@ -87,7 +88,7 @@ def main(args):
 
     # get scaler setup
     scaler = StandardScaler()
-    scaler_info = pd.HDFStore(args.input_name)['scaler']
+    scaler_info = load_scaler(args.input_name)
     scaler_info = scaler_info.drop('isSM', axis=0)
     scaler.mean_ = scaler_info['mean'].values.reshape(1, -1)
     scaler.scale_ = scaler_info['scale'].values.reshape(1, -1)
@@ -0,0 +1,39 @@
+import uproot
+import numpy as np
+import pandas as pd
+
+
+def load_scaler(name):
+    """Return the scaler constants (mean, scale, variance, nsamples indexed by variable)."""
+    if not name.endswith('.root'):
+        return pd.HDFStore(name)['scaler']
+
+    scaler_tree = uproot.open(name)['scaler']
+    scaler_info = pd.DataFrame.from_dict({
+        key: scaler_tree.array(key) for key in ['mean', 'scale', 'variance', 'nsamples']
+    })
+    scaler_info.set_index(np.array([str(ivar) for ivar in scaler_tree.array('name')]), inplace=True)
+    return scaler_info
+
+
+def load_dataset(name, syst='nominal'):
+    """Load a training set from preprocess.py (.h5) or plugins/Tools/export_training.cc (.root).
+
+    The exported file stores unscaled inputs, so they are scaled here to give
+    the same DataFrame as the HDF5 store.
+    """
+    if not name.endswith('.root'):
+        return pd.HDFStore(name)[syst]
+
+    open_file = uproot.open(name)
+    data = open_file[syst].pandas.df()
+    scaler_info = load_scaler(name)
+    for var in scaler_info.index.values:
+        data[var] = (data[var] - scaler_info.loc[var, 'mean']) / scaler_info.loc[var, 'scale']
+
+    samples = open_file['samples']
+    sample_names = np.array([str(iname) for iname in samples.array('sample_names')])
+    lepton = np.array([str(ilep) for ilep in samples.array('lepton')])
+    data['sample_names'] = sample_names[data['sample'].values]
+    data['lepton'] = lepton[data['sample'].values]
+    return data.drop('sample', axis=1).reset_index(drop=True)
@@ -1,25 +1,56 @@
 from visualize import discPlot, trainingPlots
+from dataset import load_dataset, load_scaler
 from time import time
 from sklearn.model_selection import train_test_split
 from os import environ
 environ['KERAS_BACKEND'] = 'tensorflow'
 from keras.callbacks import ModelCheckpoint, EarlyStopping, TensorBoard
 from keras.layers import Dense, Dropout
-from keras.models import Sequential
+from keras.models import Sequential, load_model
 from keras import optimizers
 import matplotlib.pyplot as plt
 import numpy as np
 import pandas as pd
+import json
+
+
+def export_model(model_name, input_name, training_variables):
+    """Write the best model with its scaler constants to Output/models/{model}.json for include/nn_inference.h"""
+    model = load_model('Output/models/{}.hdf5'.format(model_name))
+    scaler_info = load_scaler(input_name).loc[training_variables]
+    layers = []
+    for layer in model.layers:
+        if not isinstance(layer, Dense):
+            continue  # dropout does nothing when classifying
+        kernel, bias = layer.get_weights()
+        layers.append({
+            'activation': layer.get_config()['activation'],
+            'weights': kernel.tolist(),
+            'bias': bias.tolist()
+        })
+
+    with open('Output/models/{}.json'.format(model_name), 'w') as outfile:
+        json.dump({
+            'inputs': training_variables,
+            'mean': scaler_info['mean'].values.tolist(),
+            'scale': scaler_info['scale'].values.tolist(),
+            'layers': layers
+        }, outfile)
+    print 'Exported model to Output/models/{}.json'.format(model_name)
 
 
 def main(args):
-    data = pd.HDFStore(args.input)['nominal']
     # define training variables
     training_variables = [
         'Q2V1', 'Q2V2', 'Phi', 'Phi1', 'costheta1', 'costheta2',
         'costhetastar', 'mjj', 'higgs_pT', 'm_sv'
     ]
 
+    if args.export_only:
+        export_model(args.model, args.input, training_variables)
+        return
+
+    data = load_dataset(args.input)
     nvars = len(training_variables)
 
     # build the model
@@ -71,6 +102,9 @@ def main(args):
                         callbacks=callbacks, validation_split=0.25, sample_weight=training_weights
                         )
 
+    # model for the C++ inference (analyzers and add_nn_disc)
+    export_model(args.model, args.input, training_variables)
+
     # plotting things
     trainingPlots(history, 'trainingPlot_{}'.format(args.model))
 
@@ -104,5 +138,7 @@ if __name__ == "__main__":
     parser.add_argument('--background', '-b', action='store', dest='background',
                         default='ZTT.root', help='name of background file')
     parser.add_argument('--dont-plot', action='store_true', dest='dont_plot', help='don\'t make training plots')
+    parser.add_argument('--export-only', action='store_true', dest='export_only',
+                        help='only export an already trained model for the C++ inference')
 
     main(parser.parse_args())
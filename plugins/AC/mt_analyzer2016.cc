@@ -5,6 +5,7 @@
 #include <cmath>
 #include <fstream>
 #include <iostream>
+#include <memory>
 
 // ROOT includes
 #include "RooFunctor.h"
@@ -21,18 +22,31 @@
 #include "../../include/ACWeighter.h"
 #include "../../include/CLParser.h"
 #include "../../include/ComputeWG1Unc.h"
+#include "../../include/ggh_theory_weights.h"
+#include "../../include/vbf_theory_weights.h"
 #include "../../include/LumiReweightingStandAlone.h"
 #include "../../include/fsa/event_factory.h"
 #include "../../include/fsa/jet_factory.h"
 #include "../../include/fsa/met_factory.h"
 #include "../../include/fsa/muon_factory.h"
 #include "../../include/slim_tree.h"
+#include "../../include/checkpoint.h"
+#include "../../include/entry_range.h"
+#include "../../include/event_filter.h"
+#include "../../include/fake_factor.h"
+#include "../../include/file_stager.h"
+#include "../../include/friend_output.h"
+#include "../../include/job_manifest.h"
+#include "../../include/pileup_table.h"
+#include "../../include/selection_cache.h"
+#include "../../include/sf_cache.h"
+#include "../../include/shared_resources.h"
 #include "../../include/swiss_army_class.h"
 #include "../../include/fsa/tau_factory.h"
 
 typedef std::vector<double> NumV;
 
-int main(int argc, char *argv[]) {
+int analyze(int argc, char *argv[]) {
     ////////////////////////////////////////////////
     // Initial setup:                             //
     // Get file names, normalization, paths, etc. //
@@ -46,6 +60,24 @@ int main(int argc, char *argv[]) {
     std::string sample = parser.Option("-s");
     std::string output_dir = parser.Option("-d");
     std::string signal_type = parser.Option("--stype");
+    std::string schema = parser.Option("--schema");
+    std::string golden = parser.Option("--golden");
+    std::string dedup_mb = parser.Option("--dedup-mb");
+    bool dedup = parser.Flag("--dedup");
+    bool bloom = parser.Flag("--bloom");
+    std::string stage_dir = parser.Option("--stage");
+    std::string first_entry = parser.Option("--first");
+    std::string last_entry = parser.Option("--last");
+    std::string shard = parser.Option("--shard");
+    std::string checkpoint_interval = parser.Option("--checkpoint");
+    bool resume = parser.Flag("--resume");
+    std::string ff_fractions = parser.Option("--ff");
+    bool ff_syst = parser.Flag("--ff-syst");
+    std::string nn_model = parser.Option("--nn");
+    std::string sf_snapshot_name = parser.Option("--sf-snapshot");
+    std::string sf_cache_dir = parser.Option("--sf-cache");
+    std::string sel_cache_dir = parser.Option("--sel-cache");
+    bool friend_mode = parser.Flag("--friend");
     std::string fname = path + sample + ".root";
     bool isData = sample.find("data") != std::string::npos;
     bool isEmbed = sample.find("embed") != std::string::npos || name.find("embed") != std::string::npos;
@@ -58,15 +90,21 @@ int main(int argc, char *argv[]) {
         systname = "SYST_" + syst;
     }
 
+    // entries of the input processed by this job
+    entry_range range(first_entry, last_entry, shard);
+    if (!range.isGood()) {
+        return 1;
+    }
+
     // create output path
     auto suffix = "_output.root";
     auto prefix = "Output/trees/" + output_dir;
     std::string filename, logname;
-    filename = prefix + "/" + systname + "/" + sample + std::string("_") + name + "_" + systname + suffix;
-    logname = prefix + "/logs/" + sample + std::string("_") + name + "_" + systname + ".txt";
+    filename = prefix + "/" + systname + "/" + sample + std::string("_") + name + "_" + systname + range.getSuffix() + suffix;
+    logname = prefix + "/logs/" + sample + std::string("_") + name + "_" + systname + range.getSuffix() + ".txt";
 
     if (condor) {
-        filename = sample + std::string("_") + name + "_" + systname + suffix;
+        filename = sample + std::string("_") + name + "_" + systname + range.getSuffix() + suffix;
     }
 
     // create the log file
@@ -88,28 +126,57 @@ int main(int argc, char *argv[]) {
     running_log << "\t sample: " << sample << std::endl;
     running_log << "\t output_dir: " << output_dir << std::endl;
     running_log << "\t signal_type: " << signal_type << std::endl;
+    running_log << "\t schema: " << (schema.empty() ? "default" : schema) << std::endl;
+    running_log << "\t golden: " << golden << " dedup: " << dedup << std::endl;
+    running_log << "\t stage: " << (stage_dir.empty() ? "none" : stage_dir) << std::endl;
+    running_log << "\t entries: " << (range.isSharded() ? range.getSuffix().substr(1) : "all") << std::endl;
+    running_log << "\t checkpoint: " << (checkpoint_interval.empty() ? "none" : checkpoint_interval + " s") << " resume: " << resume << std::endl;
+    running_log << "\t fake factors: " << (ff_fractions.empty() ? "none" : ff_fractions) << " systematics: " << ff_syst << std::endl;
+    running_log << "\t nn: " << (nn_model.empty() ? "none" : nn_model) << std::endl;
+    running_log << "\t sf snapshot: " << (sf_snapshot_name.empty() ? "none" : sf_snapshot_name) << std::endl;
+    running_log << "\t sf cache: " << (sf_cache_dir.empty() ? "none" : sf_cache_dir) << std::endl;
+    running_log << "\t selection cache: " << (sel_cache_dir.empty() ? "none" : sel_cache_dir) << std::endl;
+    running_log << "\t friend: " << friend_mode << std::endl;
     running_log << "\t isData: " << isData << " isEmbed: " << isEmbed << " doAC: " << doAC << std::endl;
 
     // open input file
-    auto fin = TFile::Open(fname.c_str());
+    file_stager stager(stage_dir);
+    std::string input_name = stager.stage(fname);
+    auto fin = TFile::Open(input_name.c_str());
     auto ntuple = reinterpret_cast<TTree *>(fin->Get("mutau_tree"));
+    range.setTree(ntuple);
 
     // get number of generated events
     auto counts = reinterpret_cast<TH1D *>(fin->Get("nevents"));
     auto gen_number = counts->GetBinContent(2);
 
     // create output file
-    auto fout = new TFile(filename.c_str(), "RECREATE");
-    counts->Write();
-    fout->mkdir("grabbag");
+    // reopened instead of recreated when resuming an interrupted job
+    checkpoint ckpt(filename, checkpoint_interval, resume);
+    auto fout = ckpt.getFile();
+    if (!ckpt.isResumed()) {
+        // copied once per input file, not once per shard
+        if (range.isFirst()) {
+            counts->Write();
+        }
+        range.write(fout);
+        fout->mkdir("grabbag");
+    }
     fout->cd("grabbag");
 
     // initialize Helper class
-    Helper *helper = new Helper(fout, name, syst);
+    std::unique_ptr<Helper> helper(new Helper(fout, name, syst));
 
     // cd to root of output file and create tree
     fout->cd();
-    slim_tree *st = new slim_tree("mt_tree", doAC);
+    std::unique_ptr<slim_tree> st(new slim_tree("mt_tree", doAC, schema));
+    if (!schema.empty() && !st->schema.isLoaded()) {
+        return 1;
+    }
+    // data keeps the event keys for fast_merge --dedup
+    if (isData) {
+        st->keep_event_keys();
+    }
 
     std::string original = sample;
     if (name == "VBF125") {
@@ -129,8 +196,7 @@ int main(int argc, char *argv[]) {
     }
 
     // reweighter for anomolous coupling samples
-    ACWeighter ac_weights = ACWeighter(original, sample, signal_type, "2016");
-    ac_weights.fillWeightMap();
+    ACWeighter *ac_weights = shared_resources::ac_weights(original, sample, signal_type, "2016");
 
     // get normalization (lumi & xs are in util.h)
     double norm(1.);
@@ -145,27 +211,89 @@ int main(int argc, char *argv[]) {
 
     // read inputs for lumi reweighting
     auto lumi_weights =
-        new reweight::LumiReWeighting("/hdfs/store/user/tmitchel/HTT_ScaleFactors/MC_Moriond17_PU25ns_V1.root",
-                                      "/hdfs/store/user/tmitchel/HTT_ScaleFactors/Data_Pileup_2016_271036-284044_80bins.root", "pileup", "pileup");
+        shared_resources::pileup(stager.stage("/hdfs/store/user/tmitchel/HTT_ScaleFactors/MC_Moriond17_PU25ns_V1.root"),
+                                 stager.stage("/hdfs/store/user/tmitchel/HTT_ScaleFactors/Data_Pileup_2016_271036-284044_80bins.root"), "pileup",
+                                 "pileup");
+
+    // pileup weight and its variations are stored for every event
+    Float_t *puweight = st->add_weight_branch("puweight");
+    Float_t *puweight_up = st->add_weight_branch("puweight_up");
+    Float_t *puweight_down = st->add_weight_branch("puweight_down");
+
+    // legacy sf's, or their tables from make_sf_snapshot
+    sf_provider *htt_sf;
+    if (sf_snapshot_name.empty()) {
+        htt_sf = shared_resources::scale_factors(stager.stage("/hdfs/store/user/tmitchel/HTT_ScaleFactors/htt_scalefactors_legacy_2016.root"));
+    } else {
+        htt_sf = shared_resources::scale_factors(stager.stage(sf_snapshot_name), "htt");
+    }
 
-    // legacy sf's
-    TFile htt_sf_file("/hdfs/store/user/tmitchel/HTT_ScaleFactors/htt_scalefactors_legacy_2016.root");
-    RooWorkspace *htt_sf = reinterpret_cast<RooWorkspace *>(htt_sf_file.Get("w"));
-    htt_sf_file.Close();
+    // written by the nominal job, the systematic jobs of the sample reuse the unchanged sf's
+    std::string sf_cache_name;
+    if (!sf_cache_dir.empty()) {
+        sf_cache_name = sf_cache_dir + "/" + sample + "_" + name + range.getSuffix() + ".sfc";
+    }
+    sf_cache cache(sf_cache_name, (syst.empty() || syst == "NOMINAL") && !ckpt.isResumed());
+    htt_sf->setCache(&cache);
+
+    // the selection in the order it is applied, with the inputs each cut reads. Systematic jobs don't read
+    // the entries the nominal job rejected with cuts their shift can't change
+    std::string sel_cache_name;
+    if (!sel_cache_dir.empty()) {
+        sel_cache_name = sel_cache_dir + "/" + original + "_" + name + range.getSuffix() + ".sel";
+    }
+    selection_cache selection(sel_cache_name, syst, (syst.empty() || syst == "NOMINAL") && !ckpt.isResumed(), range.getFirst(),
+                              range.getLast());
+    int cut_flags = selection.cut("flags", 2, selection_cache::flags);
+    int cut_process = selection.cut("process", 3, selection_cache::gen_match);
+    int cut_os = selection.cut("OS", 4, selection_cache::charge);
+    int cut_mt = selection.cut("mt", 5, selection_cache::lepton | selection_cache::met);
+    int cut_bveto = selection.cut("b-jet veto", 6, selection_cache::jets);
+    int cut_region = selection.cut("region", 7, selection_cache::isolation);
 
     // MadGraph Higgs pT file
-    RooWorkspace *mg_sf;
-    if (signal_type == "madgraph") {
-        TFile mg_sf_file("/hdfs/store/user/tmitchel/HTT_ScaleFactors/htt_scalefactors_2016_MGggh.root");
-        mg_sf = reinterpret_cast<RooWorkspace *>(mg_sf_file.Get("w"));
-        mg_sf_file.Close();
+    sf_provider *mg_sf;
+    if (signal_type == "madgraph" && sf_snapshot_name.empty()) {
+        mg_sf = shared_resources::scale_factors(stager.stage("/hdfs/store/user/tmitchel/HTT_ScaleFactors/htt_scalefactors_2016_MGggh.root"));
+    } else if (signal_type == "madgraph") {
+        mg_sf = shared_resources::scale_factors(stager.stage(sf_snapshot_name), "mg");
     }
 
-    TFile *f_NNLOPS = new TFile("/hdfs/store/user/tmitchel/HTT_ScaleFactors/NNLOPS_reweight.root");
-    TGraph *g_NNLOPS_0jet = reinterpret_cast<TGraph *>(f_NNLOPS->Get("gr_NNLOPSratio_pt_powheg_0jet"));
-    TGraph *g_NNLOPS_1jet = reinterpret_cast<TGraph *>(f_NNLOPS->Get("gr_NNLOPSratio_pt_powheg_1jet"));
-    TGraph *g_NNLOPS_2jet = reinterpret_cast<TGraph *>(f_NNLOPS->Get("gr_NNLOPSratio_pt_powheg_2jet"));
-    TGraph *g_NNLOPS_3jet = reinterpret_cast<TGraph *>(f_NNLOPS->Get("gr_NNLOPSratio_pt_powheg_3jet"));
+    ggh_theory_weights *ggh_theory;
+    if (sf_snapshot_name.empty()) {
+        ggh_theory = shared_resources::ggh_theory(stager.stage("/hdfs/store/user/tmitchel/HTT_ScaleFactors/NNLOPS_reweight.root"));
+    } else {
+        ggh_theory = shared_resources::ggh_theory(stager.stage(sf_snapshot_name), "nnlops");
+    }
+    if (sample == "ggh125" && signal_type == "powheg") {
+        ggh_theory->book(st.get());
+    }
+
+    std::unique_ptr<vbf_theory_weights> vbf_theory(new vbf_theory_weights());
+    if (sample == "vbf125" && signal_type == "powheg") {
+        vbf_theory->book(st.get());
+    }
+
+    // jet -> tau fake factors for the anti-isolated region
+    std::unique_ptr<fake_factor> fakes;
+    if (!ff_fractions.empty()) {
+        std::string ff_dir = "/hdfs/store/user/tmitchel/deep-tau-fake-factor/ff_files_mt_2016/";
+        fakes.reset(new fake_factor(stager.stage(ff_dir + "uncorrected_fakefactors_mt.root"), stager.stage(ff_dir + "FF_corrections_1.root"),
+                                stager.stage(ff_dir + "FF_QCDcorrectionOSSS.root"), ff_fractions, "mt", isData));
+        if (!fakes->isGood()) {
+            return 1;
+        }
+        fakes->book(st.get(), ff_syst);
+    }
+
+    // NN discriminant evaluated while filling
+    std::unique_ptr<dense_network> network;
+    if (!nn_model.empty()) {
+        network.reset(new dense_network(stager.stage(nn_model)));
+        if (!network->isGood() || !st->add_nn_disc(network.get())) {
+            return 1;
+        }
+    }
 
     //////////////////////////////////////
     // Final setup:                     //
@@ -183,16 +311,58 @@ int main(int argc, char *argv[]) {
         event.setRivets(ntuple);
     }
 
+    // certified lumi and duplicate event filtering for data
+    event_filter filter;
+    if (isData && !golden.empty() && !filter.setLumiMask(golden)) {
+        return 1;
+    }
+    if (isData && dedup && !filter.setDuplicateFilter(range.getEntries(), dedup_mb.empty() ? 0 : std::stoul(dedup_mb), bloom)) {
+        return 1;
+    }
+
+    // systematic outputs keep only the columns they change next to the nominal rows, unless checkpointed
+    friend_output friends(friend_mode && !condor && checkpoint_interval.empty() && !resume ? friend_output::config : "", syst,
+                          prefix + "/NOMINAL/" + original + "_" + name + "_NOMINAL" + range.getSuffix() + suffix, "mt_tree");
+    if (friend_mode) {
+        st->add_row_key(original + "_" + name);
+        st->use_friends(&friends);
+    }
+
+    // continue from the last checkpoint of an interrupted job
+    Long64_t start_entry = ckpt.resume(st.get(), helper.get(), ntuple, &event, &filter, range.getFirst());
+
+    // read-ahead for the input tree
+    cluster_prefetcher prefetch(ntuple, input_name);
+    prefetch.set_range(start_entry, range.getLast());
+
     // begin the event loop
-    Int_t nevts = ntuple->GetEntries();
-    int progress(0), fraction((nevts - 1) / 10);
-    for (Int_t i = 0; i < nevts; i++) {
+    Long64_t nevts = range.getEntries();
+    Long64_t progress(0), fraction((nevts - 1) / 10);
+    for (Long64_t i = start_entry; i < range.getLast(); i++) {
+        ckpt.update(i, st.get(), helper.get());
+
+        // rejected by the nominal job with cuts this systematic can't change
+        if (selection.skip(i)) {
+            helper->create_and_fill("cutflow", {8, 0.5, 8.5}, 1, 1.);
+            for (auto bin : selection.passed_bins()) {
+                helper->create_and_fill("cutflow", {8, 0.5, 8.5}, bin, 1.);
+            }
+            continue;
+        }
+
         ntuple->GetEntry(i);
-        if (i == progress * fraction) {
+        cache.setEntry(i);
+        st->setEntry(i);
+        prefetch.next(i);
+        if (i - range.getFirst() >= progress * fraction) {
             running_log << "LOG: Processing: " << progress * 10 << "% complete." << std::endl;
             progress++;
         }
 
+        if (filter.isActive() && !filter.pass(&event)) {
+            continue;
+        }
+
         // find the event weight (not lumi*xs if looking at W or Drell-Yan)
         Float_t evtwt(norm), corrections(1.), sf_trig(1.), sf_id(1.), sf_iso(1.), sf_reco(1.);
         if (name == "W") {
@@ -225,6 +395,7 @@ int main(int argc, char *argv[]) {
         helper->create_and_fill("cutflow", {8, 0.5, 8.5}, 1, 1.);
 
         // run factories
+        event.run_factory();
         muons.run_factory();
         taus.run_factory();
         jets.run_factory();
@@ -234,26 +405,25 @@ int main(int argc, char *argv[]) {
         auto tau = taus.good_tau();
 
         // apply special ID for data
-        if (event.getPassFlags(isData)) {
+        if (selection.pass(cut_flags, event.getPassFlags(isData))) {
             helper->create_and_fill("cutflow", {8, 0.5, 8.5}, 2, 1.);
         } else {
             continue;
         }
 
         // Separate processes
-        if ((name == "ZL" || name == "TTL" || name == "VVL" || name == "STL") && tau.getGenMatch() > 4) {
-            continue;
-        } else if ((name == "ZTT" || name == "TTT" || name == "VVT" || name == "STT") && tau.getGenMatch() != 5) {
-            continue;
-        } else if ((name == "ZJ" || name == "TTJ" || name == "VVJ" || name == "STJ") && tau.getGenMatch() != 6) {
-            continue;
-        } else {
+        bool wrong_process = ((name == "ZL" || name == "TTL" || name == "VVL" || name == "STL") && tau.getGenMatch() > 4) ||
+                             ((name == "ZTT" || name == "TTT" || name == "VVT" || name == "STT") && tau.getGenMatch() != 5) ||
+                             ((name == "ZJ" || name == "TTJ" || name == "VVJ" || name == "STJ") && tau.getGenMatch() != 6);
+        if (selection.pass(cut_process, !wrong_process)) {
             helper->create_and_fill("cutflow", {8, 0.5, 8.5}, 3, 1.);
+        } else {
+            continue;
         }
 
         // only opposite-sign
         int evt_charge = tau.getCharge() + muon.getCharge();
-        if (evt_charge == 0) {
+        if (selection.pass(cut_os, evt_charge == 0)) {
             helper->create_and_fill("cutflow", {8, 0.5, 8.5}, 4, 1.);
         } else {
             continue;
@@ -269,14 +439,14 @@ int main(int argc, char *argv[]) {
         double mt = sqrt(pow(muon.getPt() + met_pt, 2) - pow(muon.getP4().Px() + met_x, 2) - pow(muon.getP4().Py() + met_y, 2));
 
         // now do mt selection
-        if (mt < 50) {
+        if (selection.pass(cut_mt, mt < 50)) {
             helper->create_and_fill("cutflow", {8, 0.5, 8.5}, 5, 1.);
         } else {
             continue;
         }
 
         // b-jet veto
-        if (jets.getNbtag(wps::btag_loose) < 2 && jets.getNbtag(wps::btag_medium) < 1) {
+        if (selection.pass(cut_bveto, jets.getNbtag(wps::btag_loose) < 2 && jets.getNbtag(wps::btag_medium) < 1)) {
             helper->create_and_fill("cutflow", {8, 0.5, 8.5}, 6, 1.);
         } else {
             continue;
@@ -290,7 +460,7 @@ int main(int argc, char *argv[]) {
         }
 
         // only keep the regions we need
-        if (signalRegion || antiTauIsoRegion) {
+        if (selection.pass(cut_region, signalRegion || antiTauIsoRegion)) {
             helper->create_and_fill("cutflow", {8, 0.5, 8.5}, 7, 1.);
         } else {
             continue;
@@ -303,7 +473,11 @@ int main(int argc, char *argv[]) {
         // apply all scale factors/corrections/etc.
         if (!isData && !isEmbed) {
             // pileup reweighting
-            evtwt *= lumi_weights->weight(event.getNPU());
+            auto pu = lumi_weights->get(event.getNPU());
+            evtwt *= pu.nominal;
+            *puweight = pu.nominal;
+            *puweight_up = pu.up;
+            *puweight_down = pu.down;
 
             // generator weights
             evtwt *= event.getGenWeight();
@@ -409,19 +583,17 @@ int main(int argc, char *argv[]) {
 
             // ggH theory uncertainty
             if (sample == "ggh125" && signal_type == "powheg") {
-                if (event.getNjetsRivet() == 0) evtwt *= g_NNLOPS_0jet->Eval(std::min(event.getHiggsPtRivet(), static_cast<float>(125.0)));
-                if (event.getNjetsRivet() == 1) evtwt *= g_NNLOPS_1jet->Eval(std::min(event.getHiggsPtRivet(), static_cast<float>(625.0)));
-                if (event.getNjetsRivet() == 2) evtwt *= g_NNLOPS_2jet->Eval(std::min(event.getHiggsPtRivet(), static_cast<float>(800.0)));
-                if (event.getNjetsRivet() >= 3) evtwt *= g_NNLOPS_3jet->Eval(std::min(event.getHiggsPtRivet(), static_cast<float>(925.0)));
-                NumV WG1unc = qcd_ggF_uncert_2017(event.getNjetsRivet(), event.getHiggsPtRivet(), event.getJetPtRivet());
-                if (syst.find("ggH_Rivet") != std::string::npos) {
-                    evtwt *= (1 + event.getRivetUnc(WG1unc, syst));
-                }
+                evtwt *= ggh_theory->nnlops(event.getNjetsRivet(), event.getHiggsPtRivet());
+                auto WG1unc = ggh_theory_weights::wg1_2017(event.getNjetsRivet(), event.getHiggsPtRivet(), event.getJetPtRivet());
+                ggh_theory->fill(WG1unc);
+                evtwt *= ggh_theory->weight(WG1unc, syst);
             }
 
             // VBF theory uncertainty
-            if (sample == "vbf125" && signal_type == "powheg" && syst.find("VBF_Rivet") != std::string::npos) {
-                evtwt *= event.getVBFTheoryUnc(syst);
+            if (sample == "vbf125" && signal_type == "powheg") {
+                auto VBFunc = vbf_theory_weights::get(event.getJetPtRivet());
+                vbf_theory->fill(VBFunc);
+                evtwt *= vbf_theory->weight(VBFunc, syst);
             }
 
             // recoil correction systematics
@@ -572,7 +744,14 @@ int main(int argc, char *argv[]) {
         Long64_t currentEventID = event.getLumi();
         currentEventID = currentEventID * 1000000 + event.getEvt();
         if (doAC) {
-            weights = std::make_shared<std::vector<double>>(ac_weights.getWeights(currentEventID));
+            weights = std::make_shared<std::vector<double>>(ac_weights->getWeights(currentEventID));
+        }
+
+        // fake factor weights for the jetFakes estimate
+        if (fakes != nullptr) {
+            auto vis_mass = (muon.getP4() + tau.getP4()).M();
+            fakes->fill(antiTauIsoRegion, tau.getPt(), mt, vis_mass, muon.getPt(), jets.getNjets(), jets.getDijetMass(),
+                        event.getPassCrossTrigger(muon.getPt()));
         }
 
         // fill the tree
@@ -580,13 +759,38 @@ int main(int argc, char *argv[]) {
         st->fillTree(&muon, &tau, &event, name);
     }  // close event loop
 
+    prefetch.stop();
     fin->Close();
     fout->cd();
+    ckpt.finish(st.get());
     fout->Write(0, TObject::kOverwrite);
     fout->Close();
+    ckpt.report(running_log);
+    range.report(running_log);
+    stager.report(running_log);
+    htt_sf->setCache(nullptr);
+    cache.write();
+    cache.report(running_log);
+    selection.write();
+    selection.report(running_log);
+    friends.report(running_log);
+    shared_resources::report(running_log);
+    prefetch.report(running_log);
+    filter.report(running_log);
+    if (fakes != nullptr) {
+        fakes->report(running_log);
+    }
     running_log << "Finished processing " << sample << std::endl;
     if (!condor) {
         logfile.close();
     }
     return 0;
 }
+
+int main(int argc, char *argv[]) {
+    job_manifest manifest(argc, argv);
+    if (!manifest.isActive()) {
+        return analyze(argc, argv);
+    }
+    return !manifest.isGood() || manifest.run(analyze) > 0;
+}
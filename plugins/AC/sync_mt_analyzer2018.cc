@@ -218,6 +218,7 @@ int main(int argc, char *argv[]) {
         helper->create_and_fill("cutflow", {8, 0.5, 8.5}, 1., 1.);
 
         // run factories
+        event.run_factory();
         muons.run_factory();
         taus.run_factory();
         jets.run_factory();
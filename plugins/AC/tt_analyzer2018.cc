@@ -27,6 +27,11 @@
 #include "../../include/fsa/met_factory.h"
 #include "../../include/fsa/ditau_factory.h"
 #include "../../include/slim_tree.h"
+#include "../../include/checkpoint.h"
+#include "../../include/entry_range.h"
+#include "../../include/event_filter.h"
+#include "../../include/file_stager.h"
+#include "../../include/pileup_table.h"
 #include "../../include/swiss_army_class.h"
 
 typedef std::vector<double> NumV;
@@ -45,6 +50,17 @@ int main(int argc, char *argv[]) {
     std::string sample = parser.Option("-s");
     std::string output_dir = parser.Option("-d");
     std::string signal_type = parser.Option("--stype");
+    std::string schema = parser.Option("--schema");
+    std::string golden = parser.Option("--golden");
+    std::string dedup_mb = parser.Option("--dedup-mb");
+    bool dedup = parser.Flag("--dedup");
+    bool bloom = parser.Flag("--bloom");
+    std::string stage_dir = parser.Option("--stage");
+    std::string first_entry = parser.Option("--first");
+    std::string last_entry = parser.Option("--last");
+    std::string shard = parser.Option("--shard");
+    std::string checkpoint_interval = parser.Option("--checkpoint");
+    bool resume = parser.Flag("--resume");
     std::string fname = path + sample + ".root";
     bool isData = sample.find("data") != std::string::npos;
     bool isEmbed = sample.find("embed") != std::string::npos || name.find("embed") != std::string::npos;
@@ -66,15 +82,21 @@ int main(int argc, char *argv[]) {
         systname = "SYST_" + syst;
     }
 
+    // entries of the input processed by this job
+    entry_range range(first_entry, last_entry, shard);
+    if (!range.isGood()) {
+        return 1;
+    }
+
     // create output path
     auto suffix = "_output.root";
     auto prefix = "Output/trees/" + output_dir;
     std::string filename, logname;
-    filename = prefix + "/" + systname + "/" + sample + std::string("_") + name + "_" + systname + suffix;
-    logname = prefix + "/logs/" + sample + std::string("_") + name + "_" + systname + ".txt";
+    filename = prefix + "/" + systname + "/" + sample + std::string("_") + name + "_" + systname + range.getSuffix() + suffix;
+    logname = prefix + "/logs/" + sample + std::string("_") + name + "_" + systname + range.getSuffix() + ".txt";
 
     if (condor) {
-        filename = sample + std::string("_") + name + "_" + systname + suffix;
+        filename = sample + std::string("_") + name + "_" + systname + range.getSuffix() + suffix;
     }
 
     // create the log file
@@ -96,18 +118,34 @@ int main(int argc, char *argv[]) {
     running_log << "\t sample: " << sample << std::endl;
     running_log << "\t output_dir: " << output_dir << std::endl;
     running_log << "\t signal_type: " << signal_type << std::endl;
+    running_log << "\t schema: " << (schema.empty() ? "default" : schema) << std::endl;
+    running_log << "\t golden: " << golden << " dedup: " << dedup << std::endl;
+    running_log << "\t stage: " << (stage_dir.empty() ? "none" : stage_dir) << std::endl;
+    running_log << "\t entries: " << (range.isSharded() ? range.getSuffix().substr(1) : "all") << std::endl;
+    running_log << "\t checkpoint: " << (checkpoint_interval.empty() ? "none" : checkpoint_interval + " s") << " resume: " << resume << std::endl;
     running_log << "\t isData: " << isData << " isEmbed: " << isEmbed << " doAC: " << doAC << std::endl;
 
-    auto fin = TFile::Open(fname.c_str());
+    file_stager stager(stage_dir);
+    std::string input_name = stager.stage(fname);
+    auto fin = TFile::Open(input_name.c_str());
     auto ntuple = reinterpret_cast<TTree *>(fin->Get("tt_tree"));
+    range.setTree(ntuple);
 
     // get number of generated events
     auto counts = reinterpret_cast<TH1D *>(fin->Get("nevents"));
     auto gen_number = counts->GetBinContent(2);
 
-    auto fout = new TFile(filename.c_str(), "RECREATE");
-    counts->Write();
-    fout->mkdir("grabbag");
+    // reopened instead of recreated when resuming an interrupted job
+    checkpoint ckpt(filename, checkpoint_interval, resume);
+    auto fout = ckpt.getFile();
+    if (!ckpt.isResumed()) {
+        // copied once per input file, not once per shard
+        if (range.isFirst()) {
+            counts->Write();
+        }
+        range.write(fout);
+        fout->mkdir("grabbag");
+    }
     fout->cd("grabbag");
 
     // initialize Helper class
@@ -116,7 +154,14 @@ int main(int argc, char *argv[]) {
     // cd to root of output file and create tree
     fout->cd();
     // this is important...
-    slim_tree *st = new slim_tree("tt_tree", doAC);
+    slim_tree *st = new slim_tree("tt_tree", doAC, schema);
+    if (!schema.empty() && !st->schema.isLoaded()) {
+        return 1;
+    }
+    // data keeps the event keys for fast_merge --dedup
+    if (isData) {
+        st->keep_event_keys();
+    }
 
     std::string original = sample;
     if (name == "VBF125") {
@@ -175,12 +220,17 @@ int main(int argc, char *argv[]) {
     }
     */
 
-    auto lumi_weights = new reweight::LumiReWeighting("root://cmsxrootd.fnal.gov//store/user/tmitchel/HTT_ScaleFactors/pu_distributions_mc_2018.root",
-						      "root://cmsxrootd.fnal.gov//store/user/tmitchel/HTT_ScaleFactors/pu_distributions_data_2018.root",
-						      "pileup", "pileup");
+    auto lumi_weights = new pileup_table(stager.stage("root://cmsxrootd.fnal.gov//store/user/tmitchel/HTT_ScaleFactors/pu_distributions_mc_2018.root"),
+					  stager.stage("root://cmsxrootd.fnal.gov//store/user/tmitchel/HTT_ScaleFactors/pu_distributions_data_2018.root"),
+					  "pileup", "pileup");
     
+    // pileup weight and its variations are stored for every event
+    Float_t *puweight = st->add_weight_branch("puweight");
+    Float_t *puweight_up = st->add_weight_branch("puweight_up");
+    Float_t *puweight_down = st->add_weight_branch("puweight_down");
+
     // legacy sf's
-    auto htt_sf_file = TFile::Open("root://cmsxrootd.fnal.gov//store/user/tmitchel/HTT_ScaleFactors/htt_scalefactors_legacy_2018.root");
+    auto htt_sf_file = TFile::Open(stager.stage("root://cmsxrootd.fnal.gov//store/user/tmitchel/HTT_ScaleFactors/htt_scalefactors_legacy_2018.root").c_str());
     RooWorkspace *htt_sf = reinterpret_cast<RooWorkspace *>(htt_sf_file->Get("w"));
     htt_sf_file->Close();
     
@@ -199,12 +249,30 @@ int main(int argc, char *argv[]) {
       event.setRivets(ntuple);
     }
 
+    // certified lumi and duplicate event filtering for data
+    event_filter filter;
+    if (isData && !golden.empty() && !filter.setLumiMask(golden)) {
+        return 1;
+    }
+    if (isData && dedup && !filter.setDuplicateFilter(range.getEntries(), dedup_mb.empty() ? 0 : std::stoul(dedup_mb), bloom)) {
+        return 1;
+    }
+
+    // continue from the last checkpoint of an interrupted job
+    Long64_t start_entry = ckpt.resume(st, helper, ntuple, &event, &filter, range.getFirst());
+
+    // read-ahead for the input tree
+    cluster_prefetcher prefetch(ntuple, input_name);
+    prefetch.set_range(start_entry, range.getLast());
+
     // begin the event loop
-    Int_t nevts = ntuple->GetEntries();
+    Long64_t nevts = range.getEntries();
     std::cout << "There are " << nevts << " events" << std::endl;
-    int progress(0), fraction((nevts - 1) / 10);
+    Long64_t progress(0), fraction((nevts - 1) / 10);
     for (Int_t i = 0; i < 10; i++) {
+      ckpt.update(i, st, helper);
       ntuple->GetEntry(i);
+      prefetch.next(i);
       std::cout << "********************************** evt # = " << event.getConvEvt() << std::endl;
       // REMEMBER TO TAKE THIS OUT ****
       if (event.getConvEvt() == 170135) 
@@ -213,11 +281,15 @@ int main(int argc, char *argv[]) {
       	continue;
       if (i%1000 == 0)
 	std::cout << "Processing " << i << std::endl;
-      if (i == progress * fraction) {
+      if (i - range.getFirst() == progress * fraction) {
 	running_log << "LOG: Processing: " << progress * 10 << "% complete." << std::endl;
 	progress++;
       }
 
+      if (filter.isActive() && !filter.pass(&event)) {
+          continue;
+      }
+
       // find the event weight (not lumi*xs if looking at W or Drell-Yan)
       Float_t evtwt(norm), corrections(1.), sf_trig(1.), sf_id(1.), sf_iso(1.), sf_reco(1.);
       if (name == "W") {
@@ -251,6 +323,7 @@ int main(int argc, char *argv[]) {
       std::cout << "Original Event Weight ==> " << evtwt << std::endl;
 
       // run factories
+      event.run_factory();
       taus.run_factory();
       jets.run_factory();
       event.setNjets(jets.getNjets());
@@ -361,8 +434,12 @@ int main(int argc, char *argv[]) {
 	// Pileup reweighting
 	std::cout << "Evtwt = " << evtwt << std::endl;
 	std::cout << "npu ==> " << event.getNPU() << std::endl;
-	std::cout << "weightLumi ==> " << lumi_weights->weight(event.getNPU()) << std::endl;
-	evtwt *= lumi_weights->weight(event.getNPU()); 
+	auto pu = lumi_weights->get(event.getNPU());
+	std::cout << "weightLumi ==> " << pu.nominal << std::endl;
+	evtwt *= pu.nominal;
+	*puweight = pu.nominal;
+	*puweight_up = pu.up;
+	*puweight_down = pu.down;
 	
 	
 	// lead tau id
@@ -530,10 +607,17 @@ int main(int argc, char *argv[]) {
       st->fillTree(&ltau, &stau, &event, name);
     }  // close event loop
     
+    prefetch.stop();
     fin->Close();
     fout->cd();
+    ckpt.finish(st);
     fout->Write();
     fout->Close();
+    ckpt.report(running_log);
+    range.report(running_log);
+    stager.report(running_log);
+    prefetch.report(running_log);
+    filter.report(running_log);
     running_log << "Finished processing " << sample << std::endl;
     if (!condor) {
       logfile.close();
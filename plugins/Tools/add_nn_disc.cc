@@ -0,0 +1,217 @@
+// Copyright 2020 Tyler Mitchell
+
+// Add the NN_disc branch to merged slim trees, the C++ version of
+// neural-network/classify.py.
+//
+// Usage:
+//   add_nn_disc -m Output/models/model.json -i Output/trees/dir -o dir [-j 8]
+//
+// Every input_dir/*/merged/*.root file (except jetFakes and VBF_Rivet) is
+// copied to Output/trees/{output_dir}/{systematic or nominal}/ with NN_disc
+// added, like classify.py does. The model is the json file train.py exports
+// next to the hdf5 one; it carries the input names and the scaler constants.
+// The tree is copied without unzipping the baskets and only the network
+// inputs are read, a cluster at a time. Files are processed by several
+// threads, each with its own copy of the network.
+
+// system includes
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// ROOT includes
+#include "TBranch.h"
+#include "TFile.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+// user includes
+#include "../../include/CLParser.h"
+#include "../../include/friend_output.h"
+#include "../../include/hist_filler.h"
+#include "../../include/nn_inference.h"
+
+struct classify_job {
+    std::string filename, output_name;
+    Long64_t entries;
+    bool ok;
+};
+
+// input_dir/*/merged/*.root grouped by systematic, like build_filelist in classify.py
+std::vector<std::pair<std::string, std::vector<std::string>>> build_filelist(std::string input_dir) {
+    std::vector<std::pair<std::string, std::vector<std::string>>> filelist;
+    auto dir = opendir(input_dir.c_str());
+    if (dir == nullptr) {
+        std::cerr << "Unable to open directory " << input_dir << std::endl;
+        return filelist;
+    }
+    std::vector<std::string> subdirs;
+    while (auto entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..") {
+            subdirs.push_back(name);
+        }
+    }
+    closedir(dir);
+    std::sort(subdirs.begin(), subdirs.end());
+
+    for (auto &subdir : subdirs) {
+        auto merged = input_dir + "/" + subdir + "/merged";
+        auto sub = opendir(merged.c_str());
+        if (sub == nullptr) {
+            continue;
+        }
+        std::vector<std::string> files;
+        while (auto entry = readdir(sub)) {
+            std::string filename = entry->d_name;
+            if (filename.size() > 5 && filename.substr(filename.size() - 5) == ".root" && filename.find("VBF_Rivet") == std::string::npos &&
+                filename.find("jetFakes") == std::string::npos) {
+                files.push_back(merged + "/" + filename);
+            }
+        }
+        closedir(sub);
+        std::sort(files.begin(), files.end());
+        for (auto &file : files) {
+            auto pos = file.find("SYST_");
+            std::string key = pos == std::string::npos ? "nominal" : file.substr(pos + 5, file.find('/', pos) - pos - 5);
+            auto group = std::find_if(filelist.begin(), filelist.end(),
+                                      [&key](const std::pair<std::string, std::vector<std::string>> &g) { return g.first == key; });
+            if (group == filelist.end()) {
+                filelist.push_back(std::make_pair(key, std::vector<std::string>()));
+                group = filelist.end() - 1;
+            }
+            group->second.push_back(file);
+        }
+    }
+    return filelist;
+}
+
+// copy the tree and fill NN_disc for every entry
+void classify(classify_job *job, std::string tree_name, dense_network *network) {
+    job->ok = false;
+    auto fin = std::unique_ptr<TFile>(TFile::Open(job->filename.c_str()));
+    if (fin == nullptr || fin->IsZombie()) {
+        std::cerr << "Unable to open " << job->filename << std::endl;
+        return;
+    }
+    auto tree = reinterpret_cast<TTree *>(fin->Get(tree_name.c_str()));
+    if (tree == nullptr) {
+        std::cerr << "No " << tree_name << " in " << job->filename << std::endl;
+        return;
+    } else if (friend_output::is_friend(fin.get(), tree_name)) {
+        std::cerr << job->filename << " is a --friend output without the nominal columns, join it with scripts/utils/friend_output.py" << std::endl;
+        return;
+    }
+
+    // an existing NN_disc (from an older model) is replaced
+    if (tree->GetBranch("NN_disc") != nullptr) {
+        tree->SetBranchStatus("NN_disc", 0);
+    }
+    auto &inputs = network->getInputs();
+    column_block columns(tree, inputs);
+    for (auto &name : inputs) {
+        if (columns.index(name) < 0) {
+            return;
+        }
+    }
+
+    auto fout = std::unique_ptr<TFile>(new TFile(job->output_name.c_str(), "RECREATE"));
+    auto otree = tree->CloneTree(-1, "fast");
+    Float_t disc(-1.);
+    auto branch = otree->Branch("NN_disc", &disc, "NN_disc/F");
+    std::vector<double> values(inputs.size());
+    for (auto &chunk : cluster_chunks(tree)) {
+        auto n = columns.read(chunk.first, chunk.second);
+        for (Long64_t i = 0; i < n; i++) {
+            for (size_t v = 0; v < inputs.size(); v++) {
+                values[v] = columns[v][i];
+            }
+            disc = network->evaluate(values.data());
+            branch->Fill();
+        }
+    }
+    fout->cd();
+    otree->Write();
+    job->entries = otree->GetEntries();
+    job->ok = true;
+}
+
+int main(int argc, char *argv[]) {
+    CLParser parser(argc, argv);
+    std::string model_name = parser.Option("-m");
+    std::string input_dir = parser.Option("-i");
+    std::string output_dir = parser.Option("-o");
+    std::string nthreads_str = parser.Option("-j");
+    int nthreads = nthreads_str.empty() ? 1 : std::stoi(nthreads_str);
+    if (model_name.empty() || input_dir.empty() || output_dir.empty()) {
+        std::cerr << "Usage: add_nn_disc -m model.json -i input_dir -o output_dir [-j threads]" << std::endl;
+        return 1;
+    }
+
+    // this will be removed soon
+    std::string tree_name;
+    if (input_dir.find("mutau") != std::string::npos || input_dir.find("mt20") != std::string::npos) {
+        tree_name = "mt_tree";
+    } else if (input_dir.find("etau") != std::string::npos || input_dir.find("et20") != std::string::npos) {
+        tree_name = "et_tree";
+    } else {
+        std::cerr << "Input files must have MUTAU or ETAU in the provided path. You gave " << input_dir << std::endl;
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<dense_network>> networks;
+    for (int i = 0; i < nthreads; i++) {
+        networks.emplace_back(new dense_network(model_name));
+        if (!networks.back()->isGood()) {
+            return 1;
+        }
+    }
+
+    std::vector<classify_job> jobs;
+    mkdir(("Output/trees/" + output_dir).c_str(), 0755);
+    for (auto &group : build_filelist(input_dir)) {
+        auto out_path = "Output/trees/" + output_dir + "/" + group.first;
+        mkdir(out_path.c_str(), 0755);
+        for (auto &filename : group.second) {
+            auto fname = filename.substr(filename.rfind('/') + 1);
+            jobs.push_back(classify_job{filename, out_path + "/" + fname, 0, false});
+        }
+    }
+    std::cout << "Files to process: " << jobs.size() << std::endl;
+
+    ROOT::EnableThreadSafety();
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next_job(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < std::min(nthreads, static_cast<int>(jobs.size())); i++) {
+        threads.push_back(std::thread([&, i]() {
+            for (auto j = next_job++; j < jobs.size(); j = next_job++) {
+                classify(&jobs.at(j), tree_name, networks.at(i).get());
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    int failed(0);
+    Long64_t entries(0);
+    for (auto &job : jobs) {
+        if (!job.ok) {
+            std::cerr << "FAILED " << job.filename << std::endl;
+            failed++;
+        }
+        entries += job.entries;
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Classified " << entries << " entries from " << jobs.size() - failed << " files in " << elapsed << " s" << std::endl;
+    return failed > 0;
+}
@@ -0,0 +1,501 @@
+// Copyright 2020 Tyler Mitchell
+
+// Build the 2D datacard templates of scripts/produce_datacards.py.
+//
+// Usage:
+//   build_datacards -c baseline -i Output/trees/dir -y 2018 [-d date] [--suffix _x] [--no-syst] [--embed] [-j 8]
+//
+// The input directory, the binning.json config, the output file name and its
+// layout ({channel}_{category}/{process}) are the same as for the python
+// script. Each merged file (one per sample and systematic directory) is read
+// once: the 0jet, boosted and vbf categories, the vbf_ggHMELA_bin* (DCP plus
+// and minus) sub-categories and, for jetFakes, every fake-factor variation
+// (for powheg ggH and VBF, every theory variation) are filled from the same pass.
+// Files are processed by several threads at once and the histograms are
+// written in file order when all are done.
+
+// system includes
+#include <dirent.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// ROOT includes
+#include "TFile.h"
+#include "TKey.h"
+#include "TList.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+// user includes
+#include "../../include/CLParser.h"
+#include "../../include/friend_output.h"
+#include "../../include/hist_filler.h"
+#include "../../include/json_reader.h"
+
+// one output directory: the variables on each axis and their binning
+struct card_category {
+    std::string name;
+    std::string xvar, yvar;
+    hist_axis xaxis, yaxis;
+};
+
+struct card_weight {
+    std::string hist_name;
+    std::string branch;  // multiplies evtwt, empty for none
+};
+
+struct card_job {
+    std::string filename;
+    std::vector<card_weight> weights;
+    std::vector<bin_sums_2d> sums;  // category-major, one per weight
+    bool ok;
+};
+
+class datacard_builder {
+ public:
+    datacard_builder(std::vector<card_category> _categories, std::string _edge_var, std::vector<double> _edges, std::string _dcp_var,
+                     size_t _nplus, std::string _tree_name, bool _embed)
+        : categories(_categories), edge_var(_edge_var), edges(_edges), dcp_var(_dcp_var), nplus(_nplus), tree_name(_tree_name), embed(_embed) {}
+
+    void fill(card_job *);
+
+ private:
+    std::vector<card_category> categories;  // 0jet, boosted, vbf, then the vbf sub-categories
+    std::string edge_var;
+    std::vector<double> edges;
+    std::string dcp_var;  // empty when the sub-categories aren't split by DCP sign
+    size_t nplus;         // offset of the DCP minus sub-categories
+    std::string tree_name;
+    bool embed;
+};
+
+void datacard_builder::fill(card_job *job) {
+    job->ok = false;
+    auto fin = std::unique_ptr<TFile>(TFile::Open(job->filename.c_str()));
+    auto tree = fin == nullptr ? nullptr : reinterpret_cast<TTree *>(fin->Get(tree_name.c_str()));
+    if (tree == nullptr) {
+        std::cerr << "Unable to read " << tree_name << " from " << job->filename << std::endl;
+        return;
+    } else if (friend_output::is_friend(fin.get(), tree_name)) {
+        std::cerr << job->filename << " is a --friend output without the nominal columns, join it with scripts/utils/friend_output.py" << std::endl;
+        return;
+    }
+    tree->SetCacheSize(32 * 1024 * 1024);
+
+    // jetFakes are taken from the anti-isolated region
+    std::string iso_branch = job->filename.find("jetFakes") != std::string::npos ? "is_antiTauIso" : "is_signal";
+    std::vector<std::string> names = {iso_branch, "njets", "mjj", "evtwt", edge_var};
+    if (embed) {
+        names.push_back("contamination");
+    }
+    if (!dcp_var.empty()) {
+        names.push_back(dcp_var);
+    }
+    for (auto &category : categories) {
+        names.push_back(category.xvar);
+        names.push_back(category.yvar);
+    }
+    for (auto &weight : job->weights) {
+        if (!weight.branch.empty()) {
+            names.push_back(weight.branch);
+        }
+    }
+    std::vector<std::string> unique_names;
+    for (auto &name : names) {
+        if (std::find(unique_names.begin(), unique_names.end(), name) == unique_names.end()) {
+            unique_names.push_back(name);
+        }
+    }
+    column_block block(tree, unique_names);
+
+    bool found(true);
+    for (auto &name : unique_names) {
+        found = block.index(name) >= 0 && found;
+    }
+    if (!found) {
+        return;
+    }
+    int iso(block.index(iso_branch)), njets(block.index("njets")), mjj(block.index("mjj")), evtwt(block.index("evtwt"));
+    int zvar(block.index(edge_var)), contamination(embed ? block.index("contamination") : -1), dcp(dcp_var.empty() ? -1 : block.index(dcp_var));
+    std::vector<int> xcolumns, ycolumns, weight_columns;
+    for (auto &category : categories) {
+        xcolumns.push_back(block.index(category.xvar));
+        ycolumns.push_back(block.index(category.yvar));
+    }
+    for (auto &weight : job->weights) {
+        weight_columns.push_back(weight.branch.empty() ? -1 : block.index(weight.branch));
+    }
+
+    auto nweights = job->weights.size();
+    job->sums.clear();
+    for (auto &category : categories) {
+        for (size_t w = 0; w < nweights; w++) {
+            job->sums.push_back(bin_sums_2d(category.xaxis.getNbins(), category.yaxis.getNbins()));
+        }
+    }
+
+    std::vector<double> weights(nweights);
+    std::vector<size_t> targets;
+    for (auto &chunk : cluster_chunks(tree)) {
+        auto n = block.read(chunk.first, chunk.second);
+        for (Long64_t i = 0; i < n; i++) {
+            if (block[iso][i] <= 0 || (embed && block[contamination][i] != 0)) {
+                continue;
+            }
+
+            targets.clear();
+            if (block[njets][i] == 0) {
+                targets.push_back(0);
+            } else if (block[njets][i] == 1 || (block[njets][i] > 1 && block[mjj][i] < 300)) {
+                targets.push_back(1);
+            } else if (block[njets][i] > 1 && block[mjj][i] > 300) {
+                targets.push_back(2);
+                // first bin whose upper edge is above the value, none past the last edge
+                for (size_t j = 1; j < edges.size(); j++) {
+                    if (block[zvar][i] < edges[j]) {
+                        targets.push_back(3 + j - 1 + (dcp >= 0 && !(block[dcp][i] > 0) ? nplus : 0));
+                        break;
+                    }
+                }
+            }
+            if (targets.empty()) {
+                continue;
+            }
+
+            for (size_t w = 0; w < nweights; w++) {
+                // product in single precision, like the float32 arrays in python
+                weights[w] = weight_columns[w] < 0 ? block[evtwt][i]
+                                                   : static_cast<float>(block[evtwt][i]) * static_cast<float>(block[weight_columns[w]][i]);
+            }
+            for (auto cat : targets) {
+                double x = block[xcolumns[cat]][i];
+                double y = block[ycolumns[cat]][i];
+                int xbin = categories[cat].xaxis.find(x);
+                int ybin = categories[cat].yaxis.find(y);
+                for (size_t w = 0; w < nweights; w++) {
+                    job->sums[cat * nweights + w].fill(xbin, ybin, x, y, weights[w]);
+                }
+            }
+        }
+    }
+    job->ok = true;
+}
+
+// input_dir/*/*.root, grouped by systematic (the name of the directory)
+std::vector<std::pair<std::string, std::vector<std::string>>> build_filelist(std::string input_dir) {
+    std::vector<std::pair<std::string, std::vector<std::string>>> filelist = {{"nominal", {}}};
+    auto dir = opendir(input_dir.c_str());
+    if (dir == nullptr) {
+        std::cerr << "Unable to open directory " << input_dir << std::endl;
+        return filelist;
+    }
+    std::vector<std::string> subdirs;
+    while (auto entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..") {
+            subdirs.push_back(name);
+        }
+    }
+    closedir(dir);
+    std::sort(subdirs.begin(), subdirs.end());
+
+    for (auto &subdir : subdirs) {
+        auto sub = opendir((input_dir + "/" + subdir).c_str());
+        if (sub == nullptr) {
+            continue;
+        }
+        std::vector<std::string> files;
+        while (auto entry = readdir(sub)) {
+            std::string filename = entry->d_name;
+            if (filename.size() > 5 && filename.substr(filename.size() - 5) == ".root") {
+                files.push_back(input_dir + "/" + subdir + "/" + filename);
+            }
+        }
+        closedir(sub);
+        std::sort(files.begin(), files.end());
+        for (auto &file : files) {
+            std::string key = file.find("nominal") != std::string::npos ? "nominal" : subdir;
+            auto group = std::find_if(filelist.begin(), filelist.end(),
+                                      [&key](const std::pair<std::string, std::vector<std::string>> &g) { return g.first == key; });
+            if (group == filelist.end()) {
+                filelist.push_back(std::make_pair(key, std::vector<std::string>()));
+                group = filelist.end() - 1;
+            }
+            group->second.push_back(file);
+        }
+    }
+    return filelist;
+}
+
+void replace_all(std::string *str, std::string from, std::string to) {
+    for (auto pos = str->find(from); pos != std::string::npos; pos = str->find(from, pos + to.size())) {
+        str->replace(pos, from.size(), to);
+    }
+}
+
+// datacard name of a systematic, "unknown" if there is none
+std::string get_syst_name(std::string channel, std::string syst, std::string year, const json_value &syst_name_map) {
+    if (syst == "nominal") {
+        return "";
+    } else if (!syst_name_map.has(syst)) {
+        std::cout << "\t \033[91m[INFO]  " << syst << " is unknown. Skipping...\033[0m" << std::endl;
+        return "unknown";
+    }
+    auto postfix = syst_name_map.get(syst).asString();
+    replace_all(&postfix, "YEAR", year);
+    replace_all(&postfix, "LEP", channel == "et" ? "ele" : "mu");
+    replace_all(&postfix, "CHAN", channel);
+    return postfix;
+}
+
+// embedded has its own efficiency and trigger uncertainties
+std::string embed_syst_name(std::string postfix) {
+    if (postfix.find("CMS_tauideff") != std::string::npos) {
+        replace_all(&postfix, "tauideff", "eff_t_embedded");
+    } else if (postfix.find("CMS_scale_e_") != std::string::npos) {
+        replace_all(&postfix, "scale_e_", "scale_emb_e");
+    } else if ((postfix.find("CMS_single") != std::string::npos && postfix.find("trg") != std::string::npos) ||
+               postfix.find("tautrg_") != std::string::npos) {
+        replace_all(&postfix, "trg", "trg_emb");
+    }
+    return postfix;
+}
+
+// The powheg ggH and VBF theory variations are weight branches of the nominal output.
+// They are used unless the systematic was also run on its own (auto_ac_wisc.py
+// --theory-reruns).
+std::vector<std::string> theory_variations(std::string filename, const json_value &syst_name_map,
+                                           const std::vector<std::pair<std::string, std::vector<std::string>>> &filelist) {
+    static const std::vector<std::pair<std::string, std::string>> theory_prefixes = {{"ggh125_powheg", "ggH_Rivet"},
+                                                                                     {"vbf125_powheg", "VBF_Rivet"}};
+    std::vector<std::string> variations;
+    for (auto &theory : theory_prefixes) {
+        if (filename.find(theory.first) == std::string::npos) {
+            continue;
+        }
+        for (auto &syst : syst_name_map.getMembers()) {
+            auto rerun = std::find_if(filelist.begin(), filelist.end(),
+                                      [&syst](const std::pair<std::string, std::vector<std::string>> &g) { return g.first == syst.first; });
+            if (syst.first.find(theory.second) == 0 && rerun == filelist.end()) {
+                variations.push_back(syst.first);
+            }
+        }
+    }
+    return variations;
+}
+
+std::string powheg_naming(std::string name) {
+    static const std::vector<std::pair<std::string, std::string>> powheg_names = {
+        {"ggh125_powheg", "ggH125"}, {"vbf125_powheg", "VBF125"}, {"wh125_powheg", "WH125"}, {"zh125_powheg", "ZH125"}};
+    for (auto &powheg : powheg_names) {
+        auto pos = name.find(powheg.first);
+        if (pos != std::string::npos) {
+            return name.replace(pos, powheg.first.size(), powheg.second);
+        }
+    }
+    return name;
+}
+
+int main(int argc, char *argv[]) {
+    CLParser parser(argc, argv);
+    std::string config_name = parser.Option("-c");
+    std::string input_dir = parser.Option("-i");
+    std::string year = parser.Option("-y");
+    std::string date = parser.Option("-d");
+    std::string suffix = parser.Option("--suffix");
+    std::string nthreads_str = parser.Option("-j");
+    bool doSyst = !parser.Flag("--no-syst");
+    bool embed = parser.Flag("--embed");
+    int nthreads = nthreads_str.empty() ? 1 : std::stoi(nthreads_str);
+    if (config_name.empty() || input_dir.empty() || year.empty()) {
+        std::cerr << "Usage: build_datacards -c config -i input_dir -y year [-d date] [--suffix suffix] [--no-syst] [--embed] [-j threads]"
+                  << std::endl;
+        return 1;
+    }
+    if (date.empty()) {
+        // same as datetime.now().strftime("%B%d")
+        char buffer[32];
+        auto now = std::time(nullptr);
+        std::strftime(buffer, sizeof(buffer), "%B%d", std::localtime(&now));
+        date = buffer;
+    }
+
+    json_reader reader;
+    auto boilerplate = reader.parseFile("configs/boilerplate.json");
+    auto binning = reader.parseFile("configs/binning.json");
+    if (!reader.ok() || !binning.has(config_name)) {
+        std::cerr << "Unable to read config " << config_name << " from configs/binning.json" << std::endl;
+        return 1;
+    }
+    auto &config = binning.get(config_name);
+    auto &syst_name_map = boilerplate.get("syst_name_map");
+    auto vbf_x = config.get("vbf_cat_x_bins");
+    auto vbf_y = config.get("vbf_cat_y_bins");
+    auto vbf_edges = config.get("vbf_cat_edges");
+    auto edge_var = vbf_edges.at(0).asString();
+    auto edges = vbf_edges.at(1).asDoubleVector();
+
+    // DCP binning is only used when measuring fa3
+    std::string dcp_var;
+    if (edge_var == "D0_ggH") {
+        dcp_var = "DCP_ggH";
+    } else if (edge_var == "D0_VBF") {
+        dcp_var = "DCP_VBF";
+    } else if (edge_var != "D_a2_VBF" && edge_var != "D_l1_VBF" && edge_var != "D_l1zg_VBF") {
+        std::cerr << "Don't know how to handle DCP for provided zvar_name " << edge_var << std::endl;
+        return 1;
+    }
+    std::vector<std::string> vbf_categories;
+    if (edge_var.find("D0_") != std::string::npos) {
+        vbf_categories = boilerplate.get("vbf_sub_cats_plus").asStringVector();
+        auto minus = boilerplate.get("vbf_sub_cats_minus").asStringVector();
+        vbf_categories.insert(vbf_categories.end(), minus.begin(), minus.end());
+    } else {
+        vbf_categories = boilerplate.get("vbf_sub_cats").asStringVector();
+    }
+    size_t nplus = boilerplate.get("vbf_sub_cats_plus").size();
+    if (edges.size() < 2 || edges.size() - 1 > (dcp_var.empty() ? vbf_categories.size() : nplus)) {
+        std::cerr << "More " << edge_var << " bins than vbf sub-categories in configs/boilerplate.json" << std::endl;
+        return 1;
+    }
+
+    std::vector<card_category> categories = {
+        {"0jet", "t1_pt", "m_sv", hist_axis(config.get("tau_pt_bins").asDoubleVector()), hist_axis(config.get("m_sv_bins_0jet").asDoubleVector())},
+        {"boosted", "higgs_pT", "m_sv", hist_axis(config.get("higgs_pT_bins_boost").asDoubleVector()),
+         hist_axis(config.get("m_sv_bins_boost").asDoubleVector())},
+        {"vbf", vbf_x.at(0).asString(), vbf_y.at(0).asString(), hist_axis(vbf_x.at(1).asDoubleVector()), hist_axis(vbf_y.at(1).asDoubleVector())}};
+    for (auto &category : vbf_categories) {
+        categories.push_back(categories.at(2));
+        categories.back().name = category;
+    }
+
+    auto filelist = build_filelist(input_dir);
+    if (filelist.front().second.empty()) {
+        std::cerr << "could'nt locate any nominal files" << std::endl;
+        return 1;
+    }
+
+    // the channel comes from the tree in the first nominal file
+    std::string tree_name;
+    {
+        auto fin = std::unique_ptr<TFile>(TFile::Open(filelist.front().second.front().c_str()));
+        if (fin != nullptr && fin->GetKey("et_tree") != nullptr) {
+            tree_name = "et_tree";
+        } else if (fin != nullptr && fin->GetKey("mt_tree") != nullptr) {
+            tree_name = "mt_tree";
+        }
+    }
+    if (tree_name.empty()) {
+        std::cerr << "Can't find et_tree or mt_tree in " << filelist.front().second.front() << std::endl;
+        return 1;
+    }
+    std::string channel = tree_name.substr(0, 2);
+
+    auto ff_systematics = boilerplate.get("fake_factor_systematics").asStringVector();
+    std::vector<card_job> jobs;
+    for (auto &group : filelist) {
+        if (!doSyst && group.first != "nominal") {
+            continue;
+        }
+        auto stable_postfix = get_syst_name(channel, group.first, year, syst_name_map);
+        if (stable_postfix == "unknown") {  // skip unknown systematics
+            continue;
+        }
+
+        for (auto &ifile : group.second) {
+            // handle ZTT vs embedded
+            if ((embed && ifile.find("ZTT") != std::string::npos) || (!embed && ifile.find("embed") != std::string::npos)) {
+                continue;
+            }
+            auto postfix = ifile.find("embed") != std::string::npos ? embed_syst_name(stable_postfix) : stable_postfix;
+
+            std::string name = ifile.substr(ifile.rfind('/') + 1);
+            name = name.substr(0, name.size() - 5);
+            if (name.find("wh125_JHU_CMS") != std::string::npos || name.find("zh125_JHU_CMS") != std::string::npos || name == "wh125_JHU" ||
+                name == "zh125_JHU") {
+                continue;
+            }
+            if (name.find("Data") != std::string::npos) {
+                name = "data_obs";
+            }
+            name = powheg_naming(name + postfix);
+
+            card_job job{ifile, {}, {}, false};
+            if (ifile.find("jetFakes") != std::string::npos) {
+                job.weights.push_back(card_weight{name, "fake_weight"});
+                if (doSyst && name.find("jetFakes") != std::string::npos) {
+                    for (auto &syst : ff_systematics) {
+                        auto jet_postfix = get_syst_name(channel, syst, year, syst_name_map);
+                        if (jet_postfix != "unknown") {
+                            job.weights.push_back(card_weight{"jetFakes" + jet_postfix, syst});
+                        }
+                    }
+                }
+            } else {
+                job.weights.push_back(card_weight{name, ""});
+                if (doSyst && group.first == "nominal") {
+                    for (auto &syst : theory_variations(ifile, syst_name_map, filelist)) {
+                        job.weights.push_back(card_weight{name + get_syst_name(channel, syst, year, syst_name_map), syst});
+                    }
+                }
+            }
+            jobs.push_back(job);
+        }
+    }
+
+    ROOT::EnableThreadSafety();
+    auto start = std::chrono::steady_clock::now();
+    datacard_builder builder(categories, edge_var, edges, dcp_var, nplus, tree_name, embed);
+    std::atomic<size_t> next_job(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < std::min(nthreads, static_cast<int>(jobs.size())); i++) {
+        threads.push_back(std::thread([&]() {
+            for (auto j = next_job++; j < jobs.size(); j = next_job++) {
+                builder.fill(&jobs.at(j));
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    std::string output_name = "Output/templates/2D_htt_" + channel + "_" + (embed ? "emb" : "ztt") + "_" + (doSyst ? "Sys" : "noSys") + "_fa3_" +
+                              year + "_" + date + suffix + ".root";
+    auto fout = std::unique_ptr<TFile>(new TFile(output_name.c_str(), "RECREATE"));
+    for (auto &category : boilerplate.get("categories").asStringVector()) {
+        fout->mkdir((channel + "_" + category).c_str());
+    }
+    for (auto &category : vbf_categories) {
+        fout->mkdir((channel + "_" + category).c_str());
+    }
+
+    int failed(0);
+    for (auto &job : jobs) {
+        if (!job.ok) {
+            std::cerr << "FAILED " << job.filename << std::endl;
+            failed++;
+            continue;
+        }
+        auto nweights = job.weights.size();
+        for (size_t cat = 0; cat < categories.size(); cat++) {
+            fout->cd((channel + "_" + categories.at(cat).name).c_str());
+            for (size_t w = 0; w < nweights; w++) {
+                auto hist = job.sums.at(cat * nweights + w).make(job.weights.at(w).hist_name, categories.at(cat).xaxis, categories.at(cat).yaxis);
+                hist->Write();
+                delete hist;
+            }
+        }
+    }
+    fout->Close();
+    std::cout << jobs.size() - failed << " of " << jobs.size() << " files processed" << std::endl;
+    std::cout << "Finished in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " seconds" << std::endl;
+    return failed > 0;
+}
@@ -0,0 +1,387 @@
+// Copyright 2020 Tyler Mitchell
+
+// Write the neural-network training set straight from the merged slim trees,
+// instead of neural-network/preprocess.py.
+//
+// Usage:
+//   export_training -e Output/trees/etau2017 -m Output/trees/mutau2017 -o testData [--syst] [--chunk 10000] [-j 8]
+//
+// The selection, labels and weights are those of preprocess.py. Every
+// dir/*/merged/*.root file (except jetFakes) is read once, a cluster at a
+// time, and the selected events are written to Output/datasets/{output}.root
+// as soon as their file is done (in the order of the file list, so the
+// output doesn't depend on the number of threads):
+//   - nominal (and, with --syst, one tree per systematic): the unscaled
+//     network inputs, isSM, njets, is_signal, isSignal, evtwt (scaled to
+//     [1, 2] per file) and the index of the sample in "samples", written in
+//     chunks of --chunk entries
+//   - samples: sample_names and lepton of each input file
+//   - scaler: mean, scale, variance and nsamples of every input, from running
+//     sums over the nominal SM events (the StandardScaler fit of preprocess.py)
+// neural-network/dataset.py loads this file into the DataFrames train.py and
+// classify.py used to get from the HDF5 store, scaling the inputs on the way.
+
+// system includes
+#include <dirent.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// ROOT includes
+#include "TFile.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+// user includes
+#include "../../include/CLParser.h"
+#include "../../include/friend_output.h"
+#include "../../include/hist_filler.h"
+
+// same order as scaled_vars in preprocess.py (evtwt is the weight, not an input)
+static const std::vector<std::string> input_vars = {"Q2V1",      "Q2V2",         "Phi", "Phi1",     "costheta1",
+                                                    "costheta2", "costhetastar", "mjj", "higgs_pT", "m_sv"};
+
+// Mean and variance of each column, updated one event at a time (Welford)
+// and merged between files like StandardScaler.partial_fit does.
+class running_scaler {
+ public:
+    explicit running_scaler(size_t ncolumns) : nsamples(0), mean(ncolumns, 0.), m2(ncolumns, 0.) {}
+
+    void add(const std::vector<double> &values) {
+        nsamples++;
+        for (size_t i = 0; i < mean.size(); i++) {
+            auto delta = values[i] - mean[i];
+            mean[i] += delta / nsamples;
+            m2[i] += delta * (values[i] - mean[i]);
+        }
+    }
+
+    void merge(const running_scaler &other) {
+        if (other.nsamples == 0) {
+            return;
+        }
+        auto total = nsamples + other.nsamples;
+        for (size_t i = 0; i < mean.size(); i++) {
+            auto delta = other.mean[i] - mean[i];
+            mean[i] += delta * other.nsamples / total;
+            m2[i] += other.m2[i] + delta * delta * nsamples * other.nsamples / total;
+        }
+        nsamples = total;
+    }
+
+    Long64_t getSamples() const { return nsamples; }
+    double getMean(size_t i) const { return mean[i]; }
+    double getVariance(size_t i) const { return nsamples > 0 ? m2[i] / nsamples : 0.; }
+    // StandardScaler leaves constant columns unscaled
+    double getScale(size_t i) const { return getVariance(i) > 0 ? std::sqrt(getVariance(i)) : 1.; }
+
+ private:
+    Long64_t nsamples;
+    std::vector<double> mean, m2;
+};
+
+// selected events of one file, kept until it's their turn to be written
+struct export_job {
+    std::string channel, filename, syst, sample;
+    double isSignal, isSM;
+    std::vector<std::vector<double>> rows;  // inputs, njets, is_signal, evtwt
+    running_scaler scaler;
+    Long64_t read;
+    bool done, ok;
+};
+
+// get_labels in preprocess.py
+void set_labels(export_job *job) {
+    std::string name = job->filename;
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    bool signal = name.find("reweighted") != std::string::npos || name.find("powheg") != std::string::npos;
+    job->isSignal = signal;
+    job->isSM = !signal && name.find("data") == std::string::npos && name.find("embedmu") == std::string::npos &&
+                name.find("embedel") == std::string::npos;
+}
+
+// apply_selection in preprocess.py
+bool selected(const std::vector<double> &row) {
+    auto njets = row[input_vars.size()], mjj = row[7];
+    if (!(njets > 1 && mjj > 300)) {
+        return false;
+    }
+    for (auto &value : row) {
+        if (std::isnan(value)) {
+            return false;
+        }
+    }
+    auto within = [](double x, double low, double high) { return x > low && x < high; };
+    return within(row[0], -1e10, 1e10) && within(row[1], -1e10, 1e10) && within(row[2], -2.1 * M_PI, 2.1 * M_PI) &&
+           within(row[3], -2.1 * M_PI, 2.1 * M_PI) && within(row[4], -1, 1) && within(row[5], -1, 1) && within(row[6], -1, 1);
+}
+
+void process(export_job *job) {
+    job->ok = false;
+    auto fin = std::unique_ptr<TFile>(TFile::Open(job->filename.c_str()));
+    auto tree = fin == nullptr ? nullptr : reinterpret_cast<TTree *>(fin->Get((job->channel + "_tree").c_str()));
+    if (tree == nullptr) {
+        std::cerr << "Unable to read " << job->channel << "_tree from " << job->filename << std::endl;
+        return;
+    } else if (friend_output::is_friend(fin.get(), job->channel + "_tree")) {
+        std::cerr << job->filename << " is a --friend output without the nominal columns, join it with scripts/utils/friend_output.py" << std::endl;
+        return;
+    }
+    auto branches = input_vars;
+    branches.insert(branches.end(), {"njets", "is_signal", "evtwt"});
+    column_block columns(tree, branches);
+    for (auto &name : branches) {
+        if (columns.index(name) < 0) {
+            return;
+        }
+    }
+
+    // duplicates are dropped within a file, the first one is kept
+    std::set<std::vector<double>> seen;
+    std::vector<double> row(branches.size());
+    for (auto &chunk : cluster_chunks(tree)) {
+        auto n = columns.read(chunk.first, chunk.second);
+        job->read += n;
+        for (Long64_t i = 0; i < n; i++) {
+            for (size_t v = 0; v < branches.size(); v++) {
+                row[v] = columns[v][i];
+            }
+            if (selected(row) && seen.insert(row).second) {
+                job->rows.push_back(row);
+            }
+        }
+    }
+
+    // weights scaled to [1, 2] like MinMaxScaler(feature_range=(1., 2.))
+    auto wt = branches.size() - 1;
+    double wmin(0.), wmax(0.);
+    for (size_t i = 0; i < job->rows.size(); i++) {
+        wmin = i == 0 ? job->rows[i][wt] : std::min(wmin, job->rows[i][wt]);
+        wmax = i == 0 ? job->rows[i][wt] : std::max(wmax, job->rows[i][wt]);
+    }
+    for (auto &selected_row : job->rows) {
+        selected_row[wt] = 1. + (selected_row[wt] - wmin) / (wmax > wmin ? wmax - wmin : 1.);
+        if (job->syst == "nominal" && job->isSM) {
+            std::vector<double> inputs(selected_row.begin(), selected_row.begin() + input_vars.size());
+            inputs.push_back(job->isSM);
+            job->scaler.add(inputs);
+        }
+    }
+    job->ok = true;
+}
+
+// branches of one training tree
+struct training_tree {
+    TTree *tree;
+    std::vector<Double_t> inputs;
+    Double_t isSM, njets, is_signal, isSignal, evtwt;
+    Int_t sample;
+
+    training_tree(std::string name, Long64_t chunk) : tree(new TTree(name.c_str(), name.c_str())), inputs(input_vars.size()) {
+        for (size_t i = 0; i < input_vars.size(); i++) {
+            tree->Branch(input_vars[i].c_str(), &inputs[i], (input_vars[i] + "/D").c_str());
+        }
+        tree->Branch("isSM", &isSM, "isSM/D");
+        tree->Branch("njets", &njets, "njets/D");
+        tree->Branch("is_signal", &is_signal, "is_signal/D");
+        tree->Branch("isSignal", &isSignal, "isSignal/D");
+        tree->Branch("evtwt", &evtwt, "evtwt/D");
+        tree->Branch("sample", &sample, "sample/I");
+        tree->SetAutoFlush(chunk);
+    }
+
+    void fill(const export_job &job, Int_t index) {
+        isSM = job.isSM;
+        isSignal = job.isSignal;
+        sample = index;
+        for (auto &row : job.rows) {
+            std::copy(row.begin(), row.begin() + input_vars.size(), inputs.begin());
+            njets = row[input_vars.size()];
+            is_signal = row[input_vars.size() + 1];
+            evtwt = row[input_vars.size() + 2];
+            tree->Fill();
+        }
+    }
+};
+
+// dir/*/merged/*.root, skipping jetFakes (and, without --syst, the systematics)
+void add_files(std::vector<export_job> *jobs, std::string channel, std::string input_dir, bool doSyst) {
+    auto dir = opendir(input_dir.c_str());
+    if (dir == nullptr) {
+        std::cerr << "Unable to open directory " << input_dir << std::endl;
+        return;
+    }
+    std::vector<std::string> subdirs;
+    while (auto entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..") {
+            subdirs.push_back(name);
+        }
+    }
+    closedir(dir);
+    std::sort(subdirs.begin(), subdirs.end());
+
+    for (auto &subdir : subdirs) {
+        auto merged = input_dir + "/" + subdir + "/merged";
+        auto sub = opendir(merged.c_str());
+        if (sub == nullptr) {
+            continue;
+        }
+        std::vector<std::string> files;
+        while (auto entry = readdir(sub)) {
+            std::string filename = entry->d_name;
+            if (filename.size() > 5 && filename.substr(filename.size() - 5) == ".root" && filename.find("jetFakes") == std::string::npos) {
+                files.push_back(filename);
+            }
+        }
+        closedir(sub);
+        std::sort(files.begin(), files.end());
+        for (auto &filename : files) {
+            auto path = merged + "/" + filename;
+            auto pos = path.find("SYST_");
+            if (pos != std::string::npos && !doSyst) {
+                continue;
+            }
+            std::string syst = pos == std::string::npos ? "nominal" : path.substr(pos + 5, path.find('/', pos) - pos - 5);
+            jobs->push_back(export_job{channel, path, syst, filename.substr(0, filename.size() - 5), 0., 0., {},
+                                       running_scaler(input_vars.size() + 1), 0, false, false});
+            set_labels(&jobs->back());
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    CLParser parser(argc, argv);
+    std::string el_input_dir = parser.Option("-e");
+    std::string mu_input_dir = parser.Option("-m");
+    std::string output = parser.Option("-o");
+    std::string chunk_str = parser.Option("--chunk");
+    std::string nthreads_str = parser.Option("-j");
+    bool doSyst = parser.Flag("--syst");
+    int nthreads = nthreads_str.empty() ? 1 : std::stoi(nthreads_str);
+    Long64_t chunk = chunk_str.empty() ? 10000 : std::stoll(chunk_str);
+    if (output.empty() || (el_input_dir.empty() && mu_input_dir.empty())) {
+        std::cerr << "Usage: export_training [-e etau_dir] [-m mutau_dir] -o output [--syst] [--chunk entries] [-j threads]" << std::endl;
+        return 1;
+    }
+
+    std::vector<export_job> jobs;
+    if (!el_input_dir.empty()) {
+        add_files(&jobs, "et", el_input_dir, doSyst);
+    }
+    if (!mu_input_dir.empty()) {
+        add_files(&jobs, "mt", mu_input_dir, doSyst);
+    }
+    std::cout << "Files to process: " << jobs.size() << std::endl;
+
+    auto output_name = "Output/datasets/" + output + ".root";
+    auto fout = std::unique_ptr<TFile>(new TFile(output_name.c_str(), "RECREATE"));
+    if (fout->IsZombie()) {
+        std::cerr << "Unable to create " << output_name << std::endl;
+        return 1;
+    }
+    std::vector<std::string> systs;
+    std::unordered_map<std::string, std::unique_ptr<training_tree>> trees;
+    for (auto &job : jobs) {
+        if (trees.find(job.syst) == trees.end()) {
+            systs.push_back(job.syst);
+            trees[job.syst] = std::unique_ptr<training_tree>(new training_tree(job.syst, chunk));
+        }
+    }
+
+    // Finished files are written in order by whichever thread completes the
+    // next one, so only the files in flight are held in memory.
+    ROOT::EnableThreadSafety();
+    auto start = std::chrono::steady_clock::now();
+    running_scaler scaler(input_vars.size() + 1);
+    std::mutex write_lock;
+    size_t next_write(0);
+    Long64_t read(0), written(0);
+    std::atomic<size_t> next_job(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < std::min(nthreads, static_cast<int>(jobs.size())); i++) {
+        threads.push_back(std::thread([&]() {
+            for (auto j = next_job++; j < jobs.size(); j = next_job++) {
+                process(&jobs.at(j));
+                std::lock_guard<std::mutex> lock(write_lock);
+                jobs.at(j).done = true;
+                for (; next_write < jobs.size() && jobs.at(next_write).done; next_write++) {
+                    auto &job = jobs.at(next_write);
+                    if (job.ok) {
+                        trees.at(job.syst)->fill(job, next_write);
+                        scaler.merge(job.scaler);
+                        read += job.read;
+                        written += job.rows.size();
+                    }
+                    std::vector<std::vector<double>>().swap(job.rows);
+                }
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    fout->cd();
+    for (auto &syst : systs) {
+        trees.at(syst)->tree->Write();
+    }
+
+    char sample_names[256], lepton[8];
+    auto samples = new TTree("samples", "samples");
+    samples->Branch("sample_names", sample_names, "sample_names/C");
+    samples->Branch("lepton", lepton, "lepton/C");
+    for (auto &job : jobs) {
+        std::strncpy(sample_names, job.sample.c_str(), sizeof(sample_names) - 1);
+        sample_names[sizeof(sample_names) - 1] = '\0';
+        std::strncpy(lepton, job.channel.c_str(), sizeof(lepton) - 1);
+        lepton[sizeof(lepton) - 1] = '\0';
+        samples->Fill();
+    }
+    samples->Write();
+
+    char name[64];
+    Double_t mean, scale, variance;
+    Long64_t nsamples(scaler.getSamples());
+    auto scaler_tree = new TTree("scaler", "scaler");
+    scaler_tree->Branch("name", name, "name/C");
+    scaler_tree->Branch("mean", &mean, "mean/D");
+    scaler_tree->Branch("scale", &scale, "scale/D");
+    scaler_tree->Branch("variance", &variance, "variance/D");
+    scaler_tree->Branch("nsamples", &nsamples, "nsamples/L");
+    auto scaled = input_vars;
+    scaled.push_back("isSM");
+    for (size_t i = 0; i < scaled.size(); i++) {
+        std::strncpy(name, scaled[i].c_str(), sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+        mean = scaler.getMean(i);
+        scale = scaler.getScale(i);
+        variance = scaler.getVariance(i);
+        scaler_tree->Fill();
+    }
+    scaler_tree->Write();
+    fout->Close();
+
+    int failed(0);
+    for (auto &job : jobs) {
+        if (!job.ok) {
+            std::cerr << "FAILED " << job.filename << std::endl;
+            failed++;
+        }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Wrote " << written << " of " << read << " events (" << nsamples << " for the scaler) to " << output_name << " in " << elapsed
+              << " s" << std::endl;
+    return failed > 0;
+}
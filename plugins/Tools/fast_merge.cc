@@ -0,0 +1,265 @@
+// Copyright 2020 Tyler Mitchell
+
+// Merge analyzer outputs without going through hadd/ahadd.py.
+//
+// Usage:
+//   fast_merge -o merged.root in1.root in2.root ...
+//       TFileMerger in fast mode: tree baskets are copied as they are, with
+//       no decompression or recompression, and histograms are added.
+//   fast_merge --jobs merge_jobs.json -j 8
+//       run every {"output.root": ["input.root", ...]} merge in the JSON file,
+//       8 at a time, inside one process.
+//   fast_merge --buffered -j 8 -o merged.root in1.root in2.root ...
+//       8 threads read the inputs and stream them into one output through
+//       the buffer merger (see include/output_merger.h).
+//   fast_merge --dedup ...
+//       afterwards, drop the events of each tree in the output whose exact
+//       (run, lumi, evt) already appeared (data only: the analyzers' --dedup
+//       only sees the events of one job).
+
+// system includes
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// ROOT includes
+#include "TFile.h"
+#include "TFileMerger.h"
+#include "TKey.h"
+#include "TLeaf.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+// user includes
+#include "../../include/CLParser.h"
+#include "../../include/json_reader.h"
+#include "../../include/output_merger.h"
+
+typedef std::pair<std::string, std::vector<std::string>> merge_job;
+
+std::mutex log_lock;
+
+long file_size(const std::string &name) {
+    struct stat info;
+    return stat(name.c_str(), &info) == 0 ? info.st_size : 0;
+}
+
+struct event_key {
+    ULong64_t run_lumi, evt;
+    bool operator==(const event_key &other) const { return run_lumi == other.run_lumi && evt == other.evt; }
+};
+
+struct event_key_hash {
+    size_t operator()(const event_key &key) const { return std::hash<ULong64_t>()(key.run_lumi * 0x9e3779b97f4a7c15ULL ^ key.evt); }
+};
+
+// Rewrite the trees of a merged file without the repeated (run, lumi, evt)
+// keys. The analyzers always write those branches for data, trees without
+// them (older outputs, histogram trees) are left as they are.
+bool remove_duplicates(const std::string &filename) {
+    auto fout = TFile::Open(filename.c_str(), "UPDATE");
+    if (fout == nullptr || fout->IsZombie()) {
+        std::lock_guard<std::mutex> guard(log_lock);
+        std::cerr << "Unable to open " << filename << " to remove duplicates" << std::endl;
+        return false;
+    }
+    std::vector<std::string> names;
+    TIter next(fout->GetListOfKeys());
+    while (auto key = reinterpret_cast<TKey *>(next())) {
+        if (std::string(key->GetClassName()) == "TTree" && std::find(names.begin(), names.end(), key->GetName()) == names.end()) {
+            names.push_back(key->GetName());
+        }
+    }
+
+    bool ok(true);
+    for (auto &name : names) {
+        auto tree = reinterpret_cast<TTree *>(fout->Get(name.c_str()));
+        auto run = tree->GetLeaf("run");
+        auto lumi = tree->GetLeaf("lumi");
+        auto evt = tree->GetLeaf("evt");
+        if (run == nullptr || lumi == nullptr || evt == nullptr) {
+            std::lock_guard<std::mutex> guard(log_lock);
+            std::cout << filename << ": " << name << " has no run, lumi and evt branches, skipped" << std::endl;
+            continue;
+        }
+
+        std::unordered_set<event_key, event_key_hash> seen;
+        std::vector<Long64_t> repeated;
+        tree->SetBranchStatus("*", false);
+        tree->SetBranchStatus("run", true);
+        tree->SetBranchStatus("lumi", true);
+        tree->SetBranchStatus("evt", true);
+        for (Long64_t i = 0; i < tree->GetEntries(); i++) {
+            tree->GetEntry(i);
+            event_key key = {(static_cast<ULong64_t>(run->GetValueLong64()) << 32) | static_cast<UInt_t>(lumi->GetValueLong64()),
+                             static_cast<ULong64_t>(evt->GetValueLong64())};
+            if (!seen.insert(key).second) {
+                repeated.push_back(i);
+            }
+        }
+        tree->SetBranchStatus("*", true);
+        if (repeated.empty()) {
+            continue;
+        }
+
+        auto unique = tree->CloneTree(0);
+        auto skip = repeated.begin();
+        for (Long64_t i = 0; i < tree->GetEntries(); i++) {
+            if (skip != repeated.end() && *skip == i) {
+                skip++;
+                continue;
+            }
+            tree->GetEntry(i);
+            unique->Fill();
+        }
+        std::lock_guard<std::mutex> guard(log_lock);
+        if (unique->Write("", TObject::kOverwrite) <= 0) {
+            std::cerr << "Unable to write " << name << " without duplicates to " << filename << std::endl;
+            ok = false;
+            continue;
+        }
+        std::cout << "Removed " << repeated.size() << " duplicate events of " << tree->GetEntries() << " from " << name << " in "
+                  << filename << std::endl;
+    }
+    fout->Close();
+    delete fout;
+    return ok;
+}
+
+bool fast_merge(const merge_job &job) {
+    TFileMerger merger(false, false);
+    merger.SetFastMethod(true);
+    merger.SetPrintLevel(0);
+    if (!merger.OutputFile(job.first.c_str(), "RECREATE")) {
+        std::lock_guard<std::mutex> guard(log_lock);
+        std::cerr << "Unable to create " << job.first << std::endl;
+        return false;
+    }
+    for (auto &input : job.second) {
+        if (!merger.AddFile(input.c_str(), false)) {
+            std::lock_guard<std::mutex> guard(log_lock);
+            std::cerr << "Unable to open " << input << std::endl;
+            return false;
+        }
+    }
+    bool ok = merger.Merge();
+    std::lock_guard<std::mutex> guard(log_lock);
+    std::cout << (ok ? "Merged " : "FAILED ") << job.second.size() << " files into " << job.first << std::endl;
+    return ok;
+}
+
+bool buffered_merge(const merge_job &job, int nthreads) {
+    output_merger merger(job.first);
+    std::atomic<size_t> next_input(0);
+    std::atomic<bool> ok(true);
+    auto worker = [&]() {
+        for (auto i = next_input++; i < job.second.size(); i = next_input++) {
+            auto fin = TFile::Open(job.second.at(i).c_str());
+            if (fin == nullptr || fin->IsZombie()) {
+                std::lock_guard<std::mutex> guard(log_lock);
+                std::cerr << "Unable to open " << job.second.at(i) << std::endl;
+                ok = false;
+                continue;
+            }
+            // one buffer per input so clones with the same name never meet
+            auto fout = merger.get_file();
+            output_merger::copy_directory(fin, fout.get());
+            fout->Write();
+            fin->Close();
+            delete fin;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nthreads; i++) {
+        threads.push_back(std::thread(worker));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    std::cout << (ok ? "Merged " : "FAILED ") << job.second.size() << " files into " << job.first << std::endl;
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    CLParser parser(argc, argv);
+    std::string output = parser.Option("-o");
+    std::string job_file = parser.Option("--jobs");
+    std::string nthreads_str = parser.Option("-j");
+    bool buffered = parser.Flag("--buffered");
+    bool dedup = parser.Flag("--dedup");
+    int nthreads = nthreads_str.empty() ? 1 : std::stoi(nthreads_str);
+
+    // anything that isn't an option or its value is an input file
+    std::vector<merge_job> jobs;
+    if (!output.empty()) {
+        std::vector<std::string> inputs;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-o" || arg == "--jobs" || arg == "-j") {
+                i++;
+            } else if (arg.find("--") != 0) {
+                inputs.push_back(arg);
+            }
+        }
+        jobs.push_back(std::make_pair(output, inputs));
+    }
+    if (!job_file.empty()) {
+        json_reader reader;
+        auto config = reader.parseFile(job_file);
+        if (!reader.ok()) {
+            return 1;
+        }
+        for (auto &job : config.getMembers()) {
+            jobs.push_back(std::make_pair(job.first, job.second.asStringVector()));
+        }
+    }
+    if (jobs.empty()) {
+        std::cerr << "Usage: fast_merge -o merged.root inputs... | --jobs jobs.json [-j threads] [--buffered] [--dedup]" << std::endl;
+        return 1;
+    }
+
+    ROOT::EnableThreadSafety();
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next_job(0);
+    std::atomic<int> failed(0);
+    if (buffered) {
+        // parallelism is inside each merge
+        for (auto &job : jobs) {
+            failed += !buffered_merge(job, nthreads) || (dedup && !remove_duplicates(job.first));
+        }
+    } else {
+        // parallelism is across merges
+        std::vector<std::thread> threads;
+        for (int i = 0; i < nthreads; i++) {
+            threads.push_back(std::thread([&]() {
+                for (auto j = next_job++; j < jobs.size(); j = next_job++) {
+                    failed += !fast_merge(jobs.at(j)) || (dedup && !remove_duplicates(jobs.at(j).first));
+                }
+            }));
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+    long bytes_in(0), bytes_out(0);
+    for (auto &job : jobs) {
+        bytes_out += file_size(job.first);
+        for (auto &input : job.second) {
+            bytes_in += file_size(input);
+        }
+    }
+    std::cout << "Merged " << bytes_in / (1024 * 1024) << " MB into " << jobs.size() << " files (" << bytes_out / (1024 * 1024)
+              << " MB) in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+    return failed > 0;
+}
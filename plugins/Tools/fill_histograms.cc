@@ -0,0 +1,397 @@
+// Copyright 2020 Tyler Mitchell
+
+// Fill the control-plot histograms of scripts/produce_histograms.py in one
+// pass over the merged slim trees.
+//
+// Usage:
+//   fill_histograms -c baseline -i Output/trees/dir/merged -y 2018 -d 2020_05_01 [--suffix _x] [--syst] [--embed] [-j 8]
+//
+// The options, the output file name and its layout ({channel}_{category}/
+// {variable}/{process}) are the same as for the python script. Every
+// variable of the plotting.json config, every category of boilerplate.json
+// and, with --syst, every systematic tree and fake-factor variation are
+// filled from a single read of each tree. The entries of a tree are split by
+// cluster between the threads, each thread keeps its own bin sums and they
+// are added before the histograms are written.
+
+// system includes
+#include <dirent.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// ROOT includes
+#include "TFile.h"
+#include "TKey.h"
+#include "TList.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+// user includes
+#include "../../include/CLParser.h"
+#include "../../include/friend_output.h"
+#include "../../include/hist_filler.h"
+#include "../../include/json_reader.h"
+
+struct variable_config {
+    std::string name;
+    hist_axis axis;
+};
+
+struct weight_config {
+    std::string hist_name;
+    std::string branch;  // multiplies evtwt, empty for none
+};
+
+struct fill_job {
+    std::string filename, tree_name;
+    std::vector<weight_config> weights;
+};
+
+// category selections of produce_histograms.py, applied after the isolation
+// (and, for embedded, contamination) requirements
+bool in_category(const std::string &category, double njets, double mjj) {
+    if (category == "0jet") {
+        return njets == 0;
+    } else if (category == "boosted") {
+        return njets == 1 || (njets > 1 && mjj < 300);
+    } else if (category == "vbf") {
+        return njets > 1 && mjj > 300;
+    }
+    return true;  // inclusive
+}
+
+class histogram_filler {
+ public:
+    histogram_filler(std::vector<variable_config> _variables, std::vector<std::string> _categories, bool _embed)
+        : variables(_variables), categories(_categories), embed(_embed) {}
+
+    bool fill(const fill_job &, int, TFile *, std::string);
+
+ private:
+    size_t index(size_t category, size_t variable, size_t weight, size_t nweights) {
+        return (category * variables.size() + variable) * nweights + weight;
+    }
+    void fill_chunks(const fill_job &, const std::vector<std::pair<Long64_t, Long64_t>> &, std::atomic<size_t> *, std::vector<bin_sums> *,
+                     std::atomic<bool> *);
+
+    std::vector<variable_config> variables;
+    std::vector<std::string> categories;
+    bool embed;
+};
+
+void histogram_filler::fill_chunks(const fill_job &job, const std::vector<std::pair<Long64_t, Long64_t>> &chunks,
+                                   std::atomic<size_t> *next_chunk, std::vector<bin_sums> *sums, std::atomic<bool> *ok) {
+    auto fin = std::unique_ptr<TFile>(TFile::Open(job.filename.c_str()));
+    auto tree = fin == nullptr ? nullptr : reinterpret_cast<TTree *>(fin->Get(job.tree_name.c_str()));
+    if (tree == nullptr) {
+        std::cerr << "Unable to read " << job.tree_name << " from " << job.filename << std::endl;
+        *ok = false;
+        return;
+    }
+    tree->SetCacheSize(32 * 1024 * 1024);
+
+    // jetFakes are taken from the anti-isolated region
+    std::string iso_branch = job.filename.find("jetFakes") != std::string::npos ? "is_antiTauIso" : "is_signal";
+    std::vector<std::string> names = {iso_branch, "njets", "mjj", "evtwt"};
+    if (embed) {
+        names.push_back("contamination");
+    }
+    for (auto &weight : job.weights) {
+        if (!weight.branch.empty()) {
+            names.push_back(weight.branch);
+        }
+    }
+    for (auto &variable : variables) {
+        names.push_back(variable.name);
+    }
+    column_block block(tree, names);
+
+    int iso(block.index(iso_branch)), njets(block.index("njets")), mjj(block.index("mjj")), evtwt(block.index("evtwt"));
+    int contamination(embed ? block.index("contamination") : 0);
+    if (iso < 0 || njets < 0 || mjj < 0 || evtwt < 0 || contamination < 0) {
+        *ok = false;
+        return;
+    }
+    std::vector<int> weight_columns, variable_columns;
+    for (auto &weight : job.weights) {
+        weight_columns.push_back(weight.branch.empty() ? -1 : block.index(weight.branch));
+        if (!weight.branch.empty() && weight_columns.back() < 0) {
+            *ok = false;
+            return;
+        }
+    }
+    for (auto &variable : variables) {
+        variable_columns.push_back(block.index(variable.name));
+        if (variable_columns.back() < 0) {
+            std::cerr << "No branch for variable " << variable.name << " in " << job.filename << std::endl;
+            *ok = false;
+            return;
+        }
+    }
+
+    auto nweights = job.weights.size();
+    std::vector<bool> in_cat(categories.size());
+    std::vector<double> weights(nweights);
+    for (auto c = (*next_chunk)++; c < chunks.size(); c = (*next_chunk)++) {
+        auto n = block.read(chunks.at(c).first, chunks.at(c).second);
+        for (Long64_t i = 0; i < n; i++) {
+            if (block[iso][i] <= 0 || (embed && block[contamination][i] != 0)) {
+                continue;
+            }
+            for (size_t cat = 0; cat < categories.size(); cat++) {
+                in_cat[cat] = in_category(categories.at(cat), block[njets][i], block[mjj][i]);
+            }
+            for (size_t w = 0; w < nweights; w++) {
+                // product in single precision, like the float32 arrays in python
+                weights[w] = weight_columns[w] < 0 ? block[evtwt][i]
+                                                   : static_cast<float>(block[evtwt][i]) * static_cast<float>(block[weight_columns[w]][i]);
+            }
+            for (size_t v = 0; v < variables.size(); v++) {
+                double x = block[variable_columns[v]][i];
+                int bin = variables[v].axis.find(x);
+                for (size_t cat = 0; cat < categories.size(); cat++) {
+                    if (!in_cat[cat]) {
+                        continue;
+                    }
+                    for (size_t w = 0; w < nweights; w++) {
+                        sums->at(index(cat, v, w, nweights)).fill(bin, x, weights[w]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+bool histogram_filler::fill(const fill_job &job, int nthreads, TFile *fout, std::string channel) {
+    std::vector<std::pair<Long64_t, Long64_t>> chunks;
+    {
+        auto fin = std::unique_ptr<TFile>(TFile::Open(job.filename.c_str()));
+        auto tree = fin == nullptr ? nullptr : reinterpret_cast<TTree *>(fin->Get(job.tree_name.c_str()));
+        if (tree == nullptr) {
+            std::cerr << "Unable to read " << job.tree_name << " from " << job.filename << std::endl;
+            return false;
+        } else if (friend_output::is_friend(fin.get(), job.tree_name)) {
+            std::cerr << job.filename << " is a --friend output without the nominal columns, join it with scripts/utils/friend_output.py"
+                      << std::endl;
+            return false;
+        }
+        chunks = cluster_chunks(tree);
+    }
+
+    auto nweights = job.weights.size();
+    std::vector<std::vector<bin_sums>> thread_sums(nthreads);
+    for (auto &sums : thread_sums) {
+        for (size_t cat = 0; cat < categories.size(); cat++) {
+            for (auto &variable : variables) {
+                for (size_t w = 0; w < nweights; w++) {
+                    sums.push_back(bin_sums(variable.axis.getNbins()));
+                }
+            }
+        }
+    }
+
+    std::atomic<size_t> next_chunk(0);
+    std::atomic<bool> ok(true);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < std::min(nthreads, static_cast<int>(chunks.size())); i++) {
+        threads.push_back(std::thread(&histogram_filler::fill_chunks, this, std::cref(job), std::cref(chunks), &next_chunk, &thread_sums.at(i), &ok));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    if (!ok) {
+        return false;
+    }
+
+    for (size_t cat = 0; cat < categories.size(); cat++) {
+        for (size_t v = 0; v < variables.size(); v++) {
+            fout->cd((channel + "_" + categories.at(cat) + "/" + variables.at(v).name).c_str());
+            for (size_t w = 0; w < nweights; w++) {
+                auto &total = thread_sums.at(0).at(index(cat, v, w, nweights));
+                for (int t = 1; t < nthreads; t++) {
+                    total.add(thread_sums.at(t).at(index(cat, v, w, nweights)));
+                }
+                auto hist = total.make(job.weights.at(w).hist_name, variables.at(v).axis);
+                hist->Write();
+                delete hist;
+            }
+        }
+    }
+    return true;
+}
+
+std::vector<std::string> list_files(std::string dirname) {
+    std::vector<std::string> files;
+    auto dir = opendir(dirname.c_str());
+    if (dir == nullptr) {
+        std::cerr << "Unable to open directory " << dirname << std::endl;
+        return files;
+    }
+    while (auto entry = readdir(dir)) {
+        std::string filename = entry->d_name;
+        if (filename.size() > 5 && filename.substr(filename.size() - 5) == ".root") {
+            files.push_back(dirname + "/" + filename);
+        }
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+std::vector<std::string> list_trees(TFile *fin) {
+    std::vector<std::string> trees;
+    TIter next(fin->GetListOfKeys());
+    while (auto key = reinterpret_cast<TKey *>(next())) {
+        std::string name = key->GetName();
+        if (std::string(key->GetClassName()) == "TTree" && std::find(trees.begin(), trees.end(), name) == trees.end()) {
+            trees.push_back(name);
+        }
+    }
+    return trees;
+}
+
+int main(int argc, char *argv[]) {
+    CLParser parser(argc, argv);
+    std::string config_name = parser.Option("-c");
+    std::string input_dir = parser.Option("-i");
+    std::string year = parser.Option("-y");
+    std::string date = parser.Option("-d");
+    std::string suffix = parser.Option("--suffix");
+    std::string nthreads_str = parser.Option("-j");
+    bool doSyst = parser.Flag("--syst");
+    bool embed = parser.Flag("--embed");
+    int nthreads = nthreads_str.empty() ? 1 : std::stoi(nthreads_str);
+    if (config_name.empty() || input_dir.empty() || year.empty() || date.empty()) {
+        std::cerr << "Usage: fill_histograms -c config -i input_dir -y year -d date [--suffix suffix] [--syst] [--embed] [-j threads]" << std::endl;
+        return 1;
+    }
+
+    json_reader reader;
+    auto boilerplate = reader.parseFile("configs/boilerplate.json");
+    auto plotting = reader.parseFile("configs/plotting.json");
+    if (!reader.ok() || !plotting.has(config_name)) {
+        std::cerr << "Unable to read config " << config_name << " from configs/plotting.json" << std::endl;
+        return 1;
+    }
+
+    std::vector<variable_config> variables;
+    for (auto &variable : plotting.get(config_name).get("variables").getMembers()) {
+        auto bins = variable.second.asDoubleVector();
+        variables.push_back(variable_config{variable.first, hist_axis(static_cast<int>(bins.at(0)), bins.at(1), bins.at(2))});
+    }
+    auto categories = boilerplate.get("categories").asStringVector();
+    for (auto &category : categories) {
+        if (category != "inclusive" && category != "0jet" && category != "boosted" && category != "vbf") {
+            std::cerr << "No selection defined for category " << category << std::endl;
+            return 1;
+        }
+    }
+    auto ff_systematics = boilerplate.get("fake_factor_systematics").asStringVector();
+    auto &syst_name_map = boilerplate.get("syst_name_map");
+
+    auto files = list_files(input_dir);
+    if (files.empty()) {
+        std::cerr << "No input files in " << input_dir << std::endl;
+        return 1;
+    }
+
+    // the channel comes from the tree in the first file
+    std::string tree_name;
+    {
+        auto fin = std::unique_ptr<TFile>(TFile::Open(files.front().c_str()));
+        for (auto &name : list_trees(fin.get())) {
+            if (name == "et_tree" || name == "mt_tree" || name == "em_tree" || name == "tt_tree") {
+                tree_name = name;
+            }
+        }
+    }
+    if (tree_name.empty()) {
+        std::cerr << "Can't find et_tree, mt_tree, em_tree or tt_tree in " << files.front() << std::endl;
+        return 1;
+    }
+    std::string channel = tree_name.substr(0, 2);
+
+    std::string output_name = "Output/histograms/htt_" + channel + "_" + (embed ? "emb" : "ztt") + "_" + (doSyst ? "Sys" : "noSys") + "_fa3_" +
+                              year + "_" + date + suffix + ".root";
+    auto fout = std::unique_ptr<TFile>(new TFile(output_name.c_str(), "RECREATE"));
+    for (auto &category : categories) {
+        fout->cd();
+        fout->mkdir((channel + "_" + category).c_str());
+        for (auto &variable : variables) {
+            fout->mkdir((channel + "_" + category + "/" + variable.name).c_str());
+        }
+    }
+
+    ROOT::EnableThreadSafety();
+    auto start = std::chrono::steady_clock::now();
+    histogram_filler filler(variables, categories, embed);
+    int failed(0);
+    for (auto &ifile : files) {
+        // handle ZTT vs embedded
+        if ((embed && ifile.find("ZTT") != std::string::npos) || (!embed && ifile.find("embed") != std::string::npos)) {
+            continue;
+        }
+        std::string base = ifile.substr(ifile.rfind('/') + 1);
+        base = base.substr(0, base.size() - 5);
+        std::cout << base << std::endl;
+        bool fake = ifile.find("jetFakes") != std::string::npos || ifile.find("QCD") != std::string::npos;
+
+        std::vector<std::string> trees = {tree_name};
+        if (doSyst) {
+            auto fin = std::unique_ptr<TFile>(TFile::Open(ifile.c_str()));
+            trees.clear();
+            for (auto &name : list_trees(fin.get())) {
+                if (name.find("tree") != std::string::npos) {
+                    trees.push_back(name);
+                }
+            }
+        }
+
+        for (auto &itree : trees) {
+            std::string shift;
+            if (itree != tree_name) {
+                std::string key = itree.substr(tree_name.size());
+                if (!syst_name_map.has(key) && key.find('_') == 0) {
+                    key = key.substr(1);
+                }
+                if (!syst_name_map.has(key)) {
+                    std::cerr << "No name for systematic tree " << itree << " in configs/boilerplate.json, skipping" << std::endl;
+                    continue;
+                }
+                shift = syst_name_map.get(key).asString();
+            }
+
+            std::string name = base + shift;
+            if (name.find("Data") != std::string::npos) {
+                name = "data_obs";
+            }
+            for (auto pos = name.find("embed"); pos != std::string::npos; pos = name.find("embed")) {
+                name.replace(pos, 5, "ZTT");
+            }
+
+            fill_job job{ifile, itree, {}};
+            if (fake) {
+                job.weights.push_back(weight_config{"jetFakes" + shift, "fake_weight"});
+                if (doSyst && itree == tree_name) {
+                    for (auto &syst : ff_systematics) {
+                        job.weights.push_back(weight_config{"jetFakes_CMS_htt_" + syst, syst});
+                    }
+                }
+            } else {
+                job.weights.push_back(weight_config{name, ""});
+            }
+            failed += !filler.fill(job, nthreads, fout.get(), channel);
+        }
+    }
+
+    fout->Close();
+    std::cout << "Finished in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " seconds" << std::endl;
+    return failed > 0;
+}
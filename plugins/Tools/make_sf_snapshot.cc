@@ -0,0 +1,340 @@
+// Copyright 2020 Tyler Mitchell
+
+// Flatten the scale factor workspaces and graphs of one era and channel into
+// a snapshot the analyzers can map into memory (--sf-snapshot).
+//
+// Usage:
+//   make_sf_snapshot -c configs/sf_snapshot.json -e mt_2018 -o Output/sf_snapshots/mt_2018.snap [--check 10000] [--tolerance 0.01]
+//
+// Each entry of the config (keyed by channel_era) lists
+//   "workspaces": RooWorkspace files, their tables are stored as "prefix/function".
+//                 "functions" are regular expressions picking what to store
+//   "graphs":     TGraphs stored as "prefix/name" (NNLOPS weights)
+//   "histograms": TH1/TH2 stored as bin tables, "prefix/name"
+//   "constants":  single numbers
+//   "grid":       how each workspace variable is sampled. {"bins": [edges]}
+//                 stores the value at the bin centers, constant in the bin.
+//                 {"points": [x]} stores the value at each point, linearly
+//                 interpolated in between. {"uniform": [n, low, high]} makes
+//                 n bins (or n + 1 points with "mode": "points").
+//
+// Every function is tabulated on the grid variables it depends on. Variables
+// outside of the grid stay at their workspace values (the analyzers never set
+// them). The analyzers evaluate the tables like the workspaces: the grid
+// should follow the binning of the measured scale factors, and fitted
+// functions of pt should use points fine enough for the tolerance.
+//
+// --check compares the snapshot to the workspaces at random points inside the
+// grid and fails if a function is off by more than the tolerance (relative).
+
+// system includes
+#include <sys/stat.h>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+// ROOT includes
+#include "RooAbsReal.h"
+#include "RooArgSet.h"
+#include "RooRealVar.h"
+#include "RooWorkspace.h"
+#include "TFile.h"
+#include "TGraph.h"
+#include "TH1.h"
+
+// user includes
+#include "../../include/CLParser.h"
+#include "../../include/json_reader.h"
+#include "../../include/sf_snapshot.h"
+
+// sampling of one workspace variable
+struct grid_axis {
+    sf_snapshot_writer::axis axis;
+    std::vector<double> samples;  // where the workspace is evaluated
+};
+
+grid_axis make_axis(const std::string &name, const json_value &config) {
+    grid_axis grid;
+    grid.axis.name = name;
+    grid.axis.mode = config.has("points") || config.get("mode").asString() == "points" ? sf_table::points : sf_table::bins;
+    if (config.has("uniform")) {
+        auto uniform = config.get("uniform").asDoubleVector();
+        int n = static_cast<int>(uniform.at(0));
+        for (int i = 0; i <= n; i++) {
+            grid.axis.edges.push_back(uniform.at(1) + i * (uniform.at(2) - uniform.at(1)) / n);
+        }
+    } else {
+        grid.axis.edges = config.get(grid.axis.mode == sf_table::points ? "points" : "bins").asDoubleVector();
+    }
+    std::sort(grid.axis.edges.begin(), grid.axis.edges.end());
+
+    if (grid.axis.mode == sf_table::points) {
+        grid.samples = grid.axis.edges;
+    } else {
+        for (size_t i = 0; i + 1 < grid.axis.edges.size(); i++) {
+            grid.samples.push_back(0.5 * (grid.axis.edges.at(i) + grid.axis.edges.at(i + 1)));
+        }
+    }
+    return grid;
+}
+
+// evaluate a function on every combination of its axes (the last axis changes fastest)
+std::vector<double> tabulate(RooAbsReal *func, const std::vector<RooRealVar *> &vars, const std::vector<const grid_axis *> &axes) {
+    size_t npoints(1);
+    for (auto ax : axes) {
+        npoints *= ax->samples.size();
+    }
+    std::vector<double> values(npoints);
+    std::vector<size_t> index(axes.size(), 0);
+    for (size_t point = 0; point < npoints; point++) {
+        for (size_t i = 0; i < axes.size(); i++) {
+            vars.at(i)->setVal(axes.at(i)->samples.at(index.at(i)));
+        }
+        values.at(point) = func->getVal();
+        for (int i = static_cast<int>(axes.size()) - 1; i >= 0 && ++index.at(i) == axes.at(i)->samples.size(); i--) {
+            index.at(i) = 0;
+        }
+    }
+    return values;
+}
+
+// a function stored from a workspace, kept to compare with the snapshot
+struct stored_function {
+    std::string name;
+    RooAbsReal *func;
+    std::vector<RooRealVar *> vars;
+    std::vector<const grid_axis *> axes;
+};
+
+bool pick(const std::string &name, const std::vector<std::regex> &patterns) {
+    if (patterns.empty()) {
+        return true;
+    }
+    for (auto &pattern : patterns) {
+        if (std::regex_search(name, pattern)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    CLParser parser(argc, argv);
+    std::string config_name = parser.Option("-c");
+    std::string entry_name = parser.Option("-e");
+    std::string output_name = parser.Option("-o");
+    std::string check_str = parser.Option("--check");
+    std::string tolerance_str = parser.Option("--tolerance");
+    std::string max_points_str = parser.Option("--max-points");
+
+    if (config_name.empty() || entry_name.empty() || output_name.empty()) {
+        std::cerr << "Usage: make_sf_snapshot -c configs/sf_snapshot.json -e mt_2018 -o Output/sf_snapshots/mt_2018.snap "
+                  << "[--check 10000] [--tolerance 0.01] [--max-points 2000000]" << std::endl;
+        return 1;
+    }
+    int ncheck = check_str.empty() ? 0 : std::stoi(check_str);
+    double tolerance = tolerance_str.empty() ? 0.01 : std::stod(tolerance_str);
+    size_t max_points = max_points_str.empty() ? 2000000 : std::stoul(max_points_str);
+
+    json_reader reader;
+    auto configs = reader.parseFile(config_name);
+    if (!reader.ok() || !configs.has(entry_name)) {
+        std::cerr << "No entry " << entry_name << " in " << config_name << std::endl;
+        return 1;
+    }
+    auto config = configs.get(entry_name);
+
+    std::map<std::string, grid_axis> grid;
+    for (auto &member : config.get("grid").getMembers()) {
+        grid[member.first] = make_axis(member.first, member.second);
+    }
+
+    sf_snapshot_writer writer;
+    std::vector<stored_function> stored;
+    std::vector<std::unique_ptr<TFile>> open_files;  // the workspaces are checked after writing
+    int failed(0);
+
+    for (auto &ws_config : config.get("workspaces").getElements()) {
+        auto prefix = ws_config.get("prefix").asString();
+        auto filename = ws_config.get("file").asString();
+        std::vector<std::regex> patterns;
+        for (auto &pattern : ws_config.get("functions").asStringVector()) {
+            patterns.push_back(std::regex(pattern));
+        }
+
+        open_files.emplace_back(new TFile(filename.c_str()));
+        auto w = reinterpret_cast<RooWorkspace *>(open_files.back()->Get("w"));
+        if (w == nullptr) {
+            std::cerr << "No workspace in " << filename << std::endl;
+            failed++;
+            continue;
+        }
+
+        // the grid variables present in this workspace
+        std::vector<std::pair<RooRealVar *, const grid_axis *>> variables;
+        for (auto &entry : grid) {
+            auto var = w->var(entry.first.c_str());
+            if (var != nullptr) {
+                variables.push_back(std::make_pair(var, &entry.second));
+            }
+        }
+
+        int nstored(0);
+        RooArgSet functions = w->allFunctions();
+        auto iter = functions.createIterator();
+        while (auto obj = iter->Next()) {
+            auto func = dynamic_cast<RooAbsReal *>(obj);
+            std::string name = obj->GetName();
+            if (func == nullptr || !pick(name, patterns)) {
+                continue;
+            }
+
+            stored_function entry{name, func, {}, {}};
+            size_t npoints(1);
+            for (auto &variable : variables) {
+                if (func->dependsOn(*variable.first)) {
+                    entry.vars.push_back(variable.first);
+                    entry.axes.push_back(variable.second);
+                    npoints *= variable.second->samples.size();
+                }
+            }
+            if (entry.axes.size() > sf_table::max_axes || npoints > max_points) {
+                std::cerr << "Skipping " << name << ": " << entry.axes.size() << " axes and " << npoints
+                          << " points, make the grid coarser or raise --max-points" << std::endl;
+                continue;
+            }
+
+            std::vector<sf_snapshot_writer::axis> axes;
+            for (auto ax : entry.axes) {
+                axes.push_back(ax->axis);
+            }
+            writer.add_table(prefix + "/" + name, axes, tabulate(func, entry.vars, entry.axes));
+            entry.name = prefix + "/" + name;
+            stored.push_back(entry);
+            nstored++;
+        }
+        delete iter;
+        std::cout << "Stored " << nstored << " functions from " << filename << " as " << prefix << "/" << std::endl;
+    }
+
+    for (auto &graph_config : config.get("graphs").getElements()) {
+        auto prefix = graph_config.get("prefix").asString();
+        auto filename = graph_config.get("file").asString();
+        TFile graph_file(filename.c_str());
+        for (auto &name : graph_config.get("names").asStringVector()) {
+            auto graph = reinterpret_cast<TGraph *>(graph_file.Get(name.c_str()));
+            if (graph == nullptr) {
+                std::cerr << "No graph " << name << " in " << filename << std::endl;
+                failed++;
+                continue;
+            }
+            std::vector<double> x(graph->GetX(), graph->GetX() + graph->GetN());
+            std::vector<double> y(graph->GetY(), graph->GetY() + graph->GetN());
+            writer.add_graph(prefix + "/" + name, x, y);
+        }
+        graph_file.Close();
+    }
+
+    // histograms keep their own binning, values past the edges use the first or last bin
+    for (auto &hist_config : config.get("histograms").getElements()) {
+        auto prefix = hist_config.get("prefix").asString();
+        auto filename = hist_config.get("file").asString();
+        TFile hist_file(filename.c_str());
+        for (auto &member : hist_config.get("hists").getMembers()) {
+            auto hist = reinterpret_cast<TH1 *>(hist_file.Get(member.second.asString().c_str()));
+            if (hist == nullptr) {
+                std::cerr << "No histogram " << member.second.asString() << " in " << filename << std::endl;
+                failed++;
+                continue;
+            }
+            std::vector<TAxis *> hist_axes = {hist->GetXaxis()};
+            if (hist->GetNbinsY() > 1) {
+                hist_axes.push_back(hist->GetYaxis());
+            }
+            std::vector<sf_snapshot_writer::axis> axes;
+            for (size_t i = 0; i < hist_axes.size(); i++) {
+                sf_snapshot_writer::axis ax{i == 0 ? "x" : "y", sf_table::bins, {}};
+                for (int bin = 1; bin <= hist_axes.at(i)->GetNbins() + 1; bin++) {
+                    ax.edges.push_back(hist_axes.at(i)->GetBinLowEdge(bin));
+                }
+                axes.push_back(ax);
+            }
+            std::vector<double> values;
+            for (int xbin = 1; xbin <= hist->GetNbinsX(); xbin++) {
+                if (axes.size() == 1) {
+                    values.push_back(hist->GetBinContent(xbin));
+                    continue;
+                }
+                for (int ybin = 1; ybin <= hist->GetNbinsY(); ybin++) {
+                    values.push_back(hist->GetBinContent(xbin, ybin));
+                }
+            }
+            writer.add_table(prefix + "/" + member.first, axes, values);
+        }
+        hist_file.Close();
+    }
+
+    for (auto &member : config.get("constants").getMembers()) {
+        writer.add_constant(member.first, member.second.asDouble());
+    }
+
+    if (!writer.write(output_name)) {
+        return 1;
+    }
+    std::cout << "Wrote " << writer.size() << " tables to " << output_name << std::endl;
+
+    if (ncheck > 0) {
+        sf_snapshot snapshot(output_name);
+        if (!snapshot.isGood()) {
+            return 1;
+        }
+        std::mt19937 generator(12345);
+        int nbad(0);
+        for (auto &entry : stored) {
+            auto table = snapshot.table(entry.name);
+            std::vector<double> inputs(entry.axes.size());
+            std::vector<const double *> input_ptrs;
+            for (auto &input : inputs) {
+                input_ptrs.push_back(&input);
+            }
+
+            double worst(0.), worst_ref(0.), worst_snap(0.);
+            for (int i = 0; i < ncheck; i++) {
+                for (size_t j = 0; j < entry.axes.size(); j++) {
+                    // only the points are meaningful on a points axis with few values (decay modes)
+                    auto &edges = entry.axes.at(j)->axis.edges;
+                    if (entry.axes.at(j)->axis.mode == sf_table::points && edges.size() < 5) {
+                        inputs.at(j) = edges.at(std::uniform_int_distribution<size_t>(0, edges.size() - 1)(generator));
+                    } else {
+                        inputs.at(j) = std::uniform_real_distribution<double>(edges.front(), edges.back())(generator);
+                    }
+                    entry.vars.at(j)->setVal(inputs.at(j));
+                }
+                double reference = entry.func->getVal();
+                double value = table->eval(input_ptrs.data());
+                double deviation = std::fabs(value - reference) / std::max(std::fabs(reference), 1e-6);
+                if (deviation > worst) {
+                    worst = deviation;
+                    worst_ref = reference;
+                    worst_snap = value;
+                }
+            }
+            if (worst > tolerance) {
+                std::cerr << "Off by " << std::setprecision(3) << 100 * worst << "% in " << entry.name << " (workspace " << worst_ref
+                          << ", snapshot " << worst_snap << ")" << std::endl;
+                nbad++;
+            }
+        }
+        std::cout << "Checked " << stored.size() << " functions at " << ncheck << " points each, " << nbad << " above the tolerance of "
+                  << 100 * tolerance << "%" << std::endl;
+        failed += nbad;
+    }
+    return failed > 0;
+}
@@ -0,0 +1,214 @@
+// Copyright 2020 Tyler Mitchell
+
+// Put the outputs of entry-range shards (see include/entry_range.h) back
+// together into the file a single job would have written.
+//
+// Usage:
+//   reassemble_shards -o merged.root shard0.root shard1.root ...
+//       check and merge the given shards
+//   reassemble_shards --dir Output/trees/my_dir/NOMINAL [-j 8] [--remove]
+//       find every "*_shardkofN_output.root" / "*_entriesAtoB_output.root"
+//       in the directory, group them by the name of the unsharded output and
+//       reassemble each group (8 at a time); --remove deletes the shards of
+//       groups that were merged successfully
+//
+// A group is only merged if the shards come from the same input, cover
+// every entry exactly once and only the first one holds the nevents
+// histogram. The trees are concatenated in entry order with TFileMerger in
+// fast mode and the grabbag histograms are added.
+
+// system includes
+#include <dirent.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// ROOT includes
+#include "TFile.h"
+#include "TFileMerger.h"
+#include "TNamed.h"
+#include "TROOT.h"
+
+// user includes
+#include "../../include/CLParser.h"
+#include "../../include/entry_range.h"
+
+struct shard {
+    std::string name;
+    Long64_t first, last, total;
+    int index, nshards;
+    bool has_counts;
+};
+
+std::mutex log_lock;
+
+bool read_shard(std::string filename, shard *info) {
+    auto fin = TFile::Open(filename.c_str());
+    if (fin == nullptr || fin->IsZombie()) {
+        std::cerr << "Unable to open " << filename << std::endl;
+        return false;
+    }
+    info->name = filename;
+    auto named = dynamic_cast<TNamed *>(fin->Get("shard_info"));
+    bool ok = named != nullptr && entry_range::parse(named->GetTitle(), &info->first, &info->last, &info->total, &info->index, &info->nshards);
+    if (!ok) {
+        std::cerr << filename << " has no shard_info" << std::endl;
+    }
+    info->has_counts = fin->Get("nevents") != nullptr || fin->Get("hcount") != nullptr;
+    fin->Close();
+    delete fin;
+    return ok;
+}
+
+// Check the shards tile the input and sort them in entry order.
+bool check_shards(std::vector<shard> *shards) {
+    std::sort(shards->begin(), shards->end(), [](const shard &a, const shard &b) { return a.first < b.first || (a.first == b.first && a.last < b.last); });
+
+    bool ok(true);
+    Long64_t expected(0);
+    int with_counts(0);
+    for (auto &piece : *shards) {
+        if (piece.total != shards->front().total || piece.nshards != shards->front().nshards) {
+            std::cerr << piece.name << " comes from a different input or sharding than " << shards->front().name << std::endl;
+            ok = false;
+        }
+        if (piece.first > expected) {
+            std::cerr << "Missing entries [" << expected << ", " << piece.first << ") before " << piece.name << std::endl;
+            ok = false;
+        } else if (piece.first < expected) {
+            std::cerr << piece.name << " overlaps the previous shard at entries [" << piece.first << ", " << expected << ")" << std::endl;
+            ok = false;
+        }
+        expected = std::max(expected, piece.last);
+        with_counts += piece.has_counts;
+    }
+    if (expected < shards->front().total) {
+        std::cerr << "Missing entries [" << expected << ", " << shards->front().total << ") after " << shards->back().name << std::endl;
+        ok = false;
+    }
+    if (shards->front().nshards > 0 && static_cast<int>(shards->size()) != shards->front().nshards) {
+        std::cerr << "Found " << shards->size() << " of " << shards->front().nshards << " shards" << std::endl;
+        ok = false;
+    }
+    if (with_counts != 1) {
+        std::cerr << with_counts << " shards hold the nevents histogram, expected 1" << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+bool reassemble(std::string output, std::vector<std::string> inputs) {
+    std::vector<shard> shards(inputs.size());
+    bool ok(true);
+    for (unsigned i = 0; i < inputs.size(); i++) {
+        ok = read_shard(inputs.at(i), &shards.at(i)) && ok;
+    }
+    if (!ok || shards.empty() || !check_shards(&shards)) {
+        std::lock_guard<std::mutex> guard(log_lock);
+        std::cerr << "Not reassembling " << output << std::endl;
+        return false;
+    }
+
+    TFileMerger merger(false, false);
+    merger.SetFastMethod(true);
+    merger.SetPrintLevel(0);
+    if (!merger.OutputFile(output.c_str(), "RECREATE")) {
+        std::lock_guard<std::mutex> guard(log_lock);
+        std::cerr << "Unable to create " << output << std::endl;
+        return false;
+    }
+    for (auto &piece : shards) {
+        merger.AddFile(piece.name.c_str(), false);
+    }
+    // the merged file is no longer a shard
+    merger.AddObjectNames("shard_info");
+    ok = merger.PartialMerge(TFileMerger::kAll | TFileMerger::kRegular | TFileMerger::kSkipListed);
+
+    std::lock_guard<std::mutex> guard(log_lock);
+    std::cout << (ok ? "Reassembled " : "FAILED ") << shards.size() << " shards (" << shards.front().total << " entries) into " << output
+              << std::endl;
+    return ok;
+}
+
+// group the shards in a directory by the name of the unsharded output
+std::map<std::string, std::vector<std::string>> find_shards(std::string dirname) {
+    static const std::regex pattern("(.*)_(shard[0-9]+of[0-9]+|entries[0-9]+to([0-9]+|end))(_output\\.root)");
+    std::map<std::string, std::vector<std::string>> groups;
+    auto dir = opendir(dirname.c_str());
+    if (dir == nullptr) {
+        std::cerr << "Unable to open directory " << dirname << std::endl;
+        return groups;
+    }
+    while (auto entry = readdir(dir)) {
+        std::smatch match;
+        std::string filename = entry->d_name;
+        if (std::regex_match(filename, match, pattern)) {
+            groups[dirname + "/" + match[1].str() + match[4].str()].push_back(dirname + "/" + filename);
+        }
+    }
+    closedir(dir);
+    return groups;
+}
+
+int main(int argc, char *argv[]) {
+    CLParser parser(argc, argv);
+    std::string output = parser.Option("-o");
+    std::string dirname = parser.Option("--dir");
+    std::string nthreads_str = parser.Option("-j");
+    bool remove_shards = parser.Flag("--remove");
+    int nthreads = nthreads_str.empty() ? 1 : std::stoi(nthreads_str);
+
+    std::vector<std::pair<std::string, std::vector<std::string>>> jobs;
+    if (!output.empty()) {
+        std::vector<std::string> inputs;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-o" || arg == "--dir" || arg == "-j") {
+                i++;
+            } else if (arg.find("--") != 0) {
+                inputs.push_back(arg);
+            }
+        }
+        jobs.push_back(std::make_pair(output, inputs));
+    }
+    if (!dirname.empty()) {
+        for (auto &group : find_shards(dirname)) {
+            jobs.push_back(group);
+        }
+    }
+    if (jobs.empty()) {
+        std::cerr << "Usage: reassemble_shards -o merged.root shards... | --dir directory [-j threads] [--remove]" << std::endl;
+        return 1;
+    }
+
+    ROOT::EnableThreadSafety();
+    std::atomic<size_t> next_job(0);
+    std::atomic<int> failed(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nthreads; i++) {
+        threads.push_back(std::thread([&]() {
+            for (auto j = next_job++; j < jobs.size(); j = next_job++) {
+                if (!reassemble(jobs.at(j).first, jobs.at(j).second)) {
+                    failed++;
+                } else if (remove_shards) {
+                    for (auto &input : jobs.at(j).second) {
+                        std::remove(input.c_str());
+                    }
+                }
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    std::cout << jobs.size() - failed << " of " << jobs.size() << " outputs reassembled" << std::endl;
+    return failed > 0;
+}
@@ -0,0 +1,331 @@
+// Copyright 2020 Tyler Mitchell
+
+// ROC curves, AUC and cut scans for many discriminants in one pass.
+//
+// Usage:
+//   roc_scan -s VBF125.root -b ZTT.root,TTT.root -v NN_disc,D0_VBF,mjj,ME_sm_VBF/ME_ps_VBF -o vbf_rocs
+//            [--grid D0_VBF:DCP_VBF] [--grid-bins 20] [--category vbf] [--weight evtwt] [--wp 0.5,0.7,0.9] [--points 1000] [-j 8]
+//
+// Signal and background are lists of merged slim-tree files. Each file is
+// read once, a cluster at a time, for every discriminant together; events
+// need is_signal > 0 and the category of produce_histograms.py (inclusive,
+// 0jet, boosted or vbf). A discriminant is a branch or a ratio of two
+// branches: the cut on ME_sm_VBF/ME_ps_VBF is the alpha of
+// scripts/optimize_mela.py.
+//
+// For each discriminant, the weighted ROC curve comes from the sorted scores
+// (roc_scanner.h). The tool prints the AUC, the cut with the best S/sqrt(B),
+// the working points and the balance point (background efficiency equal to
+// signal inefficiency), and writes the curve as a TGraph (signal efficiency
+// vs background efficiency, like scripts/eraROCs.py) to
+// Output/roc/{output}.root. Each --grid x:y pair also gets a TH2F of
+// S/sqrt(B) for every rectangular cut.
+
+// system includes
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// ROOT includes
+#include "TFile.h"
+#include "TGraph.h"
+#include "TH2F.h"
+#include "TKey.h"
+#include "TList.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+// user includes
+#include "../../include/CLParser.h"
+#include "../../include/hist_filler.h"
+#include "../../include/roc_scanner.h"
+
+// a branch, or numerator / denominator
+struct discriminant {
+    std::string name, numerator, denominator;
+};
+
+// selected events of one file: one column per discriminant and the weights
+struct scan_job {
+    std::string filename;
+    bool signal;
+    std::vector<std::vector<double>> scores;
+    std::vector<double> weights;
+    bool ok;
+};
+
+std::vector<std::string> split(std::string list, char delim) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, delim)) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+// category selections of produce_histograms.py
+bool in_category(const std::string &category, double njets, double mjj) {
+    if (category == "0jet") {
+        return njets == 0;
+    } else if (category == "boosted") {
+        return njets == 1 || (njets > 1 && mjj < 300);
+    } else if (category == "vbf") {
+        return njets > 1 && mjj > 300;
+    }
+    return true;  // inclusive
+}
+
+// first tree of the file (et_tree, mt_tree, tt_tree, ...)
+std::string find_tree(TFile *fin) {
+    TIter next(fin->GetListOfKeys());
+    while (auto key = reinterpret_cast<TKey *>(next())) {
+        if (std::string(key->GetClassName()) == "TTree") {
+            return key->GetName();
+        }
+    }
+    return "";
+}
+
+void read_file(scan_job *job, const std::vector<discriminant> &discs, std::string category, std::string weight) {
+    job->ok = false;
+    auto fin = std::unique_ptr<TFile>(TFile::Open(job->filename.c_str()));
+    if (fin == nullptr || fin->IsZombie()) {
+        std::cerr << "Unable to open " << job->filename << std::endl;
+        return;
+    }
+    auto tree = reinterpret_cast<TTree *>(fin->Get(find_tree(fin.get()).c_str()));
+    if (tree == nullptr) {
+        std::cerr << "No tree in " << job->filename << std::endl;
+        return;
+    }
+
+    std::vector<std::string> branches = {weight, "is_signal", "njets", "mjj"};
+    auto add_branch = [&branches](std::string name) {
+        if (!name.empty() && std::find(branches.begin(), branches.end(), name) == branches.end()) {
+            branches.push_back(name);
+        }
+    };
+    for (auto &disc : discs) {
+        add_branch(disc.numerator);
+        add_branch(disc.denominator);
+    }
+    column_block columns(tree, branches);
+    for (auto &name : branches) {
+        if (columns.index(name) < 0) {
+            return;
+        }
+    }
+    std::vector<std::pair<int, int>> disc_columns;
+    for (auto &disc : discs) {
+        disc_columns.push_back(std::make_pair(columns.index(disc.numerator), disc.denominator.empty() ? -1 : columns.index(disc.denominator)));
+    }
+
+    job->scores.resize(discs.size());
+    for (auto &chunk : cluster_chunks(tree)) {
+        auto n = columns.read(chunk.first, chunk.second);
+        for (Long64_t i = 0; i < n; i++) {
+            if (columns[1][i] <= 0 || !in_category(category, columns[2][i], columns[3][i])) {
+                continue;
+            }
+            job->weights.push_back(columns[0][i]);
+            for (size_t d = 0; d < discs.size(); d++) {
+                auto value = columns[disc_columns[d].first][i];
+                if (disc_columns[d].second >= 0) {
+                    auto denominator = columns[disc_columns[d].second][i];
+                    value = denominator != 0 ? value / denominator : 1e10;
+                }
+                job->scores[d].push_back(value);
+            }
+        }
+    }
+    job->ok = true;
+}
+
+int main(int argc, char *argv[]) {
+    CLParser parser(argc, argv);
+    std::string sig_files = parser.Option("-s");
+    std::string bkg_files = parser.Option("-b");
+    std::string variables = parser.Option("-v");
+    std::string output = parser.Option("-o");
+    std::string grids = parser.Option("--grid");
+    std::string grid_bins_str = parser.Option("--grid-bins");
+    std::string category = parser.Option("--category");
+    std::string weight = parser.Option("--weight");
+    std::string wp_str = parser.Option("--wp");
+    std::string points_str = parser.Option("--points");
+    std::string nthreads_str = parser.Option("-j");
+    int nthreads = nthreads_str.empty() ? 1 : std::stoi(nthreads_str);
+    int grid_bins = grid_bins_str.empty() ? 20 : std::stoi(grid_bins_str);
+    size_t max_points = points_str.empty() ? 1000 : std::stoul(points_str);
+    category = category.empty() ? "vbf" : category;
+    weight = weight.empty() ? "evtwt" : weight;
+    if (sig_files.empty() || bkg_files.empty() || (variables.empty() && grids.empty()) || output.empty()) {
+        std::cerr << "Usage: roc_scan -s sig.root[,...] -b bkg.root[,...] -v disc[,num/den,...] -o output [--grid x:y[,...]] [--grid-bins n]"
+                  << " [--category vbf] [--weight evtwt] [--wp 0.5,...] [--points n] [-j threads]" << std::endl;
+        return 1;
+    }
+
+    // discriminants, with the grid axes added to the list
+    std::vector<discriminant> discs;
+    auto find_disc = [&discs](std::string name) {
+        for (size_t d = 0; d < discs.size(); d++) {
+            if (discs[d].name == name) {
+                return static_cast<int>(d);
+            }
+        }
+        auto pos = name.find('/');
+        discs.push_back(pos == std::string::npos ? discriminant{name, name, ""} : discriminant{name, name.substr(0, pos), name.substr(pos + 1)});
+        return static_cast<int>(discs.size()) - 1;
+    };
+    std::vector<int> curves;
+    for (auto &name : split(variables, ',')) {
+        curves.push_back(find_disc(name));
+    }
+    std::vector<std::pair<int, int>> grid_discs;
+    for (auto &grid : split(grids, ',')) {
+        auto axes = split(grid, ':');
+        if (axes.size() != 2) {
+            std::cerr << "A grid is given as x:y, not " << grid << std::endl;
+            return 1;
+        }
+        grid_discs.push_back(std::make_pair(find_disc(axes[0]), find_disc(axes[1])));
+    }
+    std::vector<double> working_points;
+    for (auto &wp : split(wp_str.empty() ? "0.5,0.7,0.9" : wp_str, ',')) {
+        working_points.push_back(std::stod(wp));
+    }
+
+    // read every file once, several at a time
+    std::vector<scan_job> jobs;
+    for (auto &filename : split(sig_files, ',')) {
+        jobs.push_back(scan_job{filename, true, {}, {}, false});
+    }
+    for (auto &filename : split(bkg_files, ',')) {
+        jobs.push_back(scan_job{filename, false, {}, {}, false});
+    }
+    ROOT::EnableThreadSafety();
+    std::atomic<size_t> next_job(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < std::min(nthreads, static_cast<int>(jobs.size())); i++) {
+        threads.push_back(std::thread([&]() {
+            for (auto j = next_job++; j < jobs.size(); j = next_job++) {
+                read_file(&jobs.at(j), discs, category, weight);
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // combine the files into signal and background columns
+    std::vector<std::vector<double>> sig_scores(discs.size()), bkg_scores(discs.size());
+    std::vector<double> sig_weights, bkg_weights;
+    for (auto &job : jobs) {
+        if (!job.ok) {
+            std::cerr << "FAILED " << job.filename << std::endl;
+            return 1;
+        }
+        auto &scores = job.signal ? sig_scores : bkg_scores;
+        for (size_t d = 0; d < discs.size(); d++) {
+            scores[d].insert(scores[d].end(), job.scores[d].begin(), job.scores[d].end());
+        }
+        auto &weights = job.signal ? sig_weights : bkg_weights;
+        weights.insert(weights.end(), job.weights.begin(), job.weights.end());
+        std::vector<std::vector<double>>().swap(job.scores);
+    }
+    std::cout << "Selected " << sig_weights.size() << " signal and " << bkg_weights.size() << " background events (" << category << ")"
+              << std::endl;
+
+    // the curves are independent, so they are sorted in parallel
+    std::vector<std::unique_ptr<roc_curve>> rocs(curves.size());
+    std::atomic<size_t> next_curve(0);
+    threads.clear();
+    for (int i = 0; i < std::min(nthreads, static_cast<int>(curves.size())); i++) {
+        threads.push_back(std::thread([&]() {
+            for (auto c = next_curve++; c < curves.size(); c = next_curve++) {
+                auto d = curves.at(c);
+                rocs.at(c).reset(new roc_curve(sig_scores.at(d), sig_weights, bkg_scores.at(d), bkg_weights));
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    mkdir("Output/roc", 0755);
+    auto output_name = "Output/roc/" + output + ".root";
+    auto fout = std::unique_ptr<TFile>(new TFile(output_name.c_str(), "RECREATE"));
+    std::cout << std::setprecision(4);
+    for (size_t c = 0; c < curves.size(); c++) {
+        auto &roc = *rocs.at(c);
+        auto name = discs.at(curves.at(c)).name;
+        auto print_point = [&roc](std::string label, const roc_curve::point &p) {
+            std::cout << "\t " << label << ": cut " << p.cut << " sig eff " << p.sig / roc.getSigTotal() << " bkg eff " << p.bkg / roc.getBkgTotal()
+                      << std::endl;
+        };
+        std::cout << name << ": AUC " << roc.auc() << std::endl;
+        if (roc.getNonFinite() > 0) {
+            std::cout << "\t " << roc.getNonFinite() << " events with a non-finite score left out" << std::endl;
+        }
+        auto best = roc.best_significance();
+        print_point("best S/sqrt(B) " + std::to_string(best.bkg > 0 ? best.sig / std::sqrt(best.bkg) : 0.), best);
+        print_point("balance", roc.balance());
+        for (auto wp : working_points) {
+            print_point("sig eff " + std::to_string(wp), roc.working_point(wp));
+        }
+
+        std::string graph_name = "roc_" + name;
+        std::replace(graph_name.begin(), graph_name.end(), '/', '_');
+        auto graph = roc.graph(graph_name, max_points);
+        graph->Write();
+        delete graph;
+    }
+
+    for (auto &grid_disc : grid_discs) {
+        auto &xdisc = discs.at(grid_disc.first), &ydisc = discs.at(grid_disc.second);
+        auto axis = [grid_bins](const std::vector<double> &a, const std::vector<double> &b) {
+            double low(1e10), high(-1e10);
+            for (auto values : {&a, &b}) {
+                for (auto value : *values) {
+                    if (std::isfinite(value)) {
+                        low = std::min(low, value);
+                        high = std::max(high, value);
+                    }
+                }
+            }
+            return high > low ? hist_axis(grid_bins, low, high) : hist_axis(grid_bins, low - 1, low + 1);
+        };
+        cut_grid grid(axis(sig_scores.at(grid_disc.first), bkg_scores.at(grid_disc.first)),
+                      axis(sig_scores.at(grid_disc.second), bkg_scores.at(grid_disc.second)));
+        for (size_t i = 0; i < sig_weights.size(); i++) {
+            grid.fill(sig_scores[grid_disc.first][i], sig_scores[grid_disc.second][i], sig_weights[i], true);
+        }
+        for (size_t i = 0; i < bkg_weights.size(); i++) {
+            grid.fill(bkg_scores[grid_disc.first][i], bkg_scores[grid_disc.second][i], bkg_weights[i], false);
+        }
+
+        std::string hist_name = "grid_" + xdisc.name + "_" + ydisc.name;
+        std::replace(hist_name.begin(), hist_name.end(), '/', '_');
+        double best[3];
+        auto hist = grid.significance(hist_name, best);
+        std::cout << xdisc.name << " x " << ydisc.name << ": best S/sqrt(B) " << best[2] << " for " << xdisc.name << " >= " << best[0] << " && "
+                  << ydisc.name << " >= " << best[1] << std::endl;
+        hist->Write();
+        delete hist;
+    }
+    fout->Close();
+    std::cout << "Curves written to " << output_name << std::endl;
+    return 0;
+}
@@ -0,0 +1,171 @@
+// Copyright 2020 Tyler Mitchell
+
+// Run the analyzer jobs written by auto_ac_wisc.py --native on a
+// work-stealing pool instead of a multiprocessing.Pool.
+//
+// Usage:
+//   run_tasks -t Output/trees/dir/logs/tasks.json [-j 10] [-l Output/trees/dir/logs/runninglog.txt]
+//
+// tasks.json is a list of {"name", "command", "input", "cost"} objects. Tasks
+// reading the same input run back to back on one worker and the most
+// expensive inputs are started first (see include/task_scheduler.h). The log
+// has the same [SUCCESS]/[ERROR] lines as the python runner.
+//
+// Tasks marked "manifest": true (analyzers built with include/job_manifest.h)
+// are grouped by analyzer instead: each group is written to a manifest next
+// to tasks.json, largest inputs first, and run as one
+// "analyzer --manifest file --workers N" process so the scale factors are
+// read once per worker. The groups run one after the other with all the
+// workers, then the other tasks go through the scheduler, one analyzer
+// process each.
+
+// system includes
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// user includes
+#include "../../include/CLParser.h"
+#include "../../include/json_reader.h"
+#include "../../include/task_scheduler.h"
+
+// Run one analyzer over the manifest of a group, copying its [SUCCESS]/[ERROR]
+// lines to the log. Returns the number of failed jobs.
+int run_manifest(const std::string &exe, const std::string &manifest_name, const std::vector<scheduled_task> &group, int nworkers,
+                 std::ofstream *log_file) {
+    std::ofstream manifest(manifest_name);
+    for (auto &task : group) {
+        auto options = task.command.find_first_not_of(' ', task.command.find(' '));
+        manifest << (options == std::string::npos ? "" : task.command.substr(options)) << std::endl;
+    }
+    manifest.close();
+    if (!manifest.good()) {
+        std::cerr << "Unable to write " << manifest_name << std::endl;
+        return group.size();
+    }
+
+    auto command = exe + " --manifest " + manifest_name + " --workers " + std::to_string(std::min(nworkers, static_cast<int>(group.size())));
+    std::cout << "Running " << group.size() << " tasks with " << command << std::endl;
+    auto pipe = popen(command.c_str(), "r");
+    if (pipe == nullptr) {
+        std::cerr << "Unable to run " << command << std::endl;
+        return group.size();
+    }
+    int succeeded(0), failed(0);
+    char buffer[4096];
+    while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
+        std::string line(buffer);
+        std::cout << line;
+        bool success = line.find("[SUCCESS]") == 0, error = line.find("[ERROR]") == 0;
+        succeeded += success;
+        failed += error;
+        if ((success || error) && log_file->is_open()) {
+            *log_file << line;
+        }
+    }
+    auto code = pclose(pipe);
+    // jobs that never reported (the analyzer crashed) are failures as well
+    if (succeeded + failed < static_cast<int>(group.size()) || (code != 0 && failed == 0)) {
+        failed = group.size() - succeeded;
+        std::string message = "[ERROR] returned non-zero exit code while running " + command;
+        std::cout << "\033[91m" << message << "\033[0m" << std::endl;
+        if (log_file->is_open()) {
+            *log_file << message << std::endl;
+        }
+    }
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    CLParser parser(argc, argv);
+    std::string task_name = parser.Option("-t");
+    std::string nworkers_str = parser.Option("-j");
+    std::string log_name = parser.Option("-l");
+
+    if (task_name.empty()) {
+        std::cerr << "Usage: run_tasks -t tasks.json [-j workers] [-l logfile]" << std::endl;
+        return 1;
+    }
+
+    json_reader reader;
+    auto task_list = reader.parseFile(task_name);
+    if (!reader.ok() || !task_list.isArray()) {
+        std::cerr << "Unable to read the task list from " << task_name << std::endl;
+        return 1;
+    }
+
+    int nworkers = nworkers_str.empty() ? 10 : std::stoi(nworkers_str);
+    task_scheduler scheduler(nworkers);
+    std::map<std::string, std::vector<scheduled_task>> groups;  // by analyzer
+    size_t ntasks(0);
+    for (auto &entry : task_list.getElements()) {
+        auto command = entry.get("command").asString();
+        if (command.empty()) {
+            std::cerr << "Skipping a task without a command in " << task_name << std::endl;
+            continue;
+        }
+        auto name = entry.get("name").asString();
+        auto input = entry.get("input").asString();
+        scheduled_task task{name.empty() ? command : name, command, input.empty() ? command : input,
+                            entry.get("cost").isNumber() ? entry.get("cost").asDouble() : 1.};
+        if (entry.get("manifest").isBool() && entry.get("manifest").asBool()) {
+            groups[command.substr(0, command.find(' '))].push_back(task);
+        } else {
+            scheduler.add(task);
+        }
+        ntasks++;
+    }
+    std::cout << "Tasks to run: " << ntasks << " (" << ntasks - scheduler.size() << " in " << groups.size() << " manifests)" << std::endl;
+
+    std::ofstream log_file;
+    if (!log_name.empty()) {
+        log_file.open(log_name);
+    }
+    std::mutex log_lock;
+
+    auto start = std::chrono::steady_clock::now();
+    int failed(0), igroup(0);
+    for (auto &group : groups) {
+        // largest inputs first, the tasks of an input together
+        std::unordered_map<std::string, double> input_cost;
+        for (auto &task : group.second) {
+            input_cost[task.group] += task.cost;
+        }
+        std::stable_sort(group.second.begin(), group.second.end(), [&input_cost](const scheduled_task &a, const scheduled_task &b) {
+            if (input_cost[a.group] != input_cost[b.group]) {
+                return input_cost[a.group] > input_cost[b.group];
+            }
+            return a.group != b.group ? a.group < b.group : a.cost > b.cost;
+        });
+        auto manifest_name = task_name.substr(0, task_name.rfind(".json")) + "_manifest" + std::to_string(igroup++) + ".txt";
+        failed += run_manifest(group.first, manifest_name, group.second, nworkers, &log_file);
+    }
+
+    failed += scheduler.run([&](const scheduled_task &task) {
+        auto code = std::system(task.command.c_str());
+        std::string message = code == 0 ? "[SUCCESS] " + task.command + " completed successfully"
+                                        : "[ERROR] returned non-zero exit code while running " + task.command;
+        std::lock_guard<std::mutex> guard(log_lock);
+        std::cout << (code == 0 ? "\033[92m" : "\033[91m") << message << "\033[0m" << std::endl;
+        if (log_file.is_open()) {
+            log_file << message << std::endl;
+        }
+        return code;
+    });
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (scheduler.size() > 0) {
+        scheduler.report(std::cout);
+    }
+    std::cout << "Completed " << ntasks - failed << " of " << ntasks << " tasks in " << elapsed << " s" << std::endl;
+    return failed > 0;
+}
@@ -5,6 +5,7 @@ import uproot
 import multiprocessing
 from glob import glob
 from subprocess import call
+from utils.friend_output import read_output
 
 
 def to_reweight(ifile):
@@ -44,11 +45,10 @@ def parse_tree_name(keys):
 def process_dir(ifile, idir, temp_name, input_path, is2017, boilerplate):
     open_file = uproot.open(ifile)
     tree_name = parse_tree_name(open_file.keys())
-    oldtree = open_file[tree_name].arrays(['*'])
-    treedict = {ikey: oldtree[ikey].dtype for ikey in oldtree.keys()}
-
-    # build DataFrame
-    events = pandas.DataFrame(oldtree)
+    # AC weights stored as a block are expanded, the reweighted files get wt_* columns.
+    # Friend outputs are joined with their nominal file and written in full.
+    events = read_output(ifile, tree_name, ['*'])
+    treedict = {ikey: events[ikey].dtype for ikey in events.columns}
     signal_events = events[(events['is_signal'] > 0)]
 
     key, process = recognize_signal(ifile, is2017)
@@ -106,6 +106,14 @@ def create_fakes(input_name, tree_name, channel_prefix, treedict, output_dir, fa
     events = open_file[tree_name].arrays(['*'], outputtype=pandas.DataFrame)
     anti_events = events[(events['is_antiTauIso'] > 0)].copy()
 
+    # the analyzers already computed the weights (--ff), only select the events
+    if 'fake_weight' in anti_events.columns and (not doSysts or systs[0][0] + '_' + systs[0][1] in anti_events.columns):
+        with uproot.recreate('{}/jetFakes_{}.root'.format(output_dir, sample)) as f:
+            f[tree_name] = uproot.newtree(treedict)
+            f[tree_name].extend(anti_events.to_dict('list'))
+        print 'Finished writing {} (weights from the analyzer)'.format(sample)
+        return None
+
     anti_events['fake_weight'] = anti_events[filling_variables].apply(
         lambda x: get_weight(x, ff_weighter, fractions, channel_prefix), axis=1).values
     if sample != 'data_obs':
@@ -213,6 +221,11 @@ def main(args):
             fout.cd(cat_name)
             ihist.Write(frac_name)
 
+    if args.fractions_only:
+        # the fake weights are computed by the analyzers, given this file with --ff
+        fout.Close()
+        return
+
     open_file = uproot.open('{}/data_obs.root'.format(args.input))
     oldtree = open_file[tree_name].arrays(['*'])
     treedict = {ikey: oldtree[ikey].dtype for ikey in oldtree.keys()}
@@ -254,4 +267,6 @@ if __name__ == "__main__":
     parser.add_argument('--suffix', '-s', required=True, help='string to append to output file name')
     parser.add_argument('--year', '-y', required=True, help='year being processed')
     parser.add_argument('--syst', action='store_true', help='run fake factor systematics as well')
+    parser.add_argument('--fractions-only', action='store_true', dest='fractions_only',
+                        help='only write the fake fractions used by the analyzers (--ff)')
     main(parser.parse_args())
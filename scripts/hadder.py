@@ -15,6 +15,30 @@ def clean(hadd_list):
     return hadd_list
 
 
+def do_fast_merge(hadd_list, path, dedup=False):
+    """
+    Merge every directory with one call to fast_merge (copies baskets without recompressing).
+    With dedup, events repeated across the data and embedded jobs are removed from the merged files.
+    """
+    jobs, data_jobs = {}, {}
+    for idir, isamples in hadd_list.items():
+        if not os.path.exists(path + '/' + idir + '/merged'):
+            os.mkdir(path + '/' + idir + '/merged')
+        for sample, files in isamples.items():
+            is_data = dedup and sample in ['data_obs', 'embed']
+            (data_jobs if is_data else jobs)['{}/{}.root'.format(path + '/' + idir + '/merged', sample)] = files
+
+    n_processes = min(12, multiprocessing.cpu_count() / 2)
+    for name, job_list, options in [('merge_jobs', jobs, ''), ('merge_data_jobs', data_jobs, ' --dedup')]:
+        if len(job_list) == 0:
+            continue
+        job_file = '{}/{}.json'.format(path, name)
+        with open(job_file, 'w') as outfile:
+            json.dump(job_list, outfile, indent=4)
+        if os.system('fast_merge --jobs {} -j {}{}'.format(job_file, n_processes, options)) != 0:
+            raise Exception('fast_merge failed on the jobs in {}, see the messages above'.format(job_file))
+
+
 def do_hadd(hadd_list, path):
     """Start hadding files."""
     ndir = len(hadd_list.keys())
@@ -151,7 +175,10 @@ def main(args):
         for sample, files in samples.iteritems():
             full_hadd_list[isyst][sample] = files
 
-    do_hadd(full_hadd_list, args.path)
+    if args.fast:
+        do_fast_merge(full_hadd_list, args.path, args.dedup)
+    else:
+        do_hadd(full_hadd_list, args.path)
     # do_hadd(bkg_hadd_list, args.path)
     # do_hadd(sig_hadd_list, args.path)
     # rename_wh_zh(sig_hadd_list, args.path)
@@ -162,4 +189,6 @@ if __name__ == "__main__":
     parser = ArgumentParser()
     parser.add_argument('--path', '-p', required=True, help='path to files')
     parser.add_argument('--ana', '-a', required=True, help='which analysis are the files for (ac, boosted)')
+    parser.add_argument('--fast', action='store_true', help='merge with fast_merge (make tools) instead of ahadd.py')
+    parser.add_argument('--dedup', action='store_true', help='with --fast, remove events repeated across the data jobs')
     main(parser.parse_args())
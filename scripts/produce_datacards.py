@@ -9,6 +9,7 @@ import datetime
 from glob import glob
 from array import array
 from pprint import pprint
+from utils.friend_output import read_output
 
 
 def build_filelist(input_dir):
@@ -111,6 +112,19 @@ def get_syst_name(channel, syst, syst_name_map):
         return 'unknown'
 
 
+def theory_variations(fname, syst_name_map, filelist):
+    """
+    The powheg ggH and VBF theory variations are weight branches of the nominal output. They are used unless
+    the systematic was also run on its own (auto_ac_wisc.py --theory-reruns).
+    """
+    theory_prefixes = [('ggh125_powheg', 'ggH_Rivet'), ('vbf125_powheg', 'VBF_Rivet')]
+    variations = []
+    for sample, prefix in theory_prefixes:
+        if sample in fname:
+            variations += [syst for syst in sorted(syst_name_map.keys()) if syst.startswith(prefix) and syst not in filelist]
+    return variations
+
+
 def parse_tree_name(keys):
     """Take list of keys in the file and search for our TTree"""
     if 'et_tree;1' in keys:
@@ -191,6 +205,7 @@ def main(args):
         postfix = postfix.replace('LEP', 'ele') if channel_prefix == 'et' else postfix.replace('LEP', 'mu')
         postfix = postfix.replace('CHAN', 'et') if channel_prefix == 'et' else postfix.replace('CHAN', 'mt')
         stable_postfix = postfix
+        is_nominal = syst == 'nominal'  # syst is reused by the fake factor loop below
 
         for ifile in files:
             # handle ZTT vs embedded
@@ -219,7 +234,6 @@ def main(args):
                 continue
 
             logging.info('Processing: {}'.format(name + postfix))
-            input_file = uproot.open(ifile)
 
             # get data naming correct
             if 'Data' in name:
@@ -241,9 +255,12 @@ def main(args):
                     variables.add('lptclosure_*')
                     variables.add('osssclosure_*')
 
+            theory_systs = theory_variations(ifile, syst_name_map, filelist) if args.syst and is_nominal else []
+            variables.update(theory_systs)
+
             name = name + postfix  # add systematic postfix to file name
 
-            events = input_file[tree_name].arrays(list(variables), outputtype=pandas.DataFrame)
+            events = read_output(ifile, tree_name, variables)
 
             if 'jetFakes' in name:
                 iso_branch = 'is_antiTauIso'
@@ -291,6 +308,30 @@ def main(args):
 
             output_file.Write()
 
+            for theory_syst in theory_systs:
+                theory_postfix = get_syst_name(channel_prefix, theory_syst, syst_name_map).replace('YEAR', args.year)
+                theory_name = name + theory_postfix.replace('CHAN', channel_prefix)
+
+                output_file.cd('{}_0jet'.format(channel_prefix))
+                zero_jet_hist = build_histogram(theory_name, tau_pt_bins, m_sv_bins_0jet, boilerplate["powheg_map"])
+                fill_hists(zero_jet_events, zero_jet_hist, 't1_pt', 'm_sv', fake_weight=theory_syst)
+
+                output_file.cd('{}_boosted'.format(channel_prefix))
+                boost_hist = build_histogram(theory_name, higgs_pT_bins_boost, m_sv_bins_boost, boilerplate["powheg_map"])
+                fill_hists(boosted_events, boost_hist, 'higgs_pT', 'm_sv', fake_weight=theory_syst)
+
+                output_file.cd('{}_vbf'.format(channel_prefix))
+                vbf_hist = build_histogram(theory_name, vbf_cat_x_bins, vbf_cat_y_bins, boilerplate["powheg_map"])
+                fill_hists(vbf_events, vbf_hist, vbf_cat_x_var, vbf_cat_y_var, fake_weight=theory_syst)
+
+                vbf_cat_hists = []
+                for cat in vbf_categories:
+                    output_file.cd('{}_{}'.format(channel_prefix, cat))
+                    vbf_cat_hists.append(build_histogram(theory_name, vbf_cat_x_bins, vbf_cat_y_bins, boilerplate["powheg_map"]))
+                fill_hists(vbf_events, vbf_cat_hists, vbf_cat_x_var, vbf_cat_y_var, zvar_name=vbf_cat_edge_var,
+                           edges=vbf_cat_edges, fake_weight=theory_syst, DCP_idx=len(boilerplate['vbf_sub_cats_plus']))
+                output_file.Write()
+
             if args.syst and 'jetFakes' in name:
                 for syst in boilerplate['fake_factor_systematics']:
                     jet_postfix = get_syst_name(channel_prefix, syst, syst_name_map)
@@ -1,4 +1,3 @@
-import copy
 import json
 import ROOT
 import time
@@ -8,121 +7,41 @@ import uproot
 from glob import glob
 from array import array
 from pprint import pprint
-from copy import deepcopy
-from multiprocessing import Process, Queue
+from utils.hist_cache import HistCache, HistRequest
 
 
-class Config:
-    """
-    Provide a wrapper around all information needed to plot a single sample/variable combination.
-
-    Config wraps all of the information needed to process a sample and create correctly weighted
-    histograms for the provided variable and binning. Config contains a Queue so that things can
-    be done in parallel.
-
-    Variables:
-    name        -- name of the process
-    data        -- pandas DataFrame containing event data
-    xvar_name   -- variable being plotted
-    bins        -- binning for the histogram
-    queue       -- multiprocessing.Queue to write output histogram
-    fake_weight -- for jetFakes, we need to weight with the fake_weight
-    hists       -- output histograms
-
-    Functions:
-    submit      -- create a new Queue and return Config as a dict to provide as kwargs
-    """
-
-    def __init__(self, name, data, variable, bins):
-        """Initialize variables and set the rest to None"""
-        self.name = name
-        self.data = data
-        self.xvar_name = variable
-        self.bins = bins
-        self.queue = None
-        self.fake_weight = None
-        self.hists = None
-
-    def __deepcopy__(self, memo):
-        """Deep copy everything except the Queue."""
-        cp = Config(deepcopy(self.name, memo), deepcopy(self.data, memo), deepcopy(self.xvar_name, memo), deepcopy(self.bins, memo))
-        cp.fake_weight = deepcopy(self.fake_weight, memo)
-        cp.queue = None
-        cp.hists = deepcopy(self.hists, memo)
-        return cp
-
-    def submit(self):
-        """Create a new Queue and return self in a form for fill_histograms"""
-        self.queue = Queue()
-        return {'config': self}
-
-
-def build_histogram(name, bins, output_file, directory):
-    """Build a TH1F with provided binning in the correct TDirectory"""
-    output_file.cd(directory)
-    return ROOT.TH1F(name, name, bins[0], bins[1], bins[2])
-
-
-def fill_histograms(config):
-    """Use config to fill a histogram"""
-    # get common variables
-    evtwt = config.data['evtwt'].values
-    xvar = config.data[config.xvar_name].values
-
-    if config.fake_weight != None:
-        evtwt *= config.data[config.fake_weight].values
-
-    # loop over all events
-    for i in xrange(len(config.data.index)):
-        config.hists.Fill(xvar[i], evtwt[i])
-
-    config.queue.put(config.hists)
+# category selections applied after the isolation (and, for embedded, contamination) requirements
+category_selections = {
+    'inclusive': '',
+    '0jet': ' & (njets == 0)',
+    'boosted': ' & ((njets == 1) | ((njets > 1) & (mjj < 300)))',
+    'vbf': ' & (njets > 1) & (mjj > 300)',
+}
 
 
-def fill_process_list(data, name, variable, bins, boilerplate, output_file, directory, year, doSyst=False):
+def build_requests(category, name, config_variables, selection, boilerplate, doSyst):
     """
-    Create the list of processes to be run.
+    Create the list of histograms to fill for one process in one category.
 
-    Configure all options needed to fill histograms for this process. A list of multiprocessing.Process-es will be
-    returned for processing later.
-
-    Variables:
-    data        -- pandas DataFrame containing event information
-    name        -- name of the process
-    variable    -- variable to plot
-    bins        -- binning for the histogram
-    boilerplate -- json config containing some naming
-    output_file -- TFile where histograms will be written
-    directory   -- name of TDirectory for this histogram
-    year        -- which year is this? (2016, 2017, 2018)
-    doSyst      -- fill histograms after systematic shifts (not implemented) 
+    jetFakes (and QCD) are weighted by the fake factor. With systematics, each fake-factor
+    variation is an extra histogram named jetFakes_CMS_htt_{variation}.
 
     Returns:
-    List        -- multiprocessing.Process-es to be run
-    all_hists   -- dictionary containing Configs used in List
+    List -- (variable, HistRequest) for every variable, named {category}/{variable}/{histogram}
     """
-    all_hists = {}
-    config = Config(name, data, variable, bins)
-
     if 'jetFakes' in name or 'QCD' in name:
-        config.fake_weight = 'fake_weight'
-        config.hists = build_histogram('jetFakes', bins, output_file, directory)
-        all_hists['jetFakes'] = config.submit()
+        weights = [('jetFakes', 'evtwt * fake_weight')]
         if doSyst:
-            for syst in boilerplate['fake_factor_systematics']:
-                syst_config = copy.deepcopy(config)
-                syst_name = 'jetFakes_CMS_htt_{}'.format(syst)
-                syst_config.name = name
-                syst_config.fake_weight = syst
-                syst_config.hists = build_histogram(syst_name, bins, output_file, directory)
-                all_hists[name] = syst_config.submit()
+            weights += [('jetFakes_CMS_htt_{}'.format(syst), 'evtwt * {}'.format(syst))
+                        for syst in boilerplate['fake_factor_systematics']]
     else:
-        config.hists = build_histogram(name, bins, output_file, directory)
-        all_hists['nominal'] = config.submit()
+        weights = [(name, 'evtwt')]
 
     return [
-        Process(target=fill_histograms, kwargs=proc_args, name=proc_name) for proc_name, proc_args in all_hists.iteritems()
-    ], all_hists
+        (variable, HistRequest(name='{}/{}/{}'.format(category, variable, hist_name), variable=variable, bins=bins, selection=selection,
+                               weight=weight))
+        for variable, bins in config_variables.iteritems() for hist_name, weight in weights
+    ]
 
 # I've added the tt part to make it compatible with ditau analysis
 def parse_tree_name(keys):
@@ -181,6 +100,9 @@ def main(args):
     # use this once uproot supports sub-directories inside root files
     # output_file = uproot.recreate('Output/templates/htt_{}_{}_{}_fa3_{}{}.root'.format(channel_prefix,
     #                                                                               ztt_name, syst_name, args.date, '_'+args.suffix))
+    # histograms that were filled before are served from the cache, the rest are
+    # filled from one read of each tree
+    cache = HistCache(args.cache_dir, use_store=not args.no_cache)
     for ifile in files:
 
         # handle ZTT vs embedded
@@ -210,76 +132,32 @@ def main(args):
             if 'embed' in ifile:
                 name = name.replace('embed', 'ZTT')
 
-            variables = set([
-                'is_signal', 'is_antiTauIso', 'contamination', 'njets', 'mjj', 'evtwt',
-                't1_decayMode', 'vis_mass', 'higgs_pT', 'm_sv'
-            ] + config_variables.keys() + [zvars[0]])
-
-            # get fake factor weights if needed
-            if 'jetFakes' in ifile or 'QCD' in ifile:
-                variables.add('fake_weight')
-                if args.syst:
-                    variables.add('ff_*')
-
-            events = input_file[itree].arrays(list(variables), outputtype=pandas.DataFrame)
-
             if 'jetFakes' in ifile:
-                iso_branch = 'is_antiTauIso'
+                general_selection = 'is_antiTauIso > 0'
             else:
-                iso_branch = 'is_signal'
-            general_selection = events[(events[iso_branch] > 0)]
+                general_selection = 'is_signal > 0'
 
             # remove ttbar/diboson contamination to embedded sample
             if args.embed:
-                general_selection = general_selection[(general_selection['contamination'] == 0)]
-
-            # categorize
-            zero_jet_events = general_selection[general_selection['njets'] == 0]
-            boosted_events = general_selection[
-                (general_selection['njets'] == 1) |
-                ((general_selection['njets'] > 1) & (general_selection['mjj'] < 300))
-            ]
-            vbf_events = general_selection[(general_selection['njets'] > 1) & (general_selection['mjj'] > 300)]
-
-            for variable, bins in config_variables.iteritems():
-                # build list of processes
-                inclusive_processes, inclusive_hists = fill_process_list(general_selection, name, variable, bins, boilerplate, output_file,
-                                                                         '{}_inclusive/{}'.format(channel_prefix, variable), args.syst)
-
-                zero_jet_processes, zero_jet_hists = fill_process_list(zero_jet_events, name, variable, bins, boilerplate, output_file,
-                                                                     '{}_0jet/{}'.format(channel_prefix, variable), args.syst)
-
-                boosted_processes, boosted_hists = fill_process_list(boosted_events, name, variable, bins, boilerplate, output_file,
-                                                                     '{}_boosted/{}'.format(channel_prefix, variable), args.syst)
-
-                vbf_processes, vbf_hists = fill_process_list(vbf_events, name, variable, bins, boilerplate, output_file,
-                                                             '{}_vbf/{}'.format(channel_prefix, variable), args.syst)
-
-                # start all processes and wait for all to finish
-                for proc in inclusive_processes + zero_jet_processes + boosted_processes + vbf_processes:
-                    proc.start()
-                for proc in inclusive_processes + zero_jet_processes + boosted_processes + vbf_processes:
-                    proc.join()
-
-                # grab everything from the Queue's and write to the TFile
-                output_file.cd('{}_inclusive/{}'.format(channel_prefix, variable))
-                for obj in inclusive_hists.itervalues():
-                    obj['config'].queue.get().Write()
-
-                output_file.cd('{}_0jet/{}'.format(channel_prefix, variable))
-                for obj in zero_jet_hists.itervalues():
-                    obj['config'].queue.get().Write()
-
-                output_file.cd('{}_boosted/{}'.format(channel_prefix, variable))
-                for obj in boosted_hists.itervalues():
-                    obj['config'].queue.get().Write()
-
-                output_file.cd('{}_vbf/{}'.format(channel_prefix, variable))
-                for obj in vbf_hists.itervalues():
-                    obj['config'].queue.get().Write()
+                general_selection += ' & (contamination == 0)'
+
+            requests = {}
+            for cat in boilerplate['categories']:
+                requests[cat] = build_requests(cat, name, config_variables, general_selection + category_selections[cat],
+                                               boilerplate, args.syst)
+            hists = cache.get(ifile, itree, [request for cat_requests in requests.itervalues() for _, request in cat_requests])
+
+            for cat in boilerplate['categories']:
+                for variable, request in requests[cat]:
+                    output_file.cd('{}_{}/{}'.format(channel_prefix, cat, variable))
+                    hist = hists[request.name]
+                    hist_name = request.name.split('/')[-1]
+                    hist.SetName(hist_name)
+                    hist.SetTitle(hist_name)
+                    hist.Write()
 
     output_file.Close()
-    print 'Finished in {} seconds'.format(time.time() - start)
+    print 'Finished in {} seconds ({} histograms from the cache, {} filled)'.format(time.time() - start, cache.hits, cache.misses)
 
 
 if __name__ == "__main__":
@@ -292,4 +170,6 @@ if __name__ == "__main__":
     parser.add_argument('--date', '-d', required=True, action='store', help='today\'s date for output name')
     parser.add_argument('--suffix', action='store', default='', help='suffix for filename')
     parser.add_argument('--config', '-c', action='store', default=None, required=True, help='config for binning, etc.')
+    parser.add_argument('--cache-dir', action='store', default='Output/hist_cache', dest='cache_dir', help='where filled histograms are kept')
+    parser.add_argument('--no-cache', action='store_true', dest='no_cache', help='fill everything and don\'t store it')
     main(parser.parse_args())
@@ -0,0 +1,72 @@
+import numpy
+import pandas
+from fnmatch import fnmatch
+
+# Order of the weights in a block for each ac_group, as filled by slim_tree::fill_ac_block.
+ac_groups = {
+    1: ['wt_vbf_a1', 'wt_vbf_a2', 'wt_vbf_a3', 'wt_vbf_L1', 'wt_vbf_L1Zg',
+        'wt_vbf_a2int', 'wt_vbf_a3int', 'wt_vbf_L1int', 'wt_vbf_L1Zgint'],
+    2: ['wt_ggh_a1', 'wt_ggh_a3', 'wt_ggh_a3int'],
+    3: ['wt_wh_a1', 'wt_wh_a2', 'wt_wh_a3', 'wt_wh_L1', 'wt_wh_L1Zg',
+        'wt_wh_a2int', 'wt_wh_a3int', 'wt_wh_L1int', 'wt_wh_L1Zgint'],
+    4: ['wt_zh_a1', 'wt_zh_a2', 'wt_zh_a3', 'wt_zh_L1', 'wt_zh_L1Zg',
+        'wt_zh_a2int', 'wt_zh_a3int', 'wt_zh_L1int', 'wt_zh_L1Zgint'],
+}
+ac_names = [name for group in sorted(ac_groups) for name in ac_groups[group]]
+block_branches = ['ac_group', 'ac_n', 'ac_a1', 'ac_wt']
+
+
+def branch_names(tree):
+    return set(key.decode('utf-8') if isinstance(key, bytes) else key for key in tree.keys())
+
+
+def has_block(tree):
+    """True if the AC weights of this uproot tree are stored as a block (output_schema "ac_layout")."""
+    return 'ac_wt' in branch_names(tree)
+
+
+def expand(tree, entrystop=None):
+    """
+    Read the AC weight block of an uproot tree as the wt_* columns of the "columns" layout.
+
+    Events store the weights of their group only, the other columns are 0 like ACWeighter
+    fills them. A tree with "ac_a1" stores ratios to wt_a1 of the group.
+    """
+    arrays = tree.arrays([name for name in block_branches if name in branch_names(tree)], entrystop=entrystop, namedecode='utf-8')
+    group = numpy.asarray(arrays['ac_group'])
+    starts = numpy.asarray(arrays['ac_wt'].starts)
+    content = numpy.asarray(arrays['ac_wt'].content, dtype='float64')
+    ratios = 'ac_a1' in arrays
+
+    columns = {name: numpy.zeros(len(group)) for name in ac_names}
+    for igroup, names in ac_groups.iteritems():
+        selected = numpy.nonzero(group == igroup)[0]
+        if len(selected) == 0:
+            continue
+        scale = numpy.ones(len(selected))
+        if ratios:
+            a1 = numpy.asarray(arrays['ac_a1'], dtype='float64')[selected]
+            scale = numpy.where(a1 != 0, a1, 1.)
+        for i, name in enumerate(names):
+            columns[name][selected] = content[starts[selected] + i] * scale
+    return pandas.DataFrame(columns, columns=ac_names)
+
+
+def read_events(tree, variables):
+    """
+    tree.arrays(variables, outputtype=pandas.DataFrame) that also works for AC weights stored
+    as a block: the wt_* columns matching the variables (or patterns like '*') are expanded from it.
+    """
+    if not has_block(tree):
+        return tree.arrays(list(variables), outputtype=pandas.DataFrame)
+
+    # the block itself can't go in a DataFrame, patterns are matched against the other branches
+    names = sorted(branch_names(tree) - set(block_branches))
+    plain = sorted(set(name for name in names if any(fnmatch(name, var) for var in variables)))
+    wanted = [name for name in ac_names if any(fnmatch(name, var) for var in variables)]
+    events = tree.arrays(plain, outputtype=pandas.DataFrame) if plain else pandas.DataFrame(index=range(tree.numentries))
+    if wanted:
+        weights = expand(tree)
+        for name in wanted:
+            events[name] = weights[name].values
+    return events
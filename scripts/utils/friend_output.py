@@ -0,0 +1,69 @@
+import os
+import pandas
+import uproot
+from fnmatch import fnmatch
+from utils.ac_block import ac_names, branch_names, has_block, read_events
+
+
+def tree_names(open_file):
+    """Names of the objects in an uproot file, without the cycle."""
+    names = set()
+    for key in open_file.keys():
+        key = key.decode('utf-8') if isinstance(key, bytes) else key
+        names.add(key.split(';')[0])
+    return names
+
+
+def is_friend(open_file, tree_name):
+    """True if the file is a systematic output written with --friend (see include/friend_output.h)."""
+    return '{}_extra'.format(tree_name) in tree_names(open_file)
+
+
+def nominal_path(path):
+    """
+    The nominal file a systematic output belongs to: the same file name in the NOMINAL directory.
+    ac_reweighting.py moves the merged files it processed one directory up, those are found as well.
+    """
+    parts = os.path.abspath(path).split(os.sep)
+    for i in reversed(range(len(parts))):
+        if parts[i].startswith('SYST_'):
+            for nominal in ['NOMINAL', 'nominal']:
+                rest = parts[i + 1:]
+                for candidate in [rest, [part for part in rest if part != 'merged']]:
+                    candidate = os.sep.join(parts[:i] + [nominal] + candidate)
+                    if os.path.exists(candidate):
+                        return candidate
+    raise Exception('Can\'t find the nominal output of {}'.format(path))
+
+
+def available_branches(path, tree_name):
+    """Branches that read_output can return for this file, AC weight blocks expanded."""
+    open_file = uproot.open(path)
+    if is_friend(open_file, tree_name):
+        open_file = uproot.open(nominal_path(path))
+    tree = open_file[tree_name]
+    return branch_names(tree) | (set(ac_names) if has_block(tree) else set())
+
+
+def read_output(path, tree_name, variables, nominal=None):
+    """
+    read_events for any output file. For a friend output, the events the nominal job also selected are
+    the nominal rows with the shifted columns replaced (matched by row_key), followed by the events only
+    selected with the shift from "<tree>_extra".
+    """
+    open_file = uproot.open(path)
+    if not is_friend(open_file, tree_name):
+        return read_events(open_file[tree_name], variables)
+
+    variables = set(variables)
+    friend = open_file[tree_name]
+    shifted = set(name for name in branch_names(friend) if any(fnmatch(name, var) for var in variables))
+    changes = read_events(friend, shifted | set(['row_key']))
+
+    base = read_events(uproot.open(nominal or nominal_path(path))[tree_name], variables | set(['row_key']))
+    kept = [name for name in base.columns if name == 'row_key' or name not in changes.columns]
+    joined = changes.merge(base[kept], on='row_key', how='inner')
+
+    extra = read_events(open_file['{}_extra'.format(tree_name)], variables | set(['row_key']))
+    columns = [name for name in base.columns if name in joined.columns]
+    return pandas.concat([joined[columns], extra[columns]], ignore_index=True)
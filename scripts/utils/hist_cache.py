@@ -0,0 +1,148 @@
+import os
+import re
+import json
+import hashlib
+import numpy
+import pandas
+import uproot
+import ROOT
+from array import array
+from collections import namedtuple
+from utils.friend_output import available_branches, is_friend, nominal_path, read_output
+
+# One histogram to fill: name is only used for the returned histogram, the
+# other fields (with the input file) decide whether it is already cached.
+#   variable  -- branch to fill
+#   bins      -- [nbins, low, high] like configs/plotting.json
+#   selection -- pandas query string (i.e. 'is_signal > 0 & njets == 0')
+#   weight    -- pandas eval expression (i.e. 'evtwt * fake_weight')
+HistRequest = namedtuple('HistRequest', ['name', 'variable', 'bins', 'selection', 'weight'])
+
+identifier = re.compile(r'[A-Za-z_][A-Za-z0-9_]*')
+
+
+class HistCache:
+    """
+    Store of filled histograms keyed by (input file, tree, variable, binning, selection, weight).
+
+    Each input file gets its own cache file in cache_dir, named after a fingerprint of the input
+    (the UUID ROOT gives every file when it is written, its size and modification time), so
+    reprocessing an input invalidates everything filled from it. get() returns the cached
+    histograms and fills all the missing ones from a single read of the tree.
+    """
+
+    def __init__(self, cache_dir='Output/hist_cache', use_store=True):
+        self.cache_dir = cache_dir
+        self.use_store = use_store
+        self.hits = 0
+        self.misses = 0
+        if use_store and not os.path.isdir(cache_dir):
+            os.makedirs(cache_dir)
+
+    @staticmethod
+    def fingerprint(path):
+        """Identify the content of an input file without reading it."""
+        stat = os.stat(path)
+        ifile = ROOT.TFile.Open(path)
+        uuid = ifile.GetUUID().AsString()
+        ifile.Close()
+        return hashlib.sha1('{}_{}_{}'.format(uuid, stat.st_size, int(stat.st_mtime))).hexdigest()
+
+    @staticmethod
+    def key(tree, request):
+        """Name of the cached histogram for this request."""
+        return 'h' + hashlib.sha1(json.dumps([
+            tree, request.variable, [float(ibin) for ibin in request.bins], request.selection, request.weight
+        ])).hexdigest()[:24]
+
+    def get(self, path, tree, requests):
+        """Return {request.name: TH1F} for all requests, filling the ones not cached yet."""
+        fingerprint = self.fingerprint(path)
+        if self.use_store and is_friend(uproot.open(path), tree):
+            # a friend output is only complete with its nominal file
+            fingerprint = hashlib.sha1(fingerprint + self.fingerprint(nominal_path(path))).hexdigest()
+        cache_name = '{}/{}.root'.format(self.cache_dir, fingerprint) if self.use_store else None
+        keys = [self.key(tree, request) for request in requests]
+        hists = {}
+
+        missing = []
+        if cache_name and os.path.exists(cache_name):
+            cache_file = ROOT.TFile(cache_name, 'READ')
+            for key, request in zip(keys, requests):
+                cached = cache_file.Get(key)
+                if cached:
+                    hist = cached.Clone(request.name)
+                    hist.SetTitle(request.name)
+                    hist.SetDirectory(0)
+                    hists[request.name] = hist
+                else:
+                    missing.append((key, request))
+            cache_file.Close()
+        else:
+            missing = zip(keys, requests)
+
+        self.hits += len(requests) - len(missing)
+        self.misses += len(missing)
+        if not missing:
+            return hists
+
+        filled = self.fill(path, tree, [request for _, request in missing])
+        if cache_name:
+            cache_file = ROOT.TFile(cache_name, 'UPDATE')
+            for key, request in missing:
+                stored = filled[request.name].Clone(key)
+                stored.Write(key, ROOT.TObject.kOverwrite)
+            cache_file.Close()
+        hists.update(filled)
+        return hists
+
+    @staticmethod
+    def fill(path, tree, requests):
+        """Fill the requests from one read of the branches they use."""
+        available = available_branches(path, tree)
+        branches = set()
+        for request in requests:
+            for expr in [request.variable, request.selection, request.weight]:
+                branches.update(name for name in identifier.findall(expr) if name in available)
+        events = read_output(path, tree, branches)
+
+        # each selection and weight is evaluated once
+        selected, weights = {}, {}
+        hists = {}
+        for request in requests:
+            if request.selection not in selected:
+                selected[request.selection] = events.query(request.selection) if request.selection else events
+            data = selected[request.selection]
+            weight_key = (request.selection, request.weight)
+            if weight_key not in weights:
+                weights[weight_key] = numpy.asarray(data.eval(request.weight), dtype='float64') * numpy.ones(len(data))
+            hists[request.name] = make_hist(request.name, request.bins, data[request.variable].values.astype('float64'), weights[weight_key])
+        return hists
+
+
+def make_hist(name, bins, xvar, evtwt):
+    """The TH1F that TH1F::Fill would give for these values and weights."""
+    nbins, low, high = int(bins[0]), float(bins[1]), float(bins[2])
+    hist = ROOT.TH1F(name, name, nbins, low, high)
+    hist.SetDirectory(0)
+
+    # same binning as TAxis::FindFixBin, NaN goes to the overflow
+    index = numpy.full(len(xvar), nbins + 1, dtype='int64')
+    index[xvar < low] = 0
+    in_range = (xvar >= low) & (xvar < high)
+    index[in_range] = 1 + (nbins * (xvar[in_range] - low) / (high - low)).astype('int64')
+    sumw = numpy.bincount(index, weights=evtwt, minlength=nbins + 2)
+    sumw2 = numpy.bincount(index, weights=evtwt * evtwt, minlength=nbins + 2)
+
+    weighted = len(evtwt) > 0 and numpy.any(evtwt != 1.)
+    if weighted:
+        hist.Sumw2()
+    for ibin in range(nbins + 2):
+        hist.SetBinContent(ibin, sumw[ibin])
+        if weighted:
+            hist.SetBinError(ibin, numpy.sqrt(sumw2[ibin]))
+
+    w, x = evtwt[in_range], xvar[in_range]
+    hist.PutStats(array('d', [w.sum(), (w * w).sum(), (w * x).sum(), (w * x * x).sum()]))
+    hist.SetEntries(len(xvar))
+    return hist
@@ -0,0 +1,21 @@
+"""Checks of cost_model.parse_logs on tests/logs, run with "python tests/test_cost_model.py"."""
+import os
+import sys
+
+here = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.dirname(here))
+from cost_model import parse_logs
+
+
+def test_resumed_jobs():
+    jobs = parse_logs([os.path.join(here, 'logs', 'cost_model_jobs.txt')])
+    # DYJets2 logs the resume before "Processed", TTToHadronic after it (older analyzers)
+    assert [job['sample'] for job in jobs] == ['DYJets1', 'WJets'], jobs
+    assert not any(job['resumed'] for job in jobs)
+    assert jobs[0]['entries'] == 120000 and jobs[0]['seconds'] == 95.5
+    assert jobs[1]['syst'] == 'SYST_tau_id_Up'
+
+
+if __name__ == "__main__":
+    test_resumed_jobs()
+    print 'cost_model: all checks passed'